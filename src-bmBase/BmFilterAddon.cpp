@@ -6,6 +6,9 @@
  *		Oliver Tappe <beam@hirschkaefer.de>
  */
 
+#include <ctype.h>
+#include <string.h>
+
 #include "BmFilterAddon.h"
 
 /********************************************************************************\
@@ -31,20 +34,130 @@ BmFilterAddon::~BmFilterAddon()
 {
 }
 
+/*------------------------------------------------------------------------------*\
+	ExecuteBatch( msgContexts, results, jobSpecs)
+		-	default implementation, executes the filter on one mail after the
+			other
+		-	results[i] receives the result of executing the filter on 
+			msgContexts[i], true is returned if all executions succeeded
+\*------------------------------------------------------------------------------*/
+bool BmFilterAddon::ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+											 vector< bool>& results,
+											 const BMessage* jobSpecs)
+{
+	bool allOK = true;
+	results.resize( msgContexts.size());
+	for( uint32 i=0; i<msgContexts.size(); ++i) {
+		results[i] = Execute( msgContexts[i], jobSpecs);
+		if (!results[i])
+			allOK = false;
+	}
+	return allOK;
+}
+
+/*------------------------------------------------------------------------------*\
+	AddNeeds( needs)
+		-	default implementation, we do not know what the addon looks at, 
+			so it gets everything
+\*------------------------------------------------------------------------------*/
+void BmFilterAddon::AddNeeds( BmFilterNeeds& needs)
+{
+	needs.NeedEverything();
+}
+
+
+
+/********************************************************************************\
+	BmFilterNeeds
+\********************************************************************************/
+
+/*------------------------------------------------------------------------------*\
+	BmFilterNeeds()
+		-	c'tor, initially nothing is needed
+\*------------------------------------------------------------------------------*/
+BmFilterNeeds::BmFilterNeeds()
+	:	allHeaderFields( false)
+	,	body( false)
+	,	size( false)
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	Add( needs)
+		-	merges the given needs into this
+\*------------------------------------------------------------------------------*/
+void BmFilterNeeds::Add( const BmFilterNeeds& needs)
+{
+	allHeaderFields |= needs.allHeaderFields;
+	body |= needs.body;
+	size |= needs.size;
+	for( uint32 i=0; i<needs.headerFields.size(); ++i)
+		AddHeaderField( needs.headerFields[i].String());
+}
+
+/*------------------------------------------------------------------------------*\
+	AddHeaderField( fieldName)
+		-	adds the given header-field (unless it is already contained, field
+			names are compared case-insensitively)
+\*------------------------------------------------------------------------------*/
+void BmFilterNeeds::AddHeaderField( const char* fieldName)
+{
+	for( uint32 i=0; i<headerFields.size(); ++i) {
+		if (!headerFields[i].ICompare( fieldName))
+			return;
+	}
+	headerFields.push_back( fieldName);
+}
+
+/*------------------------------------------------------------------------------*\
+	NeedEverything()
+		-	marks all parts of the mail as needed
+\*------------------------------------------------------------------------------*/
+void BmFilterNeeds::NeedEverything()
+{
+	allHeaderFields = body = size = true;
+}
+
 
 
 /********************************************************************************\
 	BmMsgContext
 \********************************************************************************/
 
+// names of the well-known fields (in the order of BmMsgContext::Field):
+static const char* const nFieldNames[BmMsgContext::FIELD_COUNT] = {
+	"FolderName",
+	"Identity",
+	"ListId",
+	"RejectMsg",
+	"Status",
+	"OverallPr",
+	"RatioSpam",
+	"ForceLearning",
+	"IsReinforced",
+	"IsSpam",
+	"IsTofu",
+	"LearnAsSpam",
+	"LearnAsTofu",
+	"MoveToTrash",
+	"StopProcessing"
+};
+
 /*------------------------------------------------------------------------------*\
 	BmMsgContext()
 		-	c'tor
 \*------------------------------------------------------------------------------*/
 BmMsgContext::BmMsgContext()
 	:	mail( NULL)
+	,	headerInfoCount( 0)
 	,	headerInfos( NULL)
+	,	mHeaderIndex( NULL)
+	,	mHeaderIndexSize( 0)
+	,	mSetMask( 0)
+	,	mChangeMask( 0)
+	,	mBoolValues( 0)
 {
+	pseudoHeaderValues[0] = pseudoHeaderValues[1] = NULL;
 }
 
 /*------------------------------------------------------------------------------*\
@@ -52,11 +165,111 @@ BmMsgContext::BmMsgContext()
 		-	standard d'tor
 \*------------------------------------------------------------------------------*/
 BmMsgContext::~BmMsgContext() {
+	ResetHeaderInfos();
+	AddonDataMap::iterator iter;
+	for( iter = mAddonData.begin(); iter != mAddonData.end(); ++iter)
+		delete iter->second;
+}
+
+/*------------------------------------------------------------------------------*\
+	ResetHeaderInfos()
+		-	frees headerInfos and their hash-index, such that the next lookup
+			has to fetch them from the mail again
+\*------------------------------------------------------------------------------*/
+void BmMsgContext::ResetHeaderInfos() {
 	if (headerInfos) {
 		for( int i=0; i<headerInfoCount; ++i)
 			delete [] headerInfos[i].values;
 		delete [] headerInfos;
+		headerInfos = NULL;
 	}
+	headerInfoCount = 0;
+	delete [] mHeaderIndex;
+	mHeaderIndex = NULL;
+	mHeaderIndexSize = 0;
+}
+
+/*------------------------------------------------------------------------------*\
+	HeaderHash( fieldName)
+		-	case-insensitive hash of a header-field name
+\*------------------------------------------------------------------------------*/
+static inline uint32 HeaderHash(const char* fieldName)
+{
+	uint32 hash = 0;
+	for( ; *fieldName; ++fieldName)
+		hash = (hash << 5) - hash + tolower( (unsigned char)*fieldName);
+	return hash;
+}
+
+/*------------------------------------------------------------------------------*\
+	BuildHeaderIndex()
+		-	hashes all field names of headerInfos into a table that is at most
+			half full
+\*------------------------------------------------------------------------------*/
+void BmMsgContext::BuildHeaderIndex()
+{
+	mHeaderIndexSize = 8;
+	while( mHeaderIndexSize < 2 * (uint32)headerInfoCount)
+		mHeaderIndexSize <<= 1;
+	mHeaderIndex = new int32 [mHeaderIndexSize];
+	for( uint32 s=0; s<mHeaderIndexSize; ++s)
+		mHeaderIndex[s] = -1;
+	uint32 mask = mHeaderIndexSize - 1;
+	for( int32 i=0; i<headerInfoCount; ++i) {
+		uint32 slot = HeaderHash( headerInfos[i].fieldName.String()) & mask;
+		while( mHeaderIndex[slot] >= 0)
+			slot = (slot + 1) & mask;
+		mHeaderIndex[slot] = i;
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	HeaderValues( fieldName)
+		-	returns the NULL-terminated list of values of the given header-field
+			(the name is compared case-insensitively)
+		-	returns NULL if the mail doesn't contain that field or if headerInfos
+			haven't been filled yet
+\*------------------------------------------------------------------------------*/
+const char** BmMsgContext::HeaderValues(const char* fieldName)
+{
+	if (!headerInfos || !fieldName)
+		return NULL;
+	if (!mHeaderIndex)
+		BuildHeaderIndex();
+	uint32 mask = mHeaderIndexSize - 1;
+	uint32 slot = HeaderHash( fieldName) & mask;
+	for( ; mHeaderIndex[slot] >= 0; slot = (slot + 1) & mask) {
+		const BmHeaderInfo& info = headerInfos[mHeaderIndex[slot]];
+		if (!info.fieldName.ICompare( fieldName))
+			return info.values;
+	}
+	return NULL;
+}
+
+/*------------------------------------------------------------------------------*\
+	FieldName( field)
+		-	returns the name of the given well-known field
+\*------------------------------------------------------------------------------*/
+const char* BmMsgContext::FieldName(Field field)
+{
+	return nFieldNames[field];
+}
+
+/*------------------------------------------------------------------------------*\
+	FieldIndex( fieldName, first, last)
+		-	returns the id of the well-known field with the given name, if that
+			lies within [first, last[ (i.e. has the requested type)
+		-	returns -1 for any other field
+\*------------------------------------------------------------------------------*/
+int32 BmMsgContext::FieldIndex(const char* fieldName, int32 first, int32 last)
+{
+	if (!fieldName)
+		return -1;
+	for( int32 i=first; i<last; ++i) {
+		if (!strcmp(fieldName, nFieldNames[i]))
+			return i;
+	}
+	return -1;
 }
 
 /*------------------------------------------------------------------------------*\
@@ -65,7 +278,9 @@ BmMsgContext::~BmMsgContext() {
 \*------------------------------------------------------------------------------*/
 void BmMsgContext::ResetChanges()
 {
-	mStatusMsg.MakeEmpty();
+	mChangeMask = 0;
+	if (!mStatusMsg.IsEmpty())
+		mStatusMsg.MakeEmpty();
 }
 
 /*------------------------------------------------------------------------------*\
@@ -74,17 +289,51 @@ void BmMsgContext::ResetChanges()
 \*------------------------------------------------------------------------------*/
 bool BmMsgContext::FieldHasChanged(const char* fieldName) const
 {
+	int32 index = FieldIndex(fieldName, 0, FIELD_COUNT);
+	if (index >= 0)
+		return FieldHasChanged((Field)index);
 	bool dummy;
 	return mStatusMsg.FindBool(fieldName, &dummy) == B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	AddonData( key)
+		-	returns the data an addon has attached under the given key
+			(or NULL if there is none)
+\*------------------------------------------------------------------------------*/
+BmMsgContextData* BmMsgContext::AddonData(const char* key) const
+{
+	AddonDataMap::const_iterator iter = mAddonData.find( key);
+	return iter != mAddonData.end() ? iter->second : NULL;
+}
+
+/*------------------------------------------------------------------------------*\
+	SetAddonData( key, data)
+		-	attaches the given data under the given key, replacing (and 
+			deleting) any data that has been attached under that key before
+\*------------------------------------------------------------------------------*/
+void BmMsgContext::SetAddonData(const char* key, BmMsgContextData* data)
+{
+	BmMsgContextData*& slot = mAddonData[key];
+	if (slot != data)
+		delete slot;
+	slot = data;
+}
+
 /*------------------------------------------------------------------------------*\
 	()
 		-	
 \*------------------------------------------------------------------------------*/
 void BmMsgContext::ResetData()
 {
-	mDataMsg.MakeEmpty();
+	for( int32 i=0; i<nFirstDoubleField; ++i) {
+		if (HasField((Field)i))
+			mStrings[i].Truncate(0);
+	}
+	mSetMask = 0;
+	mBoolValues = 0;
+	if (!mDataMsg.IsEmpty())
+		mDataMsg.MakeEmpty();
 }
 
 /*------------------------------------------------------------------------------*\
@@ -104,6 +353,9 @@ void BmMsgContext::NoteChange(const char* fieldName)
 \*------------------------------------------------------------------------------*/
 bool BmMsgContext::HasField(const char* fieldName) const
 {
+	int32 index = FieldIndex(fieldName, 0, FIELD_COUNT);
+	if (index >= 0)
+		return HasField((Field)index);
 	type_code type;
 	return mDataMsg.GetInfo(fieldName, &type) == B_OK;
 }
@@ -128,12 +380,27 @@ int32 BmMsgContext::GetInt32(const char* fieldName) const
 	return mDataMsg.FindInt32(fieldName);
 }
 
+/*------------------------------------------------------------------------------*\
+	SetString( field, value)
+		-	sets the given well-known string-field
+\*------------------------------------------------------------------------------*/
+void BmMsgContext::SetString(Field field, const char* value)
+{
+	mStrings[field] = value;
+	NoteChange(field);
+}
+
 /*------------------------------------------------------------------------------*\
 	()
 		-	
 \*------------------------------------------------------------------------------*/
 void BmMsgContext::SetString(const char* fieldName, const char* value)
 {
+	int32 index = FieldIndex(fieldName, 0, nFirstDoubleField);
+	if (index >= 0) {
+		SetString((Field)index, value);
+		return;
+	}
 	mDataMsg.RemoveName(fieldName);
 	mDataMsg.AddString(fieldName, value);
 	NoteChange(fieldName);
@@ -145,6 +412,9 @@ void BmMsgContext::SetString(const char* fieldName, const char* value)
 \*------------------------------------------------------------------------------*/
 const char* BmMsgContext::GetString(const char* fieldName) const
 {
+	int32 index = FieldIndex(fieldName, 0, nFirstDoubleField);
+	if (index >= 0)
+		return GetString((Field)index);
 	return mDataMsg.FindString(fieldName);
 }
 
@@ -154,6 +424,11 @@ const char* BmMsgContext::GetString(const char* fieldName) const
 \*------------------------------------------------------------------------------*/
 void BmMsgContext::SetBool(const char* fieldName, bool value)
 {
+	int32 index = FieldIndex(fieldName, nFirstBoolField, FIELD_COUNT);
+	if (index >= 0) {
+		SetBool((Field)index, value);
+		return;
+	}
 	mDataMsg.RemoveName(fieldName);
 	mDataMsg.AddBool(fieldName, value);
 	NoteChange(fieldName);
@@ -165,6 +440,9 @@ void BmMsgContext::SetBool(const char* fieldName, bool value)
 \*------------------------------------------------------------------------------*/
 bool BmMsgContext::GetBool(const char* fieldName) const
 {
+	int32 index = FieldIndex(fieldName, nFirstBoolField, FIELD_COUNT);
+	if (index >= 0)
+		return GetBool((Field)index);
 	return mDataMsg.FindBool(fieldName);
 }
 
@@ -174,6 +452,11 @@ bool BmMsgContext::GetBool(const char* fieldName) const
 \*------------------------------------------------------------------------------*/
 void BmMsgContext::SetDouble(const char* fieldName, double value)
 {
+	int32 index = FieldIndex(fieldName, nFirstDoubleField, nFirstBoolField);
+	if (index >= 0) {
+		SetDouble((Field)index, value);
+		return;
+	}
 	mDataMsg.RemoveName(fieldName);
 	mDataMsg.AddDouble(fieldName, value);
 	NoteChange(fieldName);
@@ -185,6 +468,8 @@ void BmMsgContext::SetDouble(const char* fieldName, double value)
 \*------------------------------------------------------------------------------*/
 double BmMsgContext::GetDouble(const char* fieldName) const
 {
+	int32 index = FieldIndex(fieldName, nFirstDoubleField, nFirstBoolField);
+	if (index >= 0)
+		return GetDouble((Field)index);
 	return mDataMsg.FindDouble(fieldName);
 }
-
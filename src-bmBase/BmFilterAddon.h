@@ -9,21 +9,70 @@
 #ifndef _BmFilterAddon_h
 #define _BmFilterAddon_h
 
+#include <map>
+#include <vector>
+
 #include <Message.h>
 
 #include "BmBase.h"
 #include "BmString.h"
 
+using std::map;
+using std::vector;
+
 class BmMail;
 struct IMPEXPBMBASE BmHeaderInfo {
 	BmString fieldName;
 	const char** values;
 };
+
+/*------------------------------------------------------------------------------*\
+	BmMsgContextData
+		-	base class for data that an addon attaches to a message-context
+			(e.g. results it wants to share between several filters running
+			on the same mail)
+\*------------------------------------------------------------------------------*/
+struct IMPEXPBMBASE BmMsgContextData {
+	virtual ~BmMsgContextData()			{}
+};
+
 /*------------------------------------------------------------------------------*\
 	BmMsgContext
-		-	
+		-	carries the input & output data of filtering a single mail
+		-	the well-known fields (the ones used by Beam itself) are stored in
+			typed members, which can be accessed without any lookup via their
+			field-id. Any other fields (which are private to some addon) live 
+			in an extension message.
+		-	the string-keyed accessors work for all fields, for a well-known
+			field they map to the corresponding typed member
 \*------------------------------------------------------------------------------*/
 struct IMPEXPBMBASE BmMsgContext {
+	// ids of the well-known fields (grouped by type):
+	enum Field {
+		// strings:
+		FIELD_FOLDER_NAME = 0,
+		FIELD_IDENTITY,
+		FIELD_LIST_ID,
+		FIELD_REJECT_MSG,
+		FIELD_STATUS,
+		// doubles:
+		FIELD_OVERALL_PR,
+		FIELD_RATIO_SPAM,
+		// bools:
+		FIELD_FORCE_LEARNING,
+		FIELD_IS_REINFORCED,
+		FIELD_IS_SPAM,
+		FIELD_IS_TOFU,
+		FIELD_LEARN_AS_SPAM,
+		FIELD_LEARN_AS_TOFU,
+		FIELD_MOVE_TO_TRASH,
+		FIELD_STOP_PROCESSING,
+		//
+		FIELD_COUNT
+	};
+	static const int32 nFirstDoubleField = FIELD_OVERALL_PR;
+	static const int32 nFirstBoolField = FIELD_FORCE_LEARNING;
+
 	BmMsgContext();
 	~BmMsgContext();
 
@@ -31,7 +80,23 @@ struct IMPEXPBMBASE BmMsgContext {
 	BmMail* mail;
 	int32 headerInfoCount;
 	BmHeaderInfo *headerInfos;
+	const char* pseudoHeaderValues[2];
+							// NULL-terminated value-list for a pseudo-header
+							// (like "Status"), filters may hand this out
+							// instead of having to use a static list
 	
+	const char** HeaderValues(const char* fieldName);
+							// case-insensitive lookup in headerInfos
+	void ResetHeaderInfos();
+							// drops headerInfos (they point into the mail's
+							// header, so they must be fetched again whenever 
+							// the header may have been replaced)
+
+	BmMsgContextData* AddonData(const char* key) const;
+	void SetAddonData(const char* key, BmMsgContextData* data);
+							// the context owns the data and deletes it 
+							// when it is replaced or the context goes away
+
 	void ResetChanges();
 	bool FieldHasChanged(const char* fieldName) const;
 
@@ -50,20 +115,105 @@ struct IMPEXPBMBASE BmMsgContext {
 	void SetDouble(const char* fieldName, double value);
 	double GetDouble(const char* fieldName) const;
 
+	// typed access to the well-known fields:
+	inline bool FieldHasChanged(Field field) const
+													{ return (mChangeMask & Bit(field)) != 0; }
+	inline bool HasField(Field field) const
+													{ return (mSetMask & Bit(field)) != 0; }
+
+	void SetString(Field field, const char* value);
+	inline const char* GetString(Field field) const
+													{ return HasField(field) 
+														? mStrings[field].String() 
+														: NULL; }
+
+	inline void SetBool(Field field, bool value) {
+		if (value)
+			mBoolValues |= Bit(field);
+		else
+			mBoolValues &= ~Bit(field);
+		NoteChange(field);
+	}
+	inline bool GetBool(Field field) const
+													{ return (mBoolValues & Bit(field)) != 0; }
+
+	inline void SetDouble(Field field, double value) {
+		mDoubles[field - nFirstDoubleField] = value;
+		NoteChange(field);
+	}
+	inline double GetDouble(Field field) const
+													{ return HasField(field)
+														? mDoubles[field - nFirstDoubleField]
+														: 0.0; }
+
+	static const char* FieldName(Field field);
+
 private:
+	static inline uint32 Bit(Field field)	{ return 1UL << field; }
+	inline void NoteChange(Field field) 	{ mSetMask |= Bit(field);
+													  mChangeMask |= Bit(field); }
 	void NoteChange(const char* fieldName);
+	static int32 FieldIndex(const char* fieldName, int32 first, int32 last);
+	void BuildHeaderIndex();
+
+	// hash-index over headerInfos (built on first lookup):
+	int32* mHeaderIndex;
+							// open-addressed slots, each containing the index
+							// of a header-field (or -1 if the slot is free)
+	uint32 mHeaderIndexSize;
+							// number of slots (always a power of two)
+
+	// the well-known fields:
+	uint32 mSetMask;
+							// one bit per field that has been set
+	uint32 mChangeMask;
+							// one bit per field that has been set since the last
+							// call to ResetChanges()
+	uint32 mBoolValues;
+							// the values of all bool-fields
+	double mDoubles[nFirstBoolField - nFirstDoubleField];
+	BmString mStrings[nFirstDoubleField];
 
-	// data message that contains input & output data:
+	// extension message that contains data of any other fields:
 	BMessage mDataMsg;
-	// status message that notes changes to any of the fields:
+	// extension message that notes changes to any of the other fields:
 	BMessage mStatusMsg;
 
+	// data attached by addons:
+	typedef map< BmString, BmMsgContextData*> AddonDataMap;
+	AddonDataMap mAddonData;
+
 	// Hide copy-constructor:
 	BmMsgContext( const BmMsgContext&);
 };
 
 
 
+/*------------------------------------------------------------------------------*\
+	BmFilterNeeds
+		-	describes which parts of a mail a filter looks at, such that the
+			mail-filter can choose the cheapest way of reading the mail
+\*------------------------------------------------------------------------------*/
+struct IMPEXPBMBASE BmFilterNeeds {
+	BmFilterNeeds();
+
+	void Add( const BmFilterNeeds& needs);
+	void AddHeaderField( const char* fieldName);
+	void NeedEverything();
+
+	bool allHeaderFields;
+							// the filter may look at any header-field
+	vector< BmString> headerFields;
+							// the header-fields the filter looks at (only 
+							// meaningful if allHeaderFields isn't set)
+	bool body;
+							// the filter looks at the body (or the raw text)
+	bool size;
+							// the filter looks at the size of the mail
+};
+
+
+
 /*------------------------------------------------------------------------------*\
 	BmFilterAddon 
 		-	base class for all filter-addons, this is used as filter-addon-API
@@ -77,10 +227,24 @@ public:
 	// native methods:
 	virtual bool Execute( BmMsgContext* msgContext, 
 								 const BMessage* jobSpecs = NULL) = 0;
+	virtual bool ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+										vector< bool>& results,
+										const BMessage* jobSpecs = NULL);
+							// executes the filter on each of the given mails,
+							// addons that can share work between the mails 
+							// should override this
 	virtual void Initialize()				{}
 	virtual bool SanityCheck( BmString& complaint, BmString& fieldName) = 0;
 	virtual status_t Archive( BMessage* archive, bool deep = true) const = 0;
 	virtual BmString ErrorString() const = 0;
+	virtual bool IsThreadSafe() const	{ return false; }
+							// addons that can safely execute on several mails
+							// at the same time (from different threads) should 
+							// return true here
+	virtual void AddNeeds( BmFilterNeeds& needs);
+							// adds the parts of a mail the filter looks at,
+							// addons that do not override this are assumed to
+							// look at everything
 
 	virtual void ForeignKeyChanged( const BmString& /* key */, 
 											  const BmString& /* oldVal */, 
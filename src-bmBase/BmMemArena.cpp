@@ -0,0 +1,110 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+
+#include <cstdlib>
+
+#include "BmBasics.h"
+#include "BmMemArena.h"
+
+const size_t BmMemArena::nInitialBlockSize = 4096;
+const size_t BmMemArena::nMaxBlockSize = 65536;
+
+// every allocation is aligned to this:
+static const size_t nAlignment = 8;
+
+/*------------------------------------------------------------------------------*\
+	BmMemArena( initialBlockSize)
+		-	c'tor, no memory is reserved until the first allocation
+\*------------------------------------------------------------------------------*/
+BmMemArena::BmMemArena( size_t initialBlockSize)
+	:	mCurrBlock( NULL)
+	,	mNextBlockSize( initialBlockSize)
+	,	mBytesAllocated( 0)
+	,	mBytesReserved( 0)
+	,	mRefCount( 0)
+	,	mAllocating( 0)
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	~BmMemArena()
+		-	d'tor, releases all blocks
+\*------------------------------------------------------------------------------*/
+BmMemArena::~BmMemArena() {
+	while( mCurrBlock) {
+		Block* block = mCurrBlock;
+		mCurrBlock = block->next;
+		free( block);
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	RemoveRef()
+		-	drops a reference, the last one deletes the arena
+\*------------------------------------------------------------------------------*/
+void BmMemArena::RemoveRef() {
+	if (atomic_add( &mRefCount, -1) == 1)
+		delete this;
+}
+
+/*------------------------------------------------------------------------------*\
+	Allocate( size)
+		-	returns size bytes (aligned) from the current block, a new block
+			is reserved if the current one is exhausted
+		-	requests larger than the next block-size get a block of their own
+		-	N.B.: this is not thread-safe (see class-comment)
+\*------------------------------------------------------------------------------*/
+void* BmMemArena::Allocate( size_t size) {
+#if DEBUG
+	BM_ASSERT( atomic_add( &mAllocating, 1) == 0);
+	void* mem = DoAllocate( size);
+	atomic_add( &mAllocating, -1);
+	return mem;
+#else
+	return DoAllocate( size);
+#endif
+}
+
+/*------------------------------------------------------------------------------*\
+	DoAllocate( size)
+		-	does the actual work for Allocate()
+\*------------------------------------------------------------------------------*/
+void* BmMemArena::DoAllocate( size_t size) {
+	const size_t headerSize = (sizeof( Block) + nAlignment - 1) & ~(nAlignment - 1);
+	size = (size + nAlignment - 1) & ~(nAlignment - 1);
+	if (!mCurrBlock || mCurrBlock->size - mCurrBlock->used < size) {
+		size_t blockSize = mNextBlockSize;
+		if (blockSize < size)
+			blockSize = size;
+		Block* block = (Block*)malloc( headerSize + blockSize);
+		if (!block)
+			throw std::bad_alloc();
+		block->size = blockSize;
+		block->used = 0;
+		if (mCurrBlock && size > mNextBlockSize) {
+			// keep carving the current block, chain the oversized one behind it:
+			block->next = mCurrBlock->next;
+			mCurrBlock->next = block;
+			block->used = size;
+		} else {
+			block->next = mCurrBlock;
+			mCurrBlock = block;
+			if (mNextBlockSize < nMaxBlockSize)
+				mNextBlockSize *= 2;
+		}
+		mBytesReserved += blockSize;
+		if (block != mCurrBlock) {
+			mBytesAllocated += size;
+			return (char*)block + headerSize;
+		}
+	}
+	void* mem = (char*)mCurrBlock + headerSize + mCurrBlock->used;
+	mCurrBlock->used += size;
+	mBytesAllocated += size;
+	return mem;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+
+#ifndef _BmMemArena_h
+#define _BmMemArena_h
+
+#include <cstddef>
+#include <new>
+
+#include <OS.h>
+
+#include "BmBase.h"
+
+/*------------------------------------------------------------------------------*\
+	class BmMemArena
+		-	a monotonic memory arena: small allocations are carved out of
+			larger blocks and are never freed individually, all blocks are
+			released at once when the arena goes away.
+		-	arenas are reference-counted, every container that allocates from
+			an arena should hold a BmMemArenaRef to it, such that the arena
+			outlives all the memory it has handed out.
+		-	an arena is not locked: it belongs to a single object (a mail) and
+			must only be allocated from by the thread currently working on 
+			that object (debug-builds assert this)
+\*------------------------------------------------------------------------------*/
+class IMPEXPBMBASE BmMemArena {
+
+	struct Block {
+		Block* next;
+		size_t size;
+		size_t used;
+	};
+
+public:
+	BmMemArena( size_t initialBlockSize = nInitialBlockSize);
+
+	// native methods:
+	void* Allocate( size_t size);
+	//
+	void AddRef()								{ atomic_add( &mRefCount, 1); }
+	void RemoveRef();
+
+	// getters:
+	inline size_t BytesAllocated() const	{ return mBytesAllocated; }
+	inline size_t BytesReserved() const	{ return mBytesReserved; }
+
+	static const size_t nInitialBlockSize;
+	static const size_t nMaxBlockSize;
+
+private:
+	~BmMemArena();
+							// arenas are only deleted by RemoveRef()
+	void* DoAllocate( size_t size);
+
+	Block* mCurrBlock;
+							// the block currently being carved up, older blocks
+							// are chained through Block::next
+	size_t mNextBlockSize;
+							// size of the next block to be reserved (doubles with
+							// every block, up to nMaxBlockSize)
+	size_t mBytesAllocated;
+	size_t mBytesReserved;
+	int32 mRefCount;
+	int32 mAllocating;
+							// number of threads currently inside Allocate(), 
+							// used to detect concurrent use in debug-builds
+
+	// Hide copy-constructor and assignment:
+	BmMemArena( const BmMemArena&);
+	BmMemArena operator=( const BmMemArena&);
+};
+
+/*------------------------------------------------------------------------------*\
+	class BmMemArenaRef
+		-	holds a reference to an arena (which may be NULL)
+		-	should be declared before any member-containers using the arena,
+			such that it is destructed after them
+\*------------------------------------------------------------------------------*/
+class BmMemArenaRef {
+public:
+	BmMemArenaRef( BmMemArena* arena = NULL)
+		:	mArena( arena)							{ if (mArena) mArena->AddRef(); }
+	BmMemArenaRef( const BmMemArenaRef& ref)
+		:	mArena( ref.mArena)					{ if (mArena) mArena->AddRef(); }
+	~BmMemArenaRef()								{ if (mArena) mArena->RemoveRef(); }
+	BmMemArenaRef& operator=( const BmMemArenaRef& ref) {
+		if (ref.mArena)
+			ref.mArena->AddRef();
+		if (mArena)
+			mArena->RemoveRef();
+		mArena = ref.mArena;
+		return *this;
+	}
+	inline BmMemArena* Get() const			{ return mArena; }
+private:
+	BmMemArena* mArena;
+};
+
+/*------------------------------------------------------------------------------*\
+	class BmArenaAllocator
+		-	an STL-allocator that fetches its memory from the given arena
+		-	without an arena, this behaves like the standard allocator
+\*------------------------------------------------------------------------------*/
+template< class T> class BmArenaAllocator {
+public:
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T value_type;
+	template< class U> struct rebind { typedef BmArenaAllocator< U> other; };
+
+	BmArenaAllocator( BmMemArena* arena = NULL) throw()
+		:	mArena( arena)							{}
+	BmArenaAllocator( const BmArenaAllocator& a) throw()
+		:	mArena( a.Arena())					{}
+	template< class U> BmArenaAllocator( const BmArenaAllocator< U>& a) throw()
+		:	mArena( a.Arena())					{}
+
+	pointer allocate( size_type n, const void* = 0) {
+		size_t size = n * sizeof( T);
+		return static_cast< pointer>(
+			mArena ? mArena->Allocate( size) : ::operator new( size)
+		);
+	}
+	void deallocate( pointer p, size_type) {
+		if (!mArena)
+			::operator delete( p);
+							// arena-memory is released with the arena
+	}
+	void construct( pointer p, const T& val)	{ new( p) T( val); }
+	void destroy( pointer p)					{ p->~T(); }
+	pointer address( reference r) const		{ return &r; }
+	const_pointer address( const_reference r) const
+													{ return &r; }
+	size_type max_size() const throw()		{ return size_t(-1) / sizeof( T); }
+
+	inline BmMemArena* Arena() const			{ return mArena; }
+
+private:
+	BmMemArena* mArena;
+};
+
+template< class T, class U>
+inline bool operator==( const BmArenaAllocator< T>& a,
+								const BmArenaAllocator< U>& b) {
+	return a.Arena() == b.Arena();
+}
+
+template< class T, class U>
+inline bool operator!=( const BmArenaAllocator< T>& a,
+								const BmArenaAllocator< U>& b) {
+	return a.Arena() != b.Arena();
+}
+
+#endif
@@ -65,4 +65,34 @@ private:
 	BLocker mWriteLocker;
 };
 
+/*------------------------------------------------------------------------------*\
+	BmAutoReadLock & BmAutoWriteLock
+		-	like BAutolock, but for read- or write-locking a BmMultiLocker
+\*------------------------------------------------------------------------------*/
+class BmAutoReadLock
+{
+public:
+	BmAutoReadLock( BmMultiLocker& locker)
+		:	mLocker( locker)
+		,	mIsLocked( locker.ReadLock())	{}
+	~BmAutoReadLock()						{ if (mIsLocked) mLocker.ReadUnlock(); }
+	bool IsLocked() const				{ return mIsLocked; }
+private:
+	BmMultiLocker& mLocker;
+	bool mIsLocked;
+};
+
+class BmAutoWriteLock
+{
+public:
+	BmAutoWriteLock( BmMultiLocker& locker)
+		:	mLocker( locker)
+		,	mIsLocked( locker.WriteLock())	{}
+	~BmAutoWriteLock()					{ if (mIsLocked) mLocker.WriteUnlock(); }
+	bool IsLocked() const				{ return mIsLocked; }
+private:
+	BmMultiLocker& mLocker;
+	bool mIsLocked;
+};
+
 #endif
@@ -40,10 +40,25 @@ using namespace regexx;
 \********************************************************************************/
 
 /*------------------------------------------------------------------------------*\
-	BmContentField( ctString)
+	BmContentField( arena)
 	-	c'tor
 \*------------------------------------------------------------------------------*/
-BmContentField::BmContentField( const BmString cfString) {
+BmContentField::BmContentField( BmMemArena* arena)
+	:	mArena( arena)
+	,	mParams( less< BmString>(), BmParamMap::allocator_type( arena))
+	,	mInitCheck( B_NO_INIT)
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	BmContentField( ctString, arena)
+	-	c'tor
+\*------------------------------------------------------------------------------*/
+BmContentField::BmContentField( const BmString cfString, BmMemArena* arena)
+	:	mArena( arena)
+	,	mParams( less< BmString>(), BmParamMap::allocator_type( arena))
+	,	mInitCheck( B_NO_INIT)
+{
 	SetTo( cfString);
 }
 
@@ -54,6 +69,8 @@ BmContentField::BmContentField( const BmString cfString) {
 void BmContentField::SetTo( const BmString cfString) {
 	Regexx rx;
 
+	mFieldString = cfString;
+
 	if (rx.exec( cfString, "^\\s*([^\\s;]+)\\s*([;\\s].*)?\\s*$", 
 					 Regexx::newline)) {
 		// extract value:
@@ -161,6 +178,17 @@ BmContentField::operator BmString() const {
 int32 BmBodyPart::nBoundaryCounter = 0;
 int32 BmBodyPart::nObjectID = 0;
 
+const char* const BmBodyPart::MSG_DEPTH = 			"bm:depth";
+const char* const BmBodyPart::MSG_START = 			"bm:start";
+const char* const BmBodyPart::MSG_LENGTH = 			"bm:length";
+const char* const BmBodyPart::MSG_TYPE = 				"bm:type";
+const char* const BmBodyPart::MSG_ENCODING = 		"bm:encoding";
+const char* const BmBodyPart::MSG_ID = 				"bm:id";
+const char* const BmBodyPart::MSG_DISPOSITION = 	"bm:disposition";
+const char* const BmBodyPart::MSG_DESCRIPTION = 	"bm:description";
+const char* const BmBodyPart::MSG_LANGUAGE = 		"bm:language";
+const char* const BmBodyPart::MSG_ERRORS = 			"bm:errors";
+
 /*------------------------------------------------------------------------------*\
 	BmBodyPart( msgtext, start, length, contentType)
 	-	c'tor
@@ -183,6 +211,8 @@ BmBodyPart::BmBodyPart( BmBodyPartList* model, const BmString& msgtext,
 								BmRef<BmMailHeader> header, BmListModelItem* parent)
 	:	inherited( BmString("")<<NextObjectID(), model, parent)
 	,	mIsMultiPart( false)
+	,	mContentType( model ? model->Arena() : NULL)
+	,	mContentDisposition( model ? model->Arena() : NULL)
 	,	mInitCheck( B_NO_INIT)
 	,	mEntryRef()
 	// info about mailtext will be overwritten in SetTo(), but we initialize 
@@ -211,6 +241,8 @@ BmBodyPart::BmBodyPart( BmBodyPartList* model, const entry_ref* ref,
 								BmListModelItem* parent)
 	:	inherited( BmString("")<<NextObjectID(), model, parent)
 	,	mIsMultiPart( false)
+	,	mContentType( model ? model->Arena() : NULL)
+	,	mContentDisposition( model ? model->Arena() : NULL)
 	,	mInitCheck( B_NO_INIT)
 	,	mEntryRef( *ref)
 	,	mStartInRawText( 0)
@@ -293,6 +325,46 @@ BmBodyPart::BmBodyPart( BmBodyPartList* model, const entry_ref* ref,
 	}
 }
 	
+/*------------------------------------------------------------------------------*\
+	BmBodyPart( model, mimeIndex, index, defaultCharset, parent)
+	-	c'tor
+	-	sets up the bodypart from the entry with the given index in the given
+		mime-index, which saves us from parsing the MIME-header (and from
+		searching the boundaries) again
+	-	throws BM_invalid_argument if the mime-index is incomplete
+\*------------------------------------------------------------------------------*/
+BmBodyPart::BmBodyPart( BmBodyPartList* model, BMessage* mimeIndex, 
+								int32 index, const BmString& defaultCharset,
+								BmListModelItem* parent)
+	:	inherited( BmString("")<<NextObjectID(), model, parent)
+	,	mIsMultiPart( false)
+	,	mContentType( model ? model->Arena() : NULL)
+	,	mContentDisposition( model ? model->Arena() : NULL)
+	,	mInitCheck( B_NO_INIT)
+	,	mEntryRef()
+	,	mStartInRawText( FindMsgInt32( mimeIndex, MSG_START, index))
+	,	mBodyLength( FindMsgInt32( mimeIndex, MSG_LENGTH, index))
+	,	mHaveDecodedData( false)
+	,	mSuggestedCharset( defaultCharset)
+	,	mCurrentCharset( defaultCharset)
+	, 	mHadErrorDuringConversion( false)
+{
+	if (!mSuggestedCharset.Length())
+		mCurrentCharset = mSuggestedCharset 
+			= ThePrefs->GetBool( "ImportExportTextAsUtf8", true)
+				? BmString("utf-8")
+				: ThePrefs->GetString( "DefaultCharset");
+	SetupFromFields( FindMsgString( mimeIndex, MSG_TYPE, index),
+						  FindMsgString( mimeIndex, MSG_ENCODING, index),
+						  FindMsgString( mimeIndex, MSG_ID, index),
+						  FindMsgString( mimeIndex, MSG_DISPOSITION, index),
+						  FindMsgString( mimeIndex, MSG_DESCRIPTION, index),
+						  FindMsgString( mimeIndex, MSG_LANGUAGE, index),
+						  defaultCharset);
+	AddParsingError( FindMsgString( mimeIndex, MSG_ERRORS, index));
+	mInitCheck = B_OK;
+}
+
 /*------------------------------------------------------------------------------*\
 	BmBodyPart( bodypart)
 	-	copy c'tor
@@ -344,13 +416,6 @@ void BmBodyPart::SetTo( const BmString& msgtext, int32 start, int32 length,
 	BM_LOG2( BM_LogMailParse, 
 				BmString("BodyPart::SetTo() start: ") << start 
 					<< " len: " << length);
-	BmString type;
-	BmString transferEncoding;
-	BmString id;
-	BmString disposition;
- 	BmRef<BmListModel> bodyRef = mListModel.Get();
- 	BmBodyPartList* body = dynamic_cast< BmBodyPartList*>( bodyRef.Get());
- 	
  	mHadErrorDuringConversion = false;
  	mParsingErrors.Truncate(0);
  	
@@ -393,105 +458,18 @@ void BmBodyPart::SetTo( const BmString& msgtext, int32 start, int32 length,
 			mBodyLength = length - (mStartInRawText-start);
 		}
 		BM_LOG2( BM_LogMailParse, BmString("MIME-Header found: ") << headerText);
-		header = new BmMailHeader( headerText, NULL);
+		header = new BmMailHeader( headerText, NULL, mContentType.Arena());
 	} else {
 		mStartInRawText = start;
 		mBodyLength = length;
 	}
-	// MIME-type
-	BM_LOG2( BM_LogMailParse, "parsing Content-Type");
-	type = header->GetFieldVal( BM_FIELD_CONTENT_TYPE);
-	if (!type.Length() || type.ICompare("text")==0) {
-		// set content-type to default if is empty or contains "text"
-		// (which is illegal but used by some broken mail-clients, it seems...)
-		if (ThePrefs->GetBool( "StrictCharsetHandling", false))
-			// strict mode: no charset means: us-ascii:
-			type = "text/plain; charset=us-ascii";
-		else
-			// more relaxed, no charset means: default charset
-			type = BmString("text/plain; charset=")<<mSuggestedCharset;
-	}
-	mContentType.SetTo( type);
-	if (type.ICompare("multipart", 9) == 0) {
-		mIsMultiPart = true;
-	}
-	if (IsPlainText() && !body->EditableTextBody()) {
-		body->EditableTextBody( this);
-	}
-	// transferEncoding
-	BM_LOG2( BM_LogMailParse, "parsing Content-Transfer-Encoding");
-	transferEncoding = header->GetFieldVal( BM_FIELD_CONTENT_TRANSFER_ENCODING);
-	transferEncoding.RemoveSet( BM_WHITESPACE.String());
-							// some broken (webmail)-clients produce stuff like
-							// "7 bit"...
-	transferEncoding.IReplaceAll( "bits", "bit");
-							// others use '8bits' instead of '8bit'...
-	transferEncoding.IReplaceAll( "7-bit", "7bit");
-	transferEncoding.IReplaceAll( "8-bit", "8bit");
-							// other broken (webmail)-clients produce stuff like 
-							// "7-bit" (argh)
-	if (!transferEncoding.Length())
-		transferEncoding = "7bit";
-	mContentTransferEncoding = transferEncoding;
-	BM_LOG2( BM_LogMailParse, 
-				BmString("...found value: ")<<mContentTransferEncoding);
-
-	// determine charset of bodypart, trying to not make use of:
-	// 	-	an empty charset
-	//		-	the (dummy) charset "unknown-8bit"
-	mCurrentCharset = mSuggestedCharset = mContentType.Param( "charset"); 
-	if (!mCurrentCharset.Length() || !mCurrentCharset.ICompare("unknown-8bit"))
-		mCurrentCharset = mSuggestedCharset = defaultCharset;
-	if (!mCurrentCharset.Length() || !mCurrentCharset.ICompare("unknown-8bit"))
-		mCurrentCharset = mSuggestedCharset 
-			= ThePrefs->GetBool( "ImportExportTextAsUtf8", true)
-				? BmString("utf-8")
-				: ThePrefs->GetString( "DefaultCharset");
-
-	// MIME-Decoding:
-	if (mIsMultiPart) {
-		// decoding is unneccessary for multiparts, since they are never 
-		// handled on their own (they are split into their subparts instead)
-		mHaveDecodedData = true;
-	} else {
-		// decode body:
-		if (IsText() && body->EditableTextBody() == this) {
-			// text data is decoded and then converted from it's native charset
-			// into utf8:
-			DecodeText();
-		} else {
-			// decoding of attachments is deferred until actually needed
-		}
-	}
-	// id
-	BM_LOG2( BM_LogMailParse, "parsing Content-Id");
-	mContentId = header->GetFieldVal( BM_FIELD_CONTENT_ID);
-	BM_LOG2( BM_LogMailParse, BmString("...found value: ")<<mContentId);
-	// disposition
-	BM_LOG2( BM_LogMailParse, "parsing Content-Disposition");
-	disposition = header->GetFieldVal( BM_FIELD_CONTENT_DISPOSITION);
-	if (!disposition.Length())
-		disposition = (IsPlainText() ? "inline" : "attachment");
-	mContentDisposition.SetTo( disposition);
-	// description
-	BM_LOG2( BM_LogMailParse, "parsing Content-Description");
-	mContentDescription = header->GetFieldVal( BM_FIELD_CONTENT_DESCRIPTION);
-	BM_LOG2( BM_LogMailParse, 
-				BmString("...found value: ")<<mContentDescription);
-	// Language
-	BM_LOG2( BM_LogMailParse, "parsing Content-Language");
-	mContentLanguage = header->GetFieldVal( BM_FIELD_CONTENT_LANGUAGE);
-	mContentLanguage.ToLower();
-	BM_LOG2( BM_LogMailParse, BmString("...found value: ")<<mContentLanguage);
-	// determine a filename (if possible)
-	mFileName = mContentDisposition.Param("filename");
-	mFileName.ReplaceSet( "/~<>()`´\\\"'", "_");
-	if (!mFileName.Length()) {
-		mFileName = mContentType.Param("name");
-		if (!mFileName.Length()) {
-			mFileName = TheTempFileList.NextTempFilename();
-		}
-	}
+	SetupFromFields( header->GetFieldVal( BM_FIELD_CONTENT_TYPE),
+						  header->GetFieldVal( BM_FIELD_CONTENT_TRANSFER_ENCODING),
+						  header->GetFieldVal( BM_FIELD_CONTENT_ID),
+						  header->GetFieldVal( BM_FIELD_CONTENT_DISPOSITION),
+						  header->GetFieldVal( BM_FIELD_CONTENT_DESCRIPTION),
+						  header->GetFieldVal( BM_FIELD_CONTENT_LANGUAGE),
+						  defaultCharset);
 		
 	if (mIsMultiPart) {
 		BmString boundary = BmString("--")+mContentType.Param("boundary");
@@ -624,6 +602,138 @@ void BmBodyPart::SetTo( const BmString& msgtext, int32 start, int32 length,
 	mInitCheck = B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	SetupFromFields( type, transferEncoding, id, disposition, description, 
+						  language, defaultCharset)
+	-	initializes the MIME-info of this bodypart from the given (raw) 
+		field-values, as found in the MIME-header
+\*------------------------------------------------------------------------------*/
+void BmBodyPart::SetupFromFields( BmString type, BmString transferEncoding,
+											 const BmString& id, BmString disposition,
+											 const BmString& description,
+											 const BmString& language,
+											 const BmString& defaultCharset) {
+ 	BmRef<BmListModel> bodyRef = mListModel.Get();
+ 	BmBodyPartList* body = dynamic_cast< BmBodyPartList*>( bodyRef.Get());
+
+	// MIME-type
+	BM_LOG2( BM_LogMailParse, "parsing Content-Type");
+	if (!type.Length() || type.ICompare("text")==0) {
+		// set content-type to default if is empty or contains "text"
+		// (which is illegal but used by some broken mail-clients, it seems...)
+		if (ThePrefs->GetBool( "StrictCharsetHandling", false))
+			// strict mode: no charset means: us-ascii:
+			type = "text/plain; charset=us-ascii";
+		else
+			// more relaxed, no charset means: default charset
+			type = BmString("text/plain; charset=")<<mSuggestedCharset;
+	}
+	mContentType.SetTo( type);
+	if (type.ICompare("multipart", 9) == 0) {
+		mIsMultiPart = true;
+	}
+	if (IsPlainText() && !body->EditableTextBody()) {
+		body->EditableTextBody( this);
+	}
+	// transferEncoding
+	BM_LOG2( BM_LogMailParse, "parsing Content-Transfer-Encoding");
+	transferEncoding.RemoveSet( BM_WHITESPACE.String());
+							// some broken (webmail)-clients produce stuff like
+							// "7 bit"...
+	transferEncoding.IReplaceAll( "bits", "bit");
+							// others use '8bits' instead of '8bit'...
+	transferEncoding.IReplaceAll( "7-bit", "7bit");
+	transferEncoding.IReplaceAll( "8-bit", "8bit");
+							// other broken (webmail)-clients produce stuff like 
+							// "7-bit" (argh)
+	if (!transferEncoding.Length())
+		transferEncoding = "7bit";
+	mContentTransferEncoding = transferEncoding;
+	BM_LOG2( BM_LogMailParse, 
+				BmString("...found value: ")<<mContentTransferEncoding);
+
+	// determine charset of bodypart, trying to not make use of:
+	// 	-	an empty charset
+	//		-	the (dummy) charset "unknown-8bit"
+	mCurrentCharset = mSuggestedCharset = mContentType.Param( "charset"); 
+	if (!mCurrentCharset.Length() || !mCurrentCharset.ICompare("unknown-8bit"))
+		mCurrentCharset = mSuggestedCharset = defaultCharset;
+	if (!mCurrentCharset.Length() || !mCurrentCharset.ICompare("unknown-8bit"))
+		mCurrentCharset = mSuggestedCharset 
+			= ThePrefs->GetBool( "ImportExportTextAsUtf8", true)
+				? BmString("utf-8")
+				: ThePrefs->GetString( "DefaultCharset");
+
+	// MIME-Decoding:
+	if (mIsMultiPart) {
+		// decoding is unneccessary for multiparts, since they are never 
+		// handled on their own (they are split into their subparts instead)
+		mHaveDecodedData = true;
+	} else {
+		// decode body:
+		if (IsText() && body->EditableTextBody() == this) {
+			// text data is decoded and then converted from it's native charset
+			// into utf8:
+			DecodeText();
+		} else {
+			// decoding of attachments is deferred until actually needed
+		}
+	}
+	// id
+	BM_LOG2( BM_LogMailParse, "parsing Content-Id");
+	mContentId = id;
+	BM_LOG2( BM_LogMailParse, BmString("...found value: ")<<mContentId);
+	// disposition
+	BM_LOG2( BM_LogMailParse, "parsing Content-Disposition");
+	if (!disposition.Length())
+		disposition = (IsPlainText() ? "inline" : "attachment");
+	mContentDisposition.SetTo( disposition);
+	// description
+	BM_LOG2( BM_LogMailParse, "parsing Content-Description");
+	mContentDescription = description;
+	BM_LOG2( BM_LogMailParse, 
+				BmString("...found value: ")<<mContentDescription);
+	// Language
+	BM_LOG2( BM_LogMailParse, "parsing Content-Language");
+	mContentLanguage = language;
+	mContentLanguage.ToLower();
+	BM_LOG2( BM_LogMailParse, BmString("...found value: ")<<mContentLanguage);
+	// determine a filename (if possible)
+	mFileName = mContentDisposition.Param("filename");
+	mFileName.ReplaceSet( "/~<>()`´\\\"'", "_");
+	if (!mFileName.Length()) {
+		mFileName = mContentType.Param("name");
+		if (!mFileName.Length()) {
+			mFileName = TheTempFileList.NextTempFilename();
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	AddToMimeIndex( mimeIndex, depth)
+	-	appends the MIME-info of this bodypart (and all its subparts) to 
+		the given mime-index
+\*------------------------------------------------------------------------------*/
+void BmBodyPart::AddToMimeIndex( BMessage* mimeIndex, int8 depth) const {
+	mimeIndex->AddInt8( MSG_DEPTH, depth);
+	mimeIndex->AddInt32( MSG_START, mStartInRawText);
+	mimeIndex->AddInt32( MSG_LENGTH, mBodyLength);
+	mimeIndex->AddString( MSG_TYPE, mContentType.FieldString().String());
+	mimeIndex->AddString( MSG_ENCODING, mContentTransferEncoding.String());
+	mimeIndex->AddString( MSG_ID, mContentId.String());
+	mimeIndex->AddString( MSG_DISPOSITION, 
+								 mContentDisposition.FieldString().String());
+	mimeIndex->AddString( MSG_DESCRIPTION, mContentDescription.String());
+	mimeIndex->AddString( MSG_LANGUAGE, mContentLanguage.String());
+	mimeIndex->AddString( MSG_ERRORS, mParsingErrors.String());
+	BmModelItemMap::const_iterator iter;
+	for( iter = begin(); iter != end(); ++iter) {
+		BmBodyPart* subPart = dynamic_cast< BmBodyPart*>( iter->second.Get());
+		if (subPart)
+			subPart->AddToMimeIndex( mimeIndex, depth+1);
+	}
+}
+
 /*------------------------------------------------------------------------------*\
 	AddParsingError()
 	-	
@@ -1141,8 +1251,10 @@ BmBodyPartList::BmBodyPartList( BmMail* mail)
 	:	inherited( BmString("BodyPartList_") << mail->ModelName(), 
 					  BM_LogMailParse)
 	,	mMail( mail)
+	,	mArena( mail->Arena())
 	,	mEditableTextBody( NULL)
 	,	mInitCheck( B_NO_INIT)
+	,	mMimeIndexIsValid( false)
 {
 }
 
@@ -1153,13 +1265,39 @@ BmBodyPartList::BmBodyPartList( BmMail* mail)
 BmBodyPartList::~BmBodyPartList() {
 }
 
+const char* const BmBodyPartList::MSG_TEXT_LENGTH = 	"bm:textlen";
+const char* const BmBodyPartList::MSG_HEADER_LENGTH = "bm:headerlen";
+const char* const BmBodyPartList::MSG_TEXT_CHECKSUM = "bm:textsum";
+
 /*------------------------------------------------------------------------------*\
-	ParseMail()
-		-	
+	TextChecksum( text)
+		-	returns a (FNV-1a) checksum of the given mail-text, used to detect
+			a mime-index that belongs to a different mail-text of the same size
 \*------------------------------------------------------------------------------*/
-void BmBodyPartList::ParseMail() {
+static uint32 TextChecksum( const BmString& text) {
+	uint32 sum = 2166136261UL;
+	const unsigned char* pos = (const unsigned char*)text.String();
+	const unsigned char* end = pos + text.Length();
+	while( pos < end) {
+		sum ^= *pos++;
+		sum *= 16777619UL;
+	}
+	return sum;
+}
+
+/*------------------------------------------------------------------------------*\
+	ParseMail( mimeIndex)
+		-	splits the mail-text into its bodyparts
+		-	if a mime-index is given (and it matches the mail-text), the 
+			bodyparts are set up from it instead of being parsed
+\*------------------------------------------------------------------------------*/
+void BmBodyPartList::ParseMail( BMessage* mimeIndex) {
 	mEditableTextBody = NULL;
 	Cleanup();
+	if (mimeIndex && SetupFromMimeIndex( mimeIndex)) {
+		mInitCheck = B_OK;
+		return;
+	}
 	if (mMail && mMail->HeaderLength() >= 2) {
 		const BmString& msgText = mMail->RawText();
 		BmBodyPart* bodyPart 
@@ -1168,9 +1306,129 @@ void BmBodyPartList::ParseMail() {
 									mMail->DefaultCharset(),	mMail->Header());
 		AddItemToList( bodyPart);
 	}
+	UpdateMimeIndex();
 	mInitCheck = B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	SetupFromMimeIndex( mimeIndex)
+		-	rebuilds the bodypart-structure from the given mime-index
+		-	returns false if the mime-index doesn't match the current mail-text
+			(in which case the mail needs to be parsed)
+\*------------------------------------------------------------------------------*/
+bool BmBodyPartList::SetupFromMimeIndex( BMessage* mimeIndex) {
+	if (!mMail || mMail->HeaderLength() < 2)
+		return false;
+	int16 version;
+	int32 textLen, headerLen;
+	uint32 textSum;
+	type_code type;
+	int32 count;
+	if (mimeIndex->FindInt16( BmListModelItem::MSG_VERSION, &version) != B_OK
+	|| version != nMimeIndexVersion
+	|| mimeIndex->FindInt32( MSG_TEXT_LENGTH, &textLen) != B_OK
+	|| textLen != mMail->RawText().Length()
+	|| mimeIndex->FindInt32( MSG_HEADER_LENGTH, &headerLen) != B_OK
+	|| headerLen != mMail->HeaderLength()
+	|| mimeIndex->FindInt32( MSG_TEXT_CHECKSUM, (int32*)&textSum) != B_OK
+	|| textSum != TextChecksum( mMail->RawText())
+	|| mimeIndex->GetInfo( BmBodyPart::MSG_DEPTH, &type, &count) != B_OK
+	|| count < 1) {
+		BM_LOG2( BM_LogMailParse, "mime-index doesn't match mail-text");
+		return false;
+	}
+	BM_LOG2( BM_LogMailParse, 
+				BmString("setting up ") << count << " bodyparts from mime-index");
+	const BmString defaultCharset = mMail->DefaultCharset();
+	vector< BmBodyPart*> parentVect;
+	BmRef<BmBodyPart> rootPart;
+	try {
+		for( int32 i=0; i<count; ++i) {
+			int8 depth = 0;
+			mimeIndex->FindInt8( BmBodyPart::MSG_DEPTH, i, &depth);
+			if (depth < 0 || depth > (int8)parentVect.size() || (i && !depth)
+			|| (!i && depth))
+				BM_THROW_INVALID( "invalid depth in mime-index");
+			parentVect.resize( depth);
+			BmBodyPart* parent = depth ? parentVect.back() : NULL;
+			BmBodyPart* bodyPart 
+				= new BmBodyPart( this, mimeIndex, i, defaultCharset, parent);
+			if (bodyPart->mStartInRawText < 0 || bodyPart->mBodyLength < 0
+			|| bodyPart->mStartInRawText+bodyPart->mBodyLength > textLen) {
+				delete bodyPart;
+				BM_THROW_INVALID( "invalid bodypart-offsets in mime-index");
+			}
+			if (parent) {
+				BmAutolockCheckGlobal lock( ModelLocker());
+				if (!lock.IsLocked())
+					BM_THROW_RUNTIME( 
+						ModelNameNC() << ":SetupFromMimeIndex(): Unable to get lock"
+					);
+				parent->AddSubItem( bodyPart);
+			} else
+				rootPart = bodyPart;
+			parentVect.push_back( bodyPart);
+		}
+	} catch( BM_invalid_argument &err) {
+		BM_LOG( BM_LogMailParse, 
+				  BmString("mime-index is corrupt, parsing mail instead.\n\n")
+				  		<< err.what());
+		mEditableTextBody = NULL;
+		return false;
+	}
+	AddItemToList( rootPart.Get());
+	mMimeIndex = *mimeIndex;
+	mMimeIndexIsValid = true;
+	return true;
+}
+
+/*------------------------------------------------------------------------------*\
+	UpdateMimeIndex()
+		-	collects the structure of the (freshly parsed) bodyparts into 
+			the mime-index
+\*------------------------------------------------------------------------------*/
+void BmBodyPartList::UpdateMimeIndex() {
+	mMimeIndex.MakeEmpty();
+	mMimeIndexIsValid = false;
+	if (!mMail)
+		return;
+	BmAutolockCheckGlobal lock( ModelLocker());
+	if (!lock.IsLocked())
+		BM_THROW_RUNTIME( ModelNameNC() << ":UpdateMimeIndex(): Unable to get lock");
+	mMimeIndex.AddInt16( BmListModelItem::MSG_VERSION, nMimeIndexVersion);
+	mMimeIndex.AddInt32( MSG_TEXT_LENGTH, mMail->RawText().Length());
+	mMimeIndex.AddInt32( MSG_HEADER_LENGTH, mMail->HeaderLength());
+	mMimeIndex.AddInt32( MSG_TEXT_CHECKSUM, 
+								int32(TextChecksum( mMail->RawText())));
+	BmModelItemMap::const_iterator iter;
+	for( iter = begin(); iter != end(); ++iter) {
+		BmBodyPart* bodyPart = dynamic_cast< BmBodyPart*>( iter->second.Get());
+		if (bodyPart)
+			bodyPart->AddToMimeIndex( &mMimeIndex, 0);
+	}
+	mMimeIndexIsValid = !empty();
+}
+
+/*------------------------------------------------------------------------------*\
+	MimeIndex()
+		-	returns the mime-index describing the bodypart-structure of the
+			mail-text, or NULL if the bodyparts do not match the mail-text 
+			(anymore)
+\*------------------------------------------------------------------------------*/
+const BMessage* BmBodyPartList::MimeIndex() const {
+	int32 textLen, headerLen;
+	uint32 textSum;
+	if (!mMimeIndexIsValid || !mMail
+	|| mMimeIndex.FindInt32( MSG_TEXT_LENGTH, &textLen) != B_OK
+	|| textLen != mMail->RawText().Length()
+	|| mMimeIndex.FindInt32( MSG_HEADER_LENGTH, &headerLen) != B_OK
+	|| headerLen != mMail->HeaderLength()
+	|| mMimeIndex.FindInt32( MSG_TEXT_CHECKSUM, (int32*)&textSum) != B_OK
+	|| textSum != TextChecksum( mMail->RawText()))
+		return NULL;
+	return &mMimeIndex;
+}
+
 /*------------------------------------------------------------------------------*\
 	StartJob()
 		-	
@@ -1242,6 +1500,7 @@ void BmBodyPartList::AddAttachmentFromRef( const entry_ref* ref,
 	if (!alreadyPresent) {
 		BmBodyPart* bodyPart = new BmBodyPart( this, ref, charset, parent);
 		if (bodyPart->InitCheck() == B_OK) {
+			mMimeIndexIsValid = false;
 			AddItemToList( bodyPart, parent);
 		} else
 			delete bodyPart;
@@ -1258,6 +1517,7 @@ void BmBodyPartList::RemoveItemFromList( BmListModelItem* item) {
 	if (!lock.IsLocked())
 		BM_THROW_RUNTIME( ModelNameNC() << ": Unable to get lock");
 	Freeze();
+	mMimeIndexIsValid = false;
 	inherited::RemoveItemFromList( item);
 	PruneUnneededMultiParts();
 	Thaw();
@@ -1271,8 +1531,10 @@ void BmBodyPartList::RemoveItemFromList( BmListModelItem* item) {
 void BmBodyPartList::SetEditableText( const BmString& utf8Text, 
 												  const BmString& charset) {
 	BmRef<BmBodyPart> editableTextBody( EditableTextBody());
-	if (editableTextBody)
+	if (editableTextBody) {
+		mMimeIndexIsValid = false;
 		editableTextBody->SetBodyText( utf8Text, charset);
+	}
 }
 
 /*------------------------------------------------------------------------------*\
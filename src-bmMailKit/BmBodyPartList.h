@@ -12,9 +12,11 @@
 #include "BmMailKit.h"
 
 #include <Entry.h>
+#include <Message.h>
 
 #include "BmDataModel.h"
 #include "BmMailHeader.h"
+#include "BmMemArena.h"
 #include "BmMemIO.h"
 
 class BFile;
@@ -25,12 +27,13 @@ class BmMail;
 		-	
 \*------------------------------------------------------------------------------*/
 class IMPEXPBMMAILKIT BmContentField {
-	typedef map< BmString, BmString> BmParamMap;
+	typedef map< BmString, BmString, less< BmString>, 
+					 BmArenaAllocator< pair< const BmString, BmString> > > BmParamMap;
 
 public:
 	// c'tors and d'tor:
-	BmContentField()							{ mInitCheck = B_NO_INIT; }
-	BmContentField( const BmString cfString);
+	BmContentField( BmMemArena* arena = NULL);
+	BmContentField( const BmString cfString, BmMemArena* arena = NULL);
 	
 	// native methods:
 	void SetTo( const BmString cfString);
@@ -39,6 +42,9 @@ public:
 	// getters:
 	inline status_t InitCheck() const	{ return mInitCheck; }
 	inline const BmString& Value() const	{ return mValue; }
+	inline const BmString& FieldString() const	
+													{ return mFieldString; }
+	inline BmMemArena* Arena() const		{ return mArena.Get(); }
 	const BmString& Param( BmString key) const;
 
 	// operators:
@@ -47,8 +53,13 @@ public:
 							// (ready to be sent)
 
 private:
+	BmMemArenaRef mArena;
+							// the arena the params are allocated from (if any), 
+							// must be declared before mParams
 	BmString mValue;
 	BmParamMap mParams;
+	BmString mFieldString;
+							// the field-string this content-field was set to
 
 	status_t mInitCheck;
 
@@ -78,6 +89,9 @@ public:
 	BmBodyPart( BmBodyPartList* model, const entry_ref* ref, 
 					const BmString& defaultCharset,
 					BmListModelItem* parent=NULL);
+	BmBodyPart( BmBodyPartList* model, BMessage* mimeIndex, int32 index,
+					const BmString& defaultCharset,
+					BmListModelItem* parent=NULL);
 	BmBodyPart( const BmBodyPart& bodyPart);
 	~BmBodyPart();
 
@@ -158,7 +172,25 @@ public:
 
 	static int32 nBoundaryCounter;
 
+	// archival-fieldnames (for the mime-index):
+	static const char* const MSG_DEPTH;
+	static const char* const MSG_START;
+	static const char* const MSG_LENGTH;
+	static const char* const MSG_TYPE;
+	static const char* const MSG_ENCODING;
+	static const char* const MSG_ID;
+	static const char* const MSG_DISPOSITION;
+	static const char* const MSG_DESCRIPTION;
+	static const char* const MSG_LANGUAGE;
+	static const char* const MSG_ERRORS;
+
 private:
+	void SetupFromFields( BmString type, BmString transferEncoding,
+								 const BmString& id, BmString disposition,
+								 const BmString& description, 
+								 const BmString& language,
+								 const BmString& defaultCharset);
+	void AddToMimeIndex( BMessage* mimeIndex, int8 depth) const;
 	bool ContainsRef( const entry_ref& ref) const;
 	void PropagateHigherEncoding();
 	int32 PruneUnneededMultiParts();
@@ -205,6 +237,7 @@ class IMPEXPBMMAILKIT BmBodyPartList : public BmListModel {
 	typedef BmListModel inherited;
 
 	static const int16 nArchiveVersion = 1;
+	static const int16 nMimeIndexVersion = 2;
 
 public:
 	// c'tors and d'tor
@@ -212,7 +245,8 @@ public:
 	virtual ~BmBodyPartList();
 
 	// native methods:
-	void ParseMail();
+	void ParseMail( BMessage* mimeIndex = NULL);
+	const BMessage* MimeIndex() const;
 	bool HasAttachments() const;
 	void AddAttachmentFromRef( const entry_ref* ref,
 										const BmString& defaultCharset);
@@ -235,8 +269,14 @@ public:
 	inline const BmString& Signature() const	
 													{ return mSignature; }
 	inline BmMail* Mail() const			{ return mMail; }
+	inline BmMemArena* Arena() const		{ return mArena.Get(); }
 	bool IsMultiPart() const;
 
+	// archival-fieldnames (for the mime-index):
+	static const char* const MSG_TEXT_LENGTH;
+	static const char* const MSG_HEADER_LENGTH;
+	static const char* const MSG_TEXT_CHECKSUM;
+
 	// setters:
 	inline void EditableTextBody( BmBodyPart* b) 
 													{ mEditableTextBody = b; }
@@ -244,10 +284,22 @@ public:
 													{ mSignature = s; }
 
 private:
+	bool SetupFromMimeIndex( BMessage* mimeIndex);
+	void UpdateMimeIndex();
+
 	BmMail* mMail;
+	BmMemArenaRef mArena;
+							// the arena of our mail, used by the bodyparts' 
+							// containers
 	BmRef<BmBodyPart> mEditableTextBody;
 	status_t mInitCheck;
 	BmString mSignature;						// signature (as found in mail-text)
+	BMessage mMimeIndex;
+							// the structure of the bodyparts, as found in the
+							// mail-text (offsets, types, encodings, etc.)
+	bool mMimeIndexIsValid;
+							// false as soon as the bodyparts have been modified
+							// and thus no longer match the mail-text
 
 	// Hide copy-constructor and assignment:
 	BmBodyPartList( const BmBodyPartList&);
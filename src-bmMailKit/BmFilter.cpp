@@ -150,6 +150,31 @@ bool BmFilter::Execute( BmMsgContext* msgContext)
 	return mAddon->Execute( msgContext, &mJobSpecifier);
 }
 
+/*------------------------------------------------------------------------------*\
+	ExecuteBatch()
+		-	executes the addon on all the given mails in one go
+\*------------------------------------------------------------------------------*/
+bool BmFilter::ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+									  vector< bool>& results)
+{
+	if (!mAddon) {
+		results.assign( msgContexts.size(), false);
+		return false;
+	}
+	return mAddon->ExecuteBatch( msgContexts, results, &mJobSpecifier);
+}
+
+/*------------------------------------------------------------------------------*\
+	AddNeeds()
+		-	adds the parts of a mail that the addon looks at to needs
+			(disabled filters aren't executed, so they need nothing)
+\*------------------------------------------------------------------------------*/
+void BmFilter::AddNeeds( BmFilterNeeds& needs)
+{
+	if (mAddon)
+		mAddon->AddNeeds( needs);
+}
+
 
 /********************************************************************************\
 	BmFilterList
@@ -61,6 +61,9 @@ public:
 	// native methods:
 	bool SanityCheck( BmString& complaint, BmString& fieldName) const;
 	bool Execute( BmMsgContext* msgContext);
+	bool ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+							 vector< bool>& results);
+	void AddNeeds( BmFilterNeeds& needs);
 
 	// stuff needed for Archival:
 	status_t Archive( BMessage* archive, bool deep = true) const;
@@ -68,6 +71,8 @@ public:
 
 	// getters:
 	inline bool IsDisabled() const		{ return mAddon == NULL; }
+	inline bool IsThreadSafe() const		
+													{ return !mAddon || mAddon->IsThreadSafe(); }
 	inline const BmString &Name() const	{ return Key(); }
 	inline const BmString &Kind() const	{ return mKind; }
 
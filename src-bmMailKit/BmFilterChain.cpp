@@ -149,6 +149,7 @@ void BmChainedFilterList::RenumberPos() {
 	BmAutolockCheckGlobal lock( ModelLocker());
 	if (!lock.IsLocked())
 		BM_THROW_RUNTIME( ModelNameNC() << ": Unable to get lock");
+	BmFilterChainList::ChainsHaveChanged();
 	mPosVect.clear();
 	// first fill pos-vect from chained filters:
 	BmModelItemMap::const_iterator iter;
@@ -297,6 +298,8 @@ BmRef< BmFilterChainList> BmFilterChainList::theInstance( NULL);
 
 const int16 BmFilterChainList::nArchiveVersion = 1;
 
+int32 BmFilterChainList::nGeneration = 0;
+
 /*------------------------------------------------------------------------------*\
 	CreateInstance()
 		-	initialiazes object by reading info from settings file (if any)
@@ -332,6 +335,25 @@ const BmString BmFilterChainList::SettingsFileName() {
 	return BmString( BeamRoster->SettingsPath()) << "/FilterChains";
 }
 
+/*------------------------------------------------------------------------------*\
+	AddItemToList( item)
+		-	extends normal behaviour by invalidating all cached execution plans
+\*------------------------------------------------------------------------------*/
+bool BmFilterChainList::AddItemToList( BmListModelItem* item, 
+													BmListModelItem* parent) {
+	ChainsHaveChanged();
+	return inherited::AddItemToList( item, parent);
+}
+
+/*------------------------------------------------------------------------------*\
+	RemoveItemFromList( item)
+		-	extends normal behaviour by invalidating all cached execution plans
+\*------------------------------------------------------------------------------*/
+void BmFilterChainList::RemoveItemFromList( BmListModelItem* item) {
+	inherited::RemoveItemFromList( item);
+	ChainsHaveChanged();
+}
+
 /*------------------------------------------------------------------------------*\
 	ForeignKeyChanged( keyName, oldVal, newVal)
 		-	updates the specified foreign-key with the given new value
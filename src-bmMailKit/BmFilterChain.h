@@ -185,9 +185,14 @@ public:
 	void ForeignKeyChanged( const BmString& key, 
 								   const BmString& oldVal, const BmString& newVal);
 	void RemoveFilterFromAllChains( const BmString& filterName);
+	//
+	static int32 Generation()				{ return atomic_or( &nGeneration, 0); }
+	static void ChainsHaveChanged()		{ atomic_add( &nGeneration, 1); }
 	
 	// overrides of listmodel base:
 	const BmString SettingsFileName();
+	bool AddItemToList( BmListModelItem* item, BmListModelItem* parent=NULL);
+	void RemoveItemFromList( BmListModelItem* item);
 	void InstantiateItem( BMessage* archive);
 	int16 ArchiveVersion() const			{ return nArchiveVersion; }
 	bool StartJob();
@@ -195,6 +200,10 @@ public:
 	static BmRef<BmFilterChainList> theInstance;
 
 private:
+	static int32 nGeneration;
+							// incremented whenever a chain is added or removed or 
+							// the filters of any chain have changed, such that
+							// cached execution plans can tell they are stale
 	// Hide copy-constructor and assignment:
 	BmFilterChainList( const BmFilterChainList&);
 	BmFilterChainList operator=( const BmFilterChainList&);
@@ -10,6 +10,7 @@
 
 #include <Directory.h>
 #include <FindDirectory.h>
+#include <fs_attr.h>
 
 #include "split.hh"
 using namespace regexx;
@@ -59,6 +60,7 @@ const char* BM_MAIL_ATTR_IDENTITY		= "MAIL:beam/identity";
 const char* BM_MAIL_ATTR_MARGIN	 		= "MAIL:beam/margin";
 const char* BM_MAIL_ATTR_WHEN_CREATED = "MAIL:beam/when-created";
 const char* BM_MAIL_ATTR_IMAP_UID	 	= "MAIL:beam/imap-uid";
+const char* BM_MAIL_ATTR_MIME_INDEX 	= "MAIL:beam/mime-index";
 
 const char* BM_FIELD_BCC 					= "Bcc";
 const char* BM_FIELD_CC 					= "Cc";
@@ -121,6 +123,30 @@ static BmString BM_MAILKEY( const BmMailRef* ref)
 	return BmString("Mail_") << ref->NodeRef().node;
 }
 
+/*------------------------------------------------------------------------------*\
+	ReadMimeIndex( node, mimeIndex)
+		-	fetches the mime-index (the stored bodypart-structure) from the
+			given mail-node
+		-	returns false if there is no (readable) mime-index
+\*------------------------------------------------------------------------------*/
+static bool ReadMimeIndex( BNode& node, BMessage& mimeIndex)
+{
+	attr_info attrInfo;
+	if (node.GetAttrInfo( BM_MAIL_ATTR_MIME_INDEX, &attrInfo) != B_OK
+	|| attrInfo.type != B_MESSAGE_TYPE || attrInfo.size <= 0)
+		return false;
+	BmString buf;
+	char* data = buf.LockBuffer( int32(attrInfo.size));
+	if (!data)
+		return false;
+	ssize_t size = node.ReadAttr( BM_MAIL_ATTR_MIME_INDEX, B_MESSAGE_TYPE, 0,
+											data, size_t(attrInfo.size));
+	buf.UnlockBuffer( 0);
+	if (size != attrInfo.size)
+		return false;
+	return mimeIndex.Unflatten( buf.String()) == B_OK;
+}
+
 // #pragma mark - Initialization
 /*------------------------------------------------------------------------------*\
 	CreateInstance( mailref)
@@ -158,6 +184,7 @@ BmMail::BmMail( bool outbound)
 	,	mRightMargin( ThePrefs->GetInt( "MaxLineLen"))
 	,	mMoveToTrash( false)
 	,	mRatioSpam( BmMailRef::UNKNOWN_RATIO)
+	,	mHeaderOnly( false)
 {
 	BmString emptyMsg = BmString(BM_FIELD_MIME)+": 1.0\r\n";
 	emptyMsg << "Content-Type: text/plain; charset=\"" 
@@ -193,6 +220,7 @@ BmMail::BmMail( const BmString &msgText, const BmString account)
 	,	mRightMargin( ThePrefs->GetInt( "MaxLineLen"))
 	,	mMoveToTrash( false)
 	,	mRatioSpam( BmMailRef::UNKNOWN_RATIO)
+	,	mHeaderOnly( false)
 {
 	SetTo( msgText, account);
 
@@ -218,6 +246,7 @@ BmMail::BmMail( BmMailRef* ref)
 	,	mMoveToTrash( false)
 	,	mClassification( ref ? ref->Classification() : NULL)
 	,	mRatioSpam( ref ? ref->RatioSpam() : BmMailRef::UNKNOWN_RATIO)
+	,	mHeaderOnly( false)
 {
 	mOutbound = 
 		Status() == BM_MAIL_STATUS_DRAFT
@@ -238,8 +267,11 @@ BmMail::~BmMail() {
 		-	the mail-header is extracted from msgText and is parsed
 		-	account is the name of the POP/IMAP-account this message was 
 			received from
+		-	if only the header has been read, the body is left alone (it 
+			will be set up when the complete mail is read)
 \*------------------------------------------------------------------------------*/
-void BmMail::SetTo( const BmString &_text, const BmString account) {
+void BmMail::SetTo( const BmString &_text, const BmString account,
+						  BMessage* mimeIndex) {
 	BmString text;
 	BM_LOG2( BM_LogMailParse, "Converting Linebreaks to CRLF...");
 		// take care to remove all binary nulls
@@ -266,13 +298,18 @@ void BmMail::SetTo( const BmString &_text, const BmString account) {
 	BmString header;
 	header.SetTo( mText, headerLen);
 	BM_LOG2( BM_LogMailParse, "...init header from header-string...");
-	mHeader = new BmMailHeader( header, this);
+	mArena = new BmMemArena();
+	mHeader = new BmMailHeader( header, this, mArena.Get());
 	BM_LOG2( BM_LogMailParse, "...done (header)");
 
-	BM_LOG2( BM_LogMailParse, "init of body...");
-	mBody = new BmBodyPartList( this);
-	mBody->ParseMail();
-	BM_LOG2( BM_LogMailParse, "done (init of body)");
+	if (mHeaderOnly)
+		mBody = NULL;
+	else {
+		BM_LOG2( BM_LogMailParse, "init of body...");
+		mBody = new BmBodyPartList( this);
+		mBody->ParseMail( mimeIndex);
+		BM_LOG2( BM_LogMailParse, "done (init of body)");
+	}
 
 	mInitCheck = B_OK;
 }
@@ -287,16 +324,18 @@ bool BmMail::StartJob() {
 	status_t err;
 	BFile mailFile;
 	
-	if (!mMailRef || InitCheck() == B_OK) {
+	bool headerOnly = mJobSpecifier == BM_READ_HEADER_JOB;
+	if (!mMailRef 
+	|| (InitCheck() == B_OK && (!mHeaderOnly || headerOnly))) {
 		// mail is illdefined or has already been initialized 
 		// -> there's nothing left to do
 		return true;
 	}
 
 	try {
-		// N.B.: We skip any checks for the explicit read-mail-job, since
+		// N.B.: We skip any checks for the explicit read-jobs, since
 		//       in this mode we really, really want to read the mail now.
-		bool skipChecks = mJobSpecifier == BM_READ_MAIL_JOB;
+		bool skipChecks = mJobSpecifier == BM_READ_MAIL_JOB || headerOnly;
 		if (!skipChecks) {
 			// we take a little nap (giving the user time to navigate onwards),
 			// after which we check if we should really read the mail:
@@ -329,9 +368,56 @@ bool BmMail::StartJob() {
 		
 		// ...ok, mail-file found, we fetch the mail from it:
 		BmString mailText;
+		// if only the header has been read before, the mail is being
+		// completed, in which case we keep the state we already have, 
+		// since it may have been changed after the header has been read:
+		bool completing = mHeaderOnly && mHeader && !headerOnly;
 		// read special attributes for mail-state...
-		mailFile.ReadAttr( BM_MAIL_ATTR_MARGIN, B_INT32_TYPE, 0, 
-								 &mRightMargin, sizeof(int32));
+		if (!completing)
+			mailFile.ReadAttr( BM_MAIL_ATTR_MARGIN, B_INT32_TYPE, 0, 
+									 &mRightMargin, sizeof(int32));
+		if (headerOnly) {
+			// the caller is only interested in the header, so we just read
+			// up to the empty line that separates header from body:
+			BmString headerText;
+			const size_t blocksize = 4096;
+			char block[blocksize];
+			int32 headerEnd = B_ERROR;
+			while( headerEnd == B_ERROR) {
+				ssize_t read = mailFile.Read( block, blocksize);
+				if (read < 0)
+					throw BM_runtime_error( BmString("Could not fetch mail-header "
+																"from file\n\t<") 
+														<< eref.name << ">\n\n Result: " 
+														<< strerror(read));
+				if (!read)
+					break;
+				// take care to remove all binary nulls:
+				std::replace( block, block+read, '\0', ' ');
+				int32 searchStart = MAX( 0, headerText.Length()-2);
+				headerText.Append( block, int32(read));
+				int32 crlfPos = headerText.FindFirst( "\n\r\n", searchStart);
+				int32 lfPos = headerText.FindFirst( "\n\n", searchStart);
+				if (crlfPos != B_ERROR && (lfPos == B_ERROR || crlfPos < lfPos))
+					headerEnd = crlfPos+3;
+				else if (lfPos != B_ERROR)
+					headerEnd = lfPos+2;
+			}
+			BM_LOG2( BM_LogMailParse, 
+						BmString("...read ") << headerText.Length() 
+							<< " bytes in order to fetch header");
+			// if there's no empty line, we have read the complete mail:
+			mHeaderOnly = headerEnd != B_ERROR;
+			if (mHeaderOnly)
+				headerText.Truncate( headerEnd);
+			mIdentityName = mMailRef->Identity();
+			mImapUID = mMailRef->ImapUID();
+			SetTo( headerText, mMailRef->Account());
+			BM_LOG2( BM_LogMailParse, BmString("Done, mail-header is initialized"));
+			return InitCheck() == B_OK;
+		}
+		BMessage mimeIndex;
+		bool haveMimeIndex = ReadMimeIndex( mailFile, mimeIndex);
 		// ...and read file contents:
 		off_t mailSize;
 		if ((err = mailFile.GetSize( &mailSize)) != B_OK)
@@ -382,9 +468,26 @@ bool BmMail::StartJob() {
 		mailText.ReplaceAll( 0, 32);
 		// we initialize the BmMail-internals from the plain text:
 		BM_LOG2( BM_LogMailParse, BmString("initializing BmMail from msgtext"));
-		mIdentityName = mMailRef->Identity();
-		mImapUID = mMailRef->ImapUID();
-		SetTo( mailText, mMailRef->Account());
+		// only now that the mail has been read completely, it is no longer
+		// header-only (if reading fails, the header stays usable):
+		mHeaderOnly = false;
+		if (completing) {
+			BmRef<BmMailHeader> header( mHeader);
+			SetTo( mailText, mAccountName, haveMimeIndex ? &mimeIndex : NULL);
+			// the body-parts have been set up from the file, but the header 
+			// we already had (including any changes) stays in charge:
+			if (header->HeaderLength() == mHeader->HeaderLength())
+				mHeader = header;
+			else
+				BM_LOG( BM_LogMailParse, 
+						  BmString("header of mail ") << ModelName() 
+						  		<< " has changed on disk, header-changes are lost");
+		} else {
+			mIdentityName = mMailRef->Identity();
+			mImapUID = mMailRef->ImapUID();
+			SetTo( mailText, mMailRef->Account(), 
+					 haveMimeIndex ? &mimeIndex : NULL);
+		}
 		BM_LOG2( BM_LogMailParse, BmString("Done, mail is initialized"));
 	} catch (BM_error &e) {
 		BM_SHOWERR( e.what());
@@ -392,12 +495,62 @@ bool BmMail::StartJob() {
 	return InitCheck() == B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	PromoteToFullMail()
+		-	if only the header has been read, the complete mail is read now
+		-	this is called by every method that needs more than just the header,
+			such that callers don't have to care about how the mail was read
+		-	only mail-text and body-parts are taken from the file, all other 
+			state (header-fields, identity, account, IMAP-UID and right margin) 
+			is kept as is, since it may already have been changed (e.g. by 
+			a mail-filter) after the header has been read (see StartJob())
+		-	this is const because it only completes the (logical) state of the
+			mail, so it can be invoked from const getters like RawText()
+		-	the promotion happens under the model-lock, such that only one of
+			the threads sharing this mail reads it (the others wait for it)
+		-	returns B_OK if the complete mail is available, an error if it 
+			could not be read (the mail is still header-only in that case)
+\*------------------------------------------------------------------------------*/
+status_t BmMail::PromoteToFullMail() const {
+	if (!mHeaderOnly)
+		return B_OK;
+	BmMail* self = const_cast< BmMail*>( this);
+	while( true) {
+		{	// scope for autolock
+			BmAutolockCheckGlobal lock( ModelLocker());
+			if (!lock.IsLocked())
+				BM_THROW_RUNTIME( ModelNameNC() << ": Unable to get lock");
+			if (!mHeaderOnly)
+				return B_OK;
+			if (!IsJobRunning()) {
+				BM_LOG2( BM_LogMailParse, 
+							BmString("promoting mail ") << ModelName() 
+								<< " to full read");
+				self->mInitCheck = B_NO_INIT;
+				self->StartJobInThisThread( BM_READ_MAIL_JOB);
+				if (!mHeaderOnly)
+					return B_OK;
+				// the header we had is still intact:
+				self->mInitCheck = B_OK;
+				BM_LOG( BM_LogMailParse, 
+						  BmString("unable to read complete mail ") << ModelName());
+				return B_ERROR;
+			}
+		}
+		// the mail is being read by another thread, we wait for it outside 
+		// of the lock (which the job needs when it is done):
+		snooze( 20*1000);
+	}
+}
+
 /*------------------------------------------------------------------------------*\
 	ResyncFromDisk()
 		-	
 \*------------------------------------------------------------------------------*/
 void BmMail::ResyncFromDisk() {
 	mInitCheck = B_NO_INIT;
+	// re-read everything (instead of completing a header-only mail):
+	mHeaderOnly = false;
 	StartJobInThisThread();
 }
 
@@ -424,6 +577,12 @@ bool BmMail::Store() {
 	BDirectory destDir;
 
 	try {
+		// never write a header-only mail over its (complete) file:
+		if (PromoteToFullMail() != B_OK)
+			BM_THROW_RUNTIME( 
+				BmString("Could not read the complete mail <") << Name()
+					<< ">, so it has not been stored."
+			);
 		// Find out where mail shall be living:
 		BmRef<BmMailFolder> destFolder = DestFolder();
 		if (destFolder)
@@ -507,6 +666,11 @@ void BmMail::StoreIntoFile( BDirectory* destDir, BmString filename,
 	status_t err = B_NO_INIT;
 	ssize_t res;
 
+	if (PromoteToFullMail() != B_OK)
+		BM_THROW_RUNTIME( 
+			BmString("Could not read the complete mail <") << filename
+				<< ">, so it has not been stored."
+		);
 	if ((err = mEntry.SetTo( destDir, filename.String())) != B_OK)
 		BM_THROW_RUNTIME( 
 			BmString("Could not create entry for mail-file <") 
@@ -614,6 +778,24 @@ void BmMail::StoreAttributes( BNode& mailNode, const BmString& status,
 	mailNode.WriteAttr( BM_MAIL_ATTR_MARGIN, B_INT32_TYPE, 0, 
 							  &mRightMargin, sizeof(int32));
 	//
+	// store the bodypart-structure, such that it doesn't have to be parsed
+	// again when the mail is read next time (we only do that if the 
+	// bodyparts actually match the mail-text that is being stored):
+	const BMessage* mimeIndex = mBody ? mBody->MimeIndex() : NULL;
+	ssize_t mimeIndexSize = mimeIndex ? mimeIndex->FlattenedSize() : 0;
+	BmString mimeIndexBuf;
+	char* mimeIndexData = mimeIndexSize > 0
+		? mimeIndexBuf.LockBuffer( int32(mimeIndexSize))
+		: NULL;
+	if (mimeIndexData 
+	&& mimeIndex->Flatten( mimeIndexData, mimeIndexSize) == B_OK)
+		mailNode.WriteAttr( BM_MAIL_ATTR_MIME_INDEX, B_MESSAGE_TYPE, 0, 
+								  mimeIndexData, size_t(mimeIndexSize));
+	else
+		mailNode.RemoveAttr( BM_MAIL_ATTR_MIME_INDEX);
+	if (mimeIndexData)
+		mimeIndexBuf.UnlockBuffer( 0);
+	//
 	mailNode.WriteAttr( BM_MAIL_ATTR_WHEN_CREATED, B_UINT64_TYPE, 0, 
 							  &whenCreated, sizeof(whenCreated));
 	//
@@ -831,6 +1013,7 @@ bool BmMail::Send(bool now)
 		-	
 \*------------------------------------------------------------------------------*/
 bool BmMail::HasAttachments() const { 
+	PromoteToFullMail();
 	if (mBody)
 		return mBody->HasAttachments();
 	else
@@ -843,6 +1026,7 @@ bool BmMail::HasAttachments() const {
 \*------------------------------------------------------------------------------*/
 void BmMail::AddAttachmentFromRef( const entry_ref* ref,
 											  const BmString& charset) {
+	PromoteToFullMail();
 	if (mBody)
 		mBody->AddAttachmentFromRef( ref, charset);
 }
@@ -854,14 +1038,27 @@ void BmMail::AddAttachmentFromRef( const entry_ref* ref,
 \*------------------------------------------------------------------------------*/
 BmBodyPartList* BmMail::Body() const
 {
+	PromoteToFullMail();
 	return mBody.Get(); 
 }
 
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+const BmString& BmMail::RawText() const
+{
+	PromoteToFullMail();
+	return mText; 
+}
+
 /*------------------------------------------------------------------------------*\
 	ReconstructRawText()
 	-	
 \*------------------------------------------------------------------------------*/
 bool BmMail::ReconstructRawText() {
+	if (PromoteToFullMail() != B_OK)
+		return false;
 	BmRef< BmBodyPart> bodyPart( mBody->EditableTextBody());
 	return ConstructRawText( bodyPart ? bodyPart->DecodedData() : BM_DEFAULT_STRING,
 								 DefaultCharset(), 
@@ -886,6 +1083,8 @@ bool BmMail::ConstructAndStore() {
 bool BmMail::ConstructRawText( const BmString& editedUtf8Text, 
 										 const BmString& charset,
 										 const BmString smtpAccount) {
+	if (PromoteToFullMail() != B_OK)
+		return false;
 	int32 startSize = mBody->EstimateEncodedSize() + editedUtf8Text.Length() 
 							+ std::max( mHeader->HeaderLength(), (int32)4096)+4096;
 	startSize += 65536-(startSize%65536);
@@ -961,6 +1160,8 @@ void BmMail::SetDefaultHeaders( const BmString& defaultHeaders)
 	-	
 \*------------------------------------------------------------------------------*/
 void BmMail::SetNewHeader( const BmString& headerStr) {
+	if (PromoteToFullMail() != B_OK)
+		return;
 	BmString newMsgText;
 	newMsgText.ConvertLinebreaksToCRLF( &headerStr);
 	uint32 len = newMsgText.Length();
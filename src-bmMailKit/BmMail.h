@@ -52,6 +52,7 @@ extern IMPEXPBMMAILKIT const char* BM_MAIL_ATTR_IDENTITY;
 extern IMPEXPBMMAILKIT const char* BM_MAIL_ATTR_MARGIN;
 extern IMPEXPBMMAILKIT const char* BM_MAIL_ATTR_WHEN_CREATED;
 extern IMPEXPBMMAILKIT const char* BM_MAIL_ATTR_IMAP_UID;
+extern IMPEXPBMMAILKIT const char* BM_MAIL_ATTR_MIME_INDEX;
 
 extern IMPEXPBMMAILKIT const char* BM_FIELD_BCC;
 extern IMPEXPBMMAILKIT const char* BM_FIELD_CC;
@@ -136,7 +137,8 @@ public:
 	bool ConstructRawText( const BmString& editableUtf8Text, 
 								  const BmString& charset,
 								  BmString smtpAccount);
-	void SetTo( const BmString &text, const BmString account);
+	void SetTo( const BmString &text, const BmString account,
+					BMessage* mimeIndex = NULL);
 	void SetNewHeader( const BmString& headerStr);
 	void SetSignatureByName( const BmString sigName);
 	void SetupFromIdentityAndRecvAddr( BmIdentity* ident, 
@@ -192,8 +194,7 @@ public:
 	BmMailHeader* Header() const;
 	int32 HeaderLength() const;
 	inline int32 RightMargin() const		{ return mRightMargin; }
-	inline const BmString& RawText() const		
-													{ return mText; }
+	const BmString& RawText() const;
 	const BmString& HeaderText() const;
 	inline const bool Outbound() const	{ return mOutbound; }
 	bool IsRedirect() const;
@@ -207,6 +208,8 @@ public:
 													{ return mDestFolderName; }
 	inline const BmString& ImapUID() const	
 													{ return mImapUID; }
+	inline bool IsHeaderOnly() const		{ return mHeaderOnly; }
+	inline BmMemArena* Arena() const		{ return mArena.Get(); }
 
 	// setters:
 	inline void BumpRightMargin( int32 i)		
@@ -227,6 +230,7 @@ public:
 													{ mImapUID = s; }
 
 	static const int32 BM_READ_MAIL_JOB = 1;
+	static const int32 BM_READ_HEADER_JOB = 2;
 
 protected:
 	BmMail( BmMailRef* ref);
@@ -240,6 +244,7 @@ private:
 	BmMail();
 	
 	const BmString& DefaultStatus() const;
+	status_t PromoteToFullMail() const;
 
 	BmRef<BmMailHeader> mHeader;
 							// contains header-information
@@ -287,6 +292,13 @@ private:
 	BmString mImapUID;
 							// UID for this mail as retrieved from the IMAP
 							// server.
+	bool mHeaderOnly;
+							// true if only the header has been read from disk
+							// (the rest of the mail will be read on demand)
+	BmMemArenaRef mArena;
+							// memory-arena used by the containers of header and 
+							// body-parts, a new one is created for every SetTo(),
+							// so an old arena lives as long as its header/body
 	status_t mInitCheck;
 
 	// Hide copy-constructor and assignment:
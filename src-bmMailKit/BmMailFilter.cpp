@@ -9,6 +9,9 @@
 #include <memory>
 #include <stdio.h>
 
+#include <Autolock.h>
+#include <OS.h>
+
 #include "BmBasics.h"
 #include "BmLogHandler.h"
 #include "BmFilter.h"
@@ -16,6 +19,7 @@
 #include "BmMail.h"
 #include "BmMailFilter.h"
 #include "BmMailHeader.h"
+#include "BmPrefs.h"
 #include "BmRecvAccount.h"
 #include "BmSmtpAccount.h"
 #include "BmUtil.h"
@@ -26,6 +30,9 @@
 
 static const float GRAIN = 1.0;
 
+// number of mails that are filtered in one go by the filter-job thread:
+static const uint32 nBatchSize = 16;
+
 const char* const BmMailFilter::MSG_FILTER = 	"bm:filter";
 const char* const BmMailFilter::MSG_DELTA = 		"bm:delta";
 const char* const BmMailFilter::MSG_TRAILING = 	"bm:trailing";
@@ -42,6 +49,8 @@ BmMailFilter::BmMailFilter( const BmString& name, BmFilter* filter,
 	,	mFilter( filter)
 	,	mMailRefs( NULL)
 	,	mExecuteInMem( executeInMem)
+	,	mPlanGeneration( 0)
+	,	mPlanLock( "MailFilterPlans")
 {
 	NeedControllersToContinue( needControllers);
 }
@@ -51,6 +60,7 @@ BmMailFilter::BmMailFilter( const BmString& name, BmFilter* filter,
 		-	destructor
 \*------------------------------------------------------------------------------*/
 BmMailFilter::~BmMailFilter() { 
+	DiscardPlans();
 	delete mMailRefs;
 }
 
@@ -92,6 +102,9 @@ bool BmMailFilter::ShouldContinue() {
 \*------------------------------------------------------------------------------*/
 bool BmMailFilter::StartJob() {
 	try {
+		// start with fresh plans, the filters may have been edited since the
+		// last run:
+		DiscardPlans();
 		int32 count = mMails.size();
 		int32 c=0;
 		if (mMailRefs)
@@ -100,26 +113,31 @@ bool BmMailFilter::StartJob() {
 					BmString("Starting filter-job for ") << count << " mails.");
 		const float delta =  100.0f / (float(count) / GRAIN);
 		if (mMailRefs) {
-			BmRef<BmMail> mail;
-			for( uint32 i=0; ShouldContinue() && i<mMailRefs->size(); ++i) {
-				mail = BmMail::CreateInstance( (*mMailRefs)[i].Get());
-				if (mail) {
-					mail->StartJobInThisThread( BmMail::BM_READ_MAIL_JOB);
-					if (mail->InitCheck() == B_OK)
-					Execute( mail.Get());
+			int32 workerCount = WorkerCount();
+			if (workerCount > 1 && mMailRefs->size() > 1)
+				FilterRefsInParallel( workerCount, delta, c, count);
+			else {
+				uint32 refCount = mMailRefs->size();
+				for( uint32 i=0; ShouldContinue() && i<refCount; ) {
+					BmMailVect batch;
+					for( ; i<refCount && batch.size()<nBatchSize; ++i) {
+						BmRef<BmMail> mail 
+							= BmMail::CreateInstance( (*mMailRefs)[i].Get());
+						// RunPlanBatched() reads the rest of the mail if needed:
+						if (mail)
+							mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+						batch.push_back( mail);
+					}
+					FilterBatch( batch, delta, c, count);
 				}
-				BmString currentCount = BmString()<<++c<<" of "<<count;
-				UpdateStatus( delta, mail->Name().String(), currentCount.String());
 			}
 			mMailRefs->clear();
 		}
-		for( uint32 i=0; ShouldContinue() && i<mMails.size(); ++i) {
-			if (mMails[i]->InitCheck() != B_OK)
-				continue;
-			Execute( mMails[i].Get());
-			BmString currentCount = BmString()<<++c<<" of "<<count;
-			UpdateStatus( delta, mMails[i]->Name().String(), 
-							  currentCount.String());
+		for( uint32 i=0; ShouldContinue() && i<mMails.size(); ) {
+			BmMailVect batch;
+			for( ; i<mMails.size() && batch.size()<nBatchSize; ++i)
+				batch.push_back( mMails[i]);
+			FilterBatch( batch, delta, c, count);
 		}
 		mMails.clear();
 		BmString currentCount = BmString()<<c<<" of "<<count;
@@ -140,12 +158,412 @@ bool BmMailFilter::StartJob() {
 }
 
 /*------------------------------------------------------------------------------*\
-	Execute()
-		-	applies mail-filtering to a single given mail
+	BmMailFilterPool
+		-	the state shared between a mail-filter and its worker threads
+		-	the slots form a ring, such that the workers can run at most
+			nSlotsPerWorker mails (each) ahead of the filter-job thread, 
+			which consumes the slots in order
+\*------------------------------------------------------------------------------*/
+struct BmMailFilterPool {
+	struct Slot {
+		Slot() : msgContext( NULL), plan( NULL), status( B_NO_INIT), 
+					isReady( 0) 			{}
+		void Reset();
+		BmRef<BmMail> mail;
+		BmMsgContext* msgContext;
+		const BmFilterChainPlan* plan;
+							// the plan of the chain that belongs to the mail
+		status_t status;
+							// result of RunPlan(), B_NO_INIT if the mail could 
+							// not be read, B_WOULD_BLOCK if the plan has to be
+							// run by the filter-job thread
+		BmString error;
+		int32 isReady;
+	};
+
+	BmMailFilterPool( BmMailFilter* mailFilter, BmMailRefVect* refs, 
+							int32 workerCount);
+	~BmMailFilterPool();
+
+	BmMailFilter* mailFilter;
+	BmMailRefVect* refs;
+	vector< Slot> slots;
+	vector< thread_id> workers;
+	int32 nextIndex;
+	int32 isStopped;
+	sem_id freeSlotSem;
+	sem_id readySlotSem;
+
+	static const int32 nSlotsPerWorker = 4;
+};
+
+/*------------------------------------------------------------------------------*\
+	Reset()
+		-	prepares slot for the next mail
+\*------------------------------------------------------------------------------*/
+void BmMailFilterPool::Slot::Reset() {
+	mail = NULL;
+	delete msgContext;
+	msgContext = NULL;
+	plan = NULL;
+	status = B_NO_INIT;
+	error.Truncate( 0);
+	atomic_and( &isReady, 0);
+}
+
+/*------------------------------------------------------------------------------*\
+	BmMailFilterPool( mailFilter, refs, workerCount)
+		-	c'tor, the worker threads are spawned by the mail-filter
+\*------------------------------------------------------------------------------*/
+BmMailFilterPool::BmMailFilterPool( BmMailFilter* mf, BmMailRefVect* r, 
+												int32 workerCount)
+	:	mailFilter( mf)
+	,	refs( r)
+	,	slots( workerCount * nSlotsPerWorker)
+	,	nextIndex( 0)
+	,	isStopped( 0)
+	,	freeSlotSem( create_sem( slots.size(), "MailFilterFreeSlots"))
+	,	readySlotSem( create_sem( 0, "MailFilterReadySlots"))
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	~BmMailFilterPool()
+		-	d'tor, stops all workers and waits for them to quit
+\*------------------------------------------------------------------------------*/
+BmMailFilterPool::~BmMailFilterPool() {
+	atomic_or( &isStopped, 1);
+	delete_sem( freeSlotSem);
+							// wakes up all workers waiting for a free slot
+	status_t exitVal;
+	for( uint32 i=0; i<workers.size(); ++i)
+		wait_for_thread( workers[i], &exitVal);
+	delete_sem( readySlotSem);
+	for( uint32 i=0; i<slots.size(); ++i)
+		slots[i].Reset();
+}
+
+/*------------------------------------------------------------------------------*\
+	FilterRefsInParallel( workerCount, delta, c, count)
+		-	filters all mail-refs with the help of a pool of worker threads
+		-	the workers read & parse the mails and execute the filters if all of
+			them are thread-safe. This thread collects the results in the 
+			original order and applies them (storing/moving the mails), 
+			executes the filters that are not thread-safe and updates the status
+		-	the filters that are not thread-safe are executed on all consecutive
+			mails that are ready and belong to the same chain in one go (via 
+			RunPlanBatched()), such that the addons can make use of batching
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::FilterRefsInParallel( int32 workerCount, const float delta,
+													  int32& c, int32 count) {
+	BM_LOG2( BM_LogFilter, 
+				BmString("Filtering with ") << workerCount << " worker threads.");
+	BmMailFilterPool pool( this, mMailRefs, workerCount);
+	for( int32 w=0; w<workerCount; ++w) {
+		BmString tname = BmString("MailFilterWorker_") << w;
+		thread_id t_id = spawn_thread( &BmMailFilter::PoolWorkerEntry, 
+												 tname.String(), B_NORMAL_PRIORITY, 
+												 &pool);
+		if (t_id < 0)
+			break;
+		pool.workers.push_back( t_id);
+		resume_thread( t_id);
+	}
+	if (pool.workers.empty())
+		BM_THROW_RUNTIME( "FilterRefsInParallel(): Could not spawn thread");
+
+	int32 refCount = mMailRefs->size();
+	int32 ringSize = pool.slots.size();
+	for( int32 i=0; ShouldContinue() && i<refCount; ++i) {
+		BmMailFilterPool::Slot& slot = pool.slots[i % ringSize];
+		while( !atomic_or( &slot.isReady, 0))
+			acquire_sem( pool.readySlotSem);
+		if (slot.error.Length())
+			BM_THROW_RUNTIME( slot.error);
+		BmMail* mail = slot.mail.Get();
+		if (slot.status == B_WOULD_BLOCK) {
+			// at least one filter needs to be executed by this thread, we
+			// batch this mail with the following ones that are ready, too, 
+			// and belong to the same chain (their results are applied in order
+			// by the next iterations):
+			vector< BmMailFilterPool::Slot*> batch( 1, &slot);
+			for( int32 j=i+1; j<refCount && j<i+ringSize; ++j) {
+				BmMailFilterPool::Slot& next = pool.slots[j % ringSize];
+				if (!atomic_or( &next.isReady, 0) || next.error.Length()
+				|| next.status != B_WOULD_BLOCK || next.plan != slot.plan)
+					break;
+				batch.push_back( &next);
+			}
+			BmMailVect mails;
+			vector< BmMsgContext*> msgContexts;
+			for( uint32 b=0; b<batch.size(); ++b) {
+				mails.push_back( batch[b]->mail);
+				msgContexts.push_back( batch[b]->msgContext);
+			}
+			vector< status_t> statuses;
+			RunPlanBatched( slot.plan, mails, msgContexts, statuses);
+			for( uint32 b=0; b<batch.size(); ++b)
+				batch[b]->status = statuses[b];
+		}
+		if (slot.status == B_OK)
+			ApplyResults( mail, slot.msgContext);
+		BmString currentCount = BmString()<<++c<<" of "<<count;
+		UpdateStatus( delta, mail ? mail->Name().String() : "", 
+						  currentCount.String());
+		slot.Reset();
+		release_sem( pool.freeSlotSem);
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	PoolWorkerEntry( data)
+		-	entry function for worker threads
+\*------------------------------------------------------------------------------*/
+int32 BmMailFilter::PoolWorkerEntry( void* data) {
+	BmMailFilterPool* pool = static_cast< BmMailFilterPool*>( data);
+	if (pool && pool->mailFilter)
+		pool->mailFilter->WorkOnPool( pool);
+	return 0;
+}
+
+/*------------------------------------------------------------------------------*\
+	WorkOnPool( pool)
+		-	reads & filters mails until all slots of the pool have been 
+			processed or the pool is being stopped
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::WorkOnPool( BmMailFilterPool* pool) {
+	int32 refCount = pool->refs->size();
+	int32 ringSize = pool->slots.size();
+	while( acquire_sem( pool->freeSlotSem) == B_OK) {
+		int32 index = atomic_add( &pool->nextIndex, 1);
+		if (index >= refCount || atomic_or( &pool->isStopped, 0))
+			break;
+		BmMailFilterPool::Slot& slot = pool->slots[index % ringSize];
+		try {
+			slot.mail = BmMail::CreateInstance( (*pool->refs)[index].Get());
+			if (slot.mail) {
+				slot.mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+				if (slot.mail->InitCheck() == B_OK) {
+					slot.msgContext = new BmMsgContext;
+					slot.plan = PrepareMail( slot.mail.Get(), slot.msgContext);
+					if (!slot.plan)
+						slot.status = B_ENTRY_NOT_FOUND;
+					else if (!slot.plan->isThreadSafe)
+						// leave the plan to the filter-job thread:
+						slot.status = B_WOULD_BLOCK;
+					else
+						slot.status = RunPlan( slot.plan, slot.mail.Get(), 
+													  slot.msgContext);
+				}
+			}
+		}
+		catch( BM_runtime_error &err) {
+			// the error will be reported by the filter-job thread:
+			slot.error = err.what();
+		}
+		atomic_or( &slot.isReady, 1);
+		release_sem( pool->readySlotSem);
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	WorkerCount()
+		-	returns the number of worker threads to be used for filtering
+		-	by default, there is one worker thread per CPU
+\*------------------------------------------------------------------------------*/
+int32 BmMailFilter::WorkerCount() const {
+	int32 workerCount = ThePrefs->GetInt( "MailFilterWorkerThreads", 0);
+	if (workerCount <= 0) {
+		system_info sysInfo;
+		get_system_info( &sysInfo);
+		workerCount = sysInfo.cpu_count;
+	}
+	return workerCount;
+}
+
+/*------------------------------------------------------------------------------*\
+	FilterBatch( mails, delta, c, count)
+		-	filters the given mails in this thread and applies the results in 
+			order (skipping the mails that could not be read)
+		-	the filters are executed on all consecutive mails that belong to the 
+			same chain in one go (via RunPlanBatched()), such that the addons 
+			can make use of batching
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::FilterBatch( const BmMailVect& mails, const float delta,
+										  int32& c, int32 count) {
+	uint32 mailCount = mails.size();
+	vector< BmMsgContext*> msgContexts( mailCount, (BmMsgContext*)NULL);
+	vector< const BmFilterChainPlan*> plans( mailCount, 
+														  (const BmFilterChainPlan*)NULL);
+	vector< status_t> statuses( mailCount, B_NO_INIT);
+	try {
+		for( uint32 m=0; m<mailCount; ++m) {
+			if (!mails[m] || mails[m]->InitCheck() != B_OK)
+				continue;
+			msgContexts[m] = new BmMsgContext;
+			plans[m] = PrepareMail( mails[m].Get(), msgContexts[m]);
+			statuses[m] = plans[m] ? B_OK : B_ENTRY_NOT_FOUND;
+		}
+		for( uint32 m=0; m<mailCount; ) {
+			if (!plans[m]) {
+				++m;
+				continue;
+			}
+			uint32 end = m+1;
+			while( end<mailCount && plans[end] == plans[m])
+				++end;
+			BmMailVect group( mails.begin()+m, mails.begin()+end);
+			vector< BmMsgContext*> groupContexts( msgContexts.begin()+m, 
+															  msgContexts.begin()+end);
+			vector< status_t> groupStatuses;
+			RunPlanBatched( plans[m], group, groupContexts, groupStatuses);
+			for( uint32 g=0; g<groupStatuses.size(); ++g)
+				statuses[m+g] = groupStatuses[g];
+			m = end;
+		}
+		for( uint32 m=0; m<mailCount; ++m) {
+			BmMail* mail = mails[m].Get();
+			if (statuses[m] == B_OK)
+				ApplyResults( mail, msgContexts[m]);
+			BmString currentCount = BmString()<<++c<<" of "<<count;
+			UpdateStatus( delta, mail ? mail->Name().String() : "", 
+							  currentCount.String());
+		}
+	}
+	catch( BM_runtime_error &err) {
+		for( uint32 m=0; m<mailCount; ++m)
+			delete msgContexts[m];
+		throw;
+	}
+	for( uint32 m=0; m<mailCount; ++m)
+		delete msgContexts[m];
+}
+
+/*------------------------------------------------------------------------------*\
+	BmFilterChainPlan
+		-	the execution plan for one filter-chain: the chain's filters in order, 
+			resolved once, plus what they need from a mail
+		-	a plan is never changed after it has been built, so worker threads
+			can use it without any locking
+\*------------------------------------------------------------------------------*/
+struct BmFilterChainPlan {
+	BmFilterChainPlan() : isThreadSafe( true), needsBody( false) {}
+
+	BmString chainName;
+	vector< BmRef< BmFilter> > filters;
+	bool isThreadSafe;
+							// true if all filters can be executed by worker threads
+	bool needsBody;
+							// true if any filter looks at more than the header
+};
+
+/*------------------------------------------------------------------------------*\
+	PlanForMail( mail, recvAcc)
+		-	returns the execution plan for the filter (or the filter-chain that
+			belongs to the given mail), building it if this is the first mail
+			of this job that uses it
+		-	all plans are rebuilt if any filter-chain has changed since they
+			were built
+		-	returns NULL if no chain could be found
+\*------------------------------------------------------------------------------*/
+const BmFilterChainPlan* BmMailFilter::PlanForMail( BmMail* mail, 
+																	 BmRecvAccount* recvAcc) {
+	BmString chainName;
+	if (mFilter)
+		chainName = BmString("<filter:") << mFilter->Name() << ">";
+	else if (mail->Outbound())
+		chainName = BM_OutboundLabel;
+	else if (recvAcc)
+		chainName = recvAcc->FilterChain();
+	else
+		chainName = BM_DefaultItemLabel;
+
+	BAutolock lock( &mPlanLock);
+	int32 generation = BmFilterChainList::Generation();
+	if (generation != mPlanGeneration) {
+		// the plans are stale, but other threads may still be using them:
+		BmPlanMap::const_iterator iter;
+		for( iter = mPlans.begin(); iter != mPlans.end(); ++iter)
+			mStalePlans.push_back( iter->second);
+		mPlans.clear();
+		mPlanGeneration = generation;
+	}
+	BmPlanMap::const_iterator found = mPlans.find( chainName);
+	if (found != mPlans.end())
+		return found->second;
+	BmFilterChainPlan* plan = BuildPlan( chainName);
+	if (plan)
+		mPlans[chainName] = plan;
+	return plan;
+}
+
+/*------------------------------------------------------------------------------*\
+	BuildPlan( chainName)
+		-	collects the filters of the given chain (or just our own filter)
+			into a new execution plan
+		-	returns NULL if there is no chain of the given name
+\*------------------------------------------------------------------------------*/
+BmFilterChainPlan* BmMailFilter::BuildPlan( const BmString& chainName) {
+	std::auto_ptr< BmFilterChainPlan> plan( new BmFilterChainPlan);
+	plan->chainName = chainName;
+	if (mFilter)
+		plan->filters.push_back( mFilter);
+	else {
+		BmRef< BmListModelItem> chainItem 
+			= TheFilterChainList->FindItemByKey( chainName);
+		BmFilterChain* chain = dynamic_cast< BmFilterChain*>( chainItem.Get());
+		if (!chain)
+			return NULL;
+		plan->chainName = chain->DisplayKey();
+		BmAutolockCheckGlobal lock( chain->ModelLocker());
+		if (!lock.IsLocked())
+			BM_THROW_RUNTIME( chain->ModelNameNC() << ": Unable to get lock");
+		BmFilterPosVect::const_iterator iter;
+		for( iter = chain->posBegin(); iter != chain->posEnd(); ++iter) {
+			BmChainedFilter* chainedFilter = *iter;
+			BmRef< BmListModelItem> filterItem 
+				= TheFilterList->FindItemByKey( chainedFilter->Key());
+			BmFilter* filter = dynamic_cast< BmFilter*>( filterItem.Get());
+			if (filter)
+				plan->filters.push_back( filter);
+		}
+	}
+	BmFilterNeeds needs;
+	for( uint32 i=0; i<plan->filters.size(); ++i) {
+		plan->filters[i]->AddNeeds( needs);
+		if (!plan->filters[i]->IsThreadSafe())
+			plan->isThreadSafe = false;
+	}
+	plan->needsBody = needs.body;
+	return plan.release();
+}
+
+/*------------------------------------------------------------------------------*\
+	DiscardPlans()
+		-	frees all execution plans, must only be called while no other
+			thread is filtering on our behalf
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::DiscardPlans() {
+	BAutolock lock( &mPlanLock);
+	BmPlanMap::const_iterator iter;
+	for( iter = mPlans.begin(); iter != mPlans.end(); ++iter)
+		delete iter->second;
+	mPlans.clear();
+	for( uint32 i=0; i<mStalePlans.size(); ++i)
+		delete mStalePlans[i];
+	mStalePlans.clear();
+	mPlanGeneration = BmFilterChainList::Generation();
+}
+
+/*------------------------------------------------------------------------------*\
+	PrepareMail( mail, msgContext)
+		-	binds the given msgContext to the mail, sets the mail's default
+			folder and determines the plan of the chain that belongs to the mail
+		-	returns NULL if no chain could be found
 \*------------------------------------------------------------------------------*/
-void BmMailFilter::Execute( BmMail* mail) {
-	BmMsgContext msgContext;
-	msgContext.mail = mail;
+const BmFilterChainPlan* BmMailFilter::PrepareMail( BmMail* mail, 
+																	 BmMsgContext* msgContext) {
+	msgContext->mail = mail;
 
 	BmRef< BmListModelItem> accItem 
 		= TheRecvAccountList->FindItemByKey( mail->AccountName());
@@ -155,108 +573,249 @@ void BmMailFilter::Execute( BmMail* mail) {
 		mail->SetDestFolderName(recvAcc->HomeFolder());
 	}
 
-	if (!mFilter) {
+	BM_LOG2( BM_LogFilter, 
+				BmString("Searching filter-chain for mail with Id <") 
+					<< mail->Name() << ">...");
+	const BmFilterChainPlan* plan = PlanForMail( mail, recvAcc);
+	if (!plan) {
+		BM_LOG2( BM_LogFilter, "...no chain found -> nothing to do.");
+		return NULL;
+	}
+	BM_LOG2( BM_LogFilter, 
+				BmString("...found chain ") << plan->chainName 
+					<< ", applying all its filters...");
+	return plan;
+}
+
+/*------------------------------------------------------------------------------*\
+	RunPlan( plan, mail, msgContext)
+		-	executes the filters of the given plan on the given mail and 
+			collects the results in the given msgContext
+		-	if only the header of the mail has been read, the complete mail is
+			read if any of the filters needs more than that (before any filter
+			is executed, such that all filters see the same header)
+		-	returns B_NO_INIT if the complete mail could not be read
+\*------------------------------------------------------------------------------*/
+status_t BmMailFilter::RunPlan( const BmFilterChainPlan* plan, BmMail* mail, 
+										  BmMsgContext* msgContext) {
+	if (mail->IsHeaderOnly() && plan->needsBody) {
 		BM_LOG2( BM_LogFilter, 
-					BmString("Searching filter-chain for mail with Id <") 
-						<< mail->Name() << ">...");
-		// first we find the correct filter-chain for this mail...
-		BmRef< BmListModelItem> chainItem;
-		if (mail->Outbound()) {
-			// use the outbound chain:
-			chainItem = TheFilterChainList->FindItemByKey(BM_OutboundLabel);
-		} else {
-			// fetch the corresponding inbound-chain:
-			if (recvAcc)
-				chainItem 
-					= TheFilterChainList->FindItemByKey( recvAcc->FilterChain());
-			else
-				chainItem 
-					= TheFilterChainList->FindItemByKey( BM_DefaultItemLabel);
+					"Filters need the complete mail, reading it...");
+		ReadCompleteMail( mail, msgContext);
+		if (mail->InitCheck() != B_OK)
+			return B_NO_INIT;
+	}
+	// execute the filters:
+	bool headerOnly = mail->IsHeaderOnly();
+	for( uint32 i=0; i<plan->filters.size(); ++i) {
+		if (!ExecuteFilter( mail, plan->filters[i].Get(), msgContext))
+			break;
+		if (headerOnly && !mail->IsHeaderOnly()) {
+			// the filter has looked at more than it said it would, which made
+			// the mail read itself completely (possibly replacing the header
+			// that the header-infos point into):
+			msgContext->ResetHeaderInfos();
+			headerOnly = false;
 		}
-		BmFilterChain* chain = dynamic_cast< BmFilterChain*>( chainItem.Get());
-		if (chain) {
+	}
+	return B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	RunPlanBatched( plan, mails, msgContexts, statuses)
+		-	executes the filters of the given plan on all the given mails,
+			collecting the results in the respective msgContexts
+		-	each filter is executed on all mails (that have not stopped the
+			chain yet) in one go, before the next filter is executed, so addons 
+			that implement ExecuteBatch() can share their setup between mails
+		-	statuses[i] receives the result for mails[i], just like RunPlan()
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::RunPlanBatched( const BmFilterChainPlan* plan, 
+											  const BmMailVect& mails,
+											  const vector< BmMsgContext*>& msgContexts,
+											  vector< status_t>& statuses) {
+	uint32 count = mails.size();
+	statuses.assign( count, B_OK);
+	vector< bool> active( count, true);
+	vector< bool> headerOnly( count, false);
+	for( uint32 m=0; m<count; ++m) {
+		BmMail* mail = mails[m].Get();
+		if (mail->IsHeaderOnly() && plan->needsBody) {
 			BM_LOG2( BM_LogFilter, 
-						BmString("...found chain ") << chain->DisplayKey() 
-							<< ", applying all its filters...");
-			// execute all the chain's filters:
-			BmAutolockCheckGlobal lock( chain->ModelLocker());
-			if (!lock.IsLocked())
-				BM_THROW_RUNTIME( chain->ModelNameNC() << ": Unable to get lock");
-			BmFilterPosVect::const_iterator iter;
-			for( iter = chain->posBegin(); iter != chain->posEnd(); ++iter) {
-				BmChainedFilter* chainedFilter = *iter;
-				BmRef< BmListModelItem> filterItem 
-					= TheFilterList->FindItemByKey( chainedFilter->Key());
-				BmFilter* filter = dynamic_cast< BmFilter*>( filterItem.Get());
-				if (filter) {
-					if (!ExecuteFilter( mail, filter, &msgContext))
-						break;
-				}
+						BmString("Filters need the complete mail with Id <")
+							<< mail->Name() << ">, reading it...");
+			ReadCompleteMail( mail, msgContexts[m]);
+			if (mail->InitCheck() != B_OK) {
+				statuses[m] = B_NO_INIT;
+				active[m] = false;
+			}
+		}
+		headerOnly[m] = mail->IsHeaderOnly();
+	}
+	// execute the filters:
+	for( uint32 i=0; i<plan->filters.size(); ++i) {
+		BmFilter* filter = plan->filters[i].Get();
+		vector< BmMsgContext*> batch;
+		vector< uint32> indices;
+		for( uint32 m=0; m<count; ++m) {
+			if (active[m]) {
+				batch.push_back( msgContexts[m]);
+				indices.push_back( m);
 			}
-		} else {
-			BM_LOG2( BM_LogFilter, "...no chain found -> nothing to do.");
-			return;
 		}
-	} else
-		ExecuteFilter( mail, mFilter.Get(), &msgContext);
+		if (batch.empty())
+			break;
+		if (filter->IsDisabled()) {
+			BM_LOG2( BM_LogFilter, 
+						BmString("Addon for Filter ") << filter->Name() 
+							<< " (type=" << filter->Kind() 
+							<< ") has not been loaded, we skip this filter.");
+			continue;
+		}
+		BM_LOG2( BM_LogFilter, 
+					BmString("Executing Filter ") << filter->Name() 
+						<< " (type=" << filter->Kind() << ") on " 
+						<< batch.size() << " mails...");
+		for( uint32 b=0; b<batch.size(); ++b)
+			batch[b]->ResetChanges();
+		vector< bool> results;
+		filter->ExecuteBatch( batch, results);
+		for( uint32 b=0; b<batch.size(); ++b) {
+			uint32 m = indices[b];
+			if (!NoteFilterResults( filter, batch[b]))
+				active[m] = false;
+			if (headerOnly[m] && !mails[m]->IsHeaderOnly()) {
+				// see RunPlan():
+				batch[b]->ResetHeaderInfos();
+				headerOnly[m] = false;
+			}
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	ReadCompleteMail( mail, msgContext)
+		-	reads the complete mail if only its header has been read so far
+		-	the header-infos of the given msgContext are dropped, since the 
+			header they point into may be replaced by reading the mail
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::ReadCompleteMail( BmMail* mail, BmMsgContext* msgContext) {
+	if (!mail->IsHeaderOnly())
+		return;
+	mail->StartJobInThisThread( BmMail::BM_READ_MAIL_JOB);
+	msgContext->ResetHeaderInfos();
+}
+
+/*------------------------------------------------------------------------------*\
+	ResultsChangeMail( mail, msgContext)
+		-	returns true if applying the results of filtering changes anything
+			but the folder of the given mail (which is the only change that
+			doesn't require the complete mail)
+\*------------------------------------------------------------------------------*/
+bool BmMailFilter::ResultsChangeMail( BmMail* mail, 
+												  BmMsgContext* msgContext) const {
+	if (msgContext->GetBool(BmMsgContext::FIELD_LEARN_AS_SPAM)
+	|| msgContext->GetBool(BmMsgContext::FIELD_LEARN_AS_TOFU)
+	|| msgContext->GetBool(BmMsgContext::FIELD_MOVE_TO_TRASH))
+		return true;
+	BmString newIdentity = msgContext->GetString(BmMsgContext::FIELD_IDENTITY);
+	if (newIdentity.Length() && newIdentity != mail->IdentityName())
+		return true;
+	BmString newListId = msgContext->GetString(BmMsgContext::FIELD_LIST_ID);
+	if (newListId.Length() && newListId != mail->GetFieldVal(BM_FIELD_LIST_ID))
+		return true;
+	BmString newStatus = msgContext->GetString(BmMsgContext::FIELD_STATUS);
+	if (newStatus.Length() && newStatus != mail->Status())
+		return true;
+	if (msgContext->HasField(BmMsgContext::FIELD_RATIO_SPAM)
+	&& msgContext->GetDouble(BmMsgContext::FIELD_RATIO_SPAM) 
+		!= mail->RatioSpam())
+		return true;
+	if (msgContext->GetBool(BmMsgContext::FIELD_IS_SPAM) 
+	&& !mail->IsMarkedAsSpam())
+		return true;
+	if (msgContext->GetBool(BmMsgContext::FIELD_IS_TOFU) 
+	&& !mail->IsMarkedAsTofu())
+		return true;
+	return false;
+}
+
+/*------------------------------------------------------------------------------*\
+	ApplyResults( mail, msgContext)
+		-	applies the results of filtering to the given mail (learning, 
+			changing status/identity/folder and storing the mail)
+		-	a mail of which only the header has been read is read completely
+			first, unless the results just move it to another folder
+\*------------------------------------------------------------------------------*/
+void BmMailFilter::ApplyResults( BmMail* mail, BmMsgContext* msgContext) {
+	if (mail->IsHeaderOnly() && ResultsChangeMail( mail, msgContext)) {
+		// read the complete mail before changing anything, such that all 
+		// changes are made to the mail that will be stored:
+		BM_LOG2( BM_LogFilter, 
+					"Filtering changes the mail, reading it completely...");
+		ReadCompleteMail( mail, msgContext);
+		if (mail->InitCheck() != B_OK)
+			return;
+	}
 	bool needToStore = false;
-	bool learnAsSpam = msgContext.GetBool("LearnAsSpam");
+	bool learnAsSpam = msgContext->GetBool(BmMsgContext::FIELD_LEARN_AS_SPAM);
 	if (learnAsSpam) {
 		BmRef<BmFilter> learnAsSpamFilter = TheFilterList->LearnAsSpamFilter();
 		if (learnAsSpamFilter)
-			learnAsSpamFilter->Execute( &msgContext);
+			learnAsSpamFilter->Execute( msgContext);
 		needToStore = true;
 	}
-	bool learnAsTofu = msgContext.GetBool("LearnAsTofu");
+	bool learnAsTofu = msgContext->GetBool(BmMsgContext::FIELD_LEARN_AS_TOFU);
 	if (learnAsTofu) {
 		BmRef<BmFilter> learnAsTofuFilter = TheFilterList->LearnAsTofuFilter();
 		if (learnAsTofuFilter)
-			learnAsTofuFilter->Execute( &msgContext);
+			learnAsTofuFilter->Execute( msgContext);
 		needToStore = true;
 	}
-	BmString newIdentity = msgContext.GetString("Identity");
+	BmString newIdentity = msgContext->GetString(BmMsgContext::FIELD_IDENTITY);
 	if (newIdentity.Length() && newIdentity != mail->IdentityName()) {
 		mail->IdentityName( newIdentity);
 		needToStore = true;
 	}
-	BmString newListId = msgContext.GetString("ListId");
+	BmString newListId = msgContext->GetString(BmMsgContext::FIELD_LIST_ID);
 	if (newListId.Length() && newListId != mail->GetFieldVal(BM_FIELD_LIST_ID)) {
 		mail->SetFieldVal(BM_FIELD_LIST_ID, newListId);
 		mail->ReconstructRawText();
 		needToStore = true;
 	}
-	BmString newStatus = msgContext.GetString("Status");
+	BmString newStatus = msgContext->GetString(BmMsgContext::FIELD_STATUS);
 	if (newStatus.Length() && newStatus != mail->Status()) {
 		mail->MarkAs( newStatus.String());
 		needToStore = true;
 	}
-	BmString rejectMsg = msgContext.GetString("RejectMsg");
+	BmString rejectMsg = msgContext->GetString(BmMsgContext::FIELD_REJECT_MSG);
 	if (rejectMsg.Length()) {
 		// ToDo (maybe): implement sending of MDN
 	}
-	bool moveToTrash = msgContext.GetBool("MoveToTrash");
+	bool moveToTrash = msgContext->GetBool(BmMsgContext::FIELD_MOVE_TO_TRASH);
 	if (moveToTrash) {
 		mail->MoveToTrash( true);
 		needToStore = true;
 	}
-	if (msgContext.HasField("RatioSpam")) {
-		double ratioSpam = msgContext.GetDouble("RatioSpam");
+	if (msgContext->HasField(BmMsgContext::FIELD_RATIO_SPAM)) {
+		double ratioSpam = msgContext->GetDouble(BmMsgContext::FIELD_RATIO_SPAM);
 		if (ratioSpam != mail->RatioSpam()) {
 			mail->RatioSpam(float(ratioSpam));
 			needToStore = true;
 		}
 	}
-	bool isSpam = msgContext.GetBool("IsSpam");
+	bool isSpam = msgContext->GetBool(BmMsgContext::FIELD_IS_SPAM);
 	if (isSpam && !mail->IsMarkedAsSpam()) {
 		mail->MarkAsSpam();
 		needToStore = true;
 	}
-	bool isTofu = msgContext.GetBool("IsTofu");
+	bool isTofu = msgContext->GetBool(BmMsgContext::FIELD_IS_TOFU);
 	if (isTofu && !mail->IsMarkedAsTofu()) {
 		mail->MarkAsTofu();
 		needToStore = true;
 	}
-	BmString newFolderName = msgContext.GetString("FolderName");
+	BmString newFolderName
+		= msgContext->GetString(BmMsgContext::FIELD_FOLDER_NAME);
 	if (newFolderName.Length()) {
 		if (mail->SetDestFolderName( newFolderName)) {
 			if (!needToStore && !mExecuteInMem) {
@@ -294,47 +853,62 @@ bool BmMailFilter::ExecuteFilter( BmMail* mail, BmFilter* filter,
 						<< " (type=" << filter->Kind() << ")...");
 		msgContext->ResetChanges();
 		filter->Execute( msgContext);
-		if (msgContext->FieldHasChanged("Identity")) {
-			BmString newIdentity = msgContext->GetString("Identity");
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  		<< ": setting identity to " 
-					  		<< newIdentity);
-		}
-		if (msgContext->FieldHasChanged("Status")) {
-			BmString newStatus = msgContext->GetString("Status");
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  		<< ": setting status to " 
-					  		<< newStatus);
-		}
-		if (msgContext->FieldHasChanged("MoveToTrash")
-		&& msgContext->GetBool("MoveToTrash")) {
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  		<< ": moving mail to trash.");
-		}
-		if (msgContext->FieldHasChanged("RejectMsg")) {
-			BmString rejectMsg = msgContext->GetString("RejectMsg");
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  		<< ": rejecting mail with msg " 
-					  		<< rejectMsg);
-		}
-		if (msgContext->FieldHasChanged("ListId")) {
-			BmString newListId = msgContext->GetString("ListId");
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  		<< ": setting ListId to " 
-					  		<< newListId);
-		}
-		bool stopProcessing = msgContext->GetBool("StopProcessing");
-		if (stopProcessing) {
-			BM_LOG( BM_LogFilter, 
-					  BmString("Filter ") << filter->Name() 
-					  	<< ": wants to stop processing this chain.");
-			return false;
-		}
+		return NoteFilterResults( filter, msgContext);
+	}
+	return true;
+}
+
+/*------------------------------------------------------------------------------*\
+	NoteFilterResults()
+		-	logs the changes the given filter has made to the msgContext
+		-	return true if processing should continue, false if not
+\*------------------------------------------------------------------------------*/
+bool BmMailFilter::NoteFilterResults( BmFilter* filter, 
+												  BmMsgContext* msgContext) {
+	if (msgContext->FieldHasChanged(BmMsgContext::FIELD_IDENTITY)) {
+		BmString newIdentity
+			= msgContext->GetString(BmMsgContext::FIELD_IDENTITY);
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  		<< ": setting identity to " 
+				  		<< newIdentity);
+	}
+	if (msgContext->FieldHasChanged(BmMsgContext::FIELD_STATUS)) {
+		BmString newStatus = msgContext->GetString(BmMsgContext::FIELD_STATUS);
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  		<< ": setting status to " 
+				  		<< newStatus);
+	}
+	if (msgContext->FieldHasChanged(BmMsgContext::FIELD_MOVE_TO_TRASH)
+	&& msgContext->GetBool(BmMsgContext::FIELD_MOVE_TO_TRASH)) {
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  		<< ": moving mail to trash.");
+	}
+	if (msgContext->FieldHasChanged(BmMsgContext::FIELD_REJECT_MSG)) {
+		BmString rejectMsg
+			= msgContext->GetString(BmMsgContext::FIELD_REJECT_MSG);
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  		<< ": rejecting mail with msg " 
+				  		<< rejectMsg);
+	}
+	if (msgContext->FieldHasChanged(BmMsgContext::FIELD_LIST_ID)) {
+		BmString newListId
+			= msgContext->GetString(BmMsgContext::FIELD_LIST_ID);
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  		<< ": setting ListId to " 
+				  		<< newListId);
+	}
+	bool stopProcessing
+		= msgContext->GetBool(BmMsgContext::FIELD_STOP_PROCESSING);
+	if (stopProcessing) {
+		BM_LOG( BM_LogFilter, 
+				  BmString("Filter ") << filter->Name() 
+				  	<< ": wants to stop processing this chain.");
+		return false;
 	}
 	return true;
 }
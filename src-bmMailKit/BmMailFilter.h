@@ -11,8 +11,10 @@
 
 #include "BmMailKit.h"
 
+#include <map>
 #include <vector>
 
+#include <Locker.h>
 #include <Message.h>
 
 #include "BmMailRef.h"
@@ -20,6 +22,9 @@
 
 class BmFilter;
 class BmMsgContext;
+class BmRecvAccount;
+struct BmFilterChainPlan;
+struct BmMailFilterPool;
 
 /*------------------------------------------------------------------------------*\
 	BmMailFilter
@@ -30,6 +35,8 @@ class IMPEXPBMMAILKIT BmMailFilter : public BmJobModel {
 
 	typedef vector< BmRef< BmMail> > BmMailVect;
 	typedef vector< const char**> BmHeaderVect;
+	typedef map< BmString, BmFilterChainPlan*> BmPlanMap;
+	typedef vector< BmFilterChainPlan*> BmPlanVect;
 	
 public:
 	//	message component definitions for status-msgs:
@@ -56,9 +63,31 @@ public:
 	inline BmString Name() const			{ return ModelName(); }
 
 private:
-	void Execute( BmMail* mail);
+	void FilterRefsInParallel( int32 workerCount, const float delta,
+										int32& c, int32 count);
+	void WorkOnPool( BmMailFilterPool* pool);
+	static int32 PoolWorkerEntry( void* data);
+	int32 WorkerCount() const;
+	//
+	const BmFilterChainPlan* PlanForMail( BmMail* mail, BmRecvAccount* recvAcc);
+	BmFilterChainPlan* BuildPlan( const BmString& chainName);
+	void DiscardPlans();
+	//
+	void FilterBatch( const BmMailVect& mails, const float delta,
+							int32& c, int32 count);
+	const BmFilterChainPlan* PrepareMail( BmMail* mail, 
+													  BmMsgContext* msgContext);
+	status_t RunPlan( const BmFilterChainPlan* plan, BmMail* mail, 
+							BmMsgContext* msgContext);
+	void RunPlanBatched( const BmFilterChainPlan* plan, const BmMailVect& mails,
+								const vector< BmMsgContext*>& msgContexts,
+								vector< status_t>& statuses);
+	void ApplyResults( BmMail* mail, BmMsgContext* msgContext);
+	bool ResultsChangeMail( BmMail* mail, BmMsgContext* msgContext) const;
+	void ReadCompleteMail( BmMail* mail, BmMsgContext* msgContext);
 	bool ExecuteFilter( BmMail* mail, BmFilter* filter,
 							  BmMsgContext* msgContext);
+	bool NoteFilterResults( BmFilter* filter, BmMsgContext* msgContext);
 	void UpdateStatus( const float delta, const char* filename, 
 							 const char* currentCount);
 
@@ -71,6 +100,16 @@ private:
 	bool mExecuteInMem;
 							// indicates whether the mail shall be stored
 							// after the filtering process (false) or not (true).
+	BmPlanMap mPlans;
+							// the execution plans built during the current job, 
+							// indexed by chain-name
+	BmPlanVect mStalePlans;
+							// plans that have been replaced while the job is running
+							// (other threads may still be using them)
+	int32 mPlanGeneration;
+							// generation of the filter-chain-list the plans in 
+							// mPlans have been built from
+	BLocker mPlanLock;
 
 	// Hide copy-constructor and assignment:
 	BmMailFilter( const BmMailFilter&);
@@ -428,13 +428,40 @@ void BmAddressList::ConstructRawText( BmStringOBuf& header,
 	BmHeaderList
 \********************************************************************************/
 
+/*------------------------------------------------------------------------------*\
+	BmHeaderList( arena)
+		-	c'tor, the header-map (and the value-lists within) will allocate
+			from the given arena
+\*------------------------------------------------------------------------------*/
+BmMailHeader::BmHeaderList::BmHeaderList( BmMemArena* arena)
+	:	mHeaders( less< BmString>(), BmHeaderMap::allocator_type( arena))
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	ValueListFor( fieldName)
+		-	returns the value-list for the given fieldName, a new (empty) one
+			is created if the field does not exist yet
+		-	in contrast to operator[], a new value-list uses our allocator
+\*------------------------------------------------------------------------------*/
+BmMailHeader::BmValueList& BmMailHeader::BmHeaderList
+::ValueListFor( const BmString& fieldName) {
+	BmHeaderMap::iterator pos = mHeaders.lower_bound( fieldName);
+	if (pos == mHeaders.end() || mHeaders.key_comp()( fieldName, pos->first)) {
+		BmValueList emptyList( mHeaders.get_allocator());
+		pos = mHeaders.insert( pos, BmHeaderMap::value_type( fieldName, 
+																			  emptyList));
+	}
+	return pos->second;
+}
+
 /*------------------------------------------------------------------------------*\
 	Set( fieldName, value)
 		-	
 \*------------------------------------------------------------------------------*/
 void BmMailHeader::BmHeaderList::Set( const BmString& fieldName, 
 												  const BmString value) {
-	BmValueList& valueList = mHeaders[fieldName];
+	BmValueList& valueList = ValueListFor( fieldName);
 	valueList.clear();
 	valueList.push_back( value);
 }
@@ -445,7 +472,7 @@ void BmMailHeader::BmHeaderList::Set( const BmString& fieldName,
 \*------------------------------------------------------------------------------*/
 void BmMailHeader::BmHeaderList::Add( const BmString& fieldName, 
 												  const BmString value) {
-	BmValueList& valueList = mHeaders[fieldName];
+	BmValueList& valueList = ValueListFor( fieldName);
 	valueList.push_back( value);
 }
 
@@ -560,11 +587,16 @@ struct subpart {
 };
 
 /*------------------------------------------------------------------------------*\
-	BmMailHeader( headerText)
+	BmMailHeader( headerText, mail, arena)
 		-	constructor
+		-	if an arena is given, the header-containers allocate from it
 \*------------------------------------------------------------------------------*/
-BmMailHeader::BmMailHeader( const BmString &headerText, BmMail* mail)
-	:	mHeaderString( headerText)
+BmMailHeader::BmMailHeader( const BmString &headerText, BmMail* mail,
+									 BmMemArena* arena)
+	:	mArena( arena)
+	,	mHeaderString( headerText)
+	,	mHeaders( arena)
+	,	mAddrMap( less< BmString>(), BmAddrMap::allocator_type( arena))
 	,	mMail( mail)
 	,	mKey( RefPrintHex())
 							// generate dummy identifier from our address
@@ -17,11 +17,14 @@
 #include "BmBasics.h"
 #include "BmFilterAddon.h"
 #include "BmIdentity.h"
+#include "BmMemArena.h"
 #include "BmMemIO.h"
 #include "BmRefManager.h"
 #include "BmUtil.h"
 
+using std::less;
 using std::map;
+using std::pair;
 using std::vector;
 
 class BFile;
@@ -150,12 +153,15 @@ private:
 class IMPEXPBMMAILKIT BmMailHeader : public BmRefObj {
 
 public:
-	typedef vector< BmString> BmValueList;
-	typedef map< BmString, BmValueList> BmHeaderMap;
+	typedef vector< BmString, BmArenaAllocator< BmString> > BmValueList;
+	typedef map< BmString, BmValueList, less< BmString>, 
+					 BmArenaAllocator< pair< const BmString, BmValueList> > > 
+		BmHeaderMap;
 
 private:
 	class IMPEXPBMMAILKIT BmHeaderList {
 	public:
+		BmHeaderList( BmMemArena* arena);
 		void Set( const BmString& fieldName, const BmString content);
 		void Add( const BmString& fieldName, const BmString content);
 		void Remove( const BmString& fieldName);
@@ -171,14 +177,19 @@ private:
 		void GetAllNames(vector<BmString>& fieldNamesVect) const;
 
 	private:
+		BmValueList& ValueListFor( const BmString& fieldName);
+
 		BmHeaderMap mHeaders;
 	};
 
-	typedef map< BmString, BmAddressList> BmAddrMap;
+	typedef map< BmString, BmAddressList, less< BmString>, 
+					 BmArenaAllocator< pair< const BmString, BmAddressList> > > 
+		BmAddrMap;
 	
 public:
 	// c'tors and d'tor:
-	BmMailHeader( const BmString &headerText, BmMail* mail);
+	BmMailHeader( const BmString &headerText, BmMail* mail, 
+					  BmMemArena* arena = NULL);
 	~BmMailHeader();
 
 	// native methods:
@@ -247,6 +258,10 @@ protected:
 private:
 	void AddParsingError( const BmString& errStr);
 
+	BmMemArenaRef mArena;
+							// the arena (of our mail) that the header- and 
+							// address-maps allocate from (may be NULL).
+							// Must be declared before those maps.
 	BmString mHeaderString;
 							// the complete original mail-header
 	BmHeaderList mHeaders;
@@ -470,6 +470,9 @@ void BmPrefs::InitDefaults(BMessage& defaultsMsg) {
 	defaultsMsg.AddBool( "LookForPeopleOnlyInPeopleFolder", true);
 	// standard mail-box:
 	defaultsMsg.AddString( "MailboxPath", "/boot/home/mail");
+	// number of threads filtering mails in parallel (0 means one per CPU,
+	// 1 filters sequentially in the filter-job thread):
+	defaultsMsg.AddInt32( "MailFilterWorkerThreads", 0);
 	defaultsMsg.AddBool( "MakeQPSafeForEBCDIC", true);
 	defaultsMsg.AddBool( "MapClassificationGenuineToTofu", true);
 	defaultsMsg.AddInt32( "MarkAsReadDelay", 500);
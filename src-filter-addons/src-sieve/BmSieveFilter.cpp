@@ -6,11 +6,15 @@
  *		Oliver Tappe <beam@hirschkaefer.de>
  */
 
+#include <ctype.h>
+#include <string.h>
+
 #include <Alert.h>
 #include <Application.h>
 #include <File.h>
 #include <MenuItem.h>
 #include <Message.h>
+#include <OS.h>
 #include <PopUpMenu.h>
 #include <ScrollView.h>
 
@@ -31,6 +35,7 @@ extern "C" {
 #include "script.h"
 #include "tree.h"
 #include "sieve.h"
+#include "message.h"
 }
 
 #include "BubbleHelper.h"
@@ -64,7 +69,12 @@ BmFilterAddonPrefsView* InstantiateFilterPrefs( float minx, float miny,
 const char* const BmSieveFilter::MSG_VERSION = 		"bm:version";
 const char* const BmSieveFilter::MSG_CONTENT = 		"bm:content";
 const int16 BmSieveFilter::nArchiveVersion = 1;
-BLocker* BmSieveFilter::nSieveLock = NULL;
+// the script-cache and its lock are created when the addon is loaded (before
+// any filter can be executed), such that no thread ever has to create them:
+BmSieveFilter::ScriptCache* BmSieveFilter::nScriptCache = new ScriptCache;
+BLocker* BmSieveFilter::nScriptCacheLock 
+	= new BLocker( "SieveScriptCacheLock", true);
+const uint32 BmSieveFilter::nMaxCachedScripts = 100;
 
 // standard logfile-name for this class:
 #undef BM_LOGNAME
@@ -96,6 +106,7 @@ BmSieveFilter::BmSieveFilter( const BmString& name, const BMessage* archive)
 	:	mName( name)
 	,	mCompiledScript( NULL)
 	,	mSieveInterp( NULL)
+	,	mScriptLock( BmString("SieveScript_") << name)
 {
 	int16 version;
 	if (archive->FindInt16( MSG_VERSION, &version) != B_OK)
@@ -108,19 +119,87 @@ BmSieveFilter::BmSieveFilter( const BmString& name, const BMessage* archive)
 		-	standard d'tor
 \*------------------------------------------------------------------------------*/
 BmSieveFilter::~BmSieveFilter() {
-	if (mCompiledScript)
-		sieve_script_free( &mCompiledScript);
+	ReleaseCompiledScript();
 	if (mSieveInterp)
 		sieve_interp_free( &mSieveInterp);
 }
 
 /*------------------------------------------------------------------------------*\
-	SieveLock()
+	FetchCachedScript( content)
+		-	returns the compiled script for the given script-text, if it is
+			contained in the cache (NULL otherwise)
+		-	the caller holds a reference to the returned script, which must 
+			be given up via ReleaseCachedScript()
+\*------------------------------------------------------------------------------*/
+sieve_script_t* BmSieveFilter::FetchCachedScript( const BmString& content) {
+	BAutolock lock( nScriptCacheLock);
+	ScriptCache::iterator iter = nScriptCache->find( content);
+	if (iter == nScriptCache->end())
+		return NULL;
+	iter->second.refCount++;
+	return iter->second.script;
+}
+
+/*------------------------------------------------------------------------------*\
+	StoreCachedScript( content, script)
+		-	adds the given compiled script to the cache (which takes over 
+			ownership) and returns the script that should be used
+		-	if another filter has compiled the same script-text in the meantime, 
+			the given script is freed and the cached one is returned instead
+		-	the caller holds a reference to the returned script, which must 
+			be given up via ReleaseCachedScript()
+\*------------------------------------------------------------------------------*/
+sieve_script_t* BmSieveFilter::StoreCachedScript( const BmString& content,
+																  sieve_script_t* script) {
+	BAutolock lock( nScriptCacheLock);
+	ScriptCache::iterator iter = nScriptCache->find( content);
+	if (iter != nScriptCache->end()) {
+		sieve_script_free( &script);
+		iter->second.refCount++;
+		return iter->second.script;
+	}
+	if (nScriptCache->size() >= nMaxCachedScripts) {
+		// drop all scripts that are currently unused:
+		for( iter = nScriptCache->begin(); iter != nScriptCache->end(); ) {
+			ScriptCache::iterator curr = iter++;
+			if (curr->second.refCount <= 0) {
+				sieve_script_free( &curr->second.script);
+				nScriptCache->erase( curr);
+			}
+		}
+	}
+	CachedScript& cached = (*nScriptCache)[content];
+	cached.script = script;
+	cached.refCount = 1;
+	return script;
+}
+
+/*------------------------------------------------------------------------------*\
+	ReleaseCachedScript( content)
+		-	gives up a reference to the compiled script of the given script-text
+		-	unused scripts are kept in the cache, such that re-initializing a
+			filter does not require another compilation
 \*------------------------------------------------------------------------------*/
-BLocker* BmSieveFilter::SieveLock() {
-	if (!nSieveLock)
-		nSieveLock = new BLocker( "SieveLock", true);
-	return nSieveLock;
+void BmSieveFilter::ReleaseCachedScript( const BmString& content) {
+	BAutolock lock( nScriptCacheLock);
+	ScriptCache::iterator iter = nScriptCache->find( content);
+	if (iter != nScriptCache->end())
+		iter->second.refCount--;
+}
+
+/*------------------------------------------------------------------------------*\
+	ReleaseCompiledScript()
+		-	frees this filter's clone of the compiled script
+\*------------------------------------------------------------------------------*/
+void BmSieveFilter::ReleaseCompiledScript() {
+	if (mCompiledScript) {
+		// the clone shares the commands with the cached script, so this
+		// only frees the clone itself:
+		sieve_script_free( &mCompiledScript);
+		mCompiledScript = NULL;
+		ReleaseCachedScript( mCompiledContent);
+		mCompiledContent.Truncate( 0);
+	}
 }
 
 /*------------------------------------------------------------------------------*\
@@ -134,9 +213,38 @@ status_t BmSieveFilter::Archive( BMessage* archive, bool) const {
 	return ret;
 }
 
+/*------------------------------------------------------------------------------*\
+	EnsureCompiled()
+		-	compiles the script unless that has already been done
+		-	returns false (after logging the error) if compilation failed
+\*------------------------------------------------------------------------------*/
+bool BmSieveFilter::EnsureCompiled() {
+	bool isCompiled;
+	{
+		BmAutoReadLock lock( mScriptLock);
+		isCompiled = mCompiledScript != NULL;
+	}
+	if (!isCompiled) {
+		bool scriptOK = CompileScript();
+		if (!scriptOK) {
+			BmString errString = LastErr() + "\n" 
+										<< "Error: " 
+										<< sieve_strerror(LastErrVal()) 
+										<< "\n"
+										<< LastSieveErr();
+			BM_LOGERR( BmString("Sieve-Addon: compilation failed.\n")<<errString);
+			return false;
+		}
+	}
+	return true;
+}
+
 /*------------------------------------------------------------------------------*\
 	Execute()
-		-	
+		-	executes the compiled script on the given mail (compiling the script
+			first, if neccessary)
+		-	libSieve is reentrant, so any number of threads may execute the
+			script at the same time, only (re-)compiling it is exclusive
 \*------------------------------------------------------------------------------*/
 bool 
 BmSieveFilter::Execute( BmMsgContext* msgContext, const BMessage* /*jobSpecs*/)
@@ -148,24 +256,24 @@ BmSieveFilter::Execute( BmMsgContext* msgContext, const BMessage* /*jobSpecs*/)
 									<< Name() 
 									<< "> on mail with Id <" << mailId << ">");
 
-	// set lock to serialize SIEVE-calls:
-	BAutolock lock( SieveLock());
+	if (!EnsureCompiled())
+		return false;
+
+	// the read-lock keeps the script from being replaced during execution:
+	BmAutoReadLock lock( mScriptLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SIEVE-lock";
+		BM_LOGERR( "Sieve-Addon: unable to get script-lock");
 		return false;
 	}
-
 	if (!mCompiledScript) {
-		bool scriptOK = CompileScript();
-		if (!scriptOK || !mCompiledScript) {
-			BmString errString = LastErr() + "\n" 
-										<< "Error: " 
-										<< sieve_strerror(LastErrVal()) 
-										<< "\n"
-										<< LastSieveErr();
-			BM_LOGERR( BmString("Sieve-Addon: compilation failed.\n")<<errString);
-			return false;
-		}
+		// the script has been changed since we compiled it
+		BM_LOGERR( BmString("Sieve-Addon: script of filter <") << Name() 
+						<< "> has been changed during execution");
+		return false;
+	}
+	if (IsKnownNotToMatch( msgContext)) {
+		BM_LOG2( BM_LogFilter, "Sieve-Addon: script does not match, skipped.");
+		return true;
 	}
 	BM_LOG2( BM_LogFilter, "Sieve-Addon: starting execution of script...");
 	int res = sieve_execute_script( mCompiledScript, msgContext);
@@ -173,25 +281,167 @@ BmSieveFilter::Execute( BmMsgContext* msgContext, const BMessage* /*jobSpecs*/)
 	return res == SIEVE_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	ExecuteBatch( msgContexts, results)
+		-	executes the compiled script on all the given mails, one after the 
+			other, but the script is checked and locked only once for all of
+			them, and libSieve sets up the copy of the interpretor and the
+			action-list only once, too
+		-	results[i] receives the result for msgContexts[i], true is returned
+			if the script could be executed successfully on all mails
+\*------------------------------------------------------------------------------*/
+bool 
+BmSieveFilter::ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+									  vector< bool>& results, 
+									  const BMessage* /*jobSpecs*/)
+{
+	results.assign( msgContexts.size(), false);
+	if (msgContexts.empty())
+		return true;
+	BM_LOG2( BM_LogFilter, BmString("Sieve-Addon: asked to execute filter <") 
+									<< Name() << "> on " << int32(msgContexts.size())
+									<< " mails");
+
+	if (!EnsureCompiled())
+		return false;
+
+	BmAutoReadLock lock( mScriptLock);
+	if (!lock.IsLocked()) {
+		BM_LOGERR( "Sieve-Addon: unable to get script-lock");
+		return false;
+	}
+	if (!mCompiledScript) {
+		BM_LOGERR( BmString("Sieve-Addon: script of filter <") << Name() 
+						<< "> has been changed during execution");
+		return false;
+	}
+	vector< void*> executed;
+	vector< uint32> indices;
+	for( uint32 i=0; i<msgContexts.size(); ++i) {
+		if (IsKnownNotToMatch( msgContexts[i]))
+			results[i] = true;
+		else {
+			executed.push_back( msgContexts[i]);
+			indices.push_back( i);
+		}
+	}
+	int32 skipped = msgContexts.size() - executed.size();
+	if (executed.empty()) {
+		BM_LOG2( BM_LogFilter, "Sieve-Addon: script does not match, skipped.");
+		return true;
+	}
+	vector< int> res( executed.size(), SIEVE_OK);
+	int allRes = sieve_execute_script_batch( mCompiledScript, &executed[0], 
+														  executed.size(), &res[0]);
+	for( uint32 e=0; e<executed.size(); ++e)
+		results[indices[e]] = res[e] == SIEVE_OK;
+	BM_LOG2( BM_LogFilter, BmString("Sieve-Addon: done with script (") 
+									<< skipped << " mails skipped).");
+	return allRes == SIEVE_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	AddTestNeeds( test, needs)
+		-	adds the mail-data the given test looks at to needs
+\*------------------------------------------------------------------------------*/
+static void AddTestNeeds( const test_t* test, BmFilterNeeds& needs) {
+	if (!test)
+		return;
+	const stringlist_t* sl = NULL;
+	switch( test->type) {
+		case ADDRESS:
+			sl = test->u.ae.sl;
+			break;
+		case HEADER:
+			sl = test->u.h.sl;
+			break;
+		case EXISTS:
+			sl = test->u.sl;
+			break;
+		case ANYOF:
+		case ALLOF:
+			for( const testlist_t* tl = test->u.tl; tl; tl = tl->next)
+				AddTestNeeds( tl->t, needs);
+			break;
+		case NOT:
+			AddTestNeeds( test->u.t, needs);
+			break;
+		case SIZE:
+			needs.size = true;
+			break;
+		case STRUE:
+		case SFALSE:
+			break;
+		default:
+			// we don't know what any other test looks at:
+			needs.NeedEverything();
+			break;
+	}
+	for( ; sl; sl = sl->next)
+		needs.AddHeaderField( sl->s);
+}
+
+/*------------------------------------------------------------------------------*\
+	AddCommandNeeds( cmds, needs)
+		-	adds the mail-data the given commands (and the tests of all 
+			if-statements among them) look at to needs
+		-	apart from vacation (which looks at several header-fields), the
+			actions do not look at the mail at all
+\*------------------------------------------------------------------------------*/
+static void AddCommandNeeds( const commandlist_t* cmds, BmFilterNeeds& needs) {
+	for( ; cmds; cmds = cmds->next) {
+		if (cmds->type == IF) {
+			AddTestNeeds( cmds->u.i.t, needs);
+			AddCommandNeeds( cmds->u.i.do_then, needs);
+			AddCommandNeeds( cmds->u.i.do_else, needs);
+		} else if (cmds->type == VACATION)
+			needs.allHeaderFields = true;
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	AddNeeds( needs)
+		-	adds the mail-data the script looks at (which has been determined 
+			when the script was compiled) to needs
+		-	if the script can't be compiled, it will not be executed, so 
+			nothing is needed
+\*------------------------------------------------------------------------------*/
+void BmSieveFilter::AddNeeds( BmFilterNeeds& needs) {
+	bool isCompiled;
+	{
+		BmAutoReadLock lock( mScriptLock);
+		isCompiled = mCompiledScript != NULL;
+	}
+	if (!isCompiled && !CompileScript())
+		return;
+	BmAutoReadLock lock( mScriptLock);
+	if (!lock.IsLocked() || !mCompiledScript) {
+		// the script is being changed, so we play it safe:
+		needs.NeedEverything();
+		return;
+	}
+	needs.Add( mNeeds);
+}
+
 /*------------------------------------------------------------------------------*\
 	CompileScript()
-		-	
+		-	compiles the script (directly from memory) unless the cache already
+			contains a compiled version of the same script-text
+		-	the filter uses its own clone of the compiled script, such that
+			SIEVE-callbacks get to see this filter as script-context
 \*------------------------------------------------------------------------------*/
 bool BmSieveFilter::CompileScript() {
 	bool ret = false;
-	FILE* scriptFile = NULL;
-	BmString scriptFileName;
-	status_t err;
-	BFile scriptBFile;
+	sieve_script_t* script = NULL;
+	int res = SIEVE_OK;
 
 	BM_LOG( BM_LogFilter, 
 			  BmString("Sieve-Addon: compiling SIEVE-script of filter ") 
 					<< Name()); 
 
-	// set lock to serialize SIEVE-calls:
-	BAutolock lock( SieveLock());
+	BmAutoWriteLock lock( mScriptLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SIEVE-lock";
+		mLastErr = "Unable to get script-lock";
 		return false;
 	}
 	if (mCompiledScript)
@@ -200,58 +450,52 @@ bool BmSieveFilter::CompileScript() {
 
 	mLastErr = mLastSieveErr = "";
 
-	BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...register");
-
-	// create sieve interpreter:
-	int res = sieve_interp_alloc( &mSieveInterp, this);
-	if (res != SIEVE_OK) {
-		mLastErr = BmString(Name()) << ": Could not create SIEVE-interpreter";
-		goto cleanup;
-	}
-	RegisterCallbacks( mSieveInterp);
-
-	BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...create tmpfile");
-	// create temporary file with script-contents 
-	// (since SIEVE parses from file only):
-	scriptFileName = "/tmp/bm_sieve_script";
-	err = scriptBFile.SetTo( scriptFileName.String(), 
-									 B_CREATE_FILE | B_ERASE_FILE | B_WRITE_ONLY);
-	if (err != B_OK) {
-		mLastErr = BmString(Name()) << ":\nCould not create temporary file\n\t<" 
-											 << scriptFileName << ">\n\n Result: " 
-											 << strerror(err);
-		goto cleanup;
+	if (!mSieveInterp) {
+		BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...register");
+		// create sieve interpreter:
+		res = sieve_interp_alloc( &mSieveInterp, this);
+		if (res != SIEVE_OK) {
+			mLastErr = BmString(Name()) << ": Could not create SIEVE-interpreter";
+			goto cleanup;
+		}
+		RegisterCallbacks( mSieveInterp);
 	}
-	scriptBFile.Write( mContent.String(), mContent.Length());
-	scriptBFile.Unset();
 
-	BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...open tmpfile for sieve");
-	// open script file for sieve...
-	scriptFile = fopen( scriptFileName.String(), "r");
-	if (!scriptFile) {
-		mLastErr = BmString(Name()) << ":\nCould not re-open file \n\t<" 
-											 << scriptFileName << ">";
-		goto cleanup;
-	}
-	// ...and compile the script:	
-	if (mCompiledScript) {
-		sieve_script_free( &mCompiledScript);
-		mCompiledScript = NULL;
+	script = FetchCachedScript( mContent);
+	if (script)
+		BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...found in cache");
+	else {
+		BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...parsing");
+		res = sieve_script_parse_buffer( mSieveInterp, mContent.String(),
+													mContent.Length(), this, &script);
+		if (res != SIEVE_OK) {
+			if (script)
+				sieve_script_free( &script);
+			mLastErr = BmString(Name()) 
+								<< ":\nThe script could not be parsed correctly";
+			goto cleanup;
+		}
+		// the cached script is shared by all filters with the same script-text,
+		// so it must not refer to this one:
+		script->script_context = NULL;
+		script = StoreCachedScript( mContent, script);
 	}
-	BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...parsing");
-	res = sieve_script_parse( mSieveInterp, scriptFile, this, &mCompiledScript);
+	res = sieve_script_clone( script, mSieveInterp, this, &mCompiledScript);
 	if (res != SIEVE_OK) {
+		ReleaseCachedScript( mContent);
+		mCompiledScript = NULL;
 		mLastErr = BmString(Name()) 
-							<< ":\nThe script could not be parsed correctly";
+							<< ":\nThe compiled script could not be cloned";
 		goto cleanup;
 	}
+	mCompiledContent = mContent;
+	mNeeds = BmFilterNeeds();
+	AddCommandNeeds( mCompiledScript->cmds, mNeeds);
 	BM_LOG2( BM_LogFilter, "Sieve-Addon: compilation...done");
 	ret = true;
 
 cleanup:
 	mLastErrVal = res;
-	if (scriptFile)
-		fclose( scriptFile);
 	return ret;
 }
 
@@ -261,11 +505,9 @@ cleanup:
 \*------------------------------------------------------------------------------*/
 void BmSieveFilter::Content( const BmString &s)
 {
+	BmAutoWriteLock lock( mScriptLock);
 	mContent = s;
-	if (mCompiledScript) {
-		sieve_script_free(&mCompiledScript);
-		mCompiledScript = NULL; 
-	}
+	ReleaseCompiledScript();
 }
 
 /*------------------------------------------------------------------------------*\
@@ -361,7 +603,7 @@ void BmSieveFilter::SetMailFlags( sieve_imapflags_t* flags,
 			BM_LOG3( BM_LogFilter, BmString("Sieve-Addon: SetMailFlags called "
 													  "with flag ") << flag); 
 			if (!flag.ICompare( "\\Seen"))
-				msgContext->SetString("Status", "Read");
+				msgContext->SetString(BmMsgContext::FIELD_STATUS, "Read");
 		}
 	}
 }
@@ -392,7 +634,7 @@ int BmSieveFilter::sieve_discard( void* /*action_context*/, void*,
 	BM_LOG3( BM_LogFilter, BmString("Sieve-Addon: sieve_discard called")); 
 	BmMsgContext* msgContext = static_cast< BmMsgContext*>( message_context);
 	if (msgContext)
-		msgContext->SetBool("MoveToTrash", true);
+		msgContext->SetBool(BmMsgContext::FIELD_MOVE_TO_TRASH, true);
 	return SIEVE_OK;
 }
 
@@ -429,9 +671,11 @@ int BmSieveFilter::sieve_fileinto( void* action_context, void* script_context,
 			alert->SetShortcut( 0, B_ESCAPE);
 			char pathbuf[1024];
 			if (alert->Go( pathbuf, 1024) == 1)
-				msgContext->SetString("FolderName", pathbuf);
+				msgContext->SetString(BmMsgContext::FIELD_FOLDER_NAME, pathbuf);
 		} else
-			msgContext->SetString("FolderName", fileintoContext->mailbox);
+			msgContext->SetString(
+				BmMsgContext::FIELD_FOLDER_NAME, fileintoContext->mailbox
+			);
 	}
 	return SIEVE_OK;
 }
@@ -451,7 +695,7 @@ int BmSieveFilter::sieve_reject( void* action_context, void* script_context,
 		BM_LOG3( BM_LogFilter, BmString("Sieve-Addon: sieve_reject called "
 												  "with msg ")
 												  <<rejectContext->msg);
-		msgContext->SetString("RejectMsg", rejectContext->msg);
+		msgContext->SetString(BmMsgContext::FIELD_REJECT_MSG, rejectContext->msg);
 	}
 	return SIEVE_OK;
 }
@@ -475,27 +719,33 @@ int BmSieveFilter::sieve_notify( void* action_context, void*,
 		}
 		if (!BmNotifySetIdentity.ICompare( notifyContext->method)) {
 			// set identity for mail according to notify-options:
-			msgContext->SetString("Identity", notifyContext->options[0]);
+			msgContext->SetString(
+				BmMsgContext::FIELD_IDENTITY, notifyContext->options[0]
+			);
 		} else if (!BmNotifySetStatus.ICompare( notifyContext->method)) {
 			// set status for mail according to notify-options:
-			msgContext->SetString("Status", notifyContext->options[0]);
+			msgContext->SetString(
+				BmMsgContext::FIELD_STATUS, notifyContext->options[0]
+			);
 		} else if (!BmNotifyStopProcessing.ICompare( notifyContext->method)) {
 			// we stop processing since this filter has matched:
-			msgContext->SetBool("StopProcessing", true);
+			msgContext->SetBool(BmMsgContext::FIELD_STOP_PROCESSING, true);
 		} else if (!BmNotifySetSpamTofu.ICompare( notifyContext->method)) {
 			// set spam/tofu-state for mail according to notify-options:
 			BmString spam("Spam");
 			BmString tofu("Tofu");
 			if (!spam.ICompare(notifyContext->options[0])) {
-				msgContext->SetBool("LearnAsSpam", true);
-				msgContext->SetBool("LearnAsTofu", false);
+				msgContext->SetBool(BmMsgContext::FIELD_LEARN_AS_SPAM, true);
+				msgContext->SetBool(BmMsgContext::FIELD_LEARN_AS_TOFU, false);
 			} else if (!tofu.ICompare(notifyContext->options[0])) {
-				msgContext->SetBool("LearnAsSpam", false);
-				msgContext->SetBool("LearnAsTofu", true);
+				msgContext->SetBool(BmMsgContext::FIELD_LEARN_AS_SPAM, false);
+				msgContext->SetBool(BmMsgContext::FIELD_LEARN_AS_TOFU, true);
 			}
 		} else if (!BmNotifySetListId.ICompare( notifyContext->method)) {
 			// set list-id for mail according to notify-options:
-			msgContext->SetString("ListId", notifyContext->options[0]);
+			msgContext->SetString(
+				BmMsgContext::FIELD_LIST_ID, notifyContext->options[0]
+			);
 		}
 	}
 	return SIEVE_OK;
@@ -507,11 +757,20 @@ int BmSieveFilter::sieve_notify( void* action_context, void*,
 \*------------------------------------------------------------------------------*/
 int BmSieveFilter::sieve_get_size( void* message_context, int* sizePtr) {
 	BmMsgContext* msgContext = static_cast< BmMsgContext*>( message_context);
-	if (msgContext && sizePtr)
-		*sizePtr = msgContext->mail->RawText().Length();
+	if (!msgContext || !sizePtr)
+		return SIEVE_FAIL;
+	BmMail* mail = msgContext->mail;
+	// the size is taken from the mail-ref (whether or not the complete mail
+	// has been read), such that a size-test doesn't trigger reading the 
+	// complete mail and yields the same answer either way. Only mails that
+	// don't live in a file (yet) are measured by their text:
+	if (mail->MailRef())
+		*sizePtr = mail->MailRef()->Size();
+	else
+		*sizePtr = mail->RawText().Length();
 	BM_LOG3( BM_LogFilter, 
 				BmString("Sieve-Addon: sieve_get_size called, answer = ")
-					<< msgContext->mail->RawText().Length());
+					<< *sizePtr);
 	return SIEVE_OK;
 }
 
@@ -524,32 +783,32 @@ int BmSieveFilter::sieve_get_header( void* message_context, const char* header,
 	BM_LOG3( BM_LogFilter, 
 				BmString("Sieve-Addon: sieve_get_header called for header ")
 					<< header);
-	static const char* fakes[2] = { NULL, NULL };
 	BmMsgContext* msgContext = static_cast< BmMsgContext*>( message_context);
 	if (msgContext && contentsPtr && header) {
 		*contentsPtr = NULL;
-		BmString headerName( header);
-		if (headerName.ICompare("Status") == 0) {
-			fakes[0] = msgContext->mail->Status().String();
-			*contentsPtr = fakes;
-		} else if (headerName.ICompare("Account") == 0) {
-			fakes[0] = msgContext->mail->AccountName().String();
-			*contentsPtr = fakes;
-		} else if (headerName.ICompare("Outbound") == 0) {
-			fakes[0] = msgContext->mail->Outbound() ? "true" : "false";
-			*contentsPtr = fakes;
+		// pseudo-headers are handed out via the message-context, as several
+		// threads may be filtering different mails at the same time:
+		const char** pseudoValues = msgContext->pseudoHeaderValues;
+		if (strcasecmp( header, "Status") == 0) {
+			pseudoValues[0] = msgContext->mail->Status().String();
+			*contentsPtr = pseudoValues;
+		} else if (strcasecmp( header, "Account") == 0) {
+			pseudoValues[0] = msgContext->mail->AccountName().String();
+			*contentsPtr = pseudoValues;
+		} else if (strcasecmp( header, "Outbound") == 0) {
+			pseudoValues[0] = msgContext->mail->Outbound() ? "true" : "false";
+			*contentsPtr = pseudoValues;
 		} else {
+			// the header-values are fetched once per mail, lookups then go
+			// through the hash-index of the message-context:
 			if (!msgContext->headerInfos)
 				msgContext->mail->Header()->GetAllFieldValues( *msgContext);
-			for( int i=0; i<msgContext->headerInfoCount; ++i) {
-				if (!msgContext->headerInfos[i].fieldName.ICompare( header)) {
-					*contentsPtr = msgContext->headerInfos[i].values;
-					for( int v=0; msgContext->headerInfos[i].values[v]; ++v) {
-						BM_LOG3( BM_LogFilter, 
-									BmString("Sieve-Addon: sieve_get_header returns value[")
-										<<v<<"] = " <<msgContext->headerInfos[i].values[v]);
-					}
-					break;
+			*contentsPtr = msgContext->HeaderValues( header);
+			if (*contentsPtr) {
+				for( int v=0; (*contentsPtr)[v]; ++v) {
+					BM_LOG3( BM_LogFilter, 
+								BmString("Sieve-Addon: sieve_get_header returns value[")
+									<<v<<"] = " <<(*contentsPtr)[v]);
 				}
 			}
 		}
@@ -584,6 +843,290 @@ int BmSieveFilter::sieve_execute_error( const char* msg, void*,
 }
 
 
+/********************************************************************************\
+	BmSieveDispatchIndex
+\********************************************************************************/
+
+// the rule-map and its lock are created when the addon is loaded (just like
+// the script-cache):
+BmSieveDispatchIndex::RuleMap* BmSieveDispatchIndex::nRules = new RuleMap;
+BmSieveDispatchIndex* volatile BmSieveDispatchIndex::nCurrentIndex = NULL;
+int32 BmSieveDispatchIndex::nGeneration = 0;
+int32 BmSieveDispatchIndex::nReaders = 0;
+BLocker* BmSieveDispatchIndex::nIndexLock 
+	= new BLocker( "SieveDispatchLock", true);
+const char* const BmSieveDispatchIndex::nContextKey = "SieveDispatch";
+
+/*------------------------------------------------------------------------------*\
+	FoldCase( str)
+		-	converts the given string to lowercase in the same way as the 
+			ascii-casemap comparator of libSieve does
+\*------------------------------------------------------------------------------*/
+static BmString FoldCase( const char* str) {
+	BmString folded( str);
+	for( int32 i=0; i<folded.Length(); ++i)
+		folded[i] = tolower( (unsigned char)folded[i]);
+	return folded;
+}
+
+/*------------------------------------------------------------------------------*\
+	BmSieveDispatchIndex( rules, generation)
+		-	c'tor, builds the matchers for the given rules, each rule gets a 
+			slot of its own
+\*------------------------------------------------------------------------------*/
+BmSieveDispatchIndex::BmSieveDispatchIndex( const RuleMap& rules, 
+														  int32 generation)
+	:	mGeneration( generation)
+	,	mRefCount( 0)
+{
+	map< BmString, int32> matcherIndex;
+	int32 slot = 0;
+	RuleMap::const_iterator rule;
+	for( rule = rules.begin(); rule != rules.end(); ++rule, ++slot) {
+		mSlots[rule->first] = slot;
+		for( uint32 t=0; t<rule->second.size(); ++t) {
+			const Term& term = rule->second[t];
+			BmString key = FoldCase( term.fieldName.String());
+			key << ":" << term.addrPart;
+			int32 m;
+			map< BmString, int32>::const_iterator pos = matcherIndex.find( key);
+			if (pos == matcherIndex.end()) {
+				m = matcherIndex[key] = mFieldMatchers.size();
+				mFieldMatchers.push_back( FieldMatcher());
+				mFieldMatchers[m].fieldName = term.fieldName;
+				mFieldMatchers[m].addrPart = term.addrPart;
+				mFieldMatchers[m].nodes.push_back( Node());
+			} else
+				m = pos->second;
+			FieldMatcher& matcher = mFieldMatchers[m];
+			for( uint32 v=0; v<term.values.size(); ++v) {
+				BmString value = FoldCase( term.values[v].String());
+				if (term.contains)
+					AddPattern( matcher, value, slot);
+				else
+					matcher.exactValues[value].push_back( slot);
+			}
+		}
+	}
+	for( uint32 m=0; m<mFieldMatchers.size(); ++m)
+		BuildFailLinks( mFieldMatchers[m]);
+}
+
+/*------------------------------------------------------------------------------*\
+	~BmSieveDispatchIndex()
+		-	standard d'tor
+\*------------------------------------------------------------------------------*/
+BmSieveDispatchIndex::~BmSieveDispatchIndex() {
+}
+
+/*------------------------------------------------------------------------------*\
+	RemoveRef()
+		-	drops a reference, the last one deletes the index
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::RemoveRef() {
+	if (atomic_add( &mRefCount, -1) == 1)
+		delete this;
+}
+
+/*------------------------------------------------------------------------------*\
+	SetRule( filter, rule)
+		-	sets the rule of the given filter, an empty rule removes the filter
+			from the index (which is what filters should do before they die)
+		-	the current index is dropped, such that the next check will use a
+			new index that reflects the change
+		-	the old index is only released after all threads that may be 
+			picking it up (in CurrentIndex()) have got their own reference
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::SetRule( const BmSieveFilter* filter, 
+												const Rule& rule) {
+	BAutolock lock( nIndexLock);
+	if (rule.empty()) {
+		if (!nRules->erase( filter))
+			return;
+	} else
+		(*nRules)[filter] = rule;
+	atomic_add( &nGeneration, 1);
+	BmSieveDispatchIndex* oldIndex = nCurrentIndex;
+	nCurrentIndex = NULL;
+	if (oldIndex) {
+		while( atomic_or( &nReaders, 0) > 0)
+			snooze( 100);
+		oldIndex->RemoveRef();
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	CurrentIndex()
+		-	returns the index over the current rules (building it if required)
+		-	the caller receives a reference to the index, which it has to
+			remove when done
+		-	only building the index requires the lock
+\*------------------------------------------------------------------------------*/
+BmSieveDispatchIndex* BmSieveDispatchIndex::CurrentIndex() {
+	atomic_add( &nReaders, 1);
+	BmSieveDispatchIndex* index = nCurrentIndex;
+	if (index)
+		index->AddRef();
+	atomic_add( &nReaders, -1);
+	if (index)
+		return index;
+
+	BAutolock lock( nIndexLock);
+	if (!nCurrentIndex) {
+		index = new BmSieveDispatchIndex( *nRules, nGeneration);
+		index->AddRef();
+		nCurrentIndex = index;
+	}
+	nCurrentIndex->AddRef();
+	return nCurrentIndex;
+}
+
+/*------------------------------------------------------------------------------*\
+	Check( filter, msgContext)
+		-	returns whether or not the rule of the given filter matches the mail
+			of the given message-context (NOT_INDEXED if the filter isn't part
+			of the index)
+		-	the first check on a mail matches all rules at once, the results
+			(and the index they have been computed with) are kept in the 
+			message-context for all the other filters, which only have to 
+			compare the generation of the rules
+\*------------------------------------------------------------------------------*/
+int32 BmSieveDispatchIndex::Check( const BmSieveFilter* filter, 
+											  BmMsgContext* msgContext) {
+	if (!msgContext)
+		return NOT_INDEXED;
+	Result* result 
+		= static_cast< Result*>( msgContext->AddonData( nContextKey));
+	if (!result || result->index->mGeneration != atomic_or( &nGeneration, 0)) {
+		BmSieveDispatchIndex* index = CurrentIndex();
+		result = new Result( index);
+		index->RemoveRef();
+		index->Match( msgContext, result->matched);
+		msgContext->SetAddonData( nContextKey, result);
+	}
+	const BmSieveDispatchIndex* index = result->index;
+	map< const BmSieveFilter*, int32>::const_iterator slot 
+		= index->mSlots.find( filter);
+	if (slot == index->mSlots.end())
+		return NOT_INDEXED;
+	return result->matched[slot->second] ? MATCH : NO_MATCH;
+}
+
+/*------------------------------------------------------------------------------*\
+	AddPattern( matcher, pattern, slot)
+		-	adds the given pattern to the trie of the given matcher
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::AddPattern( FieldMatcher& matcher, 
+													const BmString& pattern, int32 slot) {
+	int32 node = 0;
+	for( const char* p = pattern.String(); *p; ++p) {
+		map< char, int32>::const_iterator next = matcher.nodes[node].next.find( *p);
+		if (next == matcher.nodes[node].next.end()) {
+			int32 newNode = matcher.nodes.size();
+			matcher.nodes.push_back( Node());
+			matcher.nodes[node].next[*p] = newNode;
+			node = newNode;
+		} else
+			node = next->second;
+	}
+	matcher.nodes[node].slots.push_back( slot);
+}
+
+/*------------------------------------------------------------------------------*\
+	BuildFailLinks( matcher)
+		-	sets the fail-links of all trie-nodes (in breadth-first order), 
+			turning the trie into an Aho-Corasick automaton
+		-	each node inherits the slots of the node its fail-link points to,
+			such that a single visit reports all patterns ending at a position
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::BuildFailLinks( FieldMatcher& matcher) {
+	vector< Node>& nodes = matcher.nodes;
+	vector< int32> queue( 1, 0);
+	for( uint32 q=0; q<queue.size(); ++q) {
+		int32 node = queue[q];
+		map< char, int32>::const_iterator iter;
+		for( iter = nodes[node].next.begin(); iter != nodes[node].next.end(); 
+			  ++iter) {
+			char c = iter->first;
+			int32 child = iter->second;
+			int32 fail = nodes[node].fail;
+			while( fail && nodes[fail].next.find( c) == nodes[fail].next.end())
+				fail = nodes[fail].fail;
+			map< char, int32>::const_iterator target = nodes[fail].next.find( c);
+			if (target != nodes[fail].next.end() && target->second != child)
+				nodes[child].fail = target->second;
+			const vector< int32>& inherited = nodes[nodes[child].fail].slots;
+			nodes[child].slots.insert( nodes[child].slots.end(), 
+												inherited.begin(), inherited.end());
+			queue.push_back( child);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	Match( msgContext, matched)
+		-	matches all rules against the mail of the given message-context,
+			the flag of every slot whose rule matches is set in matched
+		-	the header-values are fetched in the same way as during execution
+			of a script, addresses are split up by libSieve, too
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::Match( BmMsgContext* msgContext, 
+											 vector< bool>& matched) const {
+	matched.assign( mSlots.size(), false);
+	address_cache_t* addrCache = NULL;
+	for( uint32 m=0; m<mFieldMatchers.size(); ++m) {
+		const FieldMatcher& matcher = mFieldMatchers[m];
+		const char** values;
+		if (BmSieveFilter::sieve_get_header( msgContext, 
+														 matcher.fieldName.String(), 
+														 &values) != SIEVE_OK)
+			continue;
+		for( int v=0; values[v]; ++v) {
+			if (matcher.addrPart < 0) {
+				MatchValue( matcher, values[v], matched);
+				continue;
+			}
+			char* const* addresses 
+				= get_cached_addresses( &addrCache, values[v], 
+												(address_part_t)matcher.addrPart);
+			for( int a=0; addresses[a]; ++a)
+				MatchValue( matcher, addresses[a], matched);
+		}
+	}
+	free_address_cache( &addrCache);
+}
+
+/*------------------------------------------------------------------------------*\
+	MatchValue( matcher, value, matched)
+		-	matches a single value against the "is"-values and the 
+			"contains"-automaton of the given matcher
+\*------------------------------------------------------------------------------*/
+void BmSieveDispatchIndex::MatchValue( const FieldMatcher& matcher, 
+													const char* value,
+													vector< bool>& matched) const {
+	BmString folded = FoldCase( value);
+	map< BmString, vector< int32> >::const_iterator exact 
+		= matcher.exactValues.find( folded);
+	if (exact != matcher.exactValues.end()) {
+		for( uint32 s=0; s<exact->second.size(); ++s)
+			matched[exact->second[s]] = true;
+	}
+	const vector< Node>& nodes = matcher.nodes;
+	if (nodes.size() < 2)
+		return;
+	int32 node = 0;
+	for( const char* p = folded.String(); *p; ++p) {
+		map< char, int32>::const_iterator next;
+		while( (next = nodes[node].next.find( *p)) == nodes[node].next.end() 
+		&& node)
+			node = nodes[node].fail;
+		node = next != nodes[node].next.end() ? next->second : 0;
+		for( uint32 s=0; s<nodes[node].slots.size(); ++s)
+			matched[nodes[node].slots[s]] = true;
+	}
+}
+
+
 
 /********************************************************************************\
 	BmGraphicalSieveFilter
@@ -740,6 +1283,24 @@ BmGraphicalSieveFilter::BmGraphicalSieveFilter( const BmString& name,
 	}
 }
 
+/*------------------------------------------------------------------------------*\
+	~BmGraphicalSieveFilter()
+		-	standard d'tor, removes the filter from the dispatch-index
+\*------------------------------------------------------------------------------*/
+BmGraphicalSieveFilter::~BmGraphicalSieveFilter() {
+	BmSieveDispatchIndex::SetRule( this, BmSieveDispatchIndex::Rule());
+}
+
+/*------------------------------------------------------------------------------*\
+	IsKnownNotToMatch( msgContext)
+		-	consults the dispatch-index (which matches the rules of all 
+			graphical filters in one go)
+\*------------------------------------------------------------------------------*/
+bool BmGraphicalSieveFilter::IsKnownNotToMatch( BmMsgContext* msgContext) {
+	return BmSieveDispatchIndex::Check( this, msgContext) 
+				== BmSieveDispatchIndex::NO_MATCH;
+}
+
 /*------------------------------------------------------------------------------*\
 	Archive( archive, deep)
 		-	writes BmGraphicalSieveFilter into archive
@@ -884,10 +1445,14 @@ bool BmGraphicalSieveFilter::SanityCheck( BmString& complaint,
 
 /*------------------------------------------------------------------------------*\
 	BuildScriptFromStrings()
-		-	
+		-	generates the SIEVE-script from the values of the graphical editor
+		-	if the script only consists of simple "is"/"contains" tests, the 
+			equivalent rule is handed to the dispatch-index, too
 \*------------------------------------------------------------------------------*/
 bool BmGraphicalSieveFilter::BuildScriptFromStrings() {
 	vector<BmString> valueVect;
+	BmSieveDispatchIndex::Rule rule;
+	bool isIndexable = true;
 	BmString script("# generated by Beam's GUI-editor, please do not edit!\n");
 	bool needRegex = false;
 	bool needRelational = false;
@@ -932,6 +1497,27 @@ bool BmGraphicalSieveFilter::BuildScriptFromStrings() {
 		bool otherField = mMatchMailPart[i] == BM_MAILPART_OTHER;
 		bool needsAddressTest = IsAddrField( mMatchMailPart[i]) 
 										&& mMatchAddrPart[i] != BM_ADDRPART_COMPLETE;
+		if (neg.Length() || (op != "is" && op != "contains"))
+			isIndexable = false;
+		else {
+			BmSieveDispatchIndex::Term term;
+			term.fieldName = otherField ? mMatchFieldName[i] : mMatchMailPart[i];
+			term.contains = op == "contains";
+			if (!needsAddressTest)
+				term.addrPart = -1;
+			else if (mMatchAddrPart[i] == BM_ADDRPART_DOMAIN)
+				term.addrPart = ADDRESS_DOMAIN;
+			else if (mMatchAddrPart[i] == BM_ADDRPART_LOCALPART)
+				term.addrPart = ADDRESS_LOCALPART;
+			else
+				term.addrPart = ADDRESS_ALL;
+			split( "\n", mMatchValue[i], valueVect);
+			for( uint32 v=0; v<valueVect.size(); ++v) {
+				if (valueVect[v].Length())
+					term.values.push_back( valueVect[v]);
+			}
+			rule.push_back( term);
+		}
 		BmString line = (neg.Length() ? (neg + " ") : BmString(""));
 		if (needsAddressTest) {
 			// use address test:
@@ -999,7 +1585,14 @@ bool BmGraphicalSieveFilter::BuildScriptFromStrings() {
 	if (matchPart.Length()) {
 		script << "}";
 	}
+	// all of several tests can't be dispatched through the index:
+	if (!isIndexable || (rule.size() > 1 && mMatchAnyAll == choices[0]))
+		rule.clear();
+	// the script and the rule are changed together, such that no execution
+	// will see the new rule with the old script (or vice versa):
+	BmAutoWriteLock lock( mScriptLock);
 	Content( script);
+	BmSieveDispatchIndex::SetRule( this, rule);
 	return true;
 }
 
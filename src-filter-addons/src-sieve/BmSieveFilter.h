@@ -9,6 +9,9 @@
 #ifndef _BmSieveFilter_h
 #define _BmSieveFilter_h
 
+#include <map>
+#include <vector>
+
 #include <Archivable.h>
 #include <Autolock.h>
 
@@ -18,6 +21,10 @@ extern "C" {
 
 #include "BmFilterAddon.h"
 #include "BmFilterAddonPrefs.h"
+#include "BmMultiLocker.h"
+
+using std::map;
+using std::vector;
 
 const int BM_MAX_MATCH_COUNT = 20;
 
@@ -36,16 +43,27 @@ public:
 	
 	// native methods:
 	bool CompileScript();
-	BLocker* SieveLock();
 	virtual bool AskBeforeFileInto()		{ return false; }
+	virtual bool IsKnownNotToMatch( BmMsgContext*)
+													{ return false; }
+							// filters that can tell that their script would not
+							// match a mail return true here, the script will
+							// then not be executed at all
 
 	// implementations for abstract BmFilterAddon-methods:
 	bool Execute( BmMsgContext* msgContext, 
 					  const BMessage* jobSpecs = NULL);
+	bool ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+							 vector< bool>& results,
+							 const BMessage* jobSpecs = NULL);
 	virtual void Initialize();
 	bool SanityCheck( BmString& complaint, BmString& fieldName);
 	status_t Archive( BMessage* archive, bool deep = true) const;
 	BmString ErrorString() const;
+	bool IsThreadSafe() const				{ return true; }
+							// libSieve is reentrant, the script itself is
+							// protected by mScriptLock
+	void AddNeeds( BmFilterNeeds& needs);
 
 	// SIEVE-callbacks:
 	static int sieve_redirect( void* action_context, void* interp_context, 
@@ -99,6 +117,21 @@ public:
 
 protected:
 	void RegisterCallbacks( sieve_interp_t* interp);
+	void ReleaseCompiledScript();
+	bool EnsureCompiled();
+
+	struct CachedScript {
+		sieve_script_t* script;
+								// the compiled script (without script-context),
+								// filters only use clones of it
+		int32 refCount;
+								// number of filters currently using this script
+	};
+	typedef map< BmString, CachedScript> ScriptCache;
+	static sieve_script_t* FetchCachedScript( const BmString& content);
+	static sieve_script_t* StoreCachedScript( const BmString& content, 
+															sieve_script_t* script);
+	static void ReleaseCachedScript( const BmString& content);
 
 	BmString mName;
 							// the name of this filter-implementation
@@ -114,7 +147,19 @@ protected:
 							// the last (general) error that occurred
 	BmString mLastSieveErr;
 							// the last SIEVE-error that occurred
-	static BLocker* nSieveLock;
+	BmString mCompiledContent;
+								// the script-text mCompiledScript was compiled from
+	BmFilterNeeds mNeeds;
+								// the mail-data mCompiledScript looks at
+	BmMultiLocker mScriptLock;
+								// write-locked while the script is being compiled
+								// or changed, read-locked during execution
+	static ScriptCache* nScriptCache;
+								// compiled scripts, keyed by script-text
+	static BLocker* nScriptCacheLock;
+								// protects nScriptCache
+	static const uint32 nMaxCachedScripts;
+								// unused scripts are dropped from cache beyond this
 
 private:
 	BmSieveFilter();									// hide default constructor
@@ -126,6 +171,126 @@ private:
 
 
 
+/*------------------------------------------------------------------------------*\
+	BmSieveDispatchIndex 
+		-	a merged index over the match-rules of all filters that only
+			consist of simple "is"/"contains" tests on header-fields (or 
+			addresses), which are joined by "any of"
+		-	the values of all these rules are merged into one matcher per 
+			field (a map for "is" and an Aho-Corasick automaton for "contains"),
+			such that each header of a mail is scanned only once, no matter 
+			how many filters test it
+		-	the results are stored in the message-context, filters whose rule
+			did not match can then be skipped without running their script
+		-	an index is immutable, changing any rule drops the current index,
+			a new one is built when the next mail is checked
+		-	checking does not lock: the index is published via a pointer that
+			readers pick up while they are counted in nReaders (SetRule() 
+			waits for them before it drops the old index), and a mail keeps 
+			using the index it has been matched with until the generation
+			of the rules changes
+\*------------------------------------------------------------------------------*/
+class BmSieveDispatchIndex {
+
+public:
+	struct Term {
+		BmString fieldName;
+		int32 addrPart;
+								// the address-part (ADDRESS_ALL, ...) that is to be
+								// tested, -1 tests the complete header-value
+		bool contains;
+								// true for "contains", false for "is"
+		vector< BmString> values;
+								// the values to compare with
+	};
+	typedef vector< Term> Rule;
+								// a rule matches if any of its terms matches
+
+	enum {
+		NOT_INDEXED = -1,
+		NO_MATCH = 0,
+		MATCH = 1
+	};
+
+	// native methods:
+	static void SetRule( const BmSieveFilter* filter, const Rule& rule);
+								// an empty rule removes the filter from the index
+	static int32 Check( const BmSieveFilter* filter, BmMsgContext* msgContext);
+
+	void AddRef()								{ atomic_add( &mRefCount, 1); }
+	void RemoveRef();
+
+private:
+	struct Node {
+		Node() : fail( 0) 					{}
+		map< char, int32> next;
+		int32 fail;
+								// the node representing the longest proper suffix
+								// of this node's path that is present in the trie
+		vector< int32> slots;
+								// the rules that have a pattern ending here (or in
+								// any node reachable via fail)
+	};
+	struct FieldMatcher {
+		BmString fieldName;
+		int32 addrPart;
+		map< BmString, vector< int32> > exactValues;
+								// "is"-values, mapped to the slots of their rules
+		vector< Node> nodes;
+								// trie of "contains"-values, nodes[0] is the root
+	};
+	struct Result : public BmMsgContextData {
+		Result( BmSieveDispatchIndex* idx) : index( idx) 
+													{ index->AddRef(); }
+		~Result()								{ index->RemoveRef(); }
+		BmSieveDispatchIndex* index;
+								// the index the result has been computed with
+		vector< bool> matched;
+								// one flag per slot
+	};
+	typedef map< const BmSieveFilter*, Rule> RuleMap;
+
+	BmSieveDispatchIndex( const RuleMap& rules, int32 generation);
+	~BmSieveDispatchIndex();
+								// indexes are only deleted by RemoveRef()
+
+	void AddPattern( FieldMatcher& matcher, const BmString& pattern, 
+						  int32 slot);
+	void BuildFailLinks( FieldMatcher& matcher);
+	void Match( BmMsgContext* msgContext, vector< bool>& matched) const;
+	void MatchValue( const FieldMatcher& matcher, const char* value, 
+						  vector< bool>& matched) const;
+
+	static BmSieveDispatchIndex* CurrentIndex();
+
+	vector< FieldMatcher> mFieldMatchers;
+	map< const BmSieveFilter*, int32> mSlots;
+								// the slot of each indexed filter
+	int32 mGeneration;
+								// the generation of the rules this index is built from
+	int32 mRefCount;
+
+	static RuleMap* nRules;
+								// the rules of all indexable filters
+	static BmSieveDispatchIndex* volatile nCurrentIndex;
+								// the index over nRules, NULL if outdated
+	static int32 nGeneration;
+								// incremented whenever any rule changes
+	static int32 nReaders;
+								// number of threads that are picking up 
+								// nCurrentIndex without holding nIndexLock
+	static BLocker* nIndexLock;
+								// protects nRules and changes to nCurrentIndex
+	static const char* const nContextKey;
+								// key of the results in the message-context
+
+	// Hide copy-constructor and assignment:
+	BmSieveDispatchIndex( const BmSieveDispatchIndex&);
+	BmSieveDispatchIndex operator=( const BmSieveDispatchIndex&);
+};
+
+
+
 /*------------------------------------------------------------------------------*\
 	BmGraphicalSieveFilter 
 		-	additionally supports graphical editing of the filter
@@ -134,6 +299,7 @@ class BmGraphicalSieveFilter : public BmSieveFilter {
 	typedef BmSieveFilter inherited;
 
 	friend class BmSieveFilterPrefs;
+	friend class SieveTest;
 
 	// archivable components:
 	static const char* const MSG_MATCH_COUNT;
@@ -159,6 +325,7 @@ class BmGraphicalSieveFilter : public BmSieveFilter {
 
 public:
 	BmGraphicalSieveFilter( const BmString& name, const BMessage* archive);
+	~BmGraphicalSieveFilter();
 	
 	// native methods:
 	bool BuildScriptFromStrings();
@@ -174,6 +341,7 @@ public:
 									const BmString& from, 
 									const BmString& To);
 	bool AskBeforeFileInto()				{ return mActionFileIntoAsk; }
+	bool IsKnownNotToMatch( BmMsgContext* msgContext);
 
 private:
 
@@ -32,14 +32,21 @@ OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include "addr.h"
 #include "xmalloc.h"
 
-extern int addrerror(const char *msg);
-extern int addrlex(void);
+extern int addrerror(void *scanner, const char *msg);
 
 #define YYERROR_VERBOSE /* i want better error messages! */
 %}
 
+%pure-parser
+%parse-param { void *scanner }
+%lex-param { void *scanner }
+
 %token ATOM QTEXT DTEXT
 
+%{
+extern int addrlex(YYSTYPE *lvalp, void *scanner);
+%}
+
 %start sieve_address
 
 %%
@@ -81,12 +88,3 @@ qstring: '"' QTEXT '"'
 	;
 
 %%
-
-/* copy address error message into buffer provided by sieve parser */
-int addrerror(const char *s)
-{
-    extern char *addrerr;
-
-    addrerr = xstrdup(s);
-    return 0;
-}
@@ -35,6 +35,7 @@ OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include "comparator.h"
 #include "tree.h"
 #include "sieve.h"
+#include "xmalloc.h"
 
 /* --- i;octet comparators --- */
 
@@ -44,71 +45,86 @@ static int octet_contains(const char *pat, const char *text)
     return (strstr(text, pat) != NULL);
 }
 
-static int octet_matches_(const char *pat, const char *text, int casemap)
+/* [zooey]:
+	:matches patterns used to be interpreted by a recursive matcher for
+	every comparison. Now they are compiled into a sequence of tokens 
+	once (when the script is compiled), escapes are resolved, consecutive 
+	wildcards are merged and literals are case-folded if required. 
+	Matching such a glob needs neither recursion nor any allocation.
+*/
+#define GLOB_ANY	-1	/* '?' */
+#define GLOB_STAR	-2	/* '*' */
+
+struct compiled_glob {
+    int len;
+    short tok[1];	/* literal chars (0-255) or GLOB_ANY / GLOB_STAR */
+};
+
+static struct compiled_glob *compile_glob(const char *pat, int casemap)
 {
-    const char *p;
-    const char *t;
-    char c;
-
-    t = text;
-    p = pat;
-    for (;;) {
-	if (*p == '\0') {
-	    /* ran out of pattern */
-	    return (*t == '\0');
-	}
-	c = *p++;
-	switch (c) {
+    struct compiled_glob *g;
+    int len = 0;
+
+    g = (struct compiled_glob *) xmalloc(sizeof(struct compiled_glob) 
+					 + strlen(pat) * sizeof(short));
+    for (; *pat != '\0'; pat++) {
+	switch (*pat) {
+	case '*':
+	    if (len == 0 || g->tok[len-1] != GLOB_STAR)
+		g->tok[len++] = GLOB_STAR;
+	    break;
 	case '?':
-	    if (*t == '\0') {
-		return 0;
-	    }
-	    t++;
+	    g->tok[len++] = GLOB_ANY;
 	    break;
-	case '*':
-	    while (*p == '*' || *p == '?') {
-		if (*p == '?') {
-		    /* eat the character now */
-		    if (*t == '\0') {
-			return 0;
-		    }
-		    t++;
-		}
-		/* coalesce into a single wildcard */
-		p++;
-	    }
-	    if (*p == '\0') {
-		/* wildcard at end of string, any remaining text is ok */
-		return 1;
-	    }
-
-	    while (*t != '\0') {
-		/* recurse */
-		if (octet_matches_(p, t, casemap)) return 1;
-		t++;
-	    }
 	case '\\':
-	    p++;
+	    /* the escaped char is taken literally */
+	    if (pat[1] != '\0')
+		pat++;
 	    /* falls through */
 	default:
-	    if (casemap && (toupper((int)(unsigned char)c) ==
-			    toupper((int)(unsigned char)*t))) {
-		t++;
-	    } else if (!casemap && (c == *t)) {
-		t++;
-	    } else {
-		/* literal char doesn't match */
-		return 0;
-	    }
+	    g->tok[len++] = casemap 
+		? tolower((int)(unsigned char)*pat) 
+		: (unsigned char)*pat;
 	}
     }
-    /* never reaches */
-    abort();
+    g->len = len;
+    return g;
+}
+
+static int glob_matches(const struct compiled_glob *g, const char *text, 
+			int casemap)
+{
+    const short *p = g->tok;
+    const short *end = g->tok + g->len;
+    const short *starp = NULL;	/* token after the last star */
+    const char *start = NULL;	/* text the last star is trying to skip */
+
+    while (*text != '\0') {
+	int c = casemap 
+	    ? tolower((int)(unsigned char)*text) 
+	    : (unsigned char)*text;
+	if (p < end && (*p == GLOB_ANY || *p == c)) {
+	    p++;
+	    text++;
+	} else if (p < end && *p == GLOB_STAR) {
+	    starp = ++p;
+	    start = text;
+	} else if (starp != NULL) {
+	    /* let the last star swallow one more char and retry */
+	    p = starp;
+	    text = ++start;
+	} else {
+	    return 0;
+	}
+    }
+    while (p < end && *p == GLOB_STAR)
+	p++;
+    return (p == end);
 }
 
 static int octet_matches(const char *pat, const char *text)
 {
-    return octet_matches_(pat, text, 0);
+    return glob_matches((const struct compiled_glob *) pat, text, 0);
 }
 
 #ifdef ENABLE_REGEX
@@ -154,60 +170,76 @@ static int oct_le(const char *pat, const char *text)
 
 /* --- i;ascii-casemap comparators --- */
 
+/* all ascii-casemap patterns have been folded to lowercase by 
+   prepare_pattern(), so only the text needs to be folded here */
+
 /* sheer brute force */
 static int ascii_casemap_contains(const char *pat, const char *text)
 {
-    int N = strlen(text);
-    int M = strlen(pat);
-    int i, j;
-
-    i = 0, j = 0;
-    while ((j < M) && (i < N)) {
-	if (toupper((int)(unsigned char)text[i]) ==
-	    toupper((int)(unsigned char)pat[j])) {
-	    i++; j++;
-	} else {
-	    i = i - j + 1;
-	    j = 0;
-	}
+    const char *p, *t;
+
+    if (*pat == '\0')
+	return 1;
+    for (; *text != '\0'; text++) {
+	for (p = pat, t = text; 
+	     *p != '\0' && tolower((int)(unsigned char)*t) == (unsigned char)*p; 
+	     p++, t++)
+	    ;
+	if (*p == '\0')
+	    return 1; /* we found a match! */
+	if (*t == '\0')
+	    return 0; /* the rest of the text is too short */
     }
-    return (j == M); /* we found a match! */
+    return 0;
 }
 
 static int ascii_casemap_matches(const char *pat, const char *text)
 {
-    return octet_matches_(pat, text, 1);
+    return glob_matches((const struct compiled_glob *) pat, text, 1);
+}
+
+/* like strcasecmp(text, pat), but with a pre-folded pattern */
+static int acase_cmp(const char *text, const char *pat)
+{
+    int diff;
+
+    while ((diff = tolower((int)(unsigned char)*text) 
+		   - (unsigned char)*pat) == 0 && *pat != '\0') {
+	text++;
+	pat++;
+    }
+    return diff;
 }
 
 /* these are relational wrappers for ascii-casemap comparisons */
 static int acase_eq(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) == 0);
+    return (acase_cmp(text, pat) == 0);
 }
 
 static int acase_ne(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) != 0);
+    return (acase_cmp(text, pat) != 0);
 }
 
 static int acase_gt(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) > 0);
+    return (acase_cmp(text, pat) > 0);
 }
 
 static int acase_ge(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) >= 0);
+    return (acase_cmp(text, pat) >= 0);
 }
 
 static int acase_lt(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) < 0);
+    return (acase_cmp(text, pat) < 0);
 }
 
 static int acase_le(const char *pat, const char *text)
 {
-    return (strcasecmp(text, pat) <= 0);
+    return (acase_cmp(text, pat) <= 0);
 }
 
 
@@ -379,3 +411,30 @@ comparator_t *lookup_comp(const char *comp, int mode, int relation)
     }
     return ret;
 }
+
+void *prepare_pattern(const char *comp, int mode, void *pat)
+{
+    int casemap = !strcmp(comp, "i;ascii-casemap");
+    char *s = (char *) pat;
+
+    if (pat == NULL || (!casemap && strcmp(comp, "i;octet")))
+	return pat;	/* i;ascii-numeric uses the pattern as is */
+
+    switch (mode) {
+    case MATCHES: {
+	struct compiled_glob *g = compile_glob(s, casemap);
+	free(s);
+	return g;
+    }
+    case IS:
+    case CONTAINS:
+    case VALUE:
+	if (casemap) {
+	    for (; *s != '\0'; s++)
+		*s = tolower((int)(unsigned char)*s);
+	}
+	break;
+    }
+    /* regexes have been compiled by the parser already */
+    return pat;
+}
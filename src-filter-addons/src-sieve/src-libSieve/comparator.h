@@ -39,4 +39,10 @@ typedef int comparator_t(const char *, const char *);
 /* returns a pointer to a comparator function given it's name */
 comparator_t *lookup_comp(const char *comp, int mode, int relation);
 
+/* converts the given pattern into the form expected by the comparator
+   for comp & mode (folding case, compiling globs), such that this work 
+   doesn't have to be done for each comparison. The returned pattern
+   replaces the given one (which may have been freed). */
+void *prepare_pattern(const char *comp, int mode, void *pat);
+
 #endif
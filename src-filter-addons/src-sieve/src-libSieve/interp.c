@@ -62,6 +62,7 @@ int sieve_interp_alloc(sieve_interp_t **interp, void *interp_context)
     i->notify = NULL;
 
     i->curflags.flag = NULL; i->curflags.nflags = 0;
+    i->addrcache = NULL;
     i->markflags = NULL;
 
     i->interp_context = interp_context;
@@ -44,6 +44,9 @@ struct sieve_interp {
     /* current imapflags state */
     sieve_imapflags_t curflags;
 
+    /* addresses parsed during the current execution */
+    struct address_cache *addrcache;
+
     /* site-specific imapflags for mark/unmark */
     sieve_imapflags_t *markflags;
 
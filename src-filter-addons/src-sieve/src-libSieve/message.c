@@ -526,6 +526,87 @@ int free_address(void **data, void **marker)
     return SIEVE_OK;
 }
 
+/* [zooey]:
+	address tests used to parse every header value again for each pattern
+	of each test. Now the address parts of a header value are extracted 
+	only once per script execution and then served from this cache 
+	(one entry per distinct header value, the parts are collected when 
+	they are asked for the first time).
+*/
+#define ADDRESS_PART_COUNT (ADDRESS_DETAIL + 1)
+
+struct address_cache {
+    char *header;		/* the header value that has been parsed */
+    char **parts[ADDRESS_PART_COUNT];
+				/* NULL-terminated lists of address parts */
+    struct address_cache *next;
+};
+
+static char **collect_address_parts(const char *header, 
+				    address_part_t addrpart)
+{
+    void *data = NULL, *marker = NULL;
+    char *val;
+    char **parts;
+    int count = 0, size = 4;
+
+    parts = (char **) xmalloc(size * sizeof(char *));
+    parse_address(header, &data, &marker);
+    /* like evaltest used to do, stop at the first address that lacks 
+       the requested part */
+    while ((val = get_address(addrpart, &data, &marker, 0)) != NULL) {
+	if (count + 1 == size)
+	    parts = (char **) xrealloc(parts, (size *= 2) * sizeof(char *));
+	parts[count++] = xstrdup(val);
+    }
+    parts[count] = NULL;
+    free_address(&data, &marker);
+    return parts;
+}
+
+/* returns the list of addrpart-parts of the addresses in the given 
+   header value */
+char * const *get_cached_addresses(address_cache_t **cache, 
+				   const char *header, 
+				   address_part_t addrpart)
+{
+    address_cache_t *ac;
+
+    for (ac = *cache; ac != NULL; ac = ac->next) {
+	if (!strcmp(ac->header, header))
+	    break;
+    }
+    if (ac == NULL) {
+	ac = (address_cache_t *) xmalloc(sizeof(address_cache_t));
+	memset(ac->parts, 0, sizeof(ac->parts));
+	ac->header = xstrdup(header);
+	ac->next = *cache;
+	*cache = ac;
+    }
+    if (ac->parts[addrpart] == NULL)
+	ac->parts[addrpart] = collect_address_parts(header, addrpart);
+    return ac->parts[addrpart];
+}
+
+void free_address_cache(address_cache_t **cache)
+{
+    while (*cache) {
+	address_cache_t *ac = *cache;
+	int p, v;
+
+	*cache = ac->next;
+	for (p = 0; p < ADDRESS_PART_COUNT; p++) {
+	    if (ac->parts[p] == NULL)
+		continue;
+	    for (v = 0; ac->parts[p][v] != NULL; v++)
+		free(ac->parts[p][v]);
+	    free(ac->parts[p]);
+	}
+	free(ac->header);
+	free(ac);
+    }
+}
+
 notify_list_t *new_notify_list(void)    
 {
     notify_list_t *ret = xmalloc(sizeof(notify_list_t));
@@ -105,6 +105,14 @@ int parse_address(const char *header, void **data, void **marker);
 char *get_address(address_part_t addrpart, void **data, void **marker,
 		  int canon_domain);
 int free_address(void **data, void **marker);
+
+/* parsed addresses, cached for the duration of one script execution */
+typedef struct address_cache address_cache_t;
+
+char * const *get_cached_addresses(address_cache_t **cache, 
+				   const char *header, 
+				   address_part_t addrpart);
+void free_address_cache(address_cache_t **cache);
 notify_list_t *new_notify_list(void);
 void free_notify_list(notify_list_t *n);
 
@@ -116,13 +116,11 @@ int script_require(sieve_script_t *s, char *req)
     return 0;
 }
 
-/* given an interpretor and a script, produce an executable script */
-int sieve_script_parse(sieve_interp_t *interp, FILE *script,
-		       void *script_context, sieve_script_t **ret)
+static int new_script(sieve_interp_t *interp, void *script_context,
+		      sieve_script_t **ret)
 {
     sieve_script_t *s;
     int res = SIEVE_OK;
-    extern int sievelineno;
 
     res = interp_verify(interp);
     if (res != SIEVE_OK) {
@@ -136,19 +134,86 @@ int sieve_script_parse(sieve_interp_t *interp, FILE *script,
     memset(&s->support, 0, sizeof(struct sieve_support));
 
     s->err = 0;
+    s->cmds = NULL;
+    s->shares_cmds = 0;
 
-    sievelineno = 1;		/* reset line number */
-    s->cmds = sieve_parse(s, script);
+    *ret = s;
+    return SIEVE_OK;
+}
+
+static int finish_script(sieve_script_t *s)
+{
     if (s->err > 0) {
 	if (s->cmds) {
 	    free_tree(s->cmds);
 	}
 	s->cmds = NULL;
-	res = SIEVE_PARSE_ERROR;
+	return SIEVE_PARSE_ERROR;
     }
+    return SIEVE_OK;
+}
+
+/* given an interpretor and a script, produce an executable script */
+int sieve_script_parse(sieve_interp_t *interp, FILE *script,
+		       void *script_context, sieve_script_t **ret)
+{
+    sieve_script_t *s;
+    int res = new_script(interp, script_context, &s);
+    if (res != SIEVE_OK) {
+	return res;
+    }
+
+    s->cmds = sieve_parse(s, script);
 
     *ret = s;
-    return res;
+    return finish_script(s);
+}
+
+/* same as sieve_script_parse(), but reads the script from the given buffer */
+int sieve_script_parse_buffer(sieve_interp_t *interp, const char *script,
+			      int len, void *script_context, 
+			      sieve_script_t **ret)
+{
+    sieve_script_t *s;
+    int res = new_script(interp, script_context, &s);
+    if (res != SIEVE_OK) {
+	return res;
+    }
+
+    s->cmds = sieve_parse_buffer(s, script, len);
+
+    *ret = s;
+    return finish_script(s);
+}
+
+/* [zooey]:
+	produces a script that shares the compiled commands of the given one,
+	but uses its own interpretor and script context. This way, a script
+	needs to be parsed only once, even if it is used by several filters.
+	The original script must outlive all its clones.
+*/
+int sieve_script_clone(sieve_script_t *s, sieve_interp_t *interp,
+		       void *script_context, sieve_script_t **ret)
+{
+    sieve_script_t *c;
+    int res;
+
+    if (s->err > 0) {
+	return SIEVE_PARSE_ERROR;
+    }
+    res = interp_verify(interp);
+    if (res != SIEVE_OK) {
+	return res;
+    }
+
+    c = (sieve_script_t *) xmalloc(sizeof(sieve_script_t));
+    *c = *s;
+    c->interp = *interp;
+    c->script_context = script_context;
+    c->shares_cmds = 1;
+
+    *ret = c;
+    return SIEVE_OK;
 }
 
 char **stringlist_to_chararray(stringlist_t **list)
@@ -190,7 +255,7 @@ char **stringlist_to_chararray(stringlist_t **list)
 int sieve_script_free(sieve_script_t **s)
 {
     if (*s) {
-	if ((*s)->cmds) {
+	if ((*s)->cmds && !(*s)->shares_cmds) {
 	    free_tree((*s)->cmds);
 	}
 	free(*s);
@@ -294,20 +359,19 @@ static int evaltest(sieve_interp_t *i, test_t *t, void *m)
 	    for (pl = t->u.ae.pl; pl != NULL && !res; pl = pl->next) {
 		for (l = 0; body[l] != NULL && !res; l++) {
 		    /* loop through each header */
-		    void *data = NULL, *marker = NULL;
-		    char *val;
+		    char * const *val;
+		    int v;
 
-		    parse_address(body[l], &data, &marker);
-                    val = get_address(addrpart, &data, &marker, 0);
-		    while (val != NULL && !res) { 
+		    /* the addresses of each header value are parsed only once
+		       per execution */
+		    val = get_cached_addresses(&i->addrcache, body[l], addrpart);
+		    for (v = 0; val[v] != NULL && !res; v++) { 
 			/* loop through each address */
 			if (t->u.h.comptag == COUNT)
 			    count++;
 			else
-			    res |= t->u.ae.comp(pl->p, val);
-			val = get_address(addrpart, &data, &marker, 0);
+			    res |= t->u.ae.comp(pl->p, val[v]);
        		    }
-		    free_address(&data, &marker);
 		}
 		if (t->u.h.comptag == COUNT)
 		    break;
@@ -870,34 +934,22 @@ static int makehash(unsigned char hash[HASHSIZE], char *s1, char *s2)
     return SIEVE_OK;
 }
 
-/* execute a script on a message, producing side effects via callbacks.
-   it is the responsibility of the caller to save a message if this
-   returns anything but SIEVE_OK. */
-int sieve_execute_script(sieve_script_t *s, void *message_context)
+/* execute a script on one message, using the given copy of the interpretor
+   and the given (empty) action and notify lists. all of them are reset
+   by reset_execution() before the next message is executed. */
+static int execute_on_message(sieve_script_t *s, sieve_interp_t *interp,
+			      action_list_t *actions, 
+			      notify_list_t *notify_list,
+			      void *message_context)
 {
     int ret = 0;
     int implicit_keep = 0;
-    action_list_t *actions = NULL, *a;
+    action_list_t *a;
     action_t lastaction = ACTION_NULL;
-    notify_list_t *notify_list = NULL;
     char actions_string[BUF_SZ+1] = "";
     const char *errmsg = NULL;
 
-    if (s->support.notify) {
-	notify_list = new_notify_list();
-	if (notify_list == NULL)
-	    return SIEVE_NOMEM;
-    }
-
-    actions = new_action_list();
-    if (actions == NULL) {
-	ret = SIEVE_NOMEM;
-	goto error;
-    }
- 
-    free_imapflags(&s->interp.curflags);
- 
-    if (eval(&s->interp, s->cmds, message_context, actions,
+    if (eval(interp, s->cmds, message_context, actions,
 	     notify_list, &errmsg) < 0)
 	return SIEVE_RUN_ERROR;
   
@@ -1069,14 +1121,14 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
 
  
 	case ACTION_SETFLAG:
-	    free_imapflags(&s->interp.curflags);
-	    ret = sieve_addflag(&s->interp.curflags, a->u.fla.flag);
+	    free_imapflags(&interp->curflags);
+	    ret = sieve_addflag(&interp->curflags, a->u.fla.flag);
 	    break;
 	case ACTION_ADDFLAG:
-	    ret = sieve_addflag(&s->interp.curflags, a->u.fla.flag);
+	    ret = sieve_addflag(&interp->curflags, a->u.fla.flag);
 	    break;
 	case ACTION_REMOVEFLAG:
-	    ret = sieve_removeflag(&s->interp.curflags, a->u.fla.flag);
+	    ret = sieve_removeflag(&interp->curflags, a->u.fla.flag);
 	    break;
 	case ACTION_MARK:
 	    {
@@ -1084,7 +1136,7 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
 
 		ret = SIEVE_OK;
 		while (n && ret == SIEVE_OK) {
-		    ret = sieve_addflag(&s->interp.curflags,
+		    ret = sieve_addflag(&interp->curflags,
 					s->interp.markflags->flag[--n]);
 		}
 		break;
@@ -1095,7 +1147,7 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
 
 		ret = SIEVE_OK;
 		while (n && ret == SIEVE_OK) {
-		    ret = sieve_removeflag(&s->interp.curflags,
+		    ret = sieve_removeflag(&interp->curflags,
 					   s->interp.markflags->flag[--n]);
 		}
 		break;
@@ -1177,7 +1229,7 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
 
 	implicit_keep = 0;	/* don't try an implicit keep again */
 
-	keep_context.imapflags = &s->interp.curflags;
+	keep_context.imapflags = &interp->curflags;
  
 	lastaction = ACTION_KEEP;
 	keep_ret = s->interp.keep(&keep_context, s->interp.interp_context,
@@ -1198,7 +1250,7 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
     }
 
     /* Process notify actions */
-    if (s->support.notify && notify_list) {
+    if (s->support.notify && notify_list && notify_list->next) {
 	notify_list_t *n = notify_list;
 	int notify_ret = SIEVE_OK;
 
@@ -1212,16 +1264,90 @@ int sieve_execute_script(sieve_script_t *s, void *message_context)
 	    n = n->next;
 	}
 
-	if (notify_list) free_notify_list(notify_list);
-	notify_list = NULL;	/* don't try any notifications again */
+	/* don't try any notifications again */
+	free_notify_list(notify_list->next);
+	notify_list->next = NULL;
 
 	if (notify_ret != SIEVE_OK) {
 	    goto error;		/* process the notify error */
 	}
     }
  
-    if (actions)
-	free_action_list(actions);
-  
+    return ret;
+}
+
+/* drop everything the execution of a script on one message has left in
+   the given copy of the interpretor and the given lists. */
+static void reset_execution(sieve_interp_t *interp, action_list_t *actions, 
+			    notify_list_t *notify_list)
+{
+    free_action_list(actions->next);
+    actions->next = NULL;
+    if (notify_list) {
+	free_notify_list(notify_list->next);
+	notify_list->next = NULL;
+    }
+    free_imapflags(&interp->curflags);
+    free_address_cache(&interp->addrcache);
+}
+
+/* execute a script on a message, producing side effects via callbacks.
+   it is the responsibility of the caller to save a message if this
+   returns anything but SIEVE_OK. */
+int sieve_execute_script(sieve_script_t *s, void *message_context)
+{
+    return sieve_execute_script_batch(s, &message_context, 1, NULL);
+}
+
+/* execute a script on several messages, one after the other. the copy of
+   the interpretor and the action and notify lists are set up only once
+   and reused for every message. if results is given, results[i] receives 
+   the result for message_contexts[i]. returns SIEVE_OK if the script has 
+   been executed successfully on all messages. */
+int sieve_execute_script_batch(sieve_script_t *s, void **message_contexts,
+			       int count, int *results)
+{
+    int ret = SIEVE_OK;
+    int res;
+    int i;
+    action_list_t *actions = NULL;
+    notify_list_t *notify_list = NULL;
+    sieve_interp_t interp;
+
+    /* [zooey]:
+	the imapflags used to live in the script's interpretor, which meant
+	that a script could only be executed by one thread at a time. Now
+	every execution works on a private copy of the interpretor, such 
+	that the script itself is never modified during execution. */
+    interp = s->interp;
+    interp.curflags.flag = NULL;
+    interp.curflags.nflags = 0;
+    interp.addrcache = NULL;
+
+    if (s->support.notify) {
+	notify_list = new_notify_list();
+	if (notify_list == NULL)
+	    return SIEVE_NOMEM;
+    }
+
+    actions = new_action_list();
+    if (actions == NULL) {
+	if (notify_list) free_notify_list(notify_list);
+	return SIEVE_NOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+	res = execute_on_message(s, &interp, actions, notify_list,
+				 message_contexts[i]);
+	reset_execution(&interp, actions, notify_list);
+	if (results)
+	    results[i] = res;
+	if (res != SIEVE_OK)
+	    ret = res;
+    }
+
+    free_action_list(actions);
+    if (notify_list) free_notify_list(notify_list);
+
     return ret;
 }
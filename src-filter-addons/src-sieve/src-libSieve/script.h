@@ -50,12 +50,24 @@ struct sieve_script {
 
     void *script_context;
     commandlist_t *cmds;
+    int shares_cmds;		/* cmds belong to another script (a clone) */
 
     int err;
 };
 
+/* state of a single parse, shared by parser and lexer */
+struct sieve_parse_state {
+    sieve_script_t *script;	/* the script being parsed */
+    commandlist_t *ret;		/* the commands parsed so far */
+
+    char *mlbuf;		/* the string currently being scanned */
+    size_t mlbufsz, mlcur;
+};
+
 /* generated by the yacc script */
 commandlist_t *sieve_parse(sieve_script_t *interp, FILE *f);
+commandlist_t *sieve_parse_buffer(sieve_script_t *interp, 
+				  const char *buf, int len);
 int script_require(sieve_script_t *s, char *req);
 
 #endif
@@ -43,8 +43,16 @@ OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include "imparse.h"
 
 /* definitions */
-int addrparse(void);
-void reset_sieve_lexer( FILE* sievein);
+int check_address_syntax(const char *addr, char **errmsg);
+
+/* the lexer is reentrant, all state of a parse is kept in the scanner 
+   and the parse state attached to it */
+void *new_sieve_scanner(struct sieve_parse_state *ps, FILE *f);
+void *new_sieve_buffer_scanner(struct sieve_parse_state *ps,
+			       const char *buf, int len);
+void free_sieve_scanner(void *scanner);
+struct sieve_parse_state *sieveget_extra(void *scanner);
+int sieveget_lineno(void *scanner);
 
 struct vtags {
     int days;
@@ -81,12 +89,11 @@ struct dtags {
     char *priority;
 };
 
-static commandlist_t *ret;
-static sieve_script_t *parse_script;
-static int check_reqs(stringlist_t *sl);
-static test_t *build_address(int t, struct aetags *ae,
+static sieve_script_t *parse_script(void *scanner);
+static int check_reqs(void *scanner, stringlist_t *sl);
+static test_t *build_address(void *scanner, int t, struct aetags *ae,
 			     stringlist_t *sl, patternlist_t *pl);
-static test_t *build_header(int t, struct htags *h,
+static test_t *build_header(void *scanner, int t, struct htags *h,
 			    stringlist_t *sl, patternlist_t *pl);
 static commandlist_t *build_vacation(int t, struct vtags *h, char *s);
 static commandlist_t *build_notify(int t, struct ntags *n);
@@ -98,7 +105,7 @@ static struct htags *new_htags(void);
 static struct htags *canon_htags(struct htags *h);
 static void free_htags(struct htags *h);
 static struct vtags *new_vtags(void);
-static struct vtags *canon_vtags(struct vtags *v);
+static struct vtags *canon_vtags(void *scanner, struct vtags *v);
 static void free_vtags(struct vtags *v);
 static struct ntags *new_ntags(void);
 static struct ntags *canon_ntags(struct ntags *n);
@@ -106,24 +113,28 @@ static void free_ntags(struct ntags *n);
 static struct dtags *new_dtags(void);
 static void free_dtags(struct dtags *d);
 
-static int verify_stringlist(stringlist_t *sl, int (*verify)(char *));
-static int verify_mailbox(char *s);
-static int verify_address(char *s);
-static int verify_header(char *s);
-static int verify_flag(char *s);
-static int verify_relat(char *s);
+static int verify_stringlist(void *scanner, stringlist_t *sl,
+			     int (*verify)(void *, char *));
+static int verify_mailbox(void *scanner, char *s);
+static int verify_address(void *scanner, char *s);
+static int verify_header(void *scanner, char *s);
+static int verify_flag(void *scanner, char *s);
+static int verify_relat(void *scanner, char *s);
 #ifdef ENABLE_REGEX
-static regex_t *verify_regex(char *s, int cflags);
-static patternlist_t *verify_regexs(stringlist_t *sl, char *comp);
+static regex_t *verify_regex(void *scanner, char *s, int cflags);
+static patternlist_t *verify_regexs(void *scanner, stringlist_t *sl, char *comp);
 #endif
 static int ok_header(char *s);
 
-extern int sieveerror(const char *msg);
-extern int sievelex(void);
+extern int sieveerror(void *scanner, const char *msg);
 
 #define YYERROR_VERBOSE /* i want better error messages! */
 %}
 
+%pure-parser
+%parse-param { void *scanner }
+%lex-param { void *scanner }
+
 %union {
     int nval;
     char *sval;
@@ -138,6 +149,10 @@ extern int sievelex(void);
     struct dtags *dtag;
 }
 
+%{
+extern int sievelex(YYSTYPE *lvalp, void *scanner);
+%}
+
 %token <nval> NUMBER
 %token <sval> STRING
 %token IF ELSIF ELSE
@@ -165,16 +180,16 @@ extern int sievelex(void);
 
 %%
 
-start: /* empty */		{ ret = NULL; }
-	| reqs commands		{ ret = $2; }
+start: /* empty */		{ sieveget_extra(scanner)->ret = NULL; }
+	| reqs commands		{ sieveget_extra(scanner)->ret = $2; }
 	;
 
 reqs: /* empty */
 	| require reqs
 	;
 
-require: REQUIRE stringlist ';'	{ if (!check_reqs($2)) {
-                                    sieveerror("unsupported feature");
+require: REQUIRE stringlist ';'	{ if (!check_reqs(scanner, $2)) {
+                                    sieveerror(scanner, "unsupported feature");
 				    YYERROR; 
                                   } }
 	;
@@ -193,84 +208,84 @@ elsif: /* empty */               { $$ = NULL; }
 	| ELSE block             { $$ = $2; }
 	;
 
-action: REJCT STRING             { if (!parse_script->support.reject) {
-				     sieveerror("reject not required");
+action: REJCT STRING             { if (!parse_script(scanner)->support.reject) {
+				     sieveerror(scanner, "reject not required");
 				     YYERROR;
 				   }
 				   $$ = new_command(REJCT); $$->u.str = $2; }
-	| FILEINTO STRING	 { if (!parse_script->support.fileinto) {
-				     sieveerror("fileinto not required");
+	| FILEINTO STRING	 { if (!parse_script(scanner)->support.fileinto) {
+				     sieveerror(scanner, "fileinto not required");
 	                             YYERROR;
                                    }
-				   if (!verify_mailbox($2)) {
+				   if (!verify_mailbox(scanner, $2)) {
 				     YYERROR; /* vm should call sieveerror() */
 				   }
 	                           $$ = new_command(FILEINTO);
 				   $$->u.str = $2; }
 	| REDIRECT STRING         { $$ = new_command(REDIRECT);
-				   if (!verify_address($2)) {
+				   if (!verify_address(scanner, $2)) {
 				     YYERROR; /* va should call sieveerror() */
 				   }
 				   $$->u.str = $2; }
 	| KEEP			 { $$ = new_command(KEEP); }
 	| STOP			 { $$ = new_command(STOP); }
 	| DISCARD		 { $$ = new_command(DISCARD); }
-	| VACATION vtags STRING  { if (!parse_script->support.vacation) {
-				     sieveerror("vacation not required");
+	| VACATION vtags STRING  { if (!parse_script(scanner)->support.vacation) {
+				     sieveerror(scanner, "vacation not required");
 				     $$ = new_command(VACATION);
 				     YYERROR;
 				   } else {
   				     $$ = build_vacation(VACATION,
-					    canon_vtags($2), $3);
+					    canon_vtags(scanner, $2), $3);
 				   } }
-        | SETFLAG stringlist     { if (!parse_script->support.imapflags) {
-                                    sieveerror("imapflags not required");
+        | SETFLAG stringlist     { if (!parse_script(scanner)->support.imapflags) {
+                                    sieveerror(scanner, "imapflags not required");
                                     YYERROR;
                                    }
-                                  if (!verify_stringlist($2, verify_flag)) {
+                                  if (!verify_stringlist(scanner, $2, verify_flag)) {
                                     YYERROR; /* vf should call sieveerror() */
                                   }
                                   $$ = new_command(SETFLAG);
                                   $$->u.sl = $2; }
-         | ADDFLAG stringlist     { if (!parse_script->support.imapflags) {
-                                    sieveerror("imapflags not required");
+         | ADDFLAG stringlist     { if (!parse_script(scanner)->support.imapflags) {
+                                    sieveerror(scanner, "imapflags not required");
                                     YYERROR;
                                     }
-                                  if (!verify_stringlist($2, verify_flag)) {
+                                  if (!verify_stringlist(scanner, $2, verify_flag)) {
                                     YYERROR; /* vf should call sieveerror() */
                                   }
                                   $$ = new_command(ADDFLAG);
                                   $$->u.sl = $2; }
-         | REMOVEFLAG stringlist  { if (!parse_script->support.imapflags) {
-                                    sieveerror("imapflags not required");
+         | REMOVEFLAG stringlist  { if (!parse_script(scanner)->support.imapflags) {
+                                    sieveerror(scanner, "imapflags not required");
                                     YYERROR;
                                     }
-                                  if (!verify_stringlist($2, verify_flag)) {
+                                  if (!verify_stringlist(scanner, $2, verify_flag)) {
                                     YYERROR; /* vf should call sieveerror() */
                                   }
                                   $$ = new_command(REMOVEFLAG);
                                   $$->u.sl = $2; }
-         | MARK                   { if (!parse_script->support.imapflags) {
-                                    sieveerror("imapflags not required");
+         | MARK                   { if (!parse_script(scanner)->support.imapflags) {
+                                    sieveerror(scanner, "imapflags not required");
                                     YYERROR;
                                     }
                                   $$ = new_command(MARK); }
-         | UNMARK                 { if (!parse_script->support.imapflags) {
-                                    sieveerror("imapflags not required");
+         | UNMARK                 { if (!parse_script(scanner)->support.imapflags) {
+                                    sieveerror(scanner, "imapflags not required");
                                     YYERROR;
                                     }
                                   $$ = new_command(UNMARK); }
 
-         | NOTIFY ntags           { if (!parse_script->support.notify) {
-				       sieveerror("notify not required");
+         | NOTIFY ntags           { if (!parse_script(scanner)->support.notify) {
+				       sieveerror(scanner, "notify not required");
 				       $$ = new_command(NOTIFY); 
 				       YYERROR;
 	 			    } else {
 				      $$ = build_notify(NOTIFY,
 				             canon_ntags($2));
 				    } }
-         | DENOTIFY dtags         { if (!parse_script->support.notify) {
-                                       sieveerror("notify not required");
+         | DENOTIFY dtags         { if (!parse_script(scanner)->support.notify) {
+                                       sieveerror(scanner, "notify not required");
 				       $$ = new_command(DENOTIFY);
 				       YYERROR;
 				    } else {
@@ -280,28 +295,28 @@ action: REJCT STRING             { if (!parse_script->support.reject) {
 
 ntags: /* empty */		 { $$ = new_ntags(); }
 	| ntags ID STRING	 { if ($$->id != NULL) { 
-					sieveerror("duplicate :method"); YYERROR; }
+					sieveerror(scanner, "duplicate :method"); YYERROR; }
 				   else { $$->id = $3; } }
 	| ntags METHOD STRING	 { if ($$->method != NULL) { 
-					sieveerror("duplicate :method"); YYERROR; }
+					sieveerror(scanner, "duplicate :method"); YYERROR; }
 				   else { $$->method = $3; } }
 	| ntags OPTIONS stringlist { if ($$->options != NULL) { 
-					sieveerror("duplicate :options"); YYERROR; }
+					sieveerror(scanner, "duplicate :options"); YYERROR; }
 				     else { $$->options = $3; } }
 	| ntags priority	 { if ($$->priority != NULL) { 
-					sieveerror("duplicate :priority"); YYERROR; }
+					sieveerror(scanner, "duplicate :priority"); YYERROR; }
 				   else { $$->priority = $2; } }
 	| ntags MESSAGE STRING	 { if ($$->message != NULL) { 
-					sieveerror("duplicate :message"); YYERROR; }
+					sieveerror(scanner, "duplicate :message"); YYERROR; }
 				   else { $$->message = $3; } }
 	;
 
 dtags: /* empty */		 { $$ = new_dtags(); }
 	| dtags priority	 { if ($$->priority != NULL) { 
-				sieveerror("duplicate priority level"); YYERROR; }
+				sieveerror(scanner, "duplicate priority level"); YYERROR; }
 				   else { $$->priority = $2; } }
 	| dtags comptag STRING 	 { if ($$->comptag != -1) { 
-			sieveerror("duplicate comparator type tag"); YYERROR;
+			sieveerror(scanner, "duplicate comparator type tag"); YYERROR;
 				   } else {
 				       $$->comptag = $2;
 #ifdef ENABLE_REGEX
@@ -309,7 +324,7 @@ dtags: /* empty */		 { $$ = new_dtags(); }
 					   int cflags = REG_EXTENDED |
 					       REG_NOSUB | REG_ICASE;
 					   $$->pattern =
-					       (void*) verify_regex($3, cflags);
+					       (void*) verify_regex(scanner, $3, cflags);
 					   if (!$$->pattern) { YYERROR; }
 				       }
 				       else
@@ -319,10 +334,10 @@ dtags: /* empty */		 { $$ = new_dtags(); }
 				}
 	| dtags relcomp STRING  { $$ = $1;
 				  if ($$->comptag != -1) { 
-				      sieveerror("duplicate comparator type tag"); YYERROR; 
+				      sieveerror(scanner, "duplicate comparator type tag"); YYERROR; 
 				  } else {
 				      $$->comptag = $2;
-				      $$->relation = verify_relat($3);
+				      $$->relation = verify_relat(scanner, $3);
 				      if ($$->relation==-1) 
 				      {
 				      	  YYERROR; /*vr called sieveerror()*/ 
@@ -338,24 +353,24 @@ priority: LOW    { $$ = "low"; }
 
 vtags: /* empty */		 { $$ = new_vtags(); }
 	| vtags DAYS NUMBER	 { if ($$->days != -1) { 
-					sieveerror("duplicate :days"); YYERROR; }
+					sieveerror(scanner, "duplicate :days"); YYERROR; }
 				   else { $$->days = $3; } }
 	| vtags ADDRESSES stringlist { if ($$->addresses != NULL) { 
-					sieveerror("duplicate :addresses"); 
+					sieveerror(scanner, "duplicate :addresses"); 
 					YYERROR;
-				       } else if (!verify_stringlist($3,
+				       } else if (!verify_stringlist(scanner, $3,
 							verify_address)) {
 					  YYERROR;
 				       } else {
 					 $$->addresses = $3; } }
 	| vtags SUBJECT STRING	 { if ($$->subject != NULL) { 
-					sieveerror("duplicate :subject"); 
+					sieveerror(scanner, "duplicate :subject"); 
 					YYERROR;
 				   } else if (!ok_header($3)) {
 					YYERROR;
 				   } else { $$->subject = $3; } }
 	| vtags MIME		 { if ($$->mime != -1) { 
-					sieveerror("duplicate :mime"); 
+					sieveerror(scanner, "duplicate :mime"); 
 					YYERROR; }
 				   else { $$->mime = MIME; } }
 	;
@@ -379,39 +394,39 @@ test: ANYOF testlist		 { $$ = new_test(ANYOF); $$->u.tl = $2; }
 	| STRUE			 { $$ = new_test(STRUE); }
 	| HEADER htags stringlist stringlist
 				 { patternlist_t *pl;
-                                   if (!verify_stringlist($3, verify_header)) {
+                                   if (!verify_stringlist(scanner, $3, verify_header)) {
                                      YYERROR; /* vh should call sieveerror() */
                                    }
 
 				   $2 = canon_htags($2);
 #ifdef ENABLE_REGEX
 				   if ($2->comptag == REGEX) {
-				     pl = verify_regexs($4, $2->comparator);
+				     pl = verify_regexs(scanner, $4, $2->comparator);
 				     if (!pl) { YYERROR; }
 				   }
 				   else
 #endif
 				     pl = (patternlist_t *) $4;
 				       
-				   $$ = build_header(HEADER, $2, $3, pl);
+				   $$ = build_header(scanner, HEADER, $2, $3, pl);
 				   if ($$ == NULL) { YYERROR; } }
 	| addrorenv aetags stringlist stringlist
 				 { patternlist_t *pl;
-                                   if (!verify_stringlist($3, verify_header)) {
+                                   if (!verify_stringlist(scanner, $3, verify_header)) {
                                      YYERROR; /* vh should call sieveerror() */
                                    }
 
 				   $2 = canon_aetags($2);
 #ifdef ENABLE_REGEX
 				   if ($2->comptag == REGEX) {
-				     pl = verify_regexs($4, $2->comparator);
+				     pl = verify_regexs(scanner, $4, $2->comparator);
 				     if (!pl) { YYERROR; }
 				   }
 				   else
 #endif
 				     pl = (patternlist_t *) $4;
 				       
-				   $$ = build_address($1, $2, $3, pl);
+				   $$ = build_address(scanner, $1, $2, $3, pl);
 				   if ($$ == NULL) { YYERROR; } }
 	| NOT test		 { $$ = new_test(NOT); $$->u.t = $2; }
 	| SIZE sizetag NUMBER    { $$ = new_test(SIZE); $$->u.sz.t = $2;
@@ -426,7 +441,7 @@ addrorenv: ADDRESS		 { $$ = ADDRESS; }
 aetags: /* empty */              { $$ = new_aetags(); }
         | aetags addrparttag	 { $$ = $1;
 				   if ($$->addrtag != -1) { 
-				       sieveerror("duplicate or conflicting address part tag");
+				       sieveerror(scanner, "duplicate or conflicting address part tag");
 			               YYERROR; 
 			           } else {
 			               $$->addrtag = $2; 
@@ -434,17 +449,17 @@ aetags: /* empty */              { $$ = new_aetags(); }
 			         }
 	| aetags comptag         { $$ = $1;
 				   if ($$->comptag != -1) { 
-				       sieveerror("duplicate comparator type tag"); YYERROR; 
+				       sieveerror(scanner, "duplicate comparator type tag"); YYERROR; 
 				   } else { 
 				       $$->comptag = $2; 
 				   } 
 				 }
 	| aetags relcomp STRING  { $$ = $1;
 				   if ($$->comptag != -1) { 
-				       sieveerror("duplicate comparator type tag"); YYERROR; 
+				       sieveerror(scanner, "duplicate comparator type tag"); YYERROR; 
 				   } else { 
 				       $$->comptag = $2;
-				       $$->relation = verify_relat($3);
+				       $$->relation = verify_relat(scanner, $3);
 				       if ($$->relation==-1) {
 				       	   YYERROR; /*vr called sieveerror()*/ 
 				       }
@@ -452,11 +467,11 @@ aetags: /* empty */              { $$ = new_aetags(); }
 				 }
 	| aetags COMPARATOR STRING { $$ = $1;
 				   if ($$->comparator != NULL) { 
-				       sieveerror("duplicate comparator tag"); 
+				       sieveerror(scanner, "duplicate comparator tag"); 
 				       YYERROR; 
 				   } else if (!strcmp($3, "i;ascii-numeric") 
-				   && !parse_script->support.i_ascii_numeric) {
-				       sieveerror("comparator-i;ascii-numeric not required");
+				   && !parse_script(scanner)->support.i_ascii_numeric) {
+				       sieveerror(scanner, "comparator-i;ascii-numeric not required");
 				       YYERROR; 
 				   }
 				   else { $$->comparator = $3; } }
@@ -465,14 +480,14 @@ aetags: /* empty */              { $$ = new_aetags(); }
 htags: /* empty */		 { $$ = new_htags(); }
 	| htags comptag		 { $$ = $1;
 				   if ($$->comptag != -1) { 
-			sieveerror("duplicate comparator type tag"); YYERROR; }
+			sieveerror(scanner, "duplicate comparator type tag"); YYERROR; }
 				   else { $$->comptag = $2; } }
 	| htags relcomp STRING 	 { $$ = $1;
 				   if ($$->comptag != -1) { 
-				       sieveerror("duplicate comparator type tag"); YYERROR; 
+				       sieveerror(scanner, "duplicate comparator type tag"); YYERROR; 
 				   } else {
 				       $$->comptag = $2;
-				       $$->relation = verify_relat($3);
+				       $$->relation = verify_relat(scanner, $3);
 				       if ($$->relation==-1) {
 				           YYERROR; /*vr called sieveerror()*/ 
 				       }
@@ -480,11 +495,11 @@ htags: /* empty */		 { $$ = new_htags(); }
 				 }
 	| htags COMPARATOR STRING { $$ = $1;
 				   if ($$->comparator != NULL) { 
-				       sieveerror("duplicate comparator tag"); 
+				       sieveerror(scanner, "duplicate comparator tag"); 
 				       YYERROR; 
 				   } else if (!strcmp($3, "i;ascii-numeric") 
-				   && !parse_script->support.i_ascii_numeric) {
-				       sieveerror("comparator-i;ascii-numeric not required");
+				   && !parse_script(scanner)->support.i_ascii_numeric) {
+				       sieveerror(scanner, "comparator-i;ascii-numeric not required");
 				       YYERROR; 
 				   }
 				   else { $$->comparator = $3; } }
@@ -493,13 +508,13 @@ htags: /* empty */		 { $$ = new_htags(); }
 addrparttag: ALL                 { $$ = ALL; }
 	| LOCALPART		 { $$ = LOCALPART; }
 	| DOMAIN                 { $$ = DOMAIN; }
-	| USER                   { if (!parse_script->support.subaddress) {
-				     sieveerror("subaddress not required");
+	| USER                   { if (!parse_script(scanner)->support.subaddress) {
+				     sieveerror(scanner, "subaddress not required");
 				     YYERROR;
 				   }
 				   $$ = USER; }
-	| DETAIL                { if (!parse_script->support.subaddress) {
-				     sieveerror("subaddress not required");
+	| DETAIL                { if (!parse_script(scanner)->support.subaddress) {
+				     sieveerror(scanner, "subaddress not required");
 				     YYERROR;
 				   }
 				   $$ = DETAIL; }
@@ -508,21 +523,21 @@ addrparttag: ALL                 { $$ = ALL; }
 comptag: IS			 { $$ = IS; }
 	| CONTAINS		 { $$ = CONTAINS; }
 	| MATCHES		 { $$ = MATCHES; }
-	| REGEX			 { if (!parse_script->support.regex) {
-				     sieveerror("regex not required");
+	| REGEX			 { if (!parse_script(scanner)->support.regex) {
+				     sieveerror(scanner, "regex not required");
 				     YYERROR;
 				   }
 				   $$ = REGEX; }
 	;
 
-relcomp: COUNT			 { if (!parse_script->support.relational) {
-				     sieveerror("relational not required");
+relcomp: COUNT			 { if (!parse_script(scanner)->support.relational) {
+				     sieveerror(scanner, "relational not required");
 				     YYERROR;
 				   }
 				   $$ = COUNT; 
 				 }
-	| VALUE			 { if (!parse_script->support.relational) {
-				     sieveerror("relational not required");
+	| VALUE			 { if (!parse_script(scanner)->support.relational) {
+				     sieveerror(scanner, "relational not required");
 				     YYERROR;
 				   }
 				   $$ = VALUE; 
@@ -541,41 +556,69 @@ tests: test                      { $$ = new_testlist($1, NULL); }
 	;
 
 %%
-commandlist_t *sieve_parse(sieve_script_t *script, FILE *f)
+static commandlist_t *run_sieve_parser(sieve_script_t *script, void *scanner)
 {
     commandlist_t *t;
-    extern FILE *sievein;
+    struct sieve_parse_state *ps = sieveget_extra(scanner);
 
-    sievein = f;
-    parse_script = script;
-    
-    reset_sieve_lexer( f);
+    ps->script = script;
+    ps->ret = NULL;
     
-    if (sieveparse()) {
+    if (sieveparse(scanner)) {
 	t = NULL;
     } else {
-	t = ret;
+	t = ps->ret;
     }
-    ret = NULL;
+    free_sieve_scanner(scanner);
     return t;
 }
 
-int sieveerror(const char *msg)
+commandlist_t *sieve_parse(sieve_script_t *script, FILE *f)
+{
+    struct sieve_parse_state ps;
+    void *scanner = new_sieve_scanner(&ps, f);
+
+    if (!scanner) {
+	script->err++;
+	return NULL;
+    }
+    return run_sieve_parser(script, scanner);
+}
+
+commandlist_t *sieve_parse_buffer(sieve_script_t *script, 
+				  const char *buf, int len)
 {
-    extern int sievelineno;
+    struct sieve_parse_state ps;
+    void *scanner = new_sieve_buffer_scanner(&ps, buf, len);
+
+    if (!scanner) {
+	script->err++;
+	return NULL;
+    }
+    return run_sieve_parser(script, scanner);
+}
+
+static sieve_script_t *parse_script(void *scanner)
+{
+    return sieveget_extra(scanner)->script;
+}
+
+int sieveerror(void *scanner, const char *msg)
+{
+    sieve_script_t *script = parse_script(scanner);
     int ret;
 
-    parse_script->err++;
-    if (parse_script->interp.err) {
-	ret = parse_script->interp.err(sievelineno, msg, 
-				       parse_script->interp.interp_context,
-				       parse_script->script_context);
+    script->err++;
+    if (script->interp.err) {
+	ret = script->interp.err(sieveget_lineno(scanner), msg, 
+				 script->interp.interp_context,
+				 script->script_context);
     }
 
     return 0;
 }
 
-static int check_reqs(stringlist_t *sl)
+static int check_reqs(void *scanner, stringlist_t *sl)
 {
     int i = 1;
     stringlist_t *s;
@@ -584,7 +627,7 @@ static int check_reqs(stringlist_t *sl)
 	s = sl;
 	sl = sl->next;
 
-	i &= script_require(parse_script, s->s);
+	i &= script_require(parse_script(scanner), s->s);
 
 	if (s->s) free(s->s);
 	free(s);
@@ -592,7 +635,19 @@ static int check_reqs(stringlist_t *sl)
     return i;
 }
 
-static test_t *build_address(int t, struct aetags *ae,
+/* converts all patterns into the form needed by the comparator, such that
+   this doesn't have to be done during execution */
+static patternlist_t *prepare_patterns(const char *comp, int comptag, 
+				       patternlist_t *pl)
+{
+    patternlist_t *p;
+
+    for (p = pl; p != NULL; p = p->next)
+	p->p = prepare_pattern(comp, comptag, p->p);
+    return pl;
+}
+
+static test_t *build_address(void *scanner, int t, struct aetags *ae,
 			     stringlist_t *sl, patternlist_t *pl)
 {
     test_t *ret = new_test(t);	/* can be either ADDRESS or ENVELOPE */
@@ -604,11 +659,11 @@ static test_t *build_address(int t, struct aetags *ae,
 	ret->u.ae.relation = ae->relation;
 	ret->u.ae.comp = lookup_comp(ae->comparator, ae->comptag, ae->relation);
 	if (!ret->u.ae.comp) {
-   	    sieveerror("unknown comparator tag");
+   	    sieveerror(scanner, "unknown comparator tag");
 	    return NULL;
 	}
 	ret->u.ae.sl = sl;
-	ret->u.ae.pl = pl;
+	ret->u.ae.pl = prepare_patterns(ae->comparator, ae->comptag, pl);
 	ret->u.ae.addrpart = ae->addrtag;
 	free_aetags(ae);
 	if (ret->u.ae.comp == NULL) {
@@ -619,7 +674,7 @@ static test_t *build_address(int t, struct aetags *ae,
     return ret;
 }
 
-static test_t *build_header(int t, struct htags *h,
+static test_t *build_header(void *scanner, int t, struct htags *h,
 			    stringlist_t *sl, patternlist_t *pl)
 {
     test_t *ret = new_test(t);	/* can be HEADER */
@@ -631,11 +686,11 @@ static test_t *build_header(int t, struct htags *h,
 	ret->u.h.relation = h->relation;
 	ret->u.h.comp = lookup_comp(h->comparator, h->comptag, h->relation);
 	if (!ret->u.h.comp) {
-   	    sieveerror("unknown comparator tag");
+   	    sieveerror(scanner, "unknown comparator tag");
 	    return NULL;
 	}
 	ret->u.h.sl = sl;
-	ret->u.h.pl = pl;
+	ret->u.h.pl = prepare_patterns(h->comparator, h->comptag, pl);
 	free_htags(h);
 	if (ret->u.h.comp == NULL) {
 	    free_test(ret);
@@ -689,7 +744,9 @@ static commandlist_t *build_denotify(int t, struct dtags *d)
 	ret->u.d.comptag = d->comptag;
 	ret->u.d.relation = d->relation;
 	ret->u.d.comp = lookup_comp("i;ascii-casemap", d->comptag, d->relation);
-	ret->u.d.pattern = d->pattern; d->pattern = NULL;
+	ret->u.d.pattern = prepare_pattern("i;ascii-casemap", d->comptag, 
+					   d->pattern);
+	d->pattern = NULL;
 	ret->u.d.priority = d->priority;
 	free_dtags(d);
     }
@@ -755,15 +812,15 @@ static struct vtags *new_vtags(void)
     return r;
 }
 
-static struct vtags *canon_vtags(struct vtags *v)
+static struct vtags *canon_vtags(void *scanner, struct vtags *v)
 {
-    assert(parse_script->interp.vacation != NULL);
+    assert(parse_script(scanner)->interp.vacation != NULL);
 
     if (v->days == -1) { v->days = 7; }
-    if (v->days < parse_script->interp.vacation->min_response) 
-       { v->days = parse_script->interp.vacation->min_response; }
-    if (v->days > parse_script->interp.vacation->max_response)
-       { v->days = parse_script->interp.vacation->max_response; }
+    if (v->days < parse_script(scanner)->interp.vacation->min_response) 
+       { v->days = parse_script(scanner)->interp.vacation->min_response; }
+    if (v->days > parse_script(scanner)->interp.vacation->max_response)
+       { v->days = parse_script(scanner)->interp.vacation->max_response; }
     if (v->mime == -1) { v->mime = 0; }
 
     return v;
@@ -823,24 +880,21 @@ static void free_dtags(struct dtags *d)
     free(d);
 }
 
-static int verify_stringlist(stringlist_t *sl, int (*verify)(char *))
+static int verify_stringlist(void *scanner, stringlist_t *sl,
+			     int (*verify)(void *, char *))
 {
-    for (; sl != NULL && verify(sl->s); sl = sl->next) ;
+    for (; sl != NULL && verify(scanner, sl->s); sl = sl->next) ;
     return (sl == NULL);
 }
 
-char *addrptr;		/* pointer to address string for address lexer */
-char *addrerr;		/* buffer for address parser error messages */
-
-static int verify_address(char *s)
+static int verify_address(void *scanner, char *s)
 {
     char *err;
+    char *addrerr = NULL;
 
-    addrptr = s;
-    addrerr = NULL;
-    if (addrparse()) {
+    if (check_address_syntax(s, &addrerr)) {
 	err = xstrconcat("address '", s, "': ", addrerr, NULL);
-	sieveerror(err);
+	sieveerror(scanner, err);
 	free(addrerr);
 	free(err);
 	return 0;
@@ -848,13 +902,13 @@ static int verify_address(char *s)
     return 1;
 }
 
-static int verify_mailbox(char *s __attribute__((unused)))
+static int verify_mailbox(void *scanner, char *s __attribute__((unused)))
 {
     /* xxx if not a mailbox, call sieveerror */
     return 1;
 }
 
-static int verify_header(char *hdr)
+static int verify_header(void *scanner, char *hdr)
 {
     char *h = hdr;
     char *err;
@@ -867,7 +921,7 @@ static int verify_header(char *hdr)
 	   ;  ":". */
 	if (!((*h >= 33 && *h <= 57) || (*h >= 59 && *h <= 126))) {
 	    err = xstrconcat("header '", hdr, "': not a valid header", NULL);
-	    sieveerror(err);
+	    sieveerror(scanner, err);
 	    free(err);
 	    return 0;
 	}
@@ -876,7 +930,7 @@ static int verify_header(char *hdr)
     return 1;
 }
  
-static int verify_flag(char *f)
+static int verify_flag(void *scanner, char *f)
 {
     char *err;
  
@@ -886,7 +940,7 @@ static int verify_flag(char *f)
 	    strcmp(f, "\\flagged") && strcmp(f, "\\draft") &&
 	    strcmp(f, "\\deleted")) {
             err = xstrconcat("flag '", f, "': not a system flag", NULL);
-	    sieveerror(err);
+	    sieveerror(scanner, err);
 	    free(err);
 	    return 0;
 	}
@@ -894,14 +948,14 @@ static int verify_flag(char *f)
     }
     if (!imparse_isatom(f)) {
 	err = xstrconcat("flag '", f, "': not a valid keyword", NULL);
-	sieveerror(err);
+	sieveerror(scanner, err);
 	free(err);
 	return 0;
     }
     return 1;
 }
  
-static int verify_relat(char *r)
+static int verify_relat(void *scanner, char *r)
 {/* this really should have been a token to begin with.*/
     char errbuf[100];
     lcase(r);
@@ -918,13 +972,13 @@ static int verify_relat(char *r)
       snprintf(errbuf, sizeof(errbuf), 
       	   "flag '%s': not a valid relational operation", r);
 #endif
-      sieveerror(errbuf);
+      sieveerror(scanner, errbuf);
       return -1;
     }
 }
 
 #ifdef ENABLE_REGEX
-static regex_t *verify_regex(char *s, int cflags)
+static regex_t *verify_regex(void *scanner, char *s, int cflags)
 {
     int ret;
     char errbuf[100];
@@ -932,14 +986,14 @@ static regex_t *verify_regex(char *s, int cflags)
 
     if ((ret = regcomp(reg, s, cflags)) != 0) {
 	(void) regerror(ret, reg, errbuf, sizeof(errbuf));
-	sieveerror(errbuf);
+	sieveerror(scanner, errbuf);
 	free(reg);
 	return NULL;
     }
     return reg;
 }
 
-static patternlist_t *verify_regexs(stringlist_t *sl, char *comp)
+static patternlist_t *verify_regexs(void *scanner, stringlist_t *sl, char *comp)
 {
     stringlist_t *sl2;
     patternlist_t *pl = NULL;
@@ -951,7 +1005,7 @@ static patternlist_t *verify_regexs(stringlist_t *sl, char *comp)
     }
 
     for (sl2 = sl; sl2 != NULL; sl2 = sl2->next) {
-	if ((reg = verify_regex(sl2->s, cflags)) == NULL) {
+	if ((reg = verify_regex(scanner, sl2->s, cflags)) == NULL) {
 	    free_pl(pl, REGEX);
 	    break;
 	}
@@ -140,6 +140,13 @@ extern int sieve_register_execute_error(sieve_interp_t *interp,
 /* given an interpretor and a script, produce an executable script */
 extern int sieve_script_parse(sieve_interp_t *interp, FILE *script,
 		       void *script_context, sieve_script_t **ret);
+extern int sieve_script_parse_buffer(sieve_interp_t *interp, 
+			      const char *script, int len,
+			      void *script_context, sieve_script_t **ret);
+
+/* produce a script that shares the compiled commands of the given one */
+extern int sieve_script_clone(sieve_script_t *s, sieve_interp_t *interp,
+			      void *script_context, sieve_script_t **ret);
 
 extern int sieve_script_free(sieve_script_t **s);
 
@@ -147,6 +154,11 @@ extern int sieve_script_free(sieve_script_t **s);
 extern int sieve_execute_script(sieve_script_t *script, 
 			 void *message_context);
 
+/* execute a script on several messages, sharing the setup between them */
+extern int sieve_execute_script_batch(sieve_script_t *script, 
+			       void **message_contexts, int count,
+			       int *results);
+
 /* Get space separated list of extensions supported by the implementation */
 extern const char *sieve_listextensions(void);
 
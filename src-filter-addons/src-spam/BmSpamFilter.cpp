@@ -22,8 +22,17 @@
 #include "BmMultiLineTextControl.h"
 #include "TextEntryAlert.h"
 
+#include <algorithm>
 #include <cctype>
 
+#ifdef BEAM_FOR_HAIKU
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
 #include "BubbleHelper.h"
 
 #include "BmLogHandler.h"
@@ -32,6 +41,7 @@
 #include "BmRosterBase.h"
 #include "BmSpamFilter.h"
 #include "BmStorageUtil.h"
+#include "md5.h"
 
 
 // standard logfile-name for this file:
@@ -70,26 +80,30 @@ extern "C" {
 //     per second (using as text the full 2.4.9 linux kernel source)
 //     hashing individual whitespace-delimited tokens, on a Transmeta
 //     666 MHz.
-unsigned long strnhash (char *str, long len)
+//
+//     [zooey]: the byte-spreading has been simplified (a sign-extended 
+//     char already has all upper bytes set, so only non-negative chars
+//     need to be spread), the resulting hashes are identical to the
+//     original code, as existing data-files depend on them.
+static inline unsigned long strnhash (const char *str, long len)
 {
-  long i;
   // unsigned long hval;
   long hval;
   unsigned long tmp;
+  const char* end = str + len;
 
   // initialize hval
   hval= len;
 
   //  for each character in the incoming text:
-  for ( i = 0; i < len; i++)
+  for ( ; str < end; ++str)
     {
       //    xor in the current byte against each byte of hval
       //    (which alone guarantees that every bit of input will have
       //    an effect on the output)
 
-      tmp = str[i];
-      tmp = tmp | (tmp << 8) | (tmp << 16) | (tmp << 24);
-      hval ^= tmp;
+      long c = *str;
+      hval ^= c < 0 ? (unsigned long)c : (unsigned long)c * 0x01010101UL;
 
       //    add some bits out of the middle as low order bits.
       hval = hval + (( hval >> 12) & 0x0000ffff) ;
@@ -118,15 +132,13 @@ unsigned long strnhash (char *str, long len)
 		-	
 \*------------------------------------------------------------------------------*/
 BmSpamFilter::OsbfClassifier::SpamRelevantMailtextSelector::HtmlRemover
-::HtmlRemover( BmMemIBuf* input, uint32 blockSize)
+::HtmlRemover( BmMemIBuf* input, bool keepATags, uint32 blockSize)
 	:	inherited( input, blockSize)
 	,	mInTag(false)
 	,	mInQuot(false)
-	,	mKeepATags(false)
+	,	mKeepATags(keepATags)
 	,	mKeepThisTagsContent(false)
 {
-	if (mJobSpecs)
-		mJobSpecs->FindBool("KeepATags", &mKeepATags);
 }
 
 /*------------------------------------------------------------------------------*\
@@ -183,8 +195,9 @@ void BmSpamFilter::OsbfClassifier::SpamRelevantMailtextSelector::HtmlRemover
 		-	
 \*------------------------------------------------------------------------------*/
 BmSpamFilter::OsbfClassifier::SpamRelevantMailtextSelector
-::SpamRelevantMailtextSelector(BmMail* mail)
+::SpamRelevantMailtextSelector(BmMail* mail, const BMessage* jobSpecs)
 	:	mMail(mail)
+	,	mJobSpecs(jobSpecs)
 	,	mDeHtmlBuf(4096)
 {
 }
@@ -267,7 +280,8 @@ void BmSpamFilter::OsbfClassifier::SpamRelevantMailtextSelector
 		bool deHtml = mJobSpecs ? mJobSpecs->FindBool("DeHtml") : false;
 		if (deHtml && body->MimeType().ICompare("text/html") == 0) {
 			BmStringIBuf htmlIn(body->DecodedData().String(), bodyLen);
-			HtmlRemover htmlRemover(&htmlIn);
+			bool keepATags = mJobSpecs ? mJobSpecs->FindBool("KeepATags") : false;
+			HtmlRemover htmlRemover(&htmlIn, keepATags);
 			mDeHtmlBuf.Write(&htmlRemover);
 			inBuf.AddBuffer(mDeHtmlBuf.TheString());
 		} else
@@ -327,6 +341,24 @@ BmBodyPart* BmSpamFilter::OsbfClassifier::SpamRelevantMailtextSelector
 \********************************************************************************/
 // #pragma mark --- FeatureFilter ---
 
+/*------------------------------------------------------------------------------*\
+	FeatureDelimiters
+		-	table telling which characters separate features, built once 
+			(at load time) from the list of delimiter-chars
+\*------------------------------------------------------------------------------*/
+static struct FeatureDelimiters {
+	FeatureDelimiters() {
+		// N.B.: the '\0' ends the list for strchr(), so 0xa0 (shifted space)
+		// has never actually been treated as delimiter. We keep it that way,
+		// as existing data-files have been trained like this.
+		const char* delimiterChars = "!\"'<>()[];,=\0xa0";
+			// should not contain: .@?&%:/ in order to leave intact URLs
+		for( int c = 0; c < 256; ++c)
+			isDelimiter[c] = c <= ' ' || strchr(delimiterChars, c) != NULL;
+	}
+	bool isDelimiter[256];
+} nFeatureDelimiters;
+
 /*------------------------------------------------------------------------------*\
 	()
 		-	
@@ -356,11 +388,10 @@ void BmSpamFilter::OsbfClassifier
 	bool haveFeature = false;
 	char lastChar = '\0';
 	unsigned char c;
-	const char* delimiterChars = "!\"'<>()[];,=\0xa0";	// 0xa0 => shifted space
-		// should not contain: .@?&%:/ in order to leave intact URLs
+	const bool* isDelimiter = nFeatureDelimiters.isDelimiter;
 	for( ; src<srcEnd && dest<destEnd; ++src) {
 		c = *src;
-		if (c>' ' && !strchr(delimiterChars, c)) {
+		if (!isDelimiter[c]) {
 			if (c == lastChar)
 				continue;	// skip duplicate characters (viaggrrraaaa => viagra)
 			*dest++ = c;
@@ -379,6 +410,55 @@ void BmSpamFilter::OsbfClassifier
 
 
 
+/********************************************************************************\
+	BmSpamFilter::OsbfClassifier::FeatureHasher
+\********************************************************************************/
+// #pragma mark --- FeatureHasher ---
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+BmSpamFilter::OsbfClassifier
+::FeatureHasher::FeatureHasher( FeatureHashVect& hashes)
+	:	mHashes( hashes)
+{
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+status_t BmSpamFilter::OsbfClassifier
+::FeatureHasher::operator()( char* buf, uint32 bufLen)
+{
+	if (!buf || !bufLen)
+		return B_BAD_VALUE;
+
+	BM_LOG3( BM_LogFilter, BmString("hashing feature: ") << BmString( buf, bufLen));
+
+   // Shift hash value of feature into pipe
+   mHashpipe.Push( strnhash( buf, bufLen));
+
+	//
+	//     old Hash polynomial: h0 + 3h1 + 5h2 +11h3 +23h4
+	//     (coefficients chosen by requiring superincreasing,
+	//     as well as prime)
+	//
+	FeatureHash featureHash;
+	const unsigned long h1Base = mHashpipe[0] * HashCoeff[0];
+	const unsigned long h2Base = mHashpipe[0] * HashCoeff[1];
+	for (uint32 j = 1; j < WindowLen; j++) {
+		unsigned long hj = mHashpipe[j];
+		featureHash.h1 = h1Base + hj * HashCoeff[j << 1];
+		featureHash.h2 = h2Base + hj * HashCoeff[(j << 1)-1];
+		mHashes.push_back(featureHash);
+	}
+	return B_OK;
+}
+
+
+
 /********************************************************************************\
 	BmSpamFilter::OsbfClassifier::FeatureLearner
 \********************************************************************************/
@@ -395,10 +475,10 @@ BmSpamFilter::OsbfClassifier
 	,	mHeader( header)
 	,	mRevert( revert)
 	,	mStatus( B_OK)
+	,	mUsedDelta( 0)
+	,	mHaveGroomed( false)
+	,	mHaveRescaled( false)
 {
-   //  init the hashpipe with 0xDEADBEEF 
-   for (uint32 h = 0; h < WindowLen; h++)
-      mHashpipe.push_back( 0xDEADBEEF);
 }
 
 /*------------------------------------------------------------------------------*\
@@ -411,121 +491,123 @@ BmSpamFilter::OsbfClassifier
 }
 
 /*------------------------------------------------------------------------------*\
-	()
-		-	
+	LearnFeature( h1, h2)
+		-	learns the feature with the given hashes
 \*------------------------------------------------------------------------------*/
 status_t BmSpamFilter::OsbfClassifier
-::FeatureLearner::operator()( char* buf, uint32 bufLen)
+::FeatureLearner::LearnFeature( unsigned long h1, unsigned long h2)
 {
-	if (!buf || !bufLen || !mHeader->buckets) {
+	if (!mHeader->buckets) {
 		mStatus = B_BAD_VALUE;
 		return mStatus;
 	}
 
-	BM_LOG3( BM_LogFilter, BmString("learning feature: ") << BmString( buf, bufLen));
-
-   // Shift hash value of feature into pipe
-   mHashpipe.push_front( strnhash( buf, bufLen));
-   mHashpipe.pop_back();
-
 	int sense = mRevert ? -1 : 1;
 
 	unsigned long hindex;
-	unsigned long h1, h2;
 	unsigned long incrs;
 	
+	hindex = h1 % mHeader->buckets;
+	
 	//
-	//     old Hash polynomial: h0 + 3h1 + 5h2 +11h3 +23h4
-	//     (coefficients chosen by requiring superincreasing,
-	//     as well as prime)
+	//  we now look at both the primary (h1) and 
+	//  crosscut (h2) indexes to see if we've got
+	//  the right bucket or if we need to look further
 	//
-	for (uint32 j = 1; j < WindowLen; j++) {
-		h1 = mHashpipe[0] * HashCoeff[0] + mHashpipe[j] * HashCoeff[j << 1];
-		h2 = mHashpipe[0] * HashCoeff[1] + mHashpipe[j] * HashCoeff[(j << 1)-1];
-		
-		hindex = h1 % mHeader->buckets;
-		
-		//
-		//  we now look at both the primary (h1) and 
-		//  crosscut (h2) indexes to see if we've got
-		//  the right bucket or if we need to look further
+	incrs = 0;
+	while (mHash[hindex].InChain() && !mHash[hindex].HashCompare(h1, h2))
+	{
+		incrs++;
+		// 
+		//        If microgrooming is enabled, and we've found a 
+		//        chain that's too long, we groom it down.
 		//
-		incrs = 0;
-		while (mHash[hindex].InChain() && !mHash[hindex].HashCompare(h1, h2))
-		{
-			incrs++;
-			// 
-			//        If microgrooming is enabled, and we've found a 
-			//        chain that's too long, we groom it down.
+		if (DoMicrogroom && (incrs > MicrogroomChainLength)) {
+			//     set the random number generator up...
+			//     note that this is repeatable for a
+			//     particular test set, yet dynamic.  That
+			//     way, we don't always autogroom away the
+			//     same feature; we depend on the previous
+			//     feature's key.
+			srand ((unsigned int) h2);
 			//
-			if (DoMicrogroom && (incrs > MicrogroomChainLength)) {
-				//     set the random number generator up...
-				//     note that this is repeatable for a
-				//     particular test set, yet dynamic.  That
-				//     way, we don't always autogroom away the
-				//     same feature; we depend on the previous
-				//     feature's key.
-				srand ((unsigned int) h2);
-				//
-				//  and do the groom.
-				// second argument is not necessary any more... fix it!
-				Microgroom (mHash, mHeader, hindex);
-				// since things may have moved after a
-				// microgroom, restart our search
-				hindex = h1 % mHeader->buckets;
-				incrs = 0;
-				continue;
-			};
-
-			//       check to see if we've incremented ourself all the
-			//       way around the .css file.   If so, we're full, and
-			//       can hold no more features (this is unrecoverable)
-			if (incrs > mHeader->buckets - 3) {
-				BM_LOGERR("Your program is stuffing too many "
-                      "features into this data-file.   "
-                      "Adding any more features is "
-                      "impossible in this file."
-                      "You are advised to build a larger "
-                      "data file and merge your data into "
-                      "it.");
-				mStatus = B_ERROR;
-				return mStatus;
-			}
-			hindex++;
-			if (hindex >= mHeader->buckets)
-			   hindex = 0;
+			//  and do the groom.
+			// second argument is not necessary any more... fix it!
+			Microgroom (mHash, mHeader, hindex);
+			mHaveGroomed = true;
+			// since things may have moved after a
+			// microgroom, restart our search
+			hindex = h1 % mHeader->buckets;
+			incrs = 0;
+			continue;
 		};
 
-      if (mHash[hindex].GetValue() == 0)
-			BM_LOG3( BM_LogFilter, 
-						BmString("New feature at ") << hindex);
-		else
-			BM_LOG3( BM_LogFilter, 
-						BmString("Old feature at ") << hindex);
-
-		//    always rewrite hash and key, as they may be incorrect
-		//    (on a reused bucket) or zero (on a fresh one)
-		//
-		mHash[hindex].SetHash(h1);
-		mHash[hindex].SetKey(h2);
-		
-		//       watch out - sense may be both + or -, so check before 
-		//       adding it...
-		//
-		if (!mHash[hindex].IsLocked()) {
-		   if (sense > 0 
-		   && mHash[hindex].GetValue() + sense >=	FeatureBucketValueMax - 1)
-		      mHash[hindex].SetValue( FeatureBucketValueMax - 1);
-		   else if (sense < 0 && mHash[hindex].GetValue() <= (uint32)-sense)
-		      mHash[hindex].SetValue(0);
-		   else
-		      mHash[hindex].SetValue(mHash[hindex].GetValue() + sense);
-		   mHash[hindex].Lock();	// avoid learning this feature more than once
+		//       check to see if we've incremented ourself all the
+		//       way around the .css file.   If so, we're full, and
+		//       can hold no more features (this is unrecoverable)
+		if (incrs > mHeader->buckets - 3) {
+			BM_LOGERR("Your program is stuffing too many "
+                   "features into this data-file.   "
+                   "Adding any more features is "
+                   "impossible in this file."
+                   "You are advised to build a larger "
+                   "data file and merge your data into "
+                   "it.");
+			mStatus = B_ERROR;
+			return mStatus;
 		}
+		hindex++;
+		if (hindex >= mHeader->buckets)
+		   hindex = 0;
+	};
+
+   if (mHash[hindex].GetValue() == 0)
+		BM_LOG3( BM_LogFilter, 
+					BmString("New feature at ") << hindex);
+	else
+		BM_LOG3( BM_LogFilter, 
+					BmString("Old feature at ") << hindex);
+
+	//    always rewrite hash and key, as they may be incorrect
+	//    (on a reused bucket) or zero (on a fresh one)
+	//
+	mHash[hindex].SetHash(h1);
+	mHash[hindex].SetKey(h2);
+	
+	//       watch out - sense may be both + or -, so check before 
+	//       adding it...
+	//
+	if (!mHash[hindex].IsLocked()) {
+	   bool wasUsed = mHash[hindex].InChain();
+	   if (sense > 0 
+	   && mHash[hindex].GetValue() + sense >=	FeatureBucketValueMax - 1)
+	      mHash[hindex].SetValue( FeatureBucketValueMax - 1);
+	   else if (sense < 0 && mHash[hindex].GetValue() <= (uint32)-sense)
+	      mHash[hindex].SetValue(0);
+	   else
+	      mHash[hindex].SetValue(mHash[hindex].GetValue() + sense);
+	   if (wasUsed != mHash[hindex].InChain())
+	      mUsedDelta += wasUsed ? -1 : 1;
+	   mHash[hindex].Lock();	// avoid learning this feature more than once
+	   mLockedBuckets.push_back(hindex);
 	}
 	return B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	LearnFeatures( hashes)
+		-	learns all the given features (in order), stops at the first error
+\*------------------------------------------------------------------------------*/
+status_t BmSpamFilter::OsbfClassifier
+::FeatureLearner::LearnFeatures( const FeatureHashVect& hashes)
+{
+	for (uint32 i = 0; i < hashes.size(); i++) {
+		if (LearnFeature(hashes[i].h1, hashes[i].h2) != B_OK)
+			break;
+	}
+	return mStatus;
+}
+
 /*------------------------------------------------------------------------------*\
 	()
 		-	
@@ -533,9 +615,15 @@ status_t BmSpamFilter::OsbfClassifier
 void BmSpamFilter::OsbfClassifier
 ::FeatureLearner::Finalize()
 {
-   // unlock features locked during learning
-   for (uint32 i=0; i<mHeader->buckets; i++)
-     mHash[i].Unlock();
+   // unlock features locked during learning (only the ones we have touched,
+   // unless grooming has moved them around)
+	if (mHaveGroomed) {
+		for (uint32 i=0; i<mHeader->buckets; i++)
+			mHash[i].Unlock();
+	} else {
+		for (uint32 i=0; i<mLockedBuckets.size(); i++)
+			mHash[mLockedBuckets[i]].Unlock();
+	}
 
 	if (mRevert) {
 		// we had to unlearn a feature, meaning that we did make a mistake:
@@ -547,6 +635,7 @@ void BmSpamFilter::OsbfClassifier
 			mHeader->learnings >>= 1;
 			for (uint32 i = 0; i < mHeader->buckets; i++)
 				mHash[i].SetValue(mHash[i].GetRawValue() >> 1);
+			mHaveRescaled = true;
 			BM_LOG( BM_LogFilter, 
 						"You have managed to LEARN so many documents that"
 						" you have forced rescaling of the entire database."
@@ -578,15 +667,15 @@ BmSpamFilter::OsbfClassifier
 	:	mStatus( B_OK)
 	,	mTotalLearnings( 0)
 	,	mTotalFeatures( 0)
+	,	mDecisiveRatio( 0)
+	,	mMaxBytes( 0)
+	,	mBytesScanned( 0)
+	,	mStoppedEarly( false)
 {
 	mHash[0] = tofuHash;
 	mHash[1] = spamHash;
 	mHeader[0] = tofuHeader;
 	mHeader[1] = spamHeader;
-
-   //  init the hashpipe with 0xDEADBEEF 
-   for (uint32 h = 0; h < WindowLen; h++)
-      mHashpipe.push_back( 0xDEADBEEF);
       
 	// init basic arrays
 	for (uint32 i = 0; i < MaxHash; i++) {
@@ -648,8 +737,7 @@ status_t BmSpamFilter::OsbfClassifier
 	BM_LOG3( BM_LogFilter, BmString("classifying feature: ") << BmString( buf, bufLen));
 
    // Shift hash value of feature into pipe
-   mHashpipe.push_front( strnhash( buf, bufLen));
-   mHashpipe.pop_back();
+   mHashpipe.Push( strnhash( buf, bufLen));
 
 	uint32 j, k;
 	unsigned long hindex;
@@ -661,9 +749,12 @@ status_t BmSpamFilter::OsbfClassifier
 	double htf;
 
 	//
+	const unsigned long h1Base = mHashpipe[0] * HashCoeff[0];
+	const unsigned long h2Base = mHashpipe[0] * HashCoeff[1];
 	for (j = 1; j < WindowLen; j++) {
-		h1 = mHashpipe[0] * HashCoeff[0] + mHashpipe[j] * HashCoeff[j << 1];
-		h2 = mHashpipe[0] * HashCoeff[1] + mHashpipe[j] * HashCoeff[(j << 1)-1];
+		unsigned long hj = mHashpipe[j];
+		h1 = h1Base + hj * HashCoeff[j << 1];
+		h2 = h2Base + hj * HashCoeff[(j << 1)-1];
 		
 		hindex = h1;
 		
@@ -955,6 +1046,15 @@ status_t BmSpamFilter::OsbfClassifier
 	
 	}
 
+	// stop if we have seen enough (or if the outcome is clear already):
+	mBytesScanned += bufLen;
+	if ((mMaxBytes && mBytesScanned >= mMaxBytes)
+	|| (mDecisiveRatio > 0 
+		&& (mPtc[0] > mPtc[1] * mDecisiveRatio 
+			|| mPtc[1] > mPtc[0] * mDecisiveRatio))) {
+		mStoppedEarly = true;
+		return B_INTERRUPTED;
+	}
 	return B_OK;
 }
 
@@ -1028,7 +1128,18 @@ float BmSpamFilter::OsbfClassifier
 
 /* max feature value */
 const unsigned long BmSpamFilter::OsbfClassifier
-::WindowLen = 5;
+::WindowLen;
+
+/*------------------------------------------------------------------------------*\
+	HashPipe()
+		-	inits the hashpipe with 0xDEADBEEF
+\*------------------------------------------------------------------------------*/
+BmSpamFilter::OsbfClassifier::HashPipe::HashPipe()
+	:	mHead( 0)
+{
+	for (uint32 h = 0; h < WindowLen; h++)
+		mPipe[h] = 0xDEADBEEF;
+}
 
 /* max feature value */
 const unsigned long BmSpamFilter::OsbfClassifier
@@ -1038,6 +1149,18 @@ const unsigned long BmSpamFilter::OsbfClassifier
 const unsigned long BmSpamFilter::OsbfClassifier
 ::DefaultFileLength = 94321;
 
+/* the data-files will never grow beyond this number of features */
+const unsigned long BmSpamFilter::OsbfClassifier
+::MaxFileLength = 16 * 94321;
+
+/* data-files grow when more than this ratio of buckets is used */
+const double BmSpamFilter::OsbfClassifier
+::MaxLoadFactor = 0.75;
+
+/* max number of classification results kept in the cache */
+const uint32 BmSpamFilter::OsbfClassifier
+::MaxCachedClassifications = 1000;
+
 /* shall we try to do small cleanups automatically, if the hash-chains
    get too long? */ 
 const bool BmSpamFilter::OsbfClassifier
@@ -1054,24 +1177,35 @@ const unsigned long BmSpamFilter::OsbfClassifier
 /* minimum ratio between max and min P(F|C) */
 const unsigned long BmSpamFilter::OsbfClassifier
 ::MinPmaxPminRatio = 9;
+
+/* number of mails per thread whose features are collected at once 
+   during bulk-learning */
+const uint32 BmSpamFilter::OsbfClassifier
+::BulkMailsPerThread = 16;
 	
 const uint32 BmSpamFilter::OsbfClassifier::FeatureBucket
 ::ValueMask = 0x0000FFFFLU;
 const uint32 BmSpamFilter::OsbfClassifier::FeatureBucket
 ::LockedMask = 0x80000000LU;
 
-const BMessage* BmSpamFilter::OsbfClassifier::mJobSpecs = NULL;
-
 /*------------------------------------------------------------------------------*\
 	OsbfClassifier()
 		-	
 \*------------------------------------------------------------------------------*/
 BmSpamFilter::OsbfClassifier::OsbfClassifier()
 	:	mSpamHash(NULL)
+	,	mSpamUsedBuckets(0)
+	,	mSpamUsedBucketsCounted(false)
 	,	mTofuHash(NULL)
+	,	mTofuUsedBuckets(0)
+	,	mTofuUsedBucketsCounted(false)
 	,	mNeedToStoreSpam(false)
 	,	mNeedToStoreTofu(false)
-	,	mLock("SpamClassifierLock", true)
+	,	mLock("SpamClassifierLock")
+	,	mErrLock("SpamClassifierErrorLock")
+	,	mCacheLock("SpamClassificationCacheLock")
+	,	mGeneration(0)
+	,	mGrowing(0)
 {
 }
 
@@ -1082,8 +1216,8 @@ BmSpamFilter::OsbfClassifier::OsbfClassifier()
 BmSpamFilter::OsbfClassifier::~OsbfClassifier()
 {
 	Store();
-	delete [] mTofuHash;
-	delete [] mSpamHash;
+	ReleaseDataFile( mTofuHash, mTofuMapping);
+	ReleaseDataFile( mSpamHash, mSpamMapping);
 }
 
 /*------------------------------------------------------------------------------*\
@@ -1095,12 +1229,14 @@ void BmSpamFilter::OsbfClassifier::Initialize()
 	if (!mSpamHash) {
 		BmString spamFilename 
 			= BmString( BeamRoster->SettingsPath()) << "/Spam.data";
-		ReadDataFile( spamFilename, mSpamHeader, mSpamHash);
+		ReadDataFile( spamFilename, mSpamHeader, mSpamHash, mSpamMapping);
+		mSpamUsedBucketsCounted = false;
 	}
 	if (!mTofuHash) {
 		BmString tofuFilename 
 			= BmString( BeamRoster->SettingsPath()) << "/Tofu.data";
-		ReadDataFile( tofuFilename, mTofuHeader, mTofuHash);
+		ReadDataFile( tofuFilename, mTofuHeader, mTofuHash, mTofuMapping);
+		mTofuUsedBucketsCounted = false;
 	}
 }
 
@@ -1113,12 +1249,12 @@ void BmSpamFilter::OsbfClassifier::Store()
 	if (mSpamHash && mNeedToStoreSpam) {
 		BmString spamFilename 
 			= BmString( BeamRoster->SettingsPath()) << "/Spam.data";
-		WriteDataFile( spamFilename, mSpamHeader, mSpamHash);
+		WriteDataFile( spamFilename, mSpamHeader, mSpamHash, mSpamMapping);
 	}
 	if (mTofuHash && mNeedToStoreTofu) {
 		BmString tofuFilename 
 			= BmString( BeamRoster->SettingsPath()) << "/Tofu.data";
-		WriteDataFile( tofuFilename, mTofuHeader, mTofuHash);
+		WriteDataFile( tofuFilename, mTofuHeader, mTofuHash, mTofuMapping);
 	}
 }
 
@@ -1126,22 +1262,23 @@ void BmSpamFilter::OsbfClassifier::Store()
 	LearnAsSpam()
 		-	
 \*------------------------------------------------------------------------------*/
-bool BmSpamFilter::OsbfClassifier::LearnAsSpam(BmMsgContext* msgContext)
+bool BmSpamFilter::OsbfClassifier::LearnAsSpam(BmMsgContext* msgContext,
+															  const BMessage* jobSpecs)
 {
 	if (msgContext->mail->IsMarkedAsSpam()
-	&& !msgContext->GetBool("ForceLearning"))
+	&& !msgContext->GetBool(BmMsgContext::FIELD_FORCE_LEARNING))
 		return false;							// learning once is enough
 	if (msgContext->mail->IsMarkedAsTofu()) {
 		// unlearn this mail as tofu, since it's not:
-		if (!Learn(msgContext, false, true))
+		if (!Learn(msgContext, false, true, jobSpecs))
 			return false;
 	}
 	// learn this mail as spam:
-	bool ok = Learn(msgContext, true, false);
+	bool ok = Learn(msgContext, true, false, jobSpecs);
 	if (ok) {
-		msgContext->SetBool("IsSpam", true);
-		msgContext->SetBool("IsTofu", false);
-		msgContext->SetDouble("RatioSpam", 1.0);
+		msgContext->SetBool(BmMsgContext::FIELD_IS_SPAM, true);
+		msgContext->SetBool(BmMsgContext::FIELD_IS_TOFU, false);
+		msgContext->SetDouble(BmMsgContext::FIELD_RATIO_SPAM, 1.0);
 	}
 	return ok;
 }
@@ -1150,22 +1287,23 @@ bool BmSpamFilter::OsbfClassifier::LearnAsSpam(BmMsgContext* msgContext)
 	LearnAsTofu()
 		-	
 \*------------------------------------------------------------------------------*/
-bool BmSpamFilter::OsbfClassifier::LearnAsTofu( BmMsgContext* msgContext)
+bool BmSpamFilter::OsbfClassifier::LearnAsTofu( BmMsgContext* msgContext,
+																const BMessage* jobSpecs)
 {
 	if (msgContext->mail->IsMarkedAsTofu()
-	&& !msgContext->GetBool("ForceLearning"))
+	&& !msgContext->GetBool(BmMsgContext::FIELD_FORCE_LEARNING))
 		return false;							// learning once is enough
 	if (msgContext->mail->IsMarkedAsSpam()) {
 		// unlearn this mail as spam, since it's not:
-		if (!Learn(msgContext, true, true))
+		if (!Learn(msgContext, true, true, jobSpecs))
 			return false;
 	}
 	// learn this mail as tofu:
-	bool ok = Learn(msgContext, false, false);
+	bool ok = Learn(msgContext, false, false, jobSpecs);
 	if (ok) {
-		msgContext->SetBool("IsSpam", false);
-		msgContext->SetBool("IsTofu", true);
-		msgContext->SetDouble("RatioSpam", 0.0);
+		msgContext->SetBool(BmMsgContext::FIELD_IS_SPAM, false);
+		msgContext->SetBool(BmMsgContext::FIELD_IS_TOFU, true);
+		msgContext->SetDouble(BmMsgContext::FIELD_RATIO_SPAM, 0.0);
 	}
 	return ok;
 }
@@ -1175,66 +1313,268 @@ bool BmSpamFilter::OsbfClassifier::LearnAsTofu( BmMsgContext* msgContext)
 		-	
 \*------------------------------------------------------------------------------*/
 bool BmSpamFilter::OsbfClassifier::Learn( BmMsgContext* msgContext, 
-														bool learnAsSpam, bool revert)
+														bool learnAsSpam, bool revert,
+														const BMessage* jobSpecs)
 {
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
-	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
-		return false;
+	// hashing the features doesn't touch any data, so it is done before
+	// we acquire the lock:
+	FeatureHashVect hashes;
+	CollectFeatureHashes(msgContext->mail, jobSpecs, hashes);
+	return LearnFeatureHashes(hashes, learnAsSpam, revert);
+}
+
+/*------------------------------------------------------------------------------*\
+	LearnFeatureHashes()
+		-	learns the given features (of one mail) into the spam or tofu data
+\*------------------------------------------------------------------------------*/
+bool BmSpamFilter::OsbfClassifier::LearnFeatureHashes( 
+	const FeatureHashVect& hashes, bool learnAsSpam, bool revert)
+{
+	bool needToGrow = false;
+	status_t status;
+	{	// scope for lock
+		// learning modifies the data, so we need exclusive access:
+		BmAutoWriteLock lock( mLock);
+		if (!lock.IsLocked()) {
+			SetError( "Unable to get SPAM-lock");
+			return false;
+		}
+		
+		Header* header = learnAsSpam ? &mSpamHeader : &mTofuHeader;
+		FeatureBucket* hash = learnAsSpam ? mSpamHash : mTofuHash;
+		if (learnAsSpam)
+			mNeedToStoreSpam = true;
+		else
+			mNeedToStoreTofu = true;
+		
+		FeatureLearner learner( hash, header, revert);
+		learner.LearnFeatures(hashes);
+		// any cached classifications are outdated now:
+		mGeneration++;
+
+		if (learner.mStatus == B_OK) {
+			learner.Finalize();
+		}
+
+		// remember which buckets have to be written back by Store():
+		DataMapping& mapping = learnAsSpam ? mSpamMapping : mTofuMapping;
+		if (mapping.base) {
+			if (learner.mHaveGroomed || learner.mHaveRescaled)
+				mapping.allDirty = true;
+			else if (!mapping.allDirty)
+				mapping.dirtyBuckets.insert( mapping.dirtyBuckets.end(),
+													  learner.mLockedBuckets.begin(),
+													  learner.mLockedBuckets.end());
+		}
+
+		// keep track of the load of the data, such that it can grow before 
+		// chains get so long that features have to be groomed away:
+		unsigned long& usedBuckets 
+			= learnAsSpam ? mSpamUsedBuckets : mTofuUsedBuckets;
+		bool& usedBucketsCounted
+			= learnAsSpam ? mSpamUsedBucketsCounted : mTofuUsedBucketsCounted;
+		if (learner.mHaveGroomed || !usedBucketsCounted) {
+			usedBuckets = CountUsedBuckets( hash, *header);
+			usedBucketsCounted = true;
+		} else
+			usedBuckets += learner.mUsedDelta;
+		needToGrow = (learner.mHaveGroomed 
+							|| usedBuckets > header->buckets * MaxLoadFactor)
+						 && header->buckets < MaxFileLength;
+		status = learner.mStatus;
 	}
-	
-	Header* header = learnAsSpam ? &mSpamHeader : &mTofuHeader;
-	FeatureBucket* hash = learnAsSpam ? mSpamHash : mTofuHash;
-	if (learnAsSpam)
-		mNeedToStoreSpam = true;
-	else
-		mNeedToStoreTofu = true;
-	
+	// growing takes a while, so it is done without the exclusive lock:
+	if (needToGrow)
+		GrowDataFile( learnAsSpam);
+	return status == B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	CollectFeatureHashes()
+		-	fetches the spam-relevant text of the given mail and collects the
+			hashes of all its features
+\*------------------------------------------------------------------------------*/
+void BmSpamFilter::OsbfClassifier::CollectFeatureHashes( BmMail* mail, 
+																			const BMessage* jobSpecs,
+																			FeatureHashVect& hashes)
+{
 	BmStringIBuf text;
-	SpamRelevantMailtextSelector selector(msgContext->mail);
+	SpamRelevantMailtextSelector selector(mail, jobSpecs);
 	selector(text);
 	FeatureFilter filter( &text);
 	BmMemBufConsumer consumer( 4096);
-	FeatureLearner learner( hash, header, revert);
-	consumer.Consume(&filter, &learner);
+	FeatureHasher hasher( hashes);
+	consumer.Consume(&filter, &hasher);
+}
+
+/*------------------------------------------------------------------------------*\
+	BulkHashJob
+		-	a chunk of mails whose features are being collected by several
+			threads (each thread fetches the next mail via nextIndex)
+\*------------------------------------------------------------------------------*/
+struct BmSpamFilter::OsbfClassifier::BulkHashJob {
+	const BMessage* jobSpecs;
+	vector<BmMail*> mails;
+	uint32 first;
+	int32 count;
+	int32 nextIndex;
+	vector<FeatureHashVect> hashes;
+};
 
-	if (learner.mStatus == B_OK) {
-		learner.Finalize();
+/*------------------------------------------------------------------------------*\
+	BulkHasherThread()
+		-	collects the feature hashes of mails of the given job until none
+			are left
+\*------------------------------------------------------------------------------*/
+int32 BmSpamFilter::OsbfClassifier::BulkHasherThread( void* data)
+{
+	BulkHashJob* job = static_cast<BulkHashJob*>(data);
+	int32 index;
+	while ((index = atomic_add(&job->nextIndex, 1)) < job->count) {
+		try {
+			CollectFeatureHashes(job->mails[job->first+index], job->jobSpecs,
+										job->hashes[index]);
+		} catch( BM_error& err) {
+			BM_LOGERR( BmString("Spam-Addon: ") << err.what());
+			job->hashes[index].clear();
+		}
 	}
-	return learner.mStatus == B_OK;
+	return 0;
 }
 
 /*------------------------------------------------------------------------------*\
-	Classify()
-		-	
+	LearnBulk()
+		-	learns a whole set of mails, which are passed in as pointers (field
+			"mail") together with their class (field "isSpam") in jobSpecs
+		-	the features of the mails are collected by several threads (the 
+			count can be given in field "threadCount", defaults to one per 
+			cpu), afterwards they are learned mail by mail, in the given order,
+			so the resulting data is identical to learning the mails one after
+			another
+		-	this is meant for training from a corpus, so the mails are neither 
+			checked for nor marked with any previous classification
 \*------------------------------------------------------------------------------*/
-bool BmSpamFilter::OsbfClassifier::Classify( BmMsgContext* msgContext)
+bool BmSpamFilter::OsbfClassifier::LearnBulk( const BMessage* jobSpecs)
 {
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
-	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
+	if (!jobSpecs) {
+		SetError( "Illegal job-specs!");
 		return false;
 	}
+	
+	BulkHashJob job;
+	job.jobSpecs = jobSpecs;
+	void* mail;
+	for (int32 i = 0; jobSpecs->FindPointer("mail", i, &mail) == B_OK; i++)
+		job.mails.push_back(static_cast<BmMail*>(mail));
+
+	int32 threadCount = 0;
+	jobSpecs->FindInt32("threadCount", &threadCount);
+	if (threadCount <= 0) {
+		system_info sysInfo;
+		get_system_info( &sysInfo);
+		threadCount = sysInfo.cpu_count;
+	}
+	
+	// the mails are handled in chunks, such that we don't have to keep 
+	// the features of all mails in memory at once:
+	const uint32 chunkSize = BulkMailsPerThread * threadCount;
+	bool ok = true;
+	for (uint32 first = 0; first < job.mails.size(); first += chunkSize) {
+		job.first = first;
+		job.count = MIN(chunkSize, (uint32)job.mails.size() - first);
+		job.nextIndex = 0;
+		job.hashes.clear();
+		job.hashes.resize(job.count);
+		
+		// collect the features in parallel (this thread helps, too)...
+		vector<thread_id> threads;
+		for (int32 t = 1; t < threadCount && t < job.count; t++) {
+			thread_id thread = spawn_thread( BulkHasherThread, 
+														"spam-addon feature hasher",
+														B_NORMAL_PRIORITY, &job);
+			if (thread < 0 || resume_thread( thread) != B_OK)
+				break;
+			threads.push_back(thread);
+		}
+		BulkHasherThread(&job);
+		status_t exitValue;
+		for (uint32 t = 0; t < threads.size(); t++)
+			wait_for_thread( threads[t], &exitValue);
+
+		// ...and learn them in order:
+		for (int32 i = 0; i < job.count; i++) {
+			bool isSpam = false;
+			jobSpecs->FindBool("isSpam", first+i, &isSpam);
+			if (!LearnFeatureHashes(job.hashes[i], isSpam, false))
+				ok = false;
+		}
+	}
+	BM_LOG( BM_LogFilter, 
+			  BmString("Spam-Addon: bulk-learned ") << job.mails.size() 
+			  	<< " mails using " << threadCount << " threads");
+	return ok;
+}
 
+/*------------------------------------------------------------------------------*\
+	Classify()
+		-	
+\*------------------------------------------------------------------------------*/
+bool BmSpamFilter::OsbfClassifier::Classify( BmMsgContext* msgContext,
+															const BMessage* jobSpecs)
+{
 	if (!msgContext || !msgContext->mail) {
-		mLastErr = "Illegal msg-context!";
+		SetError( "Illegal msg-context!");
 		return false;
 	}
 	
+	// the same mail may be classified more than once (e.g. when re-filtering
+	// a folder), so the results are cached (unless asked not to):
+	bool useCache = true;
+	if (jobSpecs)
+		jobSpecs->FindBool("UseCache", &useCache);
+	// only the spam-relevant part of the mail is classified, so that's all
+	// the cache key needs to look at, too:
+	BmStringOBuf text( 65536, 1.2f);
+	{
+		BmStringIBuf selectedText;
+		SpamRelevantMailtextSelector selector(msgContext->mail, jobSpecs);
+		selector(selectedText);
+		text.Write(&selectedText);
+	}
+	BmString cacheKey;
+	if (useCache)
+		cacheKey = ClassificationCacheKey(msgContext->mail, text.TheString(),
+													 jobSpecs);
+
 	double overallPr;
-	bool status = DoActualClassification(msgContext, overallPr);
+	bool status;
+	{
+		// classifying only reads the data, so any number of threads
+		// may do it at the same time:
+		BmAutoReadLock lock( mLock);
+		if (!lock.IsLocked()) {
+			SetError( "Unable to get SPAM-lock");
+			return false;
+		}
+		if (useCache && LookupCachedClassification(cacheKey, overallPr))
+			status = true;
+		else {
+			status = DoActualClassification(text.TheString(), jobSpecs, 
+													  overallPr);
+			if (status && useCache)
+				CacheClassification(cacheKey, overallPr);
+		}
+	}
 	if (status) {
 		int32 ThresholdForSpam = 0;
 		int32 ThresholdForTofu = 0;
 		int32 UnsureForSpam = 0;
 		int32 UnsureForTofu = 0;
-		if (mJobSpecs) {
-			mJobSpecs->FindInt32("ThresholdForSpam", &ThresholdForSpam);
-			mJobSpecs->FindInt32("ThresholdForTofu", &ThresholdForTofu);
-			mJobSpecs->FindInt32("UnsureForSpam", &UnsureForSpam);
-			mJobSpecs->FindInt32("UnsureForTofu", &UnsureForTofu);
+		if (jobSpecs) {
+			jobSpecs->FindInt32("ThresholdForSpam", &ThresholdForSpam);
+			jobSpecs->FindInt32("ThresholdForTofu", &ThresholdForTofu);
+			jobSpecs->FindInt32("UnsureForSpam", &UnsureForSpam);
+			jobSpecs->FindInt32("UnsureForTofu", &UnsureForTofu);
 		}
 		bool isSpam = (overallPr < 0);
 		bool reinforced = false;
@@ -1242,22 +1582,31 @@ bool BmSpamFilter::OsbfClassifier::Classify( BmMsgContext* msgContext)
 			// the classifier isn't sure, so we we either reinforce or leave unsure:
 			if (fabs(overallPr) > (isSpam ? UnsureForSpam : UnsureForTofu)) {
 				// reinforce by explicitly learning it:
-				Learn(msgContext, isSpam, false);
+				Learn(msgContext, isSpam, false, jobSpecs);
 				reinforced = true;
 			}
 		}
-		msgContext->SetBool("IsReinforced", reinforced);
-		msgContext->SetBool("IsTofu", overallPr >= UnsureForTofu);
-		msgContext->SetBool("IsSpam", overallPr < -1*UnsureForTofu);
-		if (overallPr >= UnsureForTofu) {
-			mTofuHeader.classifications++;
-			mNeedToStoreTofu = true;
-		}
-		if (overallPr < -1*UnsureForTofu) {
-			mSpamHeader.classifications++;
-			mNeedToStoreSpam = true;
+		msgContext->SetBool(BmMsgContext::FIELD_IS_REINFORCED, reinforced);
+		msgContext->SetBool(
+			BmMsgContext::FIELD_IS_TOFU, overallPr >= UnsureForTofu
+		);
+		msgContext->SetBool(
+			BmMsgContext::FIELD_IS_SPAM, overallPr < -1*UnsureForTofu
+		);
+		{
+			// counting only needs the data to stay put, so the counters are 
+			// updated atomically instead of excluding all other classifiers:
+			BmAutoReadLock lock( mLock);
+			if (overallPr >= UnsureForTofu) {
+				AtomicIncrement( &mTofuHeader.classifications);
+				mNeedToStoreTofu = true;
+			}
+			if (overallPr < -1*UnsureForTofu) {
+				AtomicIncrement( &mSpamHeader.classifications);
+				mNeedToStoreSpam = true;
+			}
 		}
-		msgContext->SetDouble("OverallPr", overallPr);
+		msgContext->SetDouble(BmMsgContext::FIELD_OVERALL_PR, overallPr);
 		// overallPr is an open range (spam)[-min..+max](tofu), but the 
 		// "RatioSpam"-attribute from MDR is (tofu)[0..1](spam), 
 		// so we need to convert:
@@ -1272,35 +1621,162 @@ bool BmSpamFilter::OsbfClassifier::Classify( BmMsgContext* msgContext)
 			ratioSpam += float(fabs(overallPr / (clampMin/0.5)));
 		else
 			ratioSpam -= float(fabs(overallPr / (clampMax/0.5)));
-		msgContext->SetDouble("RatioSpam", ratioSpam);
+		msgContext->SetDouble(BmMsgContext::FIELD_RATIO_SPAM, ratioSpam);
 	}
 	
 	return status;
 }
 
+/*------------------------------------------------------------------------------*\
+	AtomicIncrement()
+		-	increments the given counter (of a data-file header) atomically
+\*------------------------------------------------------------------------------*/
+void BmSpamFilter::OsbfClassifier::AtomicIncrement( unsigned long* counter)
+{
+#ifdef B_HAIKU_64_BIT
+	atomic_add64( (int64*)counter, 1);
+#else
+	atomic_add( (int32*)counter, 1);
+#endif
+}
+
 /*------------------------------------------------------------------------------*\
 	DoActualClassification()
 		-	
 \*------------------------------------------------------------------------------*/
 bool BmSpamFilter::OsbfClassifier
-::DoActualClassification( BmMsgContext* msgContext, double& overallPr)
+::DoActualClassification( const BmString& selectedText, 
+								  const BMessage* jobSpecs, double& overallPr)
 {
-	BmStringIBuf text;
-	SpamRelevantMailtextSelector selector(msgContext->mail);
-	selector(text);
+	BmStringIBuf text( selectedText);
 	FeatureFilter filter( &text);
 	BmMemBufConsumer consumer( 4096);
 	FeatureClassifier classifier( mSpamHash, &mSpamHeader, 
 											mTofuHash, &mTofuHeader);
+	// optionally bound the work done for a single mail:
+	int32 decisiveMargin = EffectiveDecisiveMargin(jobSpecs);
+	int32 maxScanKBytes = 0;
+	if (jobSpecs)
+		jobSpecs->FindInt32("MaxScanKBytes", &maxScanKBytes);
+	if (decisiveMargin > 0)
+		classifier.mDecisiveRatio = pow(10.0, decisiveMargin);
+	classifier.mMaxBytes = maxScanKBytes > 0 ? maxScanKBytes * 1024 : 0;
 	consumer.Consume(&filter, &classifier);
 	
 	if (classifier.mStatus == B_OK)
 		classifier.Finalize();
 	overallPr = classifier.mOverallPr;
+	if (classifier.mStoppedEarly)
+		BM_LOG2( BM_LogFilter, 
+					BmString("Spam-Addon: stopped classifying after ") 
+						<< classifier.mBytesScanned << " bytes");
 
 	return classifier.mStatus == B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	EffectiveDecisiveMargin()
+		-	returns the decisive margin requested by the given job-specs, 
+			raised to the reinforcement thresholds (0 means no margin)
+\*------------------------------------------------------------------------------*/
+int32 BmSpamFilter::OsbfClassifier
+::EffectiveDecisiveMargin( const BMessage* jobSpecs)
+{
+	int32 decisiveMargin = 0;
+	if (jobSpecs)
+		jobSpecs->FindInt32("DecisiveMargin", &decisiveMargin);
+	if (decisiveMargin > 0) {
+		// never stop before the result is beyond the reinforcement thresholds,
+		// otherwise mails would be reinforced just because we stopped early:
+		int32 threshold = 0;
+		if (jobSpecs->FindInt32("ThresholdForSpam", &threshold) == B_OK)
+			decisiveMargin = max_c(decisiveMargin, threshold);
+		if (jobSpecs->FindInt32("ThresholdForTofu", &threshold) == B_OK)
+			decisiveMargin = max_c(decisiveMargin, threshold);
+	} else
+		decisiveMargin = 0;
+	return decisiveMargin;
+}
+
+/*------------------------------------------------------------------------------*\
+	ClassificationCacheKey()
+		-	returns the key of the given mail in the classification cache, which
+			consists of the message-id and a digest of the spam-relevant text
+			that is being classified (plus the options influencing how much
+			of it is being looked at)
+\*------------------------------------------------------------------------------*/
+BmString BmSpamFilter::OsbfClassifier
+::ClassificationCacheKey( BmMail* mail, const BmString& selectedText, 
+								  const BMessage* jobSpecs)
+{
+	unsigned char digest[16];
+	MD5_CTX context;
+	MD5Init( &context);
+	MD5Update( &context, (unsigned char*)selectedText.String(), 
+				  selectedText.Length());
+	MD5Final( digest, &context);
+
+	BmString key = mail->GetFieldVal( BM_FIELD_MESSAGE_ID);
+	key << '/';
+	char hex[3];
+	for (uint32 i = 0; i < sizeof(digest); i++) {
+		sprintf( hex, "%02x", digest[i]);
+		key << hex;
+	}
+	// (the digest already reflects the html-options)
+	int32 maxScanKBytes = 0;
+	if (jobSpecs)
+		jobSpecs->FindInt32("MaxScanKBytes", &maxScanKBytes);
+	key << '/' << EffectiveDecisiveMargin(jobSpecs) 
+		 << '/' << MAX(maxScanKBytes, 0);
+	return key;
+}
+
+/*------------------------------------------------------------------------------*\
+	LookupCachedClassification()
+		-	fetches the cached result for the given key, if there is one that
+			is still valid (i.e. the data hasn't changed since)
+		-	must be called with the lock held (for reading, at least)
+\*------------------------------------------------------------------------------*/
+bool BmSpamFilter::OsbfClassifier
+::LookupCachedClassification( const BmString& key, double& overallPr)
+{
+	BAutolock lock( &mCacheLock);
+	ClassificationCache::const_iterator iter = mClassificationCache.find(key);
+	if (iter == mClassificationCache.end() 
+	|| iter->second.generation != mGeneration)
+		return false;
+	overallPr = iter->second.overallPr;
+	BM_LOG2( BM_LogFilter, "Spam-Addon: using cached classification");
+	return true;
+}
+
+/*------------------------------------------------------------------------------*\
+	CacheClassification()
+		-	stores the given result in the cache, when the cache is full, all
+			outdated results are dropped (and all results if none is outdated)
+		-	must be called with the lock held (for reading, at least)
+\*------------------------------------------------------------------------------*/
+void BmSpamFilter::OsbfClassifier
+::CacheClassification( const BmString& key, double overallPr)
+{
+	BAutolock lock( &mCacheLock);
+	if (mClassificationCache.size() >= MaxCachedClassifications) {
+		ClassificationCache::iterator iter = mClassificationCache.begin();
+		while (iter != mClassificationCache.end()) {
+			if (iter->second.generation != mGeneration)
+				mClassificationCache.erase(iter++);
+			else
+				++iter;
+		}
+		if (mClassificationCache.size() >= MaxCachedClassifications)
+			mClassificationCache.clear();
+	}
+	CachedClassification& cached = mClassificationCache[key];
+	cached.overallPr = overallPr;
+	cached.generation = mGeneration;
+}
+
 /*------------------------------------------------------------------------------*\
 	Reset()
 		-	
@@ -1308,16 +1784,15 @@ bool BmSpamFilter::OsbfClassifier
 bool BmSpamFilter::OsbfClassifier::Reset( BmMsgContext* msgContext)
 {
 	BM_LOG( BM_LogFilter, "Spam-Addon: resetting datafiles");
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
+	// set lock to get exclusive access:
+	BmAutoWriteLock lock( mLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
+		SetError( "Unable to get SPAM-lock");
 		return false;
 	}
-	delete [] mTofuHash;
-	mTofuHash = NULL;
-	delete [] mSpamHash;
-	mSpamHash = NULL;
+	ReleaseDataFile( mTofuHash, mTofuMapping);
+	ReleaseDataFile( mSpamHash, mSpamMapping);
+	mGeneration++;
 
 	BEntry entry;
 	BmString spamFilename 
@@ -1336,27 +1811,46 @@ bool BmSpamFilter::OsbfClassifier::Reset( BmMsgContext* msgContext)
 
 /*------------------------------------------------------------------------------*\
 	Reload()
-		-	
+		-	rereads the data-files, dropping anything that has been learned
+			since the data has last been stored
 \*------------------------------------------------------------------------------*/
 bool BmSpamFilter::OsbfClassifier::Reload( BmMsgContext* msgContext)
 {
 	BM_LOG( BM_LogFilter, "Spam-Addon: reloading datafiles");
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
+	// set lock to get exclusive access:
+	BmAutoWriteLock lock( mLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
+		SetError( "Unable to get SPAM-lock");
 		return false;
 	}
-	delete [] mTofuHash;
-	mTofuHash = NULL;
-	delete [] mSpamHash;
-	mSpamHash = NULL;
+	ReleaseDataFile( mTofuHash, mTofuMapping);
+	ReleaseDataFile( mSpamHash, mSpamMapping);
+	mGeneration++;
 
 	Initialize();
 
 	return true;
 }
 
+/*------------------------------------------------------------------------------*\
+	Flush()
+		-	writes the current data back into the data-files, such that they
+			can be inspected (or compared) while the classifier is still active
+\*------------------------------------------------------------------------------*/
+bool BmSpamFilter::OsbfClassifier::Flush( BmMsgContext* msgContext)
+{
+	BM_LOG( BM_LogFilter, "Spam-Addon: flushing datafiles");
+	// set lock to get exclusive access:
+	BmAutoWriteLock lock( mLock);
+	if (!lock.IsLocked()) {
+		SetError( "Unable to get SPAM-lock");
+		return false;
+	}
+	Store();
+
+	return true;
+}
+
 /*------------------------------------------------------------------------------*\
 	ResetStatistics()
 		-	
@@ -1364,10 +1858,10 @@ bool BmSpamFilter::OsbfClassifier::Reload( BmMsgContext* msgContext)
 bool BmSpamFilter::OsbfClassifier::ResetStatistics( BmMsgContext* msgContext)
 {
 	BM_LOG( BM_LogFilter, "Spam-Addon: resetting statistics");
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
+	// set lock to get exclusive access:
+	BmAutoWriteLock lock( mLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
+		SetError( "Unable to get SPAM-lock");
 		return false;
 	}
 
@@ -1390,15 +1884,15 @@ bool BmSpamFilter::OsbfClassifier::ResetStatistics( BmMsgContext* msgContext)
 bool BmSpamFilter::OsbfClassifier::GetStatistics( BmMsgContext* msgContext)
 {
 	BM_LOG( BM_LogFilter, "Spam-Addon: getting statistics");
-	// set lock to serialize OSBF-calls:
-	BAutolock lock( &mLock);
+	// set lock to keep the data from changing underneath us:
+	BmAutoReadLock lock( mLock);
 	if (!lock.IsLocked()) {
-		mLastErr = "Unable to get SPAM-lock";
+		SetError( "Unable to get SPAM-lock");
 		return false;
 	}
 	
 	if (!msgContext) {
-		mLastErr = "Illegal msg-context!";
+		SetError( "Illegal msg-context!");
 		return false;
 	}
 	
@@ -1695,10 +2189,21 @@ void BmSpamFilter::OsbfClassifier::PackDataSeg( Header* header,
 	ErrorString()
 		-	
 \*------------------------------------------------------------------------------*/
-const BmString& BmSpamFilter::OsbfClassifier::ErrorString() const {
+BmString BmSpamFilter::OsbfClassifier::ErrorString() const {
+	BAutolock lock( &mErrLock);
 	return mLastErr;
 }
 
+/*------------------------------------------------------------------------------*\
+	SetError()
+		-	remembers the given error, the classifier is used by several threads
+			at once (mostly under the shared lock), so this has a lock of its own
+\*------------------------------------------------------------------------------*/
+void BmSpamFilter::OsbfClassifier::SetError( const BmString& err) {
+	BAutolock lock( &mErrLock);
+	mLastErr = err;
+}
+
 /*------------------------------------------------------------------------------*\
 	CreateDataFile()
 		-	
@@ -1723,12 +2228,11 @@ status_t BmSpamFilter::OsbfClassifier::CreateDataFile( const BmString& filename)
 		if ((err=file.Write(&h, sizeof (h))) != sizeof(h))
      		return err < 0 ? err : B_IO_ERROR;
 
-		//  Initialize hashes - zero all buckets
-		void *feature = calloc(bucketCount, sizeof(FeatureBucket));
-		int32 sz = sizeof(FeatureBucket)*bucketCount;
-     	if ((err=file.Write(feature, sz)) != sz)
-     		return err < 0 ? err : B_IO_ERROR;
-     	free(feature);
+		//  Initialize hashes - zero all buckets (by extending the file,
+		//  which fills it with zeroes without us having to write them)
+		off_t sz = sizeof(h) + sizeof(FeatureBucket)*bucketCount;
+		if ((err=file.SetSize(sz)) != B_OK)
+			return err;
 		BM_LOG( BM_LogFilter, 
 				  BmString("Spam-Addon: ok, done creating datafile ") << filename);
 	}
@@ -1744,7 +2248,8 @@ status_t BmSpamFilter::OsbfClassifier::CreateDataFile( const BmString& filename)
 \*------------------------------------------------------------------------------*/
 status_t BmSpamFilter::OsbfClassifier::ReadDataFile( const BmString& filename,
 												 					  Header& header,
-												 					  FeatureBucket*& hash)
+												 					  FeatureBucket*& hash,
+												 					  DataMapping& mapping)
 {
 	BFile file;
 	// try to open data-file...
@@ -1772,7 +2277,14 @@ status_t BmSpamFilter::OsbfClassifier::ReadDataFile( const BmString& filename,
 		BM_LOGERR( BmString("Wrong version of spam/tofu datafile ") << filename);
 		return B_MISMATCHED_VALUES;
 	}
-	// read hash
+	// map hash into memory, such that only the buckets that are actually
+	// touched need to be paged in (and written back)...
+	if (MapDataFile( filename, header, hash, mapping) == B_OK) {
+		BM_LOG( BM_LogFilter, 
+				  BmString("Spam-Addon: ok, done mapping datafile ") << filename);
+		return B_OK;
+	}
+	// ...or read hash, if mapping isn't possible
 	hash = new FeatureBucket [header.buckets];
 	ssize_t sz = header.buckets * sizeof(FeatureBucket);
 	if ((err = file.Read(hash, sz)) < sz) {
@@ -1786,14 +2298,284 @@ status_t BmSpamFilter::OsbfClassifier::ReadDataFile( const BmString& filename,
 	return B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	MapDataFile()
+		-	maps the given data-file into memory (privately, such that changes
+			to the buckets only end up in the file when the data is stored, 
+			together with the header that describes them)
+		-	returns B_NOT_SUPPORTED if the platform can't map files
+\*------------------------------------------------------------------------------*/
+status_t BmSpamFilter::OsbfClassifier::MapDataFile( const BmString& filename,
+																	 const Header& header,
+																	 FeatureBucket*& hash,
+																	 DataMapping& mapping)
+{
+#ifdef BEAM_FOR_HAIKU
+	int fd = open( filename.String(), O_RDWR);
+	if (fd < 0)
+		return errno;
+	struct stat st;
+	size_t neededSize = sizeof(Header) + header.buckets * sizeof(FeatureBucket);
+	if (fstat( fd, &st) < 0 || (size_t)st.st_size < neededSize) {
+		BM_LOGERR( BmString("Not enough data in datafile ") << filename);
+		close( fd);
+		return B_IO_ERROR;
+	}
+	void* base = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, 
+							 fd, 0);
+	if (base == MAP_FAILED) {
+		status_t err = errno;
+		BM_LOG( BM_LogFilter, 
+				  BmString("Spam-Addon: unable to map datafile ") << filename
+				  	<< " -> " << strerror(err));
+		close( fd);
+		return err;
+	}
+	mapping.base = base;
+	mapping.size = st.st_size;
+	mapping.fd = fd;
+	hash = (FeatureBucket*)((char*)base + sizeof(Header));
+	return B_OK;
+#else
+	return B_NOT_SUPPORTED;
+#endif
+}
+
+/*------------------------------------------------------------------------------*\
+	ReleaseDataFile()
+		-	frees the given hash (unmapping the data-file, if it has been mapped)
+\*------------------------------------------------------------------------------*/
+void BmSpamFilter::OsbfClassifier::ReleaseDataFile( FeatureBucket*& hash,
+																	 DataMapping& mapping)
+{
+	if (mapping.base) {
+#ifdef BEAM_FOR_HAIKU
+		munmap( mapping.base, mapping.size);
+		close( mapping.fd);
+#endif
+		mapping = DataMapping();
+	} else
+		delete [] hash;
+	hash = NULL;
+}
+
+/*------------------------------------------------------------------------------*\
+	CountUsedBuckets()
+		-	returns the number of buckets in the given hash that contain a feature
+\*------------------------------------------------------------------------------*/
+unsigned long BmSpamFilter::OsbfClassifier::CountUsedBuckets( 
+	const FeatureBucket* hash, const Header& header)
+{
+	if (!hash)
+		return 0;
+	unsigned long count = 0;
+	for (unsigned long i = 0; i < header.buckets; i++) {
+		if (hash[i].InChain())
+			count++;
+	}
+	return count;
+}
+
+/*------------------------------------------------------------------------------*\
+	GrowDataFile( spamData)
+		-	rehashes all features of the spam or tofu data into a hash with 
+			(about) twice as many buckets
+		-	a mapped data-file is replaced by a new (and then mapped) file 
+			containing the grown hash, otherwise the grown hash just replaces 
+			the current one in memory (and will be written on the next Store())
+		-	the grown data is built while holding the lock for reading only, 
+			such that classifications can go on, the exclusive lock is only
+			needed to swap in the grown data
+		-	if anything fails (or the data has been changed while it was being
+			grown), an error is returned and the current data is left untouched
+		-	must be called without holding the lock
+\*------------------------------------------------------------------------------*/
+status_t BmSpamFilter::OsbfClassifier::GrowDataFile( bool spamData)
+{
+	if (atomic_or( &mGrowing, 1))
+		// another thread is growing a data-file already
+		return B_BUSY;
+	Header& header = spamData ? mSpamHeader : mTofuHeader;
+	FeatureBucket*& hash = spamData ? mSpamHash : mTofuHash;
+	DataMapping& mapping = spamData ? mSpamMapping : mTofuMapping;
+	BmString filename = BmString( BeamRoster->SettingsPath()) 
+								<< (spamData ? "/Spam.data" : "/Tofu.data");
+	BmString newFilename = BmString(filename) << ".new";
+	FeatureBucket* newHash = NULL;
+	DataMapping newMapping;
+	unsigned long buckets = 0;
+	uint32 generation = 0;
+	status_t err = B_OK;
+	{	// scope for lock
+		BmAutoReadLock lock( mLock);
+		if (!lock.IsLocked() || !hash) {
+			atomic_and( &mGrowing, 0);
+			return B_ERROR;
+		}
+		generation = mGeneration;
+		// keep the bucket count odd, since that makes it more likely to 
+		// be relatively prime to the hashes:
+		buckets = MIN(header.buckets * 2 + 1, MaxFileLength);
+		BM_LOG( BM_LogFilter, 
+				  BmString("Spam-Addon: growing datafile ") << filename 
+				  	<< " from " << header.buckets << " to " << buckets 
+				  	<< " features");
+		newHash = new FeatureBucket [buckets];
+		memset( newHash, 0, buckets * sizeof(FeatureBucket));
+		for (unsigned long i = 0; i < header.buckets; i++) {
+			if (!hash[i].InChain())
+				continue;
+			// every feature is inserted at the place it is looked up from
+			// (exactly like PackDataSeg() does it):
+			unsigned long ito = hash[i].GetHash() % buckets;
+			while (newHash[ito].InChain()) {
+				ito++;
+				if (ito >= buckets)
+					ito = 0;
+			}
+			newHash[ito] = hash[i];
+		}
+
+		if (mapping.base) {
+			// write the grown data into a new file, which then replaces the 
+			// old one, such that we never end up with a half-grown data-file:
+			Header newHeader = header;
+			newHeader.buckets = buckets;
+			BFile file;
+			ssize_t sz = buckets * sizeof(FeatureBucket);
+			if ((err = file.SetTo( newFilename.String(), 
+										  B_READ_WRITE | B_CREATE_FILE | B_ERASE_FILE)) 
+					!= B_OK
+			|| (err = file.Write( &newHeader, sizeof(newHeader))) 
+					< (ssize_t)sizeof(newHeader)
+			|| (err = file.Write( newHash, sz)) < sz) {
+				BM_LOGERR( BmString("Couldn't grow spam/tofu datafile ") 
+									<< filename);
+				err = err < 0 ? err : B_IO_ERROR;
+			} else
+				err = B_OK;
+			file.Unset();
+			delete [] newHash;
+			newHash = NULL;
+			// map the new file before giving up the old mapping, such that any 
+			// failure leaves us with the (still valid) old data:
+			if (err == B_OK
+			&& (err = MapDataFile( newFilename, newHeader, newHash, 
+										  newMapping)) != B_OK)
+				BM_LOGERR( BmString("Couldn't map grown spam/tofu datafile ") 
+									<< newFilename << " -> " << strerror(err));
+		}
+	}
+
+	if (err == B_OK) {
+		BmAutoWriteLock lock( mLock);
+		if (!lock.IsLocked())
+			err = B_ERROR;
+		else if (mGeneration != generation) {
+			// the data has changed while it was being grown, the next 
+			// learning will try again:
+			BM_LOG( BM_LogFilter, 
+					  BmString("Spam-Addon: datafile ") << filename 
+					  	<< " has changed while growing, dropping grown data");
+			err = B_BUSY;
+		} else if (newMapping.base) {
+			BEntry entry( newFilename.String());
+			if ((err = entry.Rename( filename.String(), true)) != B_OK)
+				BM_LOGERR( BmString("Couldn't replace spam/tofu datafile ") 
+									<< filename << " -> " << strerror(err));
+			else {
+				ReleaseDataFile( hash, mapping);
+				hash = newHash;
+				mapping = newMapping;
+				header.buckets = buckets;
+				newHash = NULL;
+				newMapping = DataMapping();
+			}
+		} else {
+			delete [] hash;
+			hash = newHash;
+			header.buckets = buckets;
+			newHash = NULL;
+			// the grown hash only lives in memory:
+			if (spamData)
+				mNeedToStoreSpam = true;
+			else
+				mNeedToStoreTofu = true;
+		}
+	}
+	// clean up anything that hasn't been swapped in:
+	if (newMapping.base) {
+		ReleaseDataFile( newHash, newMapping);
+		BEntry( newFilename.String()).Remove();
+	} else
+		delete [] newHash;
+	atomic_and( &mGrowing, 0);
+	return err;
+}
+
 /*------------------------------------------------------------------------------*\
 	WriteDataFile()
-		-	
+		-	writes header and hash back into the data-file
+		-	for a mapped data-file, only the pages containing buckets that have
+			changed since the last store are written (before the header, which
+			is written last)
 \*------------------------------------------------------------------------------*/
 status_t BmSpamFilter::OsbfClassifier::WriteDataFile( const BmString& filename,
 												 						Header& header,
-												 						FeatureBucket*& hash)
+												 						FeatureBucket*& hash,
+												 						DataMapping& mapping)
 {
+#ifdef BEAM_FOR_HAIKU
+	if (mapping.base) {
+		BM_LOG( BM_LogFilter, 
+				  BmString("Spam-Addon: flushing mapped datafile ") << filename);
+		// collect the (page-aligned) ranges of the changed buckets:
+		const size_t pageSize = B_PAGE_SIZE;
+		const size_t hashEnd 
+			= sizeof(Header) + header.buckets * sizeof(FeatureBucket);
+		vector< std::pair< size_t, size_t> > ranges;
+		if (mapping.allDirty)
+			ranges.push_back( std::make_pair( sizeof(Header), hashEnd));
+		else {
+			vector<unsigned long>& dirty = mapping.dirtyBuckets;
+			std::sort( dirty.begin(), dirty.end());
+			for (uint32 i = 0; i < dirty.size(); i++) {
+				size_t offs = sizeof(Header) + dirty[i] * sizeof(FeatureBucket);
+				size_t start = MAX( offs - offs % pageSize, sizeof(Header));
+				size_t end = MIN( start + pageSize, hashEnd);
+				end = MAX( end, offs + sizeof(FeatureBucket));
+				if (!ranges.empty() && start <= ranges.back().second)
+					ranges.back().second = MAX( ranges.back().second, end);
+				else
+					ranges.push_back( std::make_pair( start, end));
+			}
+		}
+		// write the buckets first and the header last, such that the 
+		// header never describes data that hasn't made it into the file:
+		for (uint32 i = 0; i < ranges.size(); i++) {
+			size_t len = ranges[i].second - ranges[i].first;
+			if (pwrite( mapping.fd, (char*)mapping.base + ranges[i].first, len, 
+							ranges[i].first) != (ssize_t)len) {
+				status_t err = errno;
+				BM_LOGERR( BmString("Couldn't write data to file ") << filename
+									<< " -> " << strerror(err));
+				return err;
+			}
+		}
+		memcpy( mapping.base, &header, sizeof(header));
+		if (pwrite( mapping.fd, &header, sizeof(header), 0) 
+				!= (ssize_t)sizeof(header)
+		|| fsync( mapping.fd) < 0) {
+			status_t err = errno;
+			BM_LOGERR( BmString("Couldn't flush data to file ") << filename
+								<< " -> " << strerror(err));
+			return err;
+		}
+		mapping.dirtyBuckets.clear();
+		mapping.allDirty = false;
+		return B_OK;
+	}
+#endif
 	BFile file;
 	// try to open data-file...
 	status_t err;
@@ -1836,7 +2618,9 @@ const char* const BmSpamFilter::MSG_UNSURE_THRESHOLD	=	"bm:uthr";
 const char* const BmSpamFilter::MSG_DE_HTML			=		"bm:dh";
 const char* const BmSpamFilter::MSG_KEEP_A_TAGS		=		"bm:ka";
 const char* const BmSpamFilter::MSG_STOP_PROCESSING =	   "bm:stop";
-const int16 BmSpamFilter::nArchiveVersion = 7;
+const char* const BmSpamFilter::MSG_DECISIVE_MARGIN =	   "bm:dm";
+const char* const BmSpamFilter::MSG_MAX_SCAN_KBYTES =	   "bm:mskb";
+const int16 BmSpamFilter::nArchiveVersion = 8;
 
 BmSpamFilter::Data BmSpamFilter::D;
 /*------------------------------------------------------------------------------*\
@@ -1856,6 +2640,8 @@ BmSpamFilter::Data::Data()
 	,	mDeHtml(true)
 	,	mKeepATags(true)
 	,	mStopProcessing(true)
+	,	mDecisiveMargin(0)
+	,	mMaxScanKBytes(0)
 {
 }
 
@@ -1894,6 +2680,10 @@ BmSpamFilter::BmSpamFilter( const BmString& name, const BMessage* archive)
 	if (version >= 7) {
 		archive->FindBool( MSG_STOP_PROCESSING, &D.mStopProcessing);
 	}
+	if (version >= 8) {
+		archive->FindInt8( MSG_DECISIVE_MARGIN, &D.mDecisiveMargin);
+		archive->FindInt32( MSG_MAX_SCAN_KBYTES, &D.mMaxScanKBytes);
+	}
 }
 
 /*------------------------------------------------------------------------------*\
@@ -1924,7 +2714,9 @@ BmSpamFilter::Archive( BMessage* archive, bool) const
 		| archive->AddInt8( MSG_UNSURE_THRESHOLD, D.mUnsureThreshold)
 		| archive->AddBool( MSG_DE_HTML, D.mDeHtml)
 		| archive->AddBool( MSG_KEEP_A_TAGS, D.mKeepATags)
-		| archive->AddBool( MSG_STOP_PROCESSING, D.mStopProcessing));
+		| archive->AddBool( MSG_STOP_PROCESSING, D.mStopProcessing)
+		| archive->AddInt8( MSG_DECISIVE_MARGIN, D.mDecisiveMargin)
+		| archive->AddInt32( MSG_MAX_SCAN_KBYTES, D.mMaxScanKBytes));
 	return ret;
 }
 
@@ -1948,7 +2740,6 @@ BmSpamFilter::Execute( BmMsgContext* msgContext, const BMessage* _jobSpecs)
 		jobSpecs = *_jobSpecs;
 		jobSpecifier = jobSpecs.FindString("jobSpecifier");
 	}
-	nClassifier.JobSpecs(&jobSpecs);
 	bool bdummy;
 	if (jobSpecs.FindBool("DeHtml", &bdummy) != B_OK)
 		jobSpecs.AddBool("DeHtml", D.mDeHtml);
@@ -1962,11 +2753,16 @@ BmSpamFilter::Execute( BmMsgContext* msgContext, const BMessage* _jobSpecs)
 			jobSpecs.AddInt32("ThresholdForSpam", D.mSpamThreshold);
 		if (jobSpecs.FindInt32("ThresholdForTofu", &dummy) != B_OK)
 			jobSpecs.AddInt32("ThresholdForTofu", D.mTofuThreshold);
-		result = nClassifier.Classify( msgContext);
+		if (jobSpecs.FindInt32("DecisiveMargin", &dummy) != B_OK)
+			jobSpecs.AddInt32("DecisiveMargin", D.mDecisiveMargin);
+		if (jobSpecs.FindInt32("MaxScanKBytes", &dummy) != B_OK)
+			jobSpecs.AddInt32("MaxScanKBytes", D.mMaxScanKBytes);
+		result = nClassifier.Classify( msgContext, &jobSpecs);
 		if (result) {
-			bool isSpam = msgContext->GetBool("IsSpam");
+			bool isSpam = msgContext->GetBool(BmMsgContext::FIELD_IS_SPAM);
 			if (isSpam) {
-				double ratioSpam = msgContext->GetDouble("RatioSpam");
+				double ratioSpam
+					= msgContext->GetDouble(BmMsgContext::FIELD_RATIO_SPAM);
 				BM_LOG( BM_LogFilter, 
 						  BmString("Spam-Addon: mail is considered SPAM ")
 								<< "(with a confidence of " 
@@ -1992,18 +2788,24 @@ BmSpamFilter::Execute( BmMsgContext* msgContext, const BMessage* _jobSpecs)
 					if (D.mActionFileUnsure 
 					&& ratioSpam < D.mUnsureThreshold/100.0) {
 						msgContext->SetString(
-							"FolderName", BmMailFolder::QUARANTINE_FOLDER_NAME
+							BmMsgContext::FIELD_FOLDER_NAME, 
+							BmMailFolder::QUARANTINE_FOLDER_NAME
 						);
 					} else {
 						if (D.mActionFileSpam)
 							msgContext->SetString(
-								"FolderName", BmMailFolder::SPAM_FOLDER_NAME
+								BmMsgContext::FIELD_FOLDER_NAME, 
+								BmMailFolder::SPAM_FOLDER_NAME
 							);
 						if (D.mActionMarkSpamAsRead)
-							msgContext->SetString("Status", BM_MAIL_STATUS_READ);
+							msgContext->SetString(
+								BmMsgContext::FIELD_STATUS, BM_MAIL_STATUS_READ
+							);
 					}
 					if (D.mStopProcessing)
-						msgContext->SetBool("StopProcessing", true);
+						msgContext->SetBool(
+							BmMsgContext::FIELD_STOP_PROCESSING, true
+						);
 				}
 			}
 		}
@@ -2013,20 +2815,26 @@ BmSpamFilter::Execute( BmMsgContext* msgContext, const BMessage* _jobSpecs)
 		float ratioSpam = msgContext->mail->RatioSpam();
 		if (D.mActionFileUnsure && ratioSpam < D.mUnsureThreshold/100.0)
 			// allow re-learning of quarantined spam messages:
-			msgContext->SetBool("ForceLearning", true);
-		result = nClassifier.LearnAsSpam( msgContext);
+			msgContext->SetBool(BmMsgContext::FIELD_FORCE_LEARNING, true);
+		result = nClassifier.LearnAsSpam( msgContext, &jobSpecs);
 		if (result) {
 			if (D.mActionFileLearnedSpam)
-				msgContext->SetString("FolderName", BmMailFolder::SPAM_FOLDER_NAME);
+				msgContext->SetString(
+					BmMsgContext::FIELD_FOLDER_NAME, BmMailFolder::SPAM_FOLDER_NAME
+				);
 			if (D.mActionMarkSpamAsRead)
-				msgContext->SetString("Status", BM_MAIL_STATUS_READ);
+				msgContext->SetString(
+					BmMsgContext::FIELD_STATUS, BM_MAIL_STATUS_READ
+				);
 		}
 	} else if (!jobSpecifier.ICompare("LearnAsTofu")) {
 		BM_LOG2( BM_LogFilter, "Spam-Addon: starting LearnAsTofu job...");
-		result = nClassifier.LearnAsTofu( msgContext);
+		result = nClassifier.LearnAsTofu( msgContext, &jobSpecs);
 		if (result && D.mActionFileLearnedTofu) {
 			const BmString& homeFolder = msgContext->mail->DestFolderName();
-			msgContext->SetString("FolderName", homeFolder.String());
+			msgContext->SetString(
+				BmMsgContext::FIELD_FOLDER_NAME, homeFolder.String()
+			);
 		}
 	} else if (!jobSpecifier.ICompare("Reset")) {
 		BM_LOG2( BM_LogFilter, "Spam-Addon: starting Reset job...");
@@ -2034,12 +2842,19 @@ BmSpamFilter::Execute( BmMsgContext* msgContext, const BMessage* _jobSpecs)
 	} else if (!jobSpecifier.ICompare("Reload")) {
 		BM_LOG2( BM_LogFilter, "Spam-Addon: starting Reload job...");
 		result = nClassifier.Reload( msgContext);
+	} else if (!jobSpecifier.ICompare("Flush")) {
+		BM_LOG2( BM_LogFilter, "Spam-Addon: starting Flush job...");
+		result = nClassifier.Flush( msgContext);
 	} else if (!jobSpecifier.ICompare("GetStatistics")) {
 		BM_LOG2( BM_LogFilter, "Spam-Addon: starting GetStatistics job...");
 		result = nClassifier.GetStatistics( msgContext);
 	} else if (!jobSpecifier.ICompare("ResetStatistics")) {
 		BM_LOG2( BM_LogFilter, "Spam-Addon: starting ResetStatistics job...");
 		result = nClassifier.ResetStatistics( msgContext);
+	} else if (!jobSpecifier.ICompare("LearnBulk")) {
+		// the mails are passed inside of the jobSpecs, msgContext is unused:
+		BM_LOG2( BM_LogFilter, "Spam-Addon: starting LearnBulk job...");
+		result = nClassifier.LearnBulk( &jobSpecs);
 	}
 	BM_LOG2( BM_LogFilter, "Spam-Addon: done.");
 	return result;
@@ -12,13 +12,16 @@
 #include <Archivable.h>
 #include <Autolock.h>
 
-#include <deque>
-using std::deque;
+#include <map>
+#include <vector>
+using std::map;
+using std::vector;
 
 #include "BmFilterAddon.h"
 #include "BmFilterAddonPrefs.h"
 
 #include "BmMemIO.h"
+#include "BmMultiLocker.h"
 
 /*------------------------------------------------------------------------------*\
 	BmSpamFilter 
@@ -46,21 +49,23 @@ class BmSpamFilter : public BmFilterAddon {
 		OsbfClassifier();
 		~OsbfClassifier();
 		void Initialize();
-		const BmString& ErrorString() const;
-		bool LearnAsSpam( BmMsgContext* msgContext);
-		bool LearnAsTofu( BmMsgContext* msgContext);
-		bool Classify( BmMsgContext* msgContext);
+		BmString ErrorString() const;
+		bool LearnAsSpam( BmMsgContext* msgContext, 
+								const BMessage* jobSpecs = NULL);
+		bool LearnAsTofu( BmMsgContext* msgContext, 
+								const BMessage* jobSpecs = NULL);
+		bool Classify( BmMsgContext* msgContext, 
+							const BMessage* jobSpecs = NULL);
+		bool LearnBulk( const BMessage* jobSpecs);
 		bool Reset( BmMsgContext* msgContext);
 		bool Reload( BmMsgContext* msgContext);
+		bool Flush( BmMsgContext* msgContext);
 		bool ResetStatistics( BmMsgContext* msgContext);
 		bool GetStatistics( BmMsgContext* msgContext);
-		void JobSpecs( const BMessage* jobSpecs)
-													{ mJobSpecs = jobSpecs; }
 													
 #ifndef __MWERKS__
 	private:
 #endif
-		static const BMessage* mJobSpecs;
 
 		typedef struct
 		{
@@ -95,6 +100,21 @@ class BmSpamFilter : public BmFilterAddon {
 			unsigned long classifications;		/* number of classifications */
 			unsigned long mistakes;		/* number of wrong classifications */
 		} Header;
+
+		/* a data-file that has been mapped into memory (if supported),
+		   changes are private until they are written back by Store() */
+		struct DataMapping
+		{
+			DataMapping()
+				:	base(NULL), size(0), fd(-1), allDirty(false)	{}
+			void* base;
+			size_t size;
+			int fd;
+			vector<unsigned long> dirtyBuckets;
+				// indices of the buckets changed since the last Store()
+			bool allDirty;
+				// set if (potentially) all buckets have changed
+		};
 		
 		////////////////////////////////////////////////////////////////////
 		//
@@ -109,12 +129,18 @@ class BmSpamFilter : public BmFilterAddon {
 		static unsigned char FileVersion[4];
 		
 		/* max feature value */
-		static const unsigned long WindowLen;
+		static const unsigned long WindowLen = 5;
 
 		/* max feature value */
 		static const unsigned long FeatureBucketValueMax;
 		/* max number of features */
 		static const unsigned long DefaultFileLength;
+		/* the data-files will never grow beyond this number of features */
+		static const unsigned long MaxFileLength;
+		/* data-files grow when more than this ratio of buckets is used */
+		static const double MaxLoadFactor;
+		/* max number of classification results kept in the cache */
+		static const uint32 MaxCachedClassifications;
 		
 		/* shall we try to do small cleanups automatically, if the hash-chains
 		   get too long? */ 
@@ -125,6 +151,9 @@ class BmSpamFilter : public BmFilterAddon {
 		static const unsigned long MicrogroomStopAfter;
 		/* minimum ratio between max and min P(F|C) */
 		static const unsigned long MinPmaxPminRatio;
+		/* number of mails per thread whose features are collected at once 
+		   during bulk-learning */
+		static const uint32 BulkMailsPerThread;
 	
 	public:
 		static void Microgroom( FeatureBucket* hash, Header* header,
@@ -146,7 +175,8 @@ class BmSpamFilter : public BmFilterAddon {
 				typedef BmMemFilter inherited;
 			
 			public:
-				HtmlRemover( BmMemIBuf* input, uint32 blockSize=nBlockSize);
+				HtmlRemover( BmMemIBuf* input, bool keepATags,
+								 uint32 blockSize=nBlockSize);
 			
 			protected:
 				// overrides of BmMailFilter base:
@@ -161,13 +191,14 @@ class BmSpamFilter : public BmFilterAddon {
 			};
 			
 		public:
-			SpamRelevantMailtextSelector(BmMail* mail);
+			SpamRelevantMailtextSelector(BmMail* mail, const BMessage* jobSpecs);
 			void operator() (BmStringIBuf& inBuf);
 		
 		private:
 			void AddSpamRelevantBodyParts(BmStringIBuf& inBuf);
 			BmBodyPart* FindBodyPartWithHighestSpamRelevance(BmBodyPart* parent);
 			BmRef<BmMail> mMail;
+			const BMessage* mJobSpecs;
 			BmStringOBuf mDeHtmlBuf;
 		};
 		
@@ -189,23 +220,74 @@ class BmSpamFilter : public BmFilterAddon {
 	
 
 
+		/*------------------------------------------------------------------------------*\
+			HashPipe
+				-	the sliding window of the hashes of the last WindowLen features,
+					kept in a ring (index 0 is the most recent hash)
+		\*------------------------------------------------------------------------------*/
+		class HashPipe {
+		public:
+			HashPipe();
+			inline void Push( unsigned long hash) {
+				mHead = (mHead == 0 ? WindowLen : mHead) - 1;
+				mPipe[mHead] = hash;
+			}
+			inline unsigned long operator[]( uint32 index) const {
+				index += mHead;
+				return mPipe[index < WindowLen ? index : index - WindowLen];
+			}
+		private:
+			unsigned long mPipe[WindowLen];
+			uint32 mHead;
+		};
+
+		/* the (primary and crosscut) hash of a single feature */
+		struct FeatureHash {
+			unsigned long h1;
+			unsigned long h2;
+		};
+		typedef vector<FeatureHash> FeatureHashVect;
+
+		/*------------------------------------------------------------------------------*\
+			FeatureHasher
+				-	collects the hashes of all features of a mailtext (which only 
+					depend on the text, so this doesn't need any locking)
+		\*------------------------------------------------------------------------------*/
+		struct FeatureHasher : public BmMemBufConsumer::Functor {
+			FeatureHasher( FeatureHashVect& hashes);
+
+			status_t operator() (char* buf, uint32 bufLen);
+
+			FeatureHashVect& mHashes;
+			HashPipe mHashpipe;
+		};
+
 		/*------------------------------------------------------------------------------*\
 			FeatureLearner
 				-	implements the learning of features into the given feature-class
 		\*------------------------------------------------------------------------------*/
-		struct FeatureLearner : public BmMemBufConsumer::Functor {
+		struct FeatureLearner {
 			FeatureLearner( FeatureBucket* hash, Header* header, bool revert);
 			~FeatureLearner();
 
-			status_t operator() (char* buf, uint32 bufLen);
+			status_t LearnFeature( unsigned long h1, unsigned long h2);
+			status_t LearnFeatures( const FeatureHashVect& hashes);
 
 			void Finalize();
 
 			FeatureBucket* mHash;
 			Header* mHeader;
 			bool mRevert;
-			deque<unsigned long> mHashpipe;
 			status_t mStatus;
+			long mUsedDelta;
+				// change in number of used buckets caused by learning
+			vector<unsigned long> mLockedBuckets;
+				// indices of the buckets locked during learning
+			bool mHaveGroomed;
+				// microgrooming may move locked buckets around, so we can't
+				// rely on mLockedBuckets anymore, once it has happened
+			bool mHaveRescaled;
+				// set if all buckets have been rescaled
 		};
 
 
@@ -232,7 +314,7 @@ class BmSpamFilter : public BmFilterAddon {
 
 			char *mSeenFeatures[MaxHash];
 
-			deque<unsigned long> mHashpipe;
+			HashPipe mHashpipe;
 			status_t mStatus;
 			
 			unsigned long mHits[MaxHash];
@@ -255,27 +337,85 @@ class BmSpamFilter : public BmFilterAddon {
 			double mOverallPr;
 			unsigned long mHashLen[MaxHash];
 			const char *mHashName[MaxHash];
+			double mDecisiveRatio;
+				// classification stops as soon as one class is more probable
+				// than the other by this ratio (0 means never)
+			uint32 mMaxBytes;
+				// classification stops after this many bytes (0 means never)
+			uint32 mBytesScanned;
+			bool mStoppedEarly;
 		};
 
 
 
-		bool Learn( BmMsgContext* msgContext, bool learnAsSpam, bool revert);
-		bool DoActualClassification( BmMsgContext* msgContext, double& overallPr);
+		bool Learn( BmMsgContext* msgContext, bool learnAsSpam, bool revert,
+						const BMessage* jobSpecs);
+		bool LearnFeatureHashes( const FeatureHashVect& hashes, bool learnAsSpam,
+										 bool revert);
+		static void CollectFeatureHashes( BmMail* mail, const BMessage* jobSpecs,
+													 FeatureHashVect& hashes);
+		struct BulkHashJob;
+		static int32 BulkHasherThread( void* data);
+		bool DoActualClassification( const BmString& selectedText, 
+											  const BMessage* jobSpecs,
+											  double& overallPr);
+		static int32 EffectiveDecisiveMargin( const BMessage* jobSpecs);
+		static BmString ClassificationCacheKey( BmMail* mail, 
+															 const BmString& selectedText,
+															 const BMessage* jobSpecs);
+		bool LookupCachedClassification( const BmString& key, 
+													double& overallPr);
+		void CacheClassification( const BmString& key, double overallPr);
+		void SetError( const BmString& err);
+		static void AtomicIncrement( unsigned long* counter);
 		void Store();
 		status_t CreateDataFile( const BmString& filename);
 		status_t ReadDataFile( const BmString& filename, Header& header,
-									  FeatureBucket*& hash);
+									  FeatureBucket*& hash, DataMapping& mapping);
 		status_t WriteDataFile( const BmString& filename, Header& header,
-										FeatureBucket*& hash);
+										FeatureBucket*& hash, DataMapping& mapping);
+		status_t MapDataFile( const BmString& filename, const Header& header,
+									 FeatureBucket*& hash, DataMapping& mapping);
+		void ReleaseDataFile( FeatureBucket*& hash, DataMapping& mapping);
+		status_t GrowDataFile( bool spamData);
+		static unsigned long CountUsedBuckets( const FeatureBucket* hash,
+															const Header& header);
 		
 		Header mSpamHeader;
 		FeatureBucket* mSpamHash;
+		DataMapping mSpamMapping;
+		unsigned long mSpamUsedBuckets;
+		bool mSpamUsedBucketsCounted;
+							// the used buckets are only counted on the first
+							// learning, since that touches the whole data
 		bool mNeedToStoreSpam;
 		Header mTofuHeader;
 		FeatureBucket* mTofuHash;
+		DataMapping mTofuMapping;
+		unsigned long mTofuUsedBuckets;
+		bool mTofuUsedBucketsCounted;
 		bool mNeedToStoreTofu;
-		BLocker mLock;
+		BmMultiLocker mLock;
+							// classifications only read the data, so they 
+							// share the lock, learning needs exclusive access
 		BmString mLastErr;
+		mutable BLocker mErrLock;
+							// protects mLastErr, which may be set by any thread
+
+		/* a cached classification result, only valid as long as the data
+		   is still at the same generation */
+		struct CachedClassification {
+			double overallPr;
+			uint32 generation;
+		};
+		typedef map<BmString, CachedClassification> ClassificationCache;
+		ClassificationCache mClassificationCache;
+		BLocker mCacheLock;
+		uint32 mGeneration;
+							// incremented whenever learning (or reset/reload)
+							// changes the data
+		int32 mGrowing;
+							// set while a data-file is being grown
 	};
 
 public:
@@ -289,6 +429,7 @@ public:
 	status_t Archive( BMessage* archive, bool deep = true) const;
 	BmString ErrorString() const;
 	void Initialize()							{ nClassifier.Initialize(); }
+	bool IsThreadSafe() const				{ return true; }
 
 	// getters:
 	inline const BmString &Name() const	{ return mName; }
@@ -309,6 +450,8 @@ public:
 	static const char* const MSG_DE_HTML;
 	static const char* const MSG_KEEP_A_TAGS;
 	static const char* const MSG_STOP_PROCESSING;
+	static const char* const MSG_DECISIVE_MARGIN;
+	static const char* const MSG_MAX_SCAN_KBYTES;
 	static const int16 nArchiveVersion;
 
 	struct Data {
@@ -325,6 +468,8 @@ public:
 		bool mDeHtml;
 		bool mKeepATags;
 		bool mStopProcessing;
+		int8 mDecisiveMargin;
+		int32 mMaxScanKBytes;
 	};
 	static Data D;
 
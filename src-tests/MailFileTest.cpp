@@ -0,0 +1,421 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <Entry.h>
+#include <File.h>
+#include <Node.h>
+
+#include "MailFileTest.h"
+#include "TestBeam.h"
+
+#include "BmBodyPartList.h"
+#include "BmFilter.h"
+#include "BmMail.h"
+#include "BmMailFilter.h"
+#include "BmMailHeader.h"
+#include "BmMailRef.h"
+#include "BmPrefs.h"
+#include "BmStorageUtil.h"
+
+using std::vector;
+
+static vector<BmString> createdFiles;
+
+/*------------------------------------------------------------------------------*\
+	MailFilePath( name)
+		-	returns the path of the mail-file with the given name (in the 
+			in-folder)
+\*------------------------------------------------------------------------------*/
+static BmString MailFilePath( const char* name) {
+	return ThePrefs->GetString( "MailboxPath") + "/in/" + name;
+}
+
+/*------------------------------------------------------------------------------*\
+	CreateMailFile( name, text)
+		-	writes the given text into a mail-file within the in-folder and
+			returns a (not yet read) mail for it
+\*------------------------------------------------------------------------------*/
+static BmRef<BmMail> CreateMailFile( const char* name, const BmString& text) {
+	BmString path = MailFilePath( name);
+	BFile file( path.String(), B_CREATE_FILE | B_ERASE_FILE | B_WRITE_ONLY);
+	CPPUNIT_ASSERT( file.InitCheck() == B_OK);
+	CPPUNIT_ASSERT( file.Write( text.String(), text.Length()) 
+							== text.Length());
+	file.Unset();
+	createdFiles.push_back( path);
+	entry_ref eref;
+	CPPUNIT_ASSERT( BEntry( path.String()).GetRef( &eref) == B_OK);
+	BmRef<BmMailRef> ref = BmMailRef::CreateInstance( eref);
+	CPPUNIT_ASSERT( ref);
+	BmRef<BmMail> mail = BmMail::CreateInstance( ref.Get());
+	CPPUNIT_ASSERT( mail);
+	return mail;
+}
+
+/*------------------------------------------------------------------------------*\
+	CountingAddon
+		-	a filter-addon that sets the identity of every mail and counts the
+			mails it has been executed on (in batches or one by one)
+\*------------------------------------------------------------------------------*/
+class CountingAddon : public BmFilterAddon {
+public:
+	CountingAddon( bool threadSafe) 
+		:	threadSafe( threadSafe), executeCount( 0), batchCount( 0)
+		,	batchedMailCount( 0) 				{}
+	bool Execute( BmMsgContext* msgContext, const BMessage*) {
+		atomic_add( &executeCount, 1);
+		msgContext->SetString( BmMsgContext::FIELD_IDENTITY, "counted");
+		return true;
+	}
+	bool ExecuteBatch( const vector< BmMsgContext*>& msgContexts,
+							 vector< bool>& results, const BMessage* jobSpecs) {
+		atomic_add( &batchCount, 1);
+		atomic_add( &batchedMailCount, msgContexts.size());
+		return BmFilterAddon::ExecuteBatch( msgContexts, results, jobSpecs);
+	}
+	bool SanityCheck( BmString&, BmString&) 	{ return true; }
+	status_t Archive( BMessage*, bool) const	{ return B_OK; }
+	BmString ErrorString() const				{ return ""; }
+	bool IsThreadSafe() const					{ return threadSafe; }
+	void AddNeeds( BmFilterNeeds& needs)	{ needs.AddHeaderField( "From"); }
+
+	bool threadSafe;
+	int32 executeCount;
+	int32 batchCount;
+	int32 batchedMailCount;
+};
+
+/*------------------------------------------------------------------------------*\
+	CountingFilter
+		-	a filter that uses a CountingAddon
+\*------------------------------------------------------------------------------*/
+class CountingFilter : public BmFilter {
+public:
+	CountingFilter( bool threadSafe) 
+		:	BmFilter( "CountingFilter", "", NULL)
+		,	addon( new CountingAddon( threadSafe))
+													{ mAddon = addon; }
+	CountingAddon* addon;
+};
+
+/*------------------------------------------------------------------------------*\
+	CreateMailRefs( prefix, count)
+		-	creates count mail-files and returns refs to them
+\*------------------------------------------------------------------------------*/
+static BmMailRefVect* CreateMailRefs( const char* prefix, int32 count) {
+	BmMailRefVect* refs = new BmMailRefVect;
+	for( int32 m=0; m<count; ++m) {
+		BmString name = BmString(prefix) << m;
+		BmString text = BmString("From: sender") << m << "@test.org\r\n"
+							 << "Subject: mail " << m << "\r\n"
+							 << "\r\n"
+							 << "body text\r\n";
+		BmRef<BmMail> mail = CreateMailFile( name.String(), text);
+		refs->push_back( mail->MailRef());
+	}
+	return refs;
+}
+
+/*------------------------------------------------------------------------------*\
+	FilterMailRefs( filter, refs, workerThreads)
+		-	filters the given mail-refs with the given number of worker threads
+\*------------------------------------------------------------------------------*/
+static void FilterMailRefs( BmFilter* filter, BmMailRefVect* refs, 
+									 int32 workerThreads) {
+	int32 oldWorkerThreads = ThePrefs->GetInt( "MailFilterWorkerThreads");
+	ThePrefs->SetInt( "MailFilterWorkerThreads", workerThreads);
+	BmRef<BmMailFilter> mailFilter 
+		= new BmMailFilter( "FilterMailRefs", filter, false, false);
+	mailFilter->SetMailRefVect( refs);
+	mailFilter->StartJobInThisThread();
+	ThePrefs->SetInt( "MailFilterWorkerThreads", oldWorkerThreads);
+}
+
+/*------------------------------------------------------------------------------*\
+	CheckStoredIdentities( prefix, count)
+		-	checks that the results of the CountingAddon have been stored
+			for all the given mail-files
+\*------------------------------------------------------------------------------*/
+static void CheckStoredIdentities( const char* prefix, int32 count) {
+	for( int32 m=0; m<count; ++m) {
+		BmString name = BmString(prefix) << m;
+		BNode node( MailFilePath( name.String()).String());
+		BmString storedIdentity;
+		CPPUNIT_ASSERT( BmReadStringAttr( &node, BM_MAIL_ATTR_IDENTITY, 
+													 storedIdentity));
+		CPPUNIT_ASSERT( storedIdentity == "counted");
+	}
+}
+
+// setUp
+void
+MailFileTest::setUp()
+{
+	inherited::setUp();
+}
+	
+// tearDown
+void
+MailFileTest::tearDown()
+{
+	for( uint32 i=0; i<createdFiles.size(); ++i)
+		BEntry( createdFiles[i].String()).Remove();
+	createdFiles.clear();
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailFileTest::HeaderJobTest()
+{
+	// a header that is larger than one block, with folded fields and 
+	// a body that must not be read:
+	BmString longVal;
+	longVal.SetTo( 'x', 5000);
+	BmString text = BmString("From: sender@test.org\n")
+		<< "To: receiver@test.org\n"
+		<< "Subject: first\n"
+		<< "  second\n"
+		<< "\tthird\n"
+		<< "X-Long: " << longVal << "\n"
+		<< "\n"
+		<< "Subject: in body\n"
+		<< "body text\n";
+	{
+		NextSubTest();
+		BmRef<BmMail> mail = CreateMailFile( "header-job-1", text);
+		mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+		CPPUNIT_ASSERT( mail->InitCheck() == B_OK);
+		CPPUNIT_ASSERT( mail->IsHeaderOnly());
+		CPPUNIT_ASSERT( mail->HeaderText().FindFirst( "body text") < 0);
+		CPPUNIT_ASSERT( mail->HeaderText().FindFirst( longVal) >= 0);
+		CPPUNIT_ASSERT( mail->GetFieldVal( "Subject") 
+								== "first second third");
+		CPPUNIT_ASSERT( mail->GetFieldVal( "X-Long") == longVal);
+	}
+
+	// the empty line crossing the first block-boundary (CRLF-style):
+	{
+		NextSubTest();
+		BmString crlfText = "From: sender@test.org\r\nX-Fill: ";
+		int32 fill = 4096 - crlfText.Length() - 3;
+		BmString fillVal;
+		fillVal.SetTo( 'y', fill);
+		crlfText << fillVal << "\r\n\r\nbody text\r\n";
+		BmRef<BmMail> mail = CreateMailFile( "header-job-2", crlfText);
+		mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+		CPPUNIT_ASSERT( mail->InitCheck() == B_OK);
+		CPPUNIT_ASSERT( mail->IsHeaderOnly());
+		CPPUNIT_ASSERT( mail->HeaderText().FindFirst( "body text") < 0);
+		CPPUNIT_ASSERT( mail->GetFieldVal( "X-Fill") == fillVal);
+	}
+
+	// a mail without any body is read completely:
+	{
+		NextSubTest();
+		BmRef<BmMail> mail 
+			= CreateMailFile( "header-job-3", 
+									"From: sender@test.org\r\nSubject: no body\r\n");
+		mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+		CPPUNIT_ASSERT( mail->InitCheck() == B_OK);
+		CPPUNIT_ASSERT( !mail->IsHeaderOnly());
+		CPPUNIT_ASSERT( mail->GetFieldVal( "Subject") == "no body");
+		CPPUNIT_ASSERT( mail->Body() != NULL);
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailFileTest::PromotionTest()
+{
+	BmString text = "From: sender@test.org\r\n"
+						 "To: receiver@test.org\r\n"
+						 "Subject: promotion\r\n"
+						 "\r\n"
+						 "body text\r\n";
+	BmRef<BmMail> mail = CreateMailFile( "promotion-1", text);
+	mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+	CPPUNIT_ASSERT( mail->IsHeaderOnly());
+
+	// accessing the text reads the complete mail:
+	NextSubTest();
+	mail->IdentityName( "promoted-identity");
+	mail->SetFieldVal( "X-Promoted", "yes");
+	mail->RemoveField( "To");
+	CPPUNIT_ASSERT( mail->RawText() == text);
+	CPPUNIT_ASSERT( !mail->IsHeaderOnly());
+	CPPUNIT_ASSERT( mail->InitCheck() == B_OK);
+	CPPUNIT_ASSERT( mail->Body() != NULL);
+	CPPUNIT_ASSERT( mail->Body()->EditableTextBody());
+	CPPUNIT_ASSERT( mail->Body()->EditableTextBody()->DecodedData()
+							.FindFirst( "body text") == 0);
+
+	// changes made before the promotion have survived:
+	NextSubTest();
+	CPPUNIT_ASSERT( mail->IdentityName() == "promoted-identity");
+	CPPUNIT_ASSERT( mail->GetFieldVal( "X-Promoted") == "yes");
+	CPPUNIT_ASSERT( mail->IsFieldEmpty( "To"));
+	CPPUNIT_ASSERT( mail->GetFieldVal( "Subject") == "promotion");
+
+	// a full read of a header-only mail is a promotion, too:
+	NextSubTest();
+	BmRef<BmMail> mail2 = CreateMailFile( "promotion-2", text);
+	mail2->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+	CPPUNIT_ASSERT( mail2->IsHeaderOnly());
+	mail2->StartJobInThisThread( BmMail::BM_READ_MAIL_JOB);
+	CPPUNIT_ASSERT( !mail2->IsHeaderOnly());
+	CPPUNIT_ASSERT( mail2->RawText() == text);
+
+	// a failing promotion leaves the header-only mail intact:
+	NextSubTest();
+	BmRef<BmMail> mail3 = CreateMailFile( "promotion-3", text);
+	mail3->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+	CPPUNIT_ASSERT( mail3->IsHeaderOnly());
+	BEntry( MailFilePath( "promotion-3").String()).Remove();
+	CPPUNIT_ASSERT( !mail3->ReconstructRawText());
+	CPPUNIT_ASSERT( mail3->IsHeaderOnly());
+	CPPUNIT_ASSERT( mail3->InitCheck() == B_OK);
+	CPPUNIT_ASSERT( mail3->RawText().FindFirst( "body text") < 0);
+	CPPUNIT_ASSERT( mail3->GetFieldVal( "Subject") == "promotion");
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailFileTest::FilterResultsTest()
+{
+	// a filter that only looks at the header, but changes the mail:
+	TheFilterList->StartJobInThisThread();
+	BMessage addonArchive;
+	addonArchive.AddString( "bm:content", 
+									"require \"notify\";\n"
+									"notify :method \"BeamSetIdentity\" "
+										":options \"filtered-identity\";\n"
+									"notify :method \"BeamSetListId\" "
+										":options \"<filtered.list>\";\n");
+	BMessage archive;
+	archive.AddInt16( "bm:version", BmFilter::nArchiveVersion);
+	archive.AddString( BmFilter::MSG_NAME, "FilterResultsTest");
+	archive.AddString( BmFilter::MSG_KIND, "Sieve-Script");
+	archive.AddMessage( BmFilter::MSG_ADDON_ARCHIVE, &addonArchive);
+	BmRef<BmFilter> filter = new BmFilter( &archive, NULL);
+	if (filter->IsDisabled()) {
+		cerr << "sieve-addon hasn't been loaded, skipping FilterResultsTest" 
+			  << endl;
+		return;
+	}
+
+	// filtering a mail of which only the header has been read:
+	NextSubTest();
+	BmString text = "From: sender@test.org\r\n"
+						 "To: receiver@test.org\r\n"
+						 "Subject: filter results\r\n"
+						 "\r\n"
+						 "body text\r\n";
+	BmRef<BmMail> mail = CreateMailFile( "filter-results-1", text);
+	mail->StartJobInThisThread( BmMail::BM_READ_HEADER_JOB);
+	CPPUNIT_ASSERT( mail->IsHeaderOnly());
+	BmRef<BmMailFilter> mailFilter 
+		= new BmMailFilter( "FilterResultsTest", filter.Get(), false, false);
+	mailFilter->AddMail( mail.Get());
+	mailFilter->StartJobInThisThread();
+	CPPUNIT_ASSERT( !mail->IsHeaderOnly());
+	CPPUNIT_ASSERT( mail->IdentityName() == "filtered-identity");
+	CPPUNIT_ASSERT( mail->GetFieldVal( BM_FIELD_LIST_ID) == "<filtered.list>");
+
+	// both changes (and the body) have been stored:
+	NextSubTest();
+	BmString storedText;
+	CPPUNIT_ASSERT( FetchFile( MailFilePath( "filter-results-1"), storedText));
+	CPPUNIT_ASSERT( storedText.FindFirst( "<filtered.list>") >= 0);
+	CPPUNIT_ASSERT( storedText.FindFirst( "body text") >= 0);
+	BNode node( MailFilePath( "filter-results-1").String());
+	BmString storedIdentity;
+	CPPUNIT_ASSERT( BmReadStringAttr( &node, BM_MAIL_ATTR_IDENTITY, 
+												 storedIdentity));
+	CPPUNIT_ASSERT( storedIdentity == "filtered-identity");
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailFileTest::BatchedFilterTest()
+{
+	const int32 mailCount = 12;
+	BmRef<CountingFilter> filter = new CountingFilter( false);
+	BmMailRefVect* refs = CreateMailRefs( "batched-filter-", mailCount);
+
+	// the pool leaves the filter (which is not thread-safe) to the 
+	// filter-job thread, which executes it on every mail exactly once:
+	NextSubTest();
+	FilterMailRefs( filter.Get(), refs, 2);
+	CPPUNIT_ASSERT( filter->addon->executeCount == mailCount);
+	CPPUNIT_ASSERT( filter->addon->batchedMailCount == mailCount);
+	CPPUNIT_ASSERT( filter->addon->batchCount >= 1);
+	CPPUNIT_ASSERT( filter->addon->batchCount <= mailCount);
+
+	// the results of all mails have been stored:
+	NextSubTest();
+	CheckStoredIdentities( "batched-filter-", mailCount);
+
+	// without workers, the filter-job thread executes every filter (even a
+	// thread-safe one) on several mails in one go:
+	NextSubTest();
+	BmRef<CountingFilter> seqFilter = new CountingFilter( true);
+	BmMailRefVect* seqRefs = CreateMailRefs( "sequential-filter-", mailCount);
+	FilterMailRefs( seqFilter.Get(), seqRefs, 1);
+	CPPUNIT_ASSERT( seqFilter->addon->executeCount == mailCount);
+	CPPUNIT_ASSERT( seqFilter->addon->batchedMailCount == mailCount);
+	CPPUNIT_ASSERT( seqFilter->addon->batchCount >= 1);
+	CPPUNIT_ASSERT( seqFilter->addon->batchCount < mailCount);
+	CheckStoredIdentities( "sequential-filter-", mailCount);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailFileTest::PoolFilterTest()
+{
+	const int32 mailCount = 24;
+
+	// the workers execute a thread-safe filter on every mail exactly once
+	// (with the default number of worker threads, too, which means that
+	// the filter-job thread does it if there is only one CPU):
+	int32 workerCounts[] = { 4, 0 };
+	for( int32 w=0; w<2; ++w) {
+		NextSubTest();
+		BmString prefix = BmString("pool-filter-") << w << "-";
+		BmRef<CountingFilter> filter = new CountingFilter( true);
+		BmMailRefVect* refs = CreateMailRefs( prefix.String(), mailCount);
+		FilterMailRefs( filter.Get(), refs, workerCounts[w]);
+		CPPUNIT_ASSERT( filter->addon->executeCount == mailCount);
+		if (workerCounts[w] > 1)
+			CPPUNIT_ASSERT( filter->addon->batchCount == 0);
+		CheckStoredIdentities( prefix.String(), mailCount);
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+
+#ifndef _MailFileTest_h
+#define _MailFileTest_h
+
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <TestCase.h>
+
+class MailFileTest : public BTestCase
+{
+	typedef TestCase inherited;
+	CPPUNIT_TEST_SUITE( MailFileTest );
+	CPPUNIT_TEST( HeaderJobTest);
+	CPPUNIT_TEST( PromotionTest);
+	CPPUNIT_TEST( FilterResultsTest);
+	CPPUNIT_TEST( BatchedFilterTest);
+	CPPUNIT_TEST( PoolFilterTest);
+	CPPUNIT_TEST_SUITE_END();
+public:
+	// This function called before *each* test added in Suite()
+	void setUp();
+	
+	// This function called after *each* test added in Suite()
+	void tearDown();
+
+	//------------------------------------------------------------
+	// Test functions
+	//------------------------------------------------------------
+	void HeaderJobTest();
+	void PromotionTest();
+	void FilterResultsTest();
+	void BatchedFilterTest();
+	void PoolFilterTest();
+};
+
+
+#endif
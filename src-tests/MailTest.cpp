@@ -0,0 +1,120 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include <Message.h>
+
+#include "MailTest.h"
+#include "TestBeam.h"
+
+#include "BmBodyPartList.h"
+#include "BmMail.h"
+
+static const char* MultiPartMail = 
+	"From: sender@test.org\r\n"
+	"To: receiver@test.org\r\n"
+	"Subject: mime-index\r\n"
+	"MIME-Version: 1.0\r\n"
+	"Content-Type: multipart/mixed; boundary=\"sep\"\r\n"
+	"\r\n"
+	"--sep\r\n"
+	"Content-Type: text/plain\r\n"
+	"\r\n"
+	"first part\r\n"
+	"--sep\r\n"
+	"Content-Type: text/html\r\n"
+	"\r\n"
+	"<b>second part</b>\r\n"
+	"--sep--\r\n";
+
+/*------------------------------------------------------------------------------*\
+	NthPart( body, n)
+		-	returns the n-th subpart of the (multipart) root-part of the given 
+			body
+\*------------------------------------------------------------------------------*/
+static BmBodyPart* NthPart( BmBodyPartList* body, int32 n) {
+	if (!body || body->empty())
+		return NULL;
+	BmListModelItem* root = body->begin()->second.Get();
+	BmModelItemMap::const_iterator iter = root->begin();
+	for( ; n>0 && iter != root->end(); --n)
+		++iter;
+	return iter == root->end() 
+				? NULL 
+				: dynamic_cast< BmBodyPart*>( iter->second.Get());
+}
+
+// setUp
+void
+MailTest::setUp()
+{
+	inherited::setUp();
+}
+	
+// tearDown
+void
+MailTest::tearDown()
+{
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MailTest::MimeIndexTest()
+{
+	BmRef<BmMail> mail = new BmMail( MultiPartMail, "");
+	const BMessage* origIndex = mail->Body()->MimeIndex();
+
+	// a freshly parsed mail provides a mime-index:
+	NextSubTest();
+	CPPUNIT_ASSERT( origIndex != NULL);
+	CPPUNIT_ASSERT( origIndex->HasInt32( BmBodyPartList::MSG_TEXT_CHECKSUM));
+	CPPUNIT_ASSERT( NthPart( mail->Body(), 1) != NULL);
+	CPPUNIT_ASSERT( NthPart( mail->Body(), 1)->MimeType() == "text/html");
+
+	// a matching mime-index is used instead of parsing the mail (the tampered
+	// description is only visible if the index has been used):
+	NextSubTest();
+	BMessage mimeIndex( *origIndex);
+	CPPUNIT_ASSERT( mimeIndex.ReplaceString( BmBodyPart::MSG_DESCRIPTION, 2, 
+														  "from index") == B_OK);
+	BmRef<BmMail> indexedMail = new BmMail( MultiPartMail, "");
+	indexedMail->SetTo( MultiPartMail, "", &mimeIndex);
+	CPPUNIT_ASSERT( NthPart( indexedMail->Body(), 1) != NULL);
+	CPPUNIT_ASSERT( NthPart( indexedMail->Body(), 1)->Description() 
+							== "from index");
+	CPPUNIT_ASSERT( NthPart( indexedMail->Body(), 1)->MimeType() 
+							== "text/html");
+	CPPUNIT_ASSERT( indexedMail->Body()->MimeIndex() != NULL);
+
+	// a mime-index belonging to a different mail-text of the same size 
+	// (and same header-length) is ignored and the mail is parsed instead:
+	NextSubTest();
+	BmString editedText( MultiPartMail);
+	editedText.ReplaceFirst( "text/html", "text/xxxx");
+	CPPUNIT_ASSERT( editedText.Length() == BmString( MultiPartMail).Length());
+	BmRef<BmMail> staleMail = new BmMail( editedText, "");
+	staleMail->SetTo( editedText, "", &mimeIndex);
+	CPPUNIT_ASSERT( NthPart( staleMail->Body(), 1) != NULL);
+	CPPUNIT_ASSERT( NthPart( staleMail->Body(), 1)->Description() 
+							!= "from index");
+	CPPUNIT_ASSERT( NthPart( staleMail->Body(), 1)->MimeType() 
+							== "text/xxxx");
+	const BMessage* newIndex = staleMail->Body()->MimeIndex();
+	CPPUNIT_ASSERT( newIndex != NULL);
+	CPPUNIT_ASSERT( newIndex->FindInt32( BmBodyPartList::MSG_TEXT_CHECKSUM) 
+							!= origIndex->FindInt32( 
+									BmBodyPartList::MSG_TEXT_CHECKSUM));
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "MemArenaTest.h"
+#include "TestBeam.h"
+
+#include "BmMemArena.h"
+#include "BmString.h"
+
+using std::less;
+using std::map;
+using std::pair;
+using std::vector;
+
+// setUp
+void
+MemArenaTest::setUp()
+{
+	inherited::setUp();
+}
+	
+// tearDown
+void
+MemArenaTest::tearDown()
+{
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MemArenaTest::AllocateTest()
+{
+	BmMemArenaRef arenaRef( new BmMemArena( 64));
+	BmMemArena* arena = arenaRef.Get();
+
+	// nothing reserved before first allocation:
+	NextSubTest();
+	CPPUNIT_ASSERT( arena->BytesReserved() == 0);
+	CPPUNIT_ASSERT( arena->BytesAllocated() == 0);
+
+	// allocations are aligned and do not overlap:
+	NextSubTest();
+	char* p1 = (char*)arena->Allocate( 3);
+	char* p2 = (char*)arena->Allocate( 5);
+	CPPUNIT_ASSERT( ((size_t)p1 & 7) == 0);
+	CPPUNIT_ASSERT( ((size_t)p2 & 7) == 0);
+	CPPUNIT_ASSERT( p2 >= p1+3);
+	CPPUNIT_ASSERT( arena->BytesAllocated() == 16);
+	CPPUNIT_ASSERT( arena->BytesReserved() == 64);
+
+	// exhausting the block reserves a new (larger) one:
+	NextSubTest();
+	for( int i=0; i<10; ++i)
+		memset( arena->Allocate( 8), i, 8);
+	CPPUNIT_ASSERT( arena->BytesAllocated() == 96);
+	CPPUNIT_ASSERT( arena->BytesReserved() == 64+128);
+
+	// oversized requests get a block of their own:
+	NextSubTest();
+	char* big = (char*)arena->Allocate( 1000);
+	memset( big, 'x', 1000);
+	CPPUNIT_ASSERT( arena->BytesReserved() == 64+128+1000);
+	char* p3 = (char*)arena->Allocate( 8);
+	CPPUNIT_ASSERT( p3 < big || p3 >= big+1000);
+	CPPUNIT_ASSERT( arena->BytesReserved() == 64+128+1000);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MemArenaTest::AllocatorTest()
+{
+	typedef vector< BmString, BmArenaAllocator< BmString> > StrVect;
+	typedef map< BmString, StrVect, less< BmString>, 
+					 BmArenaAllocator< pair< const BmString, StrVect> > > StrMap;
+
+	// containers without arena use the heap:
+	NextSubTest();
+	{
+		StrVect vect;
+		vect.push_back( "test");
+		CPPUNIT_ASSERT( vect.get_allocator().Arena() == NULL);
+		CPPUNIT_ASSERT( vect[0] == "test");
+	}
+
+	// containers with arena allocate from it:
+	NextSubTest();
+	BmMemArena* arena = new BmMemArena();
+	BmMemArenaRef arenaRef( arena);
+	{
+		StrMap::allocator_type alloc( arena);
+		StrMap strMap( less< BmString>(), alloc);
+		for( int i=0; i<100; ++i) {
+			StrVect vals( strMap.get_allocator());
+			vals.push_back( BmString("value") << i);
+			strMap.insert( StrMap::value_type( BmString("key") << i, vals));
+		}
+		CPPUNIT_ASSERT( arena->BytesAllocated() > 0);
+		CPPUNIT_ASSERT( strMap.size() == 100);
+		CPPUNIT_ASSERT( strMap["key42"].size() == 1);
+		CPPUNIT_ASSERT( strMap["key42"][0] == "value42");
+		CPPUNIT_ASSERT( strMap["key42"].get_allocator().Arena() == arena);
+
+		// copies share the arena:
+		StrMap copy( strMap);
+		CPPUNIT_ASSERT( copy.get_allocator().Arena() == arena);
+		CPPUNIT_ASSERT( copy["key99"][0] == "value99");
+	}
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include "MsgContextTest.h"
+#include "TestBeam.h"
+
+#include "BmFilterAddon.h"
+
+// setUp
+void
+MsgContextTest::setUp()
+{
+	inherited::setUp();
+}
+	
+// tearDown
+void
+MsgContextTest::tearDown()
+{
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MsgContextTest::KnownFieldsTest()
+{
+	BmMsgContext msgContext;
+
+	// fresh context has no fields:
+	NextSubTest();
+	CPPUNIT_ASSERT( !msgContext.HasField( BmMsgContext::FIELD_FOLDER_NAME));
+	CPPUNIT_ASSERT( msgContext.GetString( BmMsgContext::FIELD_FOLDER_NAME) 
+							== NULL);
+	CPPUNIT_ASSERT( msgContext.GetString( "FolderName") == NULL);
+	CPPUNIT_ASSERT( !msgContext.GetBool( BmMsgContext::FIELD_IS_SPAM));
+	CPPUNIT_ASSERT( msgContext.GetDouble( "RatioSpam") == 0.0);
+
+	// string-keyed and typed access refer to the same field:
+	NextSubTest();
+	msgContext.SetString( "FolderName", "in/beam");
+	CPPUNIT_ASSERT( msgContext.HasField( BmMsgContext::FIELD_FOLDER_NAME));
+	CPPUNIT_ASSERT( BmString( msgContext.GetString( 
+								BmMsgContext::FIELD_FOLDER_NAME)) == "in/beam");
+	msgContext.SetBool( BmMsgContext::FIELD_IS_SPAM, true);
+	CPPUNIT_ASSERT( msgContext.GetBool( "IsSpam"));
+	CPPUNIT_ASSERT( !msgContext.GetBool( "IsTofu"));
+	msgContext.SetDouble( "RatioSpam", 0.75);
+	CPPUNIT_ASSERT( msgContext.HasField( "RatioSpam"));
+	CPPUNIT_ASSERT( msgContext.GetDouble( BmMsgContext::FIELD_RATIO_SPAM) 
+							== 0.75);
+
+	// changes are tracked until reset:
+	NextSubTest();
+	CPPUNIT_ASSERT( msgContext.FieldHasChanged( "FolderName"));
+	CPPUNIT_ASSERT( msgContext.FieldHasChanged( BmMsgContext::FIELD_IS_SPAM));
+	CPPUNIT_ASSERT( !msgContext.FieldHasChanged( BmMsgContext::FIELD_STATUS));
+	msgContext.ResetChanges();
+	CPPUNIT_ASSERT( !msgContext.FieldHasChanged( "FolderName"));
+	CPPUNIT_ASSERT( msgContext.HasField( "FolderName"));
+	msgContext.SetBool( "StopProcessing", false);
+	CPPUNIT_ASSERT( msgContext.FieldHasChanged( 
+								BmMsgContext::FIELD_STOP_PROCESSING));
+
+	// reset of data clears all values:
+	NextSubTest();
+	msgContext.ResetData();
+	CPPUNIT_ASSERT( !msgContext.HasField( "FolderName"));
+	CPPUNIT_ASSERT( msgContext.GetString( "FolderName") == NULL);
+	CPPUNIT_ASSERT( !msgContext.GetBool( BmMsgContext::FIELD_IS_SPAM));
+	CPPUNIT_ASSERT( !msgContext.HasField( BmMsgContext::FIELD_RATIO_SPAM));
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MsgContextTest::ExtensionFieldsTest()
+{
+	BmMsgContext msgContext;
+
+	// unknown fields live in the extension message:
+	NextSubTest();
+	CPPUNIT_ASSERT( !msgContext.HasField( "SpamBuckets"));
+	msgContext.SetInt32( "SpamBuckets", 42);
+	CPPUNIT_ASSERT( msgContext.HasField( "SpamBuckets"));
+	CPPUNIT_ASSERT( msgContext.GetInt32( "SpamBuckets") == 42);
+	CPPUNIT_ASSERT( msgContext.FieldHasChanged( "SpamBuckets"));
+	msgContext.SetString( "MyAddonField", "value");
+	CPPUNIT_ASSERT( BmString( msgContext.GetString( "MyAddonField")) 
+							== "value");
+
+	// a well-known name used with another type is an extension field, too:
+	NextSubTest();
+	msgContext.SetBool( "FolderName", true);
+	CPPUNIT_ASSERT( msgContext.GetBool( "FolderName"));
+	CPPUNIT_ASSERT( !msgContext.HasField( BmMsgContext::FIELD_FOLDER_NAME));
+
+	// resetting:
+	NextSubTest();
+	msgContext.ResetChanges();
+	CPPUNIT_ASSERT( !msgContext.FieldHasChanged( "SpamBuckets"));
+	msgContext.ResetData();
+	CPPUNIT_ASSERT( !msgContext.HasField( "SpamBuckets"));
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+MsgContextTest::HeaderIndexTest()
+{
+	BmMsgContext msgContext;
+
+	// without any header-infos, there's nothing to be found:
+	NextSubTest();
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "Subject") == NULL);
+
+	// lookups are case-insensitive and return the original value-lists:
+	NextSubTest();
+	const int32 fieldCount = 40;
+	msgContext.headerInfoCount = fieldCount;
+	msgContext.headerInfos = new BmHeaderInfo [fieldCount];
+	for( int32 i=0; i<fieldCount; ++i) {
+		msgContext.headerInfos[i].fieldName = BmString("X-Field-") << i;
+		msgContext.headerInfos[i].values = new const char* [2];
+		msgContext.headerInfos[i].values[0] = "value";
+		msgContext.headerInfos[i].values[1] = NULL;
+	}
+	for( int32 i=0; i<fieldCount; ++i) {
+		BmString name = BmString("x-FIELD-") << i;
+		CPPUNIT_ASSERT( msgContext.HeaderValues( name.String()) 
+								== msgContext.headerInfos[i].values);
+	}
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "X-Field") == NULL);
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "X-Field-40") == NULL);
+	CPPUNIT_ASSERT( msgContext.HeaderValues( NULL) == NULL);
+
+	// after resetting, the header-infos (and their index) are gone:
+	NextSubTest();
+	msgContext.ResetHeaderInfos();
+	CPPUNIT_ASSERT( msgContext.headerInfos == NULL);
+	CPPUNIT_ASSERT( msgContext.headerInfoCount == 0);
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "X-Field-1") == NULL);
+
+	// new header-infos get a new index:
+	NextSubTest();
+	msgContext.headerInfoCount = 1;
+	msgContext.headerInfos = new BmHeaderInfo [1];
+	msgContext.headerInfos[0].fieldName = "Subject";
+	msgContext.headerInfos[0].values = new const char* [2];
+	msgContext.headerInfos[0].values[0] = "value";
+	msgContext.headerInfos[0].values[1] = NULL;
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "subject") 
+							== msgContext.headerInfos[0].values);
+	CPPUNIT_ASSERT( msgContext.HeaderValues( "X-Field-1") == NULL);
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <OS.h>
+
+#include "SieveRegressionTest.h"
+#include "TestBeam.h"
+
+#include "BmMail.h"
+#include "BmSieveFilter.h"
+#include "BmStorageUtil.h"
+
+extern "C" {
+#include "sieve_interface.h"
+#include "message.h"
+}
+
+using std::vector;
+
+static BMessage archive;
+static BmSieveFilter filter("RegressionFilter",&archive);
+static BmString mailAcc("testacc@test.org");
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	returns the value of the given environment variable, or the given
+			default if it isn't set
+\*------------------------------------------------------------------------------*/
+static const char*
+EnvOr( const char* name, const char* defaultValue)
+{
+	const char* value = getenv( name);
+	return (value && *value) ? value : defaultValue;
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	returns the (sorted) names of all files in the given folder that end
+			with the given suffix (all files if suffix is NULL)
+\*------------------------------------------------------------------------------*/
+static vector<BmString>
+FileNames( const char* path, const char* suffix)
+{
+	vector<BmString> names;
+	BDirectory dir( path);
+	BEntry entry;
+	char nameBuf[B_FILE_NAME_LENGTH];
+	int32 suffixLen = suffix ? strlen( suffix) : 0;
+	while( dir.GetNextEntry( &entry, true) == B_OK) {
+		if (!entry.IsFile())
+			continue;
+		entry.GetName( nameBuf);
+		BmString name( nameBuf);
+		if (suffix && (name.Length() <= suffixLen
+		|| name.FindLast( suffix) != name.Length() - suffixLen))
+			continue;
+		names.push_back( name);
+	}
+	std::sort( names.begin(), names.end());
+	return names;
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	describes what the script has decided about a mail, in a form
+			that resembles the sieve-actions (e.g. 'fileinto "x"; discard')
+\*------------------------------------------------------------------------------*/
+static BmString
+Decision( BmMsgContext& msgContext)
+{
+	BmString decision;
+	BmString folder = msgContext.GetString( BmMsgContext::FIELD_FOLDER_NAME);
+	if (folder.Length())
+		decision << "fileinto \"" << folder << "\"; ";
+	BmString status = msgContext.GetString( BmMsgContext::FIELD_STATUS);
+	if (status.Length())
+		decision << "status \"" << status << "\"; ";
+	BmString identity = msgContext.GetString( BmMsgContext::FIELD_IDENTITY);
+	if (identity.Length())
+		decision << "identity \"" << identity << "\"; ";
+	BmString rejectMsg = msgContext.GetString( BmMsgContext::FIELD_REJECT_MSG);
+	if (rejectMsg.Length())
+		decision << "reject \"" << rejectMsg << "\"; ";
+	if (msgContext.GetBool( BmMsgContext::FIELD_MOVE_TO_TRASH))
+		decision << "discard; ";
+	if (msgContext.GetBool( BmMsgContext::FIELD_STOP_PROCESSING))
+		decision << "stop; ";
+	if (!decision.Length())
+		return "keep";
+	return decision.Truncate( decision.Length() - 2);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	reads & parses all mails of the given corpus folder, such that the
+			timings only cover the sieve-part
+\*------------------------------------------------------------------------------*/
+static void
+ReadCorpus( const BmString& corpusDir, vector<BmString>& mailNames, 
+				vector< BmRef<BmMail> >& mails)
+{
+	mailNames = FileNames( corpusDir.String(), NULL);
+	for( uint32 m=0; m<mailNames.size(); ++m) {
+		BmString text;
+		SlurpFile( (BmString(corpusDir) << "/" << mailNames[m]).String(), text);
+		mails.push_back( new BmMail( text, mailAcc));
+	}
+}
+
+static const char* addressFields[] = { "From", "To", "Cc", "Sender", NULL };
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	does the work of an address-test with the given number of keys on 
+			every address-part of the usual address fields of the given mail,
+			adding all the address-parts it looks at to parts (if given)
+		-	without a cache, the addresses are parsed for every key (just like 
+			evaltest() did before libSieve cached the parsed addresses), 
+			otherwise they are fetched from the given cache
+		-	returns the number of address-parts that have been looked at
+\*------------------------------------------------------------------------------*/
+static int32
+VisitAddresses( BmMsgContext& msgContext, int32 keys, address_cache_t** cache,
+					 vector<BmString>* parts = NULL)
+{
+	int32 count = 0;
+	for( int32 f=0; addressFields[f]; ++f) {
+		const char** values;
+		if (BmSieveFilter::sieve_get_header( &msgContext, addressFields[f], 
+														 &values) != SIEVE_OK)
+			continue;
+		for( int p=ADDRESS_ALL; p<=ADDRESS_DETAIL; ++p) {
+			address_part_t addrPart = (address_part_t)p;
+			for( int32 k=0; k<keys; ++k) {
+				for( int v=0; values[v]; ++v) {
+					if (cache) {
+						char* const* cached 
+							= get_cached_addresses( cache, values[v], addrPart);
+						for( int a=0; cached[a]; ++a, ++count) {
+							if (parts)
+								parts->push_back( cached[a]);
+						}
+						continue;
+					}
+					void* data = NULL;
+					void* marker = NULL;
+					parse_address( values[v], &data, &marker);
+					char* part;
+					while( (part = get_address( addrPart, &data, &marker, 0))) {
+						if (parts)
+							parts->push_back( part);
+						count++;
+					}
+					free_address( &data, &marker);
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// setUp
+void
+SieveRegressionTest::setUp()
+{
+	inherited::setUp();
+}
+	
+// tearDown
+void
+SieveRegressionTest::tearDown()
+{
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+SieveRegressionTest::ScriptCorpusTest()
+{
+	BmString scriptDir = EnvOr( "BEAM_SIEVE_SCRIPTS", "sieve");
+	BmString corpusDir = EnvOr( "BEAM_SIEVE_CORPUS", "mail/in");
+	int32 rounds = atoi( EnvOr( "BEAM_SIEVE_ROUNDS", "1"));
+	if (rounds < 1)
+		rounds = 1;
+	bool updateGolden = getenv( "BEAM_SIEVE_UPDATE_GOLDEN") != NULL;
+
+	// read & parse the corpus up front, such that the timings only
+	// cover the sieve-part:
+	NextSubTest();
+	vector<BmString> mailNames;
+	vector< BmRef<BmMail> > mails;
+	ReadCorpus( corpusDir, mailNames, mails);
+	CPPUNIT_ASSERT( mails.size() > 0);
+
+	vector<BmString> scriptNames = FileNames( scriptDir.String(), ".sieve");
+	CPPUNIT_ASSERT( scriptNames.size() > 0);
+	cerr << endl << "sieve-scripts in " << scriptDir.String() << ", " 
+		  << mails.size() << " mails from " << corpusDir.String() << ":" << endl;
+	for( uint32 s=0; s<scriptNames.size(); ++s) {
+		NextSubTest();
+		BmString baseName( scriptNames[s]);
+		baseName.Truncate( baseName.Length() - strlen( ".sieve"));
+		BmString script;
+		SlurpFile( (BmString(scriptDir) << "/" << scriptNames[s]).String(), 
+					  script);
+
+		bigtime_t start = system_time();
+		filter.Content( script);
+		bool compiled = filter.CompileScript();
+		bigtime_t compileTime = system_time() - start;
+		if (!compiled)
+			cerr << scriptNames[s].String() << ": " 
+				  << filter.ErrorString().String() << endl;
+		CPPUNIT_ASSERT( compiled);
+
+		// the actions are only recorded in the msg-context, so nothing 
+		// ever happens to the mails themselves:
+		BmString decisions;
+		bigtime_t executeTime = 0;
+		for( int32 r=0; r<rounds; ++r) {
+			for( uint32 m=0; m<mails.size(); ++m) {
+				BmMsgContext msgContext;
+				msgContext.mail = mails[m].Get();
+				start = system_time();
+				bool executed = filter.Execute( &msgContext);
+				executeTime += system_time() - start;
+				CPPUNIT_ASSERT( executed);
+				if (r == 0)
+					decisions << mailNames[m] << ": " << Decision( msgContext) 
+								 << "\n";
+			}
+		}
+		int32 executions = rounds * mails.size();
+		cerr << "  " << baseName.String() << ": compile " << compileTime 
+			  << "us, " << executions << " executions " << executeTime 
+			  << "us (" << executeTime / executions << "us per mail)" << endl;
+
+		BmString goldenName 
+			= BmString(scriptDir) << "/" << baseName << ".golden";
+		if (updateGolden) {
+			BFile golden( goldenName.String(), 
+							  B_WRITE_ONLY | B_CREATE_FILE | B_ERASE_FILE);
+			CPPUNIT_ASSERT( golden.InitCheck() == B_OK);
+			golden.Write( decisions.String(), decisions.Length());
+			continue;
+		}
+		BmString golden;
+		SlurpFile( goldenName.String(), golden);
+		if (decisions != golden) {
+			cerr << baseName.String() << ": decisions differ from " 
+				  << goldenName.String() << endl;
+			DumpResult( decisions);
+		}
+		CPPUNIT_ASSERT( decisions == golden);
+	}
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void
+SieveRegressionTest::AddressCacheTest()
+{
+	BmString corpusDir = EnvOr( "BEAM_SIEVE_CORPUS", "mail/in");
+	int32 rounds = atoi( EnvOr( "BEAM_SIEVE_ROUNDS", "1"));
+	if (rounds < 1)
+		rounds = 1;
+	int32 keys = atoi( EnvOr( "BEAM_SIEVE_ADDRESS_KEYS", "8"));
+	if (keys < 1)
+		keys = 1;
+
+	NextSubTest();
+	vector<BmString> mailNames;
+	vector< BmRef<BmMail> > mails;
+	ReadCorpus( corpusDir, mailNames, mails);
+	CPPUNIT_ASSERT( mails.size() > 0);
+
+	// the cache must yield exactly what parsing yields:
+	for( uint32 m=0; m<mails.size(); ++m) {
+		BmMsgContext msgContext;
+		msgContext.mail = mails[m].Get();
+		vector<BmString> parsed;
+		vector<BmString> cached;
+		VisitAddresses( msgContext, 1, NULL, &parsed);
+		address_cache_t* cache = NULL;
+		VisitAddresses( msgContext, 1, &cache, &cached);
+		free_address_cache( &cache);
+		CPPUNIT_ASSERT( parsed == cached);
+	}
+
+	// time the baseline (parsing the addresses for every key) against the
+	// cache (which lives as long as one execution of a script):
+	NextSubTest();
+	bigtime_t parseTime = 0;
+	bigtime_t cacheTime = 0;
+	int32 parsedCount = 0;
+	int32 cachedCount = 0;
+	for( int32 r=0; r<rounds; ++r) {
+		for( uint32 m=0; m<mails.size(); ++m) {
+			BmMsgContext msgContext;
+			msgContext.mail = mails[m].Get();
+			bigtime_t start = system_time();
+			parsedCount += VisitAddresses( msgContext, keys, NULL);
+			parseTime += system_time() - start;
+			address_cache_t* cache = NULL;
+			start = system_time();
+			cachedCount += VisitAddresses( msgContext, keys, &cache);
+			free_address_cache( &cache);
+			cacheTime += system_time() - start;
+		}
+	}
+	int32 mailCount = rounds * mails.size();
+	cerr << endl << "address-tests with " << keys << " keys on " 
+		  << mails.size() << " mails from " << corpusDir.String() << ":" 
+		  << endl << "  parsed for every key: " << parseTime / mailCount 
+		  << "us per mail, cached: " << cacheTime / mailCount 
+		  << "us per mail" << endl;
+	CPPUNIT_ASSERT( parsedCount == cachedCount);
+}
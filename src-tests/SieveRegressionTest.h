@@ -0,0 +1,61 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+
+#ifndef _SieveRegressionTest_h
+#define _SieveRegressionTest_h
+
+#include <cppunit/TestCaller.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <TestCase.h>
+
+/*------------------------------------------------------------------------------*\
+	SieveRegressionTest
+		-	runs every script (*.sieve) of the script folder against every mail 
+			of the corpus folder and compares the resulting decisions with
+			the script's golden file (<script>.golden)
+		-	compile- and execution-times are reported for each script
+		-	the defaults (folder "sieve" and the unzipped "mail/in" of the
+			testdata) can be overridden by setting BEAM_SIEVE_SCRIPTS and 
+			BEAM_SIEVE_CORPUS, BEAM_SIEVE_ROUNDS sets the number of times each
+			script is executed per mail (for timing purposes)
+		-	if BEAM_SIEVE_UPDATE_GOLDEN is set, the golden files are (re-)written
+			instead of being checked
+		-	the address-cache of libSieve is timed against parsing the 
+			addresses for every key (BEAM_SIEVE_ADDRESS_KEYS keys, 8 by 
+			default) on the same corpus
+\*------------------------------------------------------------------------------*/
+class SieveRegressionTest : public BTestCase
+{
+	typedef TestCase inherited;
+	CPPUNIT_TEST_SUITE( SieveRegressionTest );
+	CPPUNIT_TEST( ScriptCorpusTest);
+	CPPUNIT_TEST( AddressCacheTest);
+	CPPUNIT_TEST_SUITE_END();
+public:
+	// This function called before *each* test added in Suite()
+	void setUp();
+	
+	// This function called after *each* test added in Suite()
+	void tearDown();
+
+	//------------------------------------------------------------
+	// Test functions
+	//------------------------------------------------------------
+	void ScriptCorpusTest();
+	void AddressCacheTest();
+};
+
+
+#endif
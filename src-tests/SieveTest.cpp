@@ -11,6 +11,7 @@
  *
  */
 
+#include <cstring>
 #include <iostream>
 
 #include "SieveTest.h"
@@ -18,6 +19,11 @@
 #include "BmSieveFilter.h"
 #include "BmMail.h"
 
+extern "C" {
+#undef DOMAIN
+#include "script.h"
+}
+
 static BMessage msg;
 static BmSieveFilter filter("TestFilter",&msg);
 static BmString dummyText;
@@ -1510,3 +1516,500 @@ SieveTest::NumericRelationalCountTestsTest(void)
 	CPPUNIT_ASSERT( filter.Execute(msgContext));
 	CPPUNIT_ASSERT( Result() == RES_KEEP);
 }
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::CompiledScriptCacheTest(void)
+{
+	const char* script = "\
+require [\"fileinto\"];\n\
+if header :contains \"Subject\" \"SIEVE\" { fileinto \"cached\"; }\n\
+";
+	BmSieveFilter otherFilter("OtherTestFilter",&msg);
+
+	// both filters share the compiled commands, but not the script-context
+	NextSubTest();
+	filter.Content( script);
+	otherFilter.Content( script);
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( otherFilter.CompileScript());
+	CPPUNIT_ASSERT( filter.mCompiledScript != otherFilter.mCompiledScript);
+	CPPUNIT_ASSERT( filter.mCompiledScript->cmds != NULL
+						 && filter.mCompiledScript->cmds 
+						 		== otherFilter.mCompiledScript->cmds);
+	CPPUNIT_ASSERT( filter.mCompiledScript->script_context == &filter);
+	CPPUNIT_ASSERT( otherFilter.mCompiledScript->script_context 
+							== &otherFilter);
+	CPPUNIT_ASSERT( BmSieveFilter::nScriptCache->find( script)
+							->second.refCount == 2);
+	CPPUNIT_ASSERT( otherFilter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "cached");
+
+	// changing one filter does not affect the other
+	NextSubTest();
+	filter.Content( "discard;");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_TRASH);
+	CPPUNIT_ASSERT( otherFilter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "cached");
+
+	// unused scripts stay in the cache and are reused when recompiling
+	NextSubTest();
+	otherFilter.Content( "keep;");
+	CPPUNIT_ASSERT( BmSieveFilter::nScriptCache->find( script)
+							->second.refCount == 0);
+	filter.Content( script);
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( BmSieveFilter::nScriptCache->find( script)
+							->second.refCount == 1);
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "cached");
+
+	// scripts with errors are not cached, but still report the error
+	NextSubTest();
+	filter.Content( "keep;\nkeep;\nfileinto \"a_folder\";\n");
+	CPPUNIT_ASSERT( !filter.CompileScript() 
+						 && filter.ErrorString()
+						 		.FindFirst("fileinto not required") != B_ERROR);
+	CPPUNIT_ASSERT( BmSieveFilter::nScriptCache->find( filter.Content())
+							== BmSieveFilter::nScriptCache->end());
+	CPPUNIT_ASSERT( !filter.CompileScript());
+}
+
+static const int32 nParallelRounds = 200;
+
+struct SieveWorkerData {
+	BmSieveFilter* filters[3];
+	const char* expectedFolders[3];
+	BmMail* mail;
+	int32* failures;
+};
+
+/*------------------------------------------------------------------------------*\
+	ExecuteInParallel()
+		-	executes the given filters over and over again on a mail of its own
+\*------------------------------------------------------------------------------*/
+static status_t
+ExecuteInParallel(void* data)
+{
+	SieveWorkerData* workerData = static_cast<SieveWorkerData*>(data);
+	BmMsgContext context;
+	context.mail = workerData->mail;
+	for( int32 i=0; i<nParallelRounds; ++i) {
+		int f = i % 3;
+		bool ok = workerData->filters[f]->Execute(&context);
+		const char* folder = context.GetString("FolderName");
+		if (!ok || !folder || strcmp(folder, workerData->expectedFolders[f]))
+			atomic_add(workerData->failures, 1);
+		context.ResetData();
+		context.ResetChanges();
+	}
+	return B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	CompileInParallel()
+		-	compiles a new script (with an address to verify) in every round
+\*------------------------------------------------------------------------------*/
+static status_t
+CompileInParallel(void* data)
+{
+	int32* failures = static_cast<int32*>(data);
+	BmSieveFilter compileFilter("CompileTestFilter",&msg);
+	for( int32 i=0; i<nParallelRounds; ++i) {
+		compileFilter.Content( BmString("\
+			if address :all :is \"To\" \"x") << i << "@test.org\" \
+			{ redirect \"y" << i << "@test.org\"; }");
+		if (!compileFilter.CompileScript())
+			atomic_add(failures, 1);
+	}
+	return B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::ParallelExecutionTest(void)
+{
+	const int32 workerCount = 4;
+	int32 failures = 0;
+	BmSieveFilter headerFilter("HeaderTestFilter",&msg);
+	BmSieveFilter addressFilter("AddressTestFilter",&msg);
+	BmSieveFilter accountFilter("AccountTestFilter",&msg);
+	headerFilter.Content("\
+		require \"fileinto\"; \
+		if header :contains \"Subject\" \"SIEVE\" { fileinto \"subject\"; }");
+	addressFilter.Content("\
+		require \"fileinto\"; \
+		if address :domain :is \"Cc\" \"test.org\" { fileinto \"cc\"; }");
+	accountFilter.Content("\
+		require \"fileinto\"; \
+		if header :is \"Account\" \"acc-0\" { fileinto \"acc-0\"; } \
+		else { fileinto \"acc-1\"; }");
+
+	// the filters are compiled by whichever worker gets there first, while
+	// another thread keeps compiling scripts of its own
+	NextSubTest();
+	BmRef<BmMail> mails[workerCount];
+	SieveWorkerData workerData[workerCount];
+	thread_id threads[workerCount+1];
+	for( int32 w=0; w<workerCount; ++w) {
+		mails[w] = new BmMail(mailText, w % 2 ? "acc-1" : "acc-0");
+		workerData[w].filters[0] = &headerFilter;
+		workerData[w].filters[1] = &addressFilter;
+		workerData[w].filters[2] = &accountFilter;
+		workerData[w].expectedFolders[0] = "subject";
+		workerData[w].expectedFolders[1] = "cc";
+		workerData[w].expectedFolders[2] = w % 2 ? "acc-1" : "acc-0";
+		workerData[w].mail = mails[w].Get();
+		workerData[w].failures = &failures;
+	}
+	for( int32 w=0; w<workerCount; ++w)
+		threads[w] = spawn_thread( ExecuteInParallel, "SieveExecuter", 
+											B_NORMAL_PRIORITY, &workerData[w]);
+	threads[workerCount] = spawn_thread( CompileInParallel, "SieveCompiler", 
+													 B_NORMAL_PRIORITY, &failures);
+	for( int32 t=0; t<=workerCount; ++t)
+		resume_thread( threads[t]);
+	status_t threadRes;
+	for( int32 t=0; t<=workerCount; ++t)
+		wait_for_thread( threads[t], &threadRes);
+	CPPUNIT_ASSERT( failures == 0);
+
+	// after a script has been changed, all workers pick up the new one
+	NextSubTest();
+	headerFilter.Content("\
+		require \"fileinto\"; \
+		if header :contains \"Subject\" \"SIEVE\" { fileinto \"changed\"; }");
+	for( int32 w=0; w<workerCount; ++w) {
+		workerData[w].expectedFolders[0] = "changed";
+		threads[w] = spawn_thread( ExecuteInParallel, "SieveExecuter", 
+											B_NORMAL_PRIORITY, &workerData[w]);
+	}
+	for( int32 w=0; w<workerCount; ++w)
+		resume_thread( threads[w]);
+	for( int32 w=0; w<workerCount; ++w)
+		wait_for_thread( threads[w], &threadRes);
+	CPPUNIT_ASSERT( failures == 0);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::BatchExecutionTest(void)
+{
+	const int32 mailCount = 4;
+	BmSieveFilter batchFilter("BatchTestFilter",&msg);
+	batchFilter.Content("\
+		require \"fileinto\"; \
+		if header :is \"Account\" \"acc-0\" { fileinto \"acc-0\"; }");
+
+	// every mail gets its own result
+	NextSubTest();
+	BmRef<BmMail> mails[mailCount];
+	BmMsgContext contexts[mailCount];
+	vector<BmMsgContext*> msgContexts;
+	for( int32 m=0; m<mailCount; ++m) {
+		mails[m] = new BmMail(mailText, m % 2 ? "acc-1" : "acc-0");
+		contexts[m].mail = mails[m].Get();
+		msgContexts.push_back( &contexts[m]);
+	}
+	vector<bool> results;
+	CPPUNIT_ASSERT( batchFilter.ExecuteBatch( msgContexts, results));
+	CPPUNIT_ASSERT( results.size() == uint32(mailCount));
+	for( int32 m=0; m<mailCount; ++m) {
+		CPPUNIT_ASSERT( results[m]);
+		BmString folder = contexts[m].GetString("FolderName");
+		CPPUNIT_ASSERT( m % 2 ? folder.Length() == 0 : folder == "acc-0");
+	}
+
+	// the results are the same as those of single executions
+	NextSubTest();
+	for( int32 m=0; m<mailCount; ++m) {
+		BmMsgContext single;
+		single.mail = mails[m].Get();
+		CPPUNIT_ASSERT( batchFilter.Execute( &single));
+		CPPUNIT_ASSERT( single.GetString("FolderName") 
+								== contexts[m].GetString("FolderName"));
+	}
+
+	// an empty batch is fine
+	NextSubTest();
+	vector<BmMsgContext*> noContexts;
+	CPPUNIT_ASSERT( batchFilter.ExecuteBatch( noContexts, results));
+	CPPUNIT_ASSERT( results.empty());
+
+	// a script that does not compile fails for all mails
+	NextSubTest();
+	batchFilter.Content( "fileinto \"a_folder\";");
+	CPPUNIT_ASSERT( !batchFilter.ExecuteBatch( msgContexts, results));
+	CPPUNIT_ASSERT( results.size() == uint32(mailCount));
+	for( int32 m=0; m<mailCount; ++m)
+		CPPUNIT_ASSERT( !results[m]);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::AddressCacheTest(void)
+{
+	// many address tests over the same headers are answered from the
+	// addresses parsed for the first one
+	NextSubTest();
+	filter.Content("\
+		require [\"fileinto\", \"subaddress\"]; \
+		if address :localpart :is \"Cc\" \"nobody\" { fileinto \"wrong1\"; } \
+		elsif address :domain :is [\"To\",\"Cc\"] \"nowhere.org\" \
+		{ fileinto \"wrong2\"; } \
+		elsif address :user :is \"To\" \"me\" { fileinto \"wrong3\"; } \
+		elsif address :all :is \"Cc\" \"cc3@elsewhere.org\" \
+		{ fileinto \"wrong4\"; } \
+		elsif allof( address :user :is \"To\" \"you\", \
+						 address :detail :is \"To\" \"sieve\", \
+						 address :localpart :is \"Cc\" \"cc2\", \
+						 address :domain :is \"Cc\" \"test.org\", \
+						 address :all :is \"Cc\" \"cc3\") \
+		{ fileinto \"right\"; }");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "right");
+	// a second execution must yield the same result:
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "right");
+
+	// parsed addresses do not survive the execution, another mail
+	// yields other addresses
+	NextSubTest();
+	SetupMsgContext("\
+Cc: cc3@elsewhere.org\r\n\
+To: me+sieve@test.org\r\n\
+\r\n\
+body\
+");
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "wrong3");
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::PreparedPatternTest(void)
+{
+	// ascii-casemap patterns are folded when the script is compiled
+	NextSubTest();
+	filter.Content("\
+		if allof( header :is \"Subject\" \
+							\"A SIMPLE TESTMAIL FOR sieve FILTERING\", \
+					 header :contains \"Subject\" \"TestMail\", \
+					 header :matches \"Subject\" \"*TESTMAIL*SIEVE*\", \
+					 not header :matches :comparator \"i;octet\" \
+					 		\"Subject\" \"*TESTMAIL*\") \
+		{ discard; }");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_TRASH);
+
+	// escaped wildcards in :matches are taken literally
+	NextSubTest();
+	filter.Content("\
+		if header :matches \"Subject\" \"A simple testmail\\?*\" \
+		{ discard; }");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_KEEP);
+	filter.Content("\
+		if header :matches \"Subject\" \"A simple ?estmail*\" \
+		{ discard; }");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	CPPUNIT_ASSERT( filter.Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_TRASH);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+static BmGraphicalSieveFilter*
+GraphicalFilter(const char* anyAll, const char* mailPart, const char* addrPart,
+					 const char* op, const char* value, const char* folder,
+					 const char* mailPart2 = NULL, const char* op2 = NULL,
+					 const char* value2 = NULL)
+{
+	BMessage archive;
+	archive.AddInt16( BmGraphicalSieveFilter::MSG_MATCH_COUNT, mailPart2 ? 2 : 1);
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_ANYALL, anyAll);
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_MAILPART, mailPart);
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_ADDRPART, addrPart);
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_FIELDNAME, "");
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_OPERATOR, op);
+	archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_VALUE, value);
+	if (mailPart2) {
+		archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_MAILPART, mailPart2);
+		archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_ADDRPART, 
+								 "(Complete)");
+		archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_FIELDNAME, "");
+		archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_OPERATOR, op2);
+		archive.AddString( BmGraphicalSieveFilter::MSG_MATCH_VALUE, value2);
+	}
+	archive.AddBool( BmGraphicalSieveFilter::MSG_FILEINTO, true);
+	archive.AddString( BmGraphicalSieveFilter::MSG_FILEINTO_VALUE, folder);
+	return new BmGraphicalSieveFilter( folder, &archive);
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::DispatchIndexTest(void)
+{
+	// simple "is"/"contains" rules of graphical filters are matched through
+	// the dispatch-index, filters that don't match are skipped
+	NextSubTest();
+	BmGraphicalSieveFilter* fromFilter 
+		= GraphicalFilter( "any of", "From", "(Complete)", "contains", 
+								 "nobody\nTHE", "from");
+	BmGraphicalSieveFilter* toFilter 
+		= GraphicalFilter( "any of", "To", "(Complete)", "is", "YOU", "to");
+	BmGraphicalSieveFilter* ccFilter 
+		= GraphicalFilter( "all of", "Cc", "(Domain)", "is", "test.org", "cc");
+	BmGraphicalSieveFilter* subjectFilter 
+		= GraphicalFilter( "any of", "Subject", "(Complete)", "contains", 
+								 "nothing\nelse", "subject");
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( fromFilter, msgContext)
+							== BmSieveDispatchIndex::MATCH);
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( toFilter, msgContext)
+							== BmSieveDispatchIndex::MATCH);
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( ccFilter, msgContext)
+							== BmSieveDispatchIndex::MATCH);
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( subjectFilter, msgContext)
+							== BmSieveDispatchIndex::NO_MATCH);
+	CPPUNIT_ASSERT( fromFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "from");
+	CPPUNIT_ASSERT( ccFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "cc");
+	CPPUNIT_ASSERT( subjectFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_KEEP);
+
+	// other tests and "all of" several tests fall back to the script
+	NextSubTest();
+	BmGraphicalSieveFilter* startFilter 
+		= GraphicalFilter( "any of", "Subject", "(Complete)", "starts with", 
+								 "A simple", "start");
+	BmGraphicalSieveFilter* allOfFilter 
+		= GraphicalFilter( "all of", "From", "(Complete)", "contains", "them", 
+								 "allof", "Subject", "contains", "nothing");
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( startFilter, msgContext)
+							== BmSieveDispatchIndex::NOT_INDEXED);
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( allOfFilter, msgContext)
+							== BmSieveDispatchIndex::NOT_INDEXED);
+	CPPUNIT_ASSERT( startFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "start");
+	CPPUNIT_ASSERT( allOfFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_KEEP);
+
+	// a changed rule is picked up by the next check, even for a mail that
+	// has already been matched
+	NextSubTest();
+	delete subjectFilter;
+	subjectFilter 
+		= GraphicalFilter( "any of", "Subject", "(Complete)", "contains", 
+								 "TESTMAIL", "subject");
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( subjectFilter, msgContext)
+							== BmSieveDispatchIndex::MATCH);
+	CPPUNIT_ASSERT( subjectFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "subject");
+	// ...and a new mail is matched anew
+	SetupMsgContext("\
+From: someone@else.org\r\n\
+Subject: testmail\r\n\
+\r\n\
+body\
+");
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( fromFilter, msgContext)
+							== BmSieveDispatchIndex::NO_MATCH);
+	CPPUNIT_ASSERT( BmSieveDispatchIndex::Check( ccFilter, msgContext)
+							== BmSieveDispatchIndex::NO_MATCH);
+	CPPUNIT_ASSERT( fromFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_KEEP);
+	CPPUNIT_ASSERT( subjectFilter->Execute(msgContext));
+	CPPUNIT_ASSERT( Result() == RES_FILEINTO && targetFolder == "subject");
+
+	delete fromFilter;
+	delete toFilter;
+	delete ccFilter;
+	delete subjectFilter;
+	delete startFilter;
+	delete allOfFilter;
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+static bool
+NeedsHeaderField(const BmFilterNeeds& needs, const char* fieldName)
+{
+	for( uint32 i=0; i<needs.headerFields.size(); ++i) {
+		if (!needs.headerFields[i].ICompare(fieldName))
+			return true;
+	}
+	return false;
+}
+
+/*------------------------------------------------------------------------------*\
+	()
+		-	
+\*------------------------------------------------------------------------------*/
+void 
+SieveTest::FilterNeedsTest(void)
+{
+	// the header-fields tested by a script are collected when it is compiled
+	NextSubTest();
+	filter.Content("\
+		require \"fileinto\"; \
+		if anyof( header :contains [\"Subject\",\"X-Priority\"] \"test\", \
+					 not address :domain :is \"from\" \"test.org\") \
+		{ fileinto \"test\"; } \
+		elsif exists \"List-Id\" { discard; } \
+		elsif header :is \"SUBJECT\" \"other\" { keep; }");
+	CPPUNIT_ASSERT( filter.CompileScript() || CompErr());
+	BmFilterNeeds needs;
+	filter.AddNeeds( needs);
+	CPPUNIT_ASSERT( !needs.allHeaderFields && !needs.body && !needs.size);
+	CPPUNIT_ASSERT( needs.headerFields.size() == 4);
+	CPPUNIT_ASSERT( NeedsHeaderField( needs, "Subject"));
+	CPPUNIT_ASSERT( NeedsHeaderField( needs, "X-Priority"));
+	CPPUNIT_ASSERT( NeedsHeaderField( needs, "From"));
+	CPPUNIT_ASSERT( NeedsHeaderField( needs, "List-Id"));
+
+	// size-tests need the size, but never the body
+	NextSubTest();
+	filter.Content("if size :over 10000 { discard; }");
+	BmFilterNeeds sizeNeeds;
+	filter.AddNeeds( sizeNeeds);
+	CPPUNIT_ASSERT( sizeNeeds.size && !sizeNeeds.body);
+	CPPUNIT_ASSERT( sizeNeeds.headerFields.empty());
+	needs.Add( sizeNeeds);
+	CPPUNIT_ASSERT( needs.size && needs.headerFields.size() == 4);
+
+	// unconditional actions need nothing at all
+	NextSubTest();
+	filter.Content("discard;");
+	BmFilterNeeds noNeeds;
+	filter.AddNeeds( noNeeds);
+	CPPUNIT_ASSERT( !noNeeds.allHeaderFields && !noNeeds.body && !noNeeds.size);
+	CPPUNIT_ASSERT( noNeeds.headerFields.empty());
+}
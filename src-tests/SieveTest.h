@@ -33,6 +33,13 @@ class SieveTest : public BTestCase
 	CPPUNIT_TEST( RelationalValueTestsTest);
 	CPPUNIT_TEST( NumericRelationalValueTestsTest);
 	CPPUNIT_TEST( NumericRelationalCountTestsTest);
+	CPPUNIT_TEST( CompiledScriptCacheTest);
+	CPPUNIT_TEST( ParallelExecutionTest);
+	CPPUNIT_TEST( BatchExecutionTest);
+	CPPUNIT_TEST( AddressCacheTest);
+	CPPUNIT_TEST( PreparedPatternTest);
+	CPPUNIT_TEST( DispatchIndexTest);
+	CPPUNIT_TEST( FilterNeedsTest);
 	CPPUNIT_TEST_SUITE_END();
 public:
 //	static CppUnit::Test* Suite();
@@ -55,6 +62,13 @@ public:
 	void RelationalValueTestsTest();
 	void NumericRelationalValueTestsTest();
 	void NumericRelationalCountTestsTest();
+	void CompiledScriptCacheTest();
+	void ParallelExecutionTest();
+	void BatchExecutionTest();
+	void AddressCacheTest();
+	void PreparedPatternTest();
+	void DispatchIndexTest();
+	void FilterNeedsTest();
 };
 
 
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2002-2006, project beam (http://sourceforge.net/projects/beam).
+ * All rights reserved. Distributed under the terms of the GNU GPL v2.
+ *
+ * Authors:
+ *		Oliver Tappe <beam@hirschkaefer.de>
+ */
+/*
+ * Beam's test-application is based on the OpenBeOS testing framework
+ * (which in turn is based on cppunit). Big thanks to everyone involved!
+ *
+ */
+
+#include <Message.h>
+#include <OS.h>
+
+#include "SpamTest.h"
+#include "TestBeam.h"
+
+#include "BmFilter.h"
+#include "BmFilterAddon.h"
+#include "BmMail.h"
+
+// The spam-addon is used through the filter-list (just like Beam does), 
+// since it can't be linked into the test-app next to the sieve-addon.
+// N.B.: In test-mode, the data-files live in the test settings-folder.
+
+static const int32 nMailCount = 6;
+static const int32 nParallelRounds = 100;
+
+static BMessage resetJob;
+static BMessage learnAsSpamJob;
+static BMessage learnAsTofuJob;
+static BMessage classifyJob;
+static BMessage flushJob;
+static BMessage reloadJob;
+static BMessage statisticsJob;
+
+struct SpamWorkerData {
+	BmFilterAddon* addon;
+	BmMail** mails;
+	double* expectedPr;
+	int32* failures;
+};
+
+/*------------------------------------------------------------------------------*\
+	CreateMailText( n, isSpam)
+		-	returns the text of the n-th spam- or tofu-mail, both classes use
+			a vocabulary of their own
+\*------------------------------------------------------------------------------*/
+static BmString CreateMailText( int32 n, bool isSpam) {
+	BmString text = BmString("From: sender") << n << "@test.org\r\n"
+		<< "To: receiver@test.org\r\n"
+		<< "Subject: " << (isSpam ? "cheap pills offer " : "meeting notes ") 
+		<< n << "\r\n\r\n";
+	for( int32 i=0; i<20; ++i) {
+		if (isSpam)
+			text << "buy cheap pills now, limited offer, click here " << i 
+				  << " for your free casino bonus\r\n";
+		else
+			text << "the agenda for the project meeting " << i 
+				  << " covers the release schedule and the open bugs\r\n";
+	}
+	return text;
+}
+
+/*------------------------------------------------------------------------------*\
+	ClassifyInParallel()
+		-	classifies all mails over and over again and compares the results
+			with the ones computed serially
+\*------------------------------------------------------------------------------*/
+static status_t
+ClassifyInParallel(void* data)
+{
+	SpamWorkerData* workerData = static_cast<SpamWorkerData*>(data);
+	for( int32 i=0; i<nParallelRounds; ++i) {
+		int32 m = i % nMailCount;
+		BmMsgContext context;
+		context.mail = workerData->mails[m];
+		if (!workerData->addon->Execute( &context, &classifyJob)
+		|| context.GetDouble( BmMsgContext::FIELD_OVERALL_PR) != workerData->expectedPr[m])
+			atomic_add( workerData->failures, 1);
+	}
+	return B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	FailInParallel()
+		-	triggers errors over and over again (by requesting statistics 
+			without a msg-context) and checks the reported error
+\*------------------------------------------------------------------------------*/
+static status_t
+FailInParallel(void* data)
+{
+	SpamWorkerData* workerData = static_cast<SpamWorkerData*>(data);
+	for( int32 i=0; i<nParallelRounds; ++i) {
+		if (workerData->addon->Execute( NULL, &statisticsJob)
+		|| workerData->addon->ErrorString() != "Illegal msg-context!")
+			atomic_add( workerData->failures, 1);
+	}
+	return B_OK;
+}
+
+/*------------------------------------------------------------------------------*\
+	SpamAddon()
+		-	returns the spam-addon (via the filter that is used for learning)
+			or NULL if it hasn't been loaded
+\*------------------------------------------------------------------------------*/
+BmFilterAddon*
+SpamTest::SpamAddon()
+{
+	TheFilterList->StartJobInThisThread();
+	BmRef<BmFilter> spamFilter = TheFilterList->LearnAsSpamFilter();
+	return spamFilter ? spamFilter->Addon() : NULL;
+}
+
+// setUp
+void
+SpamTest::setUp()
+{
+	inherited::setUp();
+	resetJob.MakeEmpty();
+	resetJob.AddString( "jobSpecifier", "Reset");
+	learnAsSpamJob.MakeEmpty();
+	learnAsSpamJob.AddString( "jobSpecifier", "LearnAsSpam");
+	learnAsTofuJob.MakeEmpty();
+	learnAsTofuJob.AddString( "jobSpecifier", "LearnAsTofu");
+	classifyJob.MakeEmpty();
+	classifyJob.AddString( "jobSpecifier", "Classify");
+	classifyJob.AddInt32( "ThresholdForSpam", 0);
+	classifyJob.AddInt32( "ThresholdForTofu", 0);
+	classifyJob.AddBool( "UseCache", false);
+	flushJob.MakeEmpty();
+	flushJob.AddString( "jobSpecifier", "Flush");
+	reloadJob.MakeEmpty();
+	reloadJob.AddString( "jobSpecifier", "Reload");
+	statisticsJob.MakeEmpty();
+	statisticsJob.AddString( "jobSpecifier", "GetStatistics");
+}
+	
+// tearDown
+void
+SpamTest::tearDown()
+{
+	inherited::tearDown();
+}
+
+/*------------------------------------------------------------------------------*\
+	ParallelClassifyTest()
+		-	classifies from several threads at once and checks that neither
+			the results nor the reported errors get mixed up
+\*------------------------------------------------------------------------------*/
+void 
+SpamTest::ParallelClassifyTest(void)
+{
+	BmFilterAddon* addon = SpamAddon();
+	CPPUNIT_ASSERT( addon);
+
+	// train a fresh database with a few mails of each class:
+	NextSubTest();
+	CPPUNIT_ASSERT( addon->Execute( NULL, &resetJob));
+	BmRef<BmMail> mailRefs[nMailCount];
+	BmMail* mails[nMailCount];
+	for( int32 m=0; m<nMailCount; ++m) {
+		bool isSpam = m % 2 == 0;
+		mailRefs[m] = new BmMail( CreateMailText( m, isSpam), "");
+		mails[m] = mailRefs[m].Get();
+		BmMsgContext context;
+		context.mail = mails[m];
+		context.SetBool( BmMsgContext::FIELD_FORCE_LEARNING, true);
+		CPPUNIT_ASSERT( addon->Execute( &context, 
+												  isSpam ? &learnAsSpamJob 
+												  		 : &learnAsTofuJob));
+	}
+
+	// serial classification separates both classes:
+	NextSubTest();
+	double expectedPr[nMailCount];
+	for( int32 m=0; m<nMailCount; ++m) {
+		BmMsgContext context;
+		context.mail = mails[m];
+		CPPUNIT_ASSERT( addon->Execute( &context, &classifyJob));
+		expectedPr[m] = context.GetDouble( BmMsgContext::FIELD_OVERALL_PR);
+		if (m % 2 == 0)
+			CPPUNIT_ASSERT( expectedPr[m] < 0);
+		else
+			CPPUNIT_ASSERT( expectedPr[m] >= 0);
+	}
+
+	// parallel classifications yield the same results, even while other
+	// threads keep producing errors:
+	NextSubTest();
+	const int32 workerCount = 4;
+	int32 failures = 0;
+	SpamWorkerData workerData;
+	workerData.addon = addon;
+	workerData.mails = mails;
+	workerData.expectedPr = expectedPr;
+	workerData.failures = &failures;
+	thread_id threads[workerCount+2];
+	for( int32 w=0; w<workerCount; ++w)
+		threads[w] = spawn_thread( ClassifyInParallel, "SpamClassifier", 
+											B_NORMAL_PRIORITY, &workerData);
+	for( int32 w=workerCount; w<workerCount+2; ++w)
+		threads[w] = spawn_thread( FailInParallel, "SpamFailer", 
+											B_NORMAL_PRIORITY, &workerData);
+	for( int32 t=0; t<workerCount+2; ++t)
+		resume_thread( threads[t]);
+	status_t threadRes;
+	for( int32 t=0; t<workerCount+2; ++t)
+		wait_for_thread( threads[t], &threadRes);
+	CPPUNIT_ASSERT( failures == 0);
+
+	CPPUNIT_ASSERT( addon->Execute( NULL, &resetJob));
+}
+
+/*------------------------------------------------------------------------------*\
+	StoreReloadTest()
+		-	checks that the data-files only contain what has been stored, such
+			that reloading them drops anything learned afterwards
+\*------------------------------------------------------------------------------*/
+void 
+SpamTest::StoreReloadTest(void)
+{
+	BmFilterAddon* addon = SpamAddon();
+	CPPUNIT_ASSERT( addon);
+
+	BmRef<BmMail> mails[nMailCount];
+	for( int32 m=0; m<nMailCount; ++m)
+		mails[m] = new BmMail( CreateMailText( m, m % 2 == 0), "");
+	CPPUNIT_ASSERT( addon->Execute( NULL, &resetJob));
+
+	// learn (and store) the first two mails:
+	NextSubTest();
+	for( int32 m=0; m<2; ++m) {
+		BmMsgContext context;
+		context.mail = mails[m].Get();
+		context.SetBool( BmMsgContext::FIELD_FORCE_LEARNING, true);
+		CPPUNIT_ASSERT( addon->Execute( &context, 
+												  m % 2 == 0 ? &learnAsSpamJob 
+												  			 : &learnAsTofuJob));
+	}
+	CPPUNIT_ASSERT( addon->Execute( NULL, &flushJob));
+	BmMsgContext storedContext;
+	storedContext.mail = mails[nMailCount-1].Get();
+	CPPUNIT_ASSERT( addon->Execute( &storedContext, &classifyJob));
+	double storedPr 
+		= storedContext.GetDouble( BmMsgContext::FIELD_OVERALL_PR);
+
+	// reloading the stored data yields the same classification:
+	NextSubTest();
+	CPPUNIT_ASSERT( addon->Execute( NULL, &reloadJob));
+	BmMsgContext reloadedContext;
+	reloadedContext.mail = mails[nMailCount-1].Get();
+	CPPUNIT_ASSERT( addon->Execute( &reloadedContext, &classifyJob));
+	CPPUNIT_ASSERT( reloadedContext.GetDouble( BmMsgContext::FIELD_OVERALL_PR)
+							== storedPr);
+
+	// learning more mails changes the classification...
+	NextSubTest();
+	for( int32 m=2; m<nMailCount-1; ++m) {
+		BmMsgContext context;
+		context.mail = mails[m].Get();
+		context.SetBool( BmMsgContext::FIELD_FORCE_LEARNING, true);
+		CPPUNIT_ASSERT( addon->Execute( &context, 
+												  m % 2 == 0 ? &learnAsSpamJob 
+												  			 : &learnAsTofuJob));
+	}
+	BmMsgContext learnedContext;
+	learnedContext.mail = mails[nMailCount-1].Get();
+	CPPUNIT_ASSERT( addon->Execute( &learnedContext, &classifyJob));
+	CPPUNIT_ASSERT( learnedContext.GetDouble( BmMsgContext::FIELD_OVERALL_PR)
+							!= storedPr);
+
+	// ...until the unsaved learnings are dropped by reloading:
+	NextSubTest();
+	CPPUNIT_ASSERT( addon->Execute( NULL, &reloadJob));
+	BmMsgContext droppedContext;
+	droppedContext.mail = mails[nMailCount-1].Get();
+	CPPUNIT_ASSERT( addon->Execute( &droppedContext, &classifyJob));
+	CPPUNIT_ASSERT( droppedContext.GetDouble( BmMsgContext::FIELD_OVERALL_PR)
+							== storedPr);
+
+	CPPUNIT_ASSERT( addon->Execute( NULL, &resetJob));
+}
@@ -42,12 +42,18 @@ using namespace regexx;
 #include "FoldedLineEncoderTest.h"
 #include "LinebreakDecoderTest.h"
 #include "LinebreakEncoderTest.h"
+#include "MailFileTest.h"
 #include "MailMonitorTest.h"
+#include "MailTest.h"
+#include "MemArenaTest.h"
 #include "MemIoTest.h"
+#include "MsgContextTest.h"
 #include "MultiLockerTest.h"
 #include "QuotedPrintableDecoderTest.h"
 #include "QuotedPrintableEncoderTest.h"
+#include "SieveRegressionTest.h"
 #include "SieveTest.h"
+#include "SpamTest.h"
 #include "StringTest.h"
 #include "Utf8DecoderTest.h"
 #include "Utf8EncoderTest.h"
@@ -100,8 +106,12 @@ BTestSuite* CreateBmBaseTestSuite() {
 	BTestSuite *suite = new BTestSuite("BmBase");
 
 	// ##### Add test suites here #####
+	suite->addTest("BmBase::MemArena", 
+						MemArenaTest::suite());
 	suite->addTest("BmBase::MemIo", 
 						MemIoTest::suite());
+	suite->addTest("BmBase::MsgContext", 
+						MsgContextTest::suite());
 //	suite->addTest("BmBase::MultiLocker", 
 //						MultiLockerTest::suite());
 	suite->addTest("BmBase::String", 
@@ -119,6 +129,8 @@ BTestSuite* CreateMailTrackerTestSuite() {
 	// ##### Add test suites here #####
 	suite->addTest("MailTracker::MailMonitor", 
 						MailMonitorTest::suite());
+	suite->addTest("MailTracker::MailFile", 
+						MailFileTest::suite());
 	return suite;
 }
 
@@ -154,6 +166,8 @@ BTestSuite* CreateMailParserTestSuite() {
 						Utf8DecoderTest::suite());
 	suite->addTest("Encoding::Utf8Encoder", 
 						Utf8EncoderTest::suite());
+	suite->addTest("MailParser::Mail", 
+						MailTest::suite());
 	return suite;
 }
 
@@ -167,6 +181,14 @@ BTestSuite* CreateFilterAddonsTestSuite() {
 	// ##### Add test suites here #####
 	suite->addTest("FilterAddons::Sieve", 
 						SieveTest::suite());
+	if (HaveTestdata)
+		suite->addTest("FilterAddons::SieveRegression", 
+							SieveRegressionTest::suite());
+	if (SpamTest::SpamAddon())
+		suite->addTest("FilterAddons::Spam", 
+							SpamTest::suite());
+	else
+		fprintf(stderr, "spam-addon hasn't been loaded, skipping Spam-tests\n");
 	return suite;
 }
 
@@ -21,8 +21,11 @@
 #include <Directory.h>
 #include <Entry.h>
 #include <File.h>
+#include <Path.h>
 #include <Query.h>
 
+#include <algorithm>
+
 #include "split.hh"
 using namespace regexx;
 
@@ -32,6 +35,7 @@ using namespace regexx;
 #include "BmMailFilter.h"
 #include "BmMailRef.h"
 #include "BmPrefs.h"
+#include "BmRosterBase.h"
 #include "BmStorageUtil.h"
 
 static bool Verbose = false;
@@ -46,12 +50,20 @@ static int32 UnsureForTofu = 0;
 
 static uint32 Limit = 0xFFFFFFFF;
 static int32 PerfCount = -1;
+static int32 ThreadCount = 0;
+static int32 DecisiveMargin = 0;
+static int32 MaxScanKBytes = 0;
+static bool BulkTraining = false;
+static bool Benchmark = false;
 
 static bool DeHtml = false;
 static bool KeepATags = false;
 
 static void Out(const char* format, ...)
 {
+	if (Benchmark && !Verbose)
+		return;
+							// keep stdout clean for the benchmark report
 	if (Verbose) {
 		va_list args;
 		va_start( args, format);
@@ -90,6 +102,28 @@ static BMessage ClassifyJob;
 static BMessage LearnAsSpamJob;
 static BMessage LearnAsTofuJob;
 static BMessage GetStatisticsJob;
+static BMessage PlainClassifyJob;
+static BMessage CachedClassifyJob;
+static BMessage FullClassifyJob;
+static BMessage LearnBulkJob;
+static BMessage FlushJob;
+
+// compares bounded classifications (decisive-margin/max-scan-kb) with
+// the ones of a full scan of the same mails against the same data:
+struct BoundedInfo
+{
+	BoundedInfo()
+		:	mails(0)
+		,	flips(0)
+		,	fullFalsePos(0)
+		,	fullFalseNeg(0)
+		,	fullTime(0)
+		{}
+
+	uint32 mails, flips, fullFalsePos, fullFalseNeg;
+	bigtime_t fullTime;
+};
+static BoundedInfo Bounded;
 
 static vector<BmString> TrainingMailsSpam;
 static vector<BmString> TrainingMailsTofu;
@@ -198,6 +232,368 @@ status_t FindTrainingMails( BmString &msgFileName)
 	return B_OK;
 }
 
+/*------------------------------------------------------------------------------*\
+	ReadMail()
+		-	reads the mail living at the given path, returns NULL if that fails
+\*------------------------------------------------------------------------------*/
+static BmRef<BmMail> ReadMail( const BmString& path)
+{
+	entry_ref eref;
+	BEntry entry;
+	if (entry.SetTo(path.String()) != B_OK)
+		return NULL;
+	entry.GetRef(&eref);
+	BmRef<BmMailRef> ref = BmMailRef::CreateInstance(eref);
+	if (!ref)
+		return NULL;
+	BmRef<BmMail> mail = BmMail::CreateInstance(ref.Get());
+	if (!mail)
+		return NULL;
+	mail->StartJobInThisThread( BmMail::BM_READ_MAIL_JOB);
+	if (mail->InitCheck() != B_OK)
+		return NULL;
+	return mail;
+}
+
+/*------------------------------------------------------------------------------*\
+	ThroughputInfo
+		-	the data shared by all threads of a throughput measurement
+\*------------------------------------------------------------------------------*/
+struct ThroughputInfo
+{
+	vector< BmRef<BmMail> > mails;
+	vector<double> expectedPr;
+	int32 threadCount;
+	int32 mismatches;
+};
+
+struct ThroughputThreadInfo
+{
+	ThroughputInfo* info;
+	int32 index;
+};
+
+/*------------------------------------------------------------------------------*\
+	ClassifyMails()
+		-	classifies every threadCount-th mail (starting with the thread's 
+			index) and counts the results that differ from the expected ones
+\*------------------------------------------------------------------------------*/
+static int32 ClassifyMails( void* data)
+{
+	ThroughputThreadInfo* threadInfo = static_cast<ThroughputThreadInfo*>(data);
+	ThroughputInfo* info = threadInfo->info;
+	for( uint32 i=threadInfo->index; i<info->mails.size(); i+=info->threadCount) {
+		BmMsgContext result;
+		result.mail = info->mails[i].Get();
+		spamAddon->Execute( &result, &PlainClassifyJob);
+		if (result.GetDouble("OverallPr") != info->expectedPr[i])
+			atomic_add( &info->mismatches, 1);
+	}
+	return 0;
+}
+
+/*------------------------------------------------------------------------------*\
+	MeasureThroughput()
+		-	classifies the given mails once in this thread and then again 
+			with ThreadCount threads in parallel, reports the throughput of
+			both runs and checks that the parallel results are identical
+		-	classifying is done without reinforcement, such that the database
+			doesn't change during the measurement
+		-	afterwards, the throughput of cached classifications is measured
+\*------------------------------------------------------------------------------*/
+void MeasureThroughput( const vector<BmString>& pathVect, uint32 count)
+{
+	ThroughputInfo info;
+	info.threadCount = ThreadCount;
+	info.mismatches = 0;
+	for(uint32 i=0; i<count; ++i) {
+		BmRef<BmMail> mail = ReadMail( pathVect[i]);
+		if (mail)
+			info.mails.push_back( mail);
+	}
+	if (info.mails.empty())
+		return;
+
+	double kbytes = 0;
+	for(uint32 i=0; i<info.mails.size(); ++i)
+		kbytes += info.mails[i]->RawText().Length() / 1024.0;
+
+	bigtime_t startTime = system_time();
+	for(uint32 i=0; i<info.mails.size(); ++i) {
+		BmMsgContext result;
+		result.mail = info.mails[i].Get();
+		spamAddon->Execute( &result, &PlainClassifyJob);
+		info.expectedPr.push_back( result.GetDouble("OverallPr"));
+	}
+	bigtime_t serialTime = system_time() - startTime;
+
+	vector<thread_id> threads;
+	vector<ThroughputThreadInfo> threadInfos( ThreadCount);
+	startTime = system_time();
+	for( int32 t=0; t<ThreadCount; ++t) {
+		threadInfos[t].info = &info;
+		threadInfos[t].index = t;
+		thread_id thread = spawn_thread( ClassifyMails, "spamometer classifier", 
+													B_NORMAL_PRIORITY, &threadInfos[t]);
+		if (thread >= 0 && resume_thread( thread) == B_OK)
+			threads.push_back( thread);
+	}
+	status_t exitValue;
+	for( uint32 t=0; t<threads.size(); ++t)
+		wait_for_thread( threads[t], &exitValue);
+	bigtime_t parallelTime = system_time() - startTime;
+
+	// classify all mails twice more with the cache enabled, the second run
+	// should be served from the cache completely:
+	int32 cacheMismatches = 0;
+	bigtime_t cachedTime = 0;
+	for( int run=0; run<2; ++run) {
+		startTime = system_time();
+		for(uint32 i=0; i<info.mails.size(); ++i) {
+			BmMsgContext result;
+			result.mail = info.mails[i].Get();
+			spamAddon->Execute( &result, &CachedClassifyJob);
+			if (result.GetDouble("OverallPr") != info.expectedPr[i])
+				cacheMismatches++;
+		}
+		cachedTime = system_time() - startTime;
+	}
+
+	double mails = info.mails.size();
+	fprintf(stderr,"\tthroughput of classifying %d messages:\n", 
+						(int)info.mails.size());
+	fprintf(stderr,"\t1 thread:   %8.1f msgs/sec (%.1f usecs/KB)\n", 
+						serialTime ? mails*1000000.0/serialTime : 0.0,
+						kbytes ? serialTime/kbytes : 0.0);
+	fprintf(stderr,"\t%ld threads: %8.1f msgs/sec (speedup %.2f)\n", 
+						(long)threads.size(), 
+						parallelTime ? mails*1000000.0/parallelTime : 0.0,
+						parallelTime ? (double)serialTime/parallelTime : 0.0);
+	fprintf(stderr,"\tcached:     %8.1f msgs/sec\n", 
+						cachedTime ? mails*1000000.0/cachedTime : 0.0);
+	if (info.mismatches)
+		fprintf(stderr,"\t### %ld parallel classifications differ from serial ones!\n",
+							info.mismatches);
+	if (cacheMismatches)
+		fprintf(stderr,"\t### %ld cached classifications differ from serial ones!\n",
+							cacheMismatches);
+}
+
+/*------------------------------------------------------------------------------*\
+	BulkLearn()
+		-	resets the database and learns all given mails at once, using the
+			given number of threads
+		-	returns the time spent learning
+\*------------------------------------------------------------------------------*/
+static bigtime_t BulkLearn( const vector< BmRef<BmMail> >& mails, 
+									 const vector<bool>& isSpam, int32 threadCount)
+{
+	spamAddon->Execute( NULL, &ResetJob);
+	BMessage job( LearnBulkJob);
+	for( uint32 i=0; i<mails.size(); ++i) {
+		job.AddPointer( "mail", mails[i].Get());
+		job.AddBool( "isSpam", isSpam[i]);
+	}
+	job.AddInt32( "threadCount", threadCount);
+	bigtime_t startTime = system_time();
+	if (!spamAddon->Execute( NULL, &job))
+		fprintf(stderr, "\t### bulk-learning failed: %s\n", 
+							spamAddon->ErrorString().String());
+	return system_time() - startTime;
+}
+
+/*------------------------------------------------------------------------------*\
+	FetchDataFiles()
+		-	flushes the spam-database and returns the contents of both 
+			data-files (spam & tofu)
+\*------------------------------------------------------------------------------*/
+static bool FetchDataFiles( BmString& spamData, BmString& tofuData)
+{
+	if (!spamAddon->Execute( NULL, &FlushJob)) {
+		fprintf(stderr, "\t### flushing the datafiles failed: %s\n", 
+							spamAddon->ErrorString().String());
+		return false;
+	}
+	BmString settingsPath = BeamRoster->SettingsPath();
+	return FetchFile( settingsPath + "/Spam.data", spamData)
+		&& FetchFile( settingsPath + "/Tofu.data", tofuData);
+}
+
+/*------------------------------------------------------------------------------*\
+	SameBytes()
+		-	compares the given (binary) data, which may contain null bytes
+\*------------------------------------------------------------------------------*/
+static bool SameBytes( const BmString& data1, const BmString& data2)
+{
+	return data1.Length() == data2.Length()
+		&& memcmp( data1.String(), data2.String(), data1.Length()) == 0;
+}
+
+/*------------------------------------------------------------------------------*\
+	BulkTrain()
+		-	trains the given mails with a single thread and then again with
+			ThreadCount threads, reports the time taken by both runs and checks
+			that both runs produce identical data-files (byte for byte) and
+			that both resulting databases classify all mails identically
+\*------------------------------------------------------------------------------*/
+void BulkTrain( const vector<BmString>& pathVect, uint32 count)
+{
+	vector< BmRef<BmMail> > mails;
+	vector<bool> isSpam;
+	for(uint32 i=0; i<count; ++i) {
+		BmRef<BmMail> mail = ReadMail( pathVect[i]);
+		if (!mail)
+			continue;
+		mails.push_back( mail);
+		isSpam.push_back( pathVect[i].IFindFirst("spam/") >= B_OK 
+			|| mail->MailRef()->Classification().ICompare("Spam") == 0);
+	}
+	if (mails.empty())
+		return;
+
+	bigtime_t serialTime = BulkLearn( mails, isSpam, 1);
+	// fetch the data before classifying, as that updates the statistics:
+	BmString serialSpamData, serialTofuData;
+	bool haveSerialData = FetchDataFiles( serialSpamData, serialTofuData);
+	vector<double> expectedPr;
+	for(uint32 i=0; i<mails.size(); ++i) {
+		BmMsgContext result;
+		result.mail = mails[i].Get();
+		spamAddon->Execute( &result, &PlainClassifyJob);
+		expectedPr.push_back( result.GetDouble("OverallPr"));
+	}
+
+	int32 threadCount = ThreadCount > 0 ? ThreadCount : 0;
+							// 0 means: one thread per cpu
+	bigtime_t parallelTime = BulkLearn( mails, isSpam, threadCount);
+	BmString parallelSpamData, parallelTofuData;
+	bool haveParallelData 
+		= FetchDataFiles( parallelSpamData, parallelTofuData);
+	int32 mismatches = 0;
+	for(uint32 i=0; i<mails.size(); ++i) {
+		BmMsgContext result;
+		result.mail = mails[i].Get();
+		spamAddon->Execute( &result, &PlainClassifyJob);
+		if (result.GetDouble("OverallPr") != expectedPr[i])
+			mismatches++;
+	}
+
+	double msgs = mails.size();
+	fprintf(stderr,"\tbulk-training of %d messages:\n", (int)mails.size());
+	fprintf(stderr,"\t1 thread:   %8.1f msgs/sec\n", 
+						serialTime ? msgs*1000000.0/serialTime : 0.0);
+	fprintf(stderr,"\tparallel:   %8.1f msgs/sec (speedup %.2f)\n", 
+						parallelTime ? msgs*1000000.0/parallelTime : 0.0,
+						parallelTime ? (double)serialTime/parallelTime : 0.0);
+	if (!haveSerialData || !haveParallelData)
+		fprintf(stderr,"\t### unable to read the datafiles for comparison!\n");
+	else if (!SameBytes( serialSpamData, parallelSpamData)
+	|| !SameBytes( serialTofuData, parallelTofuData))
+		fprintf(stderr,"\t### datafiles differ between serial and parallel "
+							"training!\n");
+	if (mismatches)
+		fprintf(stderr,"\t### %ld classifications differ between serial and "
+							"parallel training!\n", mismatches);
+}
+
+/*------------------------------------------------------------------------------*\
+	CollectMailPaths()
+		-	adds the paths of all files in the given directory (and all its
+			subdirectories) to the given vector, sorted by name, such that
+			runs over the same corpus are reproducible
+\*------------------------------------------------------------------------------*/
+static void CollectMailPaths( const char* dirPath, vector<BmString>& pathVect)
+{
+	BDirectory dir( dirPath);
+	BEntry entry;
+	BPath path;
+	vector<BmString> files;
+	vector<BmString> subDirs;
+	while (dir.GetNextEntry( &entry, true) == B_OK) {
+		if (entry.GetPath( &path) != B_OK)
+			continue;
+		if (entry.IsDirectory())
+			subDirs.push_back( path.Path());
+		else
+			files.push_back( path.Path());
+	}
+	std::sort( files.begin(), files.end());
+	std::sort( subDirs.begin(), subDirs.end());
+	pathVect.insert( pathVect.end(), files.begin(), files.end());
+	for( uint32 i=0; i<subDirs.size(); ++i)
+		CollectMailPaths( subDirs[i].String(), pathVect);
+}
+
+/*------------------------------------------------------------------------------*\
+	BenchmarkReport()
+		-	prints the results of a benchmark run as key=value lines to stdout,
+			such that they can be compared by scripts
+\*------------------------------------------------------------------------------*/
+static void BenchmarkReport( const char* corpusName, 
+									  vector<bigtime_t>& latencies, double bytes, 
+									  const char* resultBuf, uint32 count,
+									  const vector<bigtime_t>& learnLatencies)
+{
+	bigtime_t totalTime = 0;
+	for( uint32 i=0; i<latencies.size(); ++i)
+		totalTime += latencies[i];
+	std::sort( latencies.begin(), latencies.end());
+	uint32 falsePos = 0, falseNeg = 0, unsure = 0, spam = 0, tofu = 0;
+	for( uint32 i=0; i<count; ++i) {
+		switch(resultBuf[i]) {
+			case 'P': falsePos++; tofu++; break;
+			case 'N': falseNeg++; spam++; break;
+			case 'S': case 's': spam++; break;
+			case 'T': case 't': tofu++; break;
+			case 'U': unsure++; break;
+		}
+	}
+	BmMsgContext stats;
+	spamAddon->Execute( &stats, &GetStatisticsJob);
+	int32 spamBuckets = stats.GetInt32("SpamBuckets");
+	int32 tofuBuckets = stats.GetInt32("TofuBuckets");
+
+	uint32 mails = latencies.size();
+	double secs = totalTime / 1000000.0;
+	printf("corpus=%s\n", corpusName);
+	printf("mails=%lu\n", (unsigned long)mails);
+	printf("bytes=%.0f\n", bytes);
+	printf("classify_secs=%.3f\n", secs);
+	printf("mails_per_sec=%.1f\n", secs > 0 ? mails / secs : 0.0);
+	printf("mb_per_sec=%.3f\n", secs > 0 ? bytes / (1024*1024) / secs : 0.0);
+	bigtime_t learnTime = 0;
+	for( uint32 i=0; i<learnLatencies.size(); ++i)
+		learnTime += learnLatencies[i];
+	printf("learnings=%lu\n", (unsigned long)learnLatencies.size());
+	printf("learn_secs=%.3f\n", learnTime / 1000000.0);
+	printf("learn_usecs_avg=%.1f\n", learnLatencies.size() 
+				? (double)learnTime / learnLatencies.size() : 0.0);
+	if (mails) {
+		printf("latency_usecs_p50=%Ld\n", latencies[mails*50/100]);
+		printf("latency_usecs_p90=%Ld\n", latencies[mails*90/100]);
+		printf("latency_usecs_p99=%Ld\n", latencies[mails*99/100]);
+		printf("latency_usecs_max=%Ld\n", latencies[mails-1]);
+	}
+	printf("false_positives=%lu\n", (unsigned long)falsePos);
+	printf("false_negatives=%lu\n", (unsigned long)falseNeg);
+	printf("unsure=%lu\n", (unsigned long)unsure);
+	printf("false_positive_rate=%.4f\n", tofu ? (double)falsePos / tofu : 0.0);
+	printf("false_negative_rate=%.4f\n", spam ? (double)falseNeg / spam : 0.0);
+	if (Bounded.mails) {
+		printf("full_classify_secs=%.3f\n", Bounded.fullTime / 1000000.0);
+		printf("full_false_positives=%lu\n", 
+					(unsigned long)Bounded.fullFalsePos);
+		printf("full_false_negatives=%lu\n", 
+					(unsigned long)Bounded.fullFalseNeg);
+		printf("bounded_decisions_differing=%lu\n", 
+					(unsigned long)Bounded.flips);
+	}
+	printf("spam_load_factor=%.4f\n", spamBuckets 
+				? (double)stats.GetInt32("SpamBucketsUsed") / spamBuckets : 0.0);
+	printf("tofu_load_factor=%.4f\n", tofuBuckets
+				? (double)stats.GetInt32("TofuBucketsUsed") / tofuBuckets : 0.0);
+}
+
 /*------------------------------------------------------------------------------*\
 	()
 		-	
@@ -212,25 +608,38 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 	spamAddon->Execute( NULL, &ResetJob);
 
 	time_t starttime = time(NULL);
-	printf("%s: ", pathfileName);
-	if (Verbose)
-		printf("\n");
+	if (!Benchmark) {
+		printf("%s: ", pathfileName);
+		if (Verbose)
+			printf("\n");
+	}
 
-	BFile pathFile(pathfileName, B_READ_ONLY);
-	if ((res = pathFile.InitCheck()) != B_OK) {
-		fprintf(stderr, "%s: %s\n", pathfileName, strerror(res));
-		return;
+	vector<BmString> pathVect;
+	BEntry pathEntry(pathfileName);
+	if (pathEntry.IsDirectory()) {
+		// a directory containing the corpus (e.g. unpacked testdata/mail.zip):
+		CollectMailPaths( pathfileName, pathVect);
+	} else {
+		// a file listing the paths of all mails:
+		BFile pathFile(pathfileName, B_READ_ONLY);
+		if ((res = pathFile.InitCheck()) != B_OK) {
+			fprintf(stderr, "%s: %s\n", pathfileName, strerror(res));
+			return;
+		}
+		pathFile.GetSize(&size);
+		char* buf = str.LockBuffer(int32(size+1));
+		if (!buf) {
+			fprintf(stderr, "not enough memory for %Lu bytes\n", size);
+			return;
+		}
+		sz = pathFile.Read(buf, size_t(size));
+		str.UnlockBuffer(int32(sz));
+		split( "\n", str, pathVect);
 	}
-	pathFile.GetSize(&size);
-	char* buf = str.LockBuffer(int32(size+1));
-	if (!buf) {
-		fprintf(stderr, "not enough memory for %Lu bytes\n", size);
+	if (BulkTraining) {
+		BulkTrain( pathVect, min_c(pathVect.size(), Limit));
 		return;
 	}
-	sz = pathFile.Read(buf, size_t(size));
-	str.UnlockBuffer(int32(sz));
-	vector<BmString> pathVect;
-	split( "\n", str, pathVect);
 	BmRef<BmMailRef> ref;
 	BmRef<BmMail> mail;
 	entry_ref eref;
@@ -238,6 +647,11 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 	unsigned int pvs = min_c(pathVect.size(), Limit);
 	int perfs = PerfCount >= 0 ? min_c(PerfCount, (int32)pvs) : pvs/5;
 	char* resultBuf = new char [pvs];
+	memset( resultBuf, ' ', pvs);
+							// unreadable mails have no result
+	vector<bigtime_t> latencies;
+	vector<bigtime_t> learnLatencies;
+	double bytes = 0;
 	for(uint32 i=0; i<pvs; ++i) {
 		Out("%s...", pathVect[i].String());
 		if ((res = entry.SetTo(pathVect[i].String())) != B_OK) {
@@ -266,7 +680,21 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 		result.SetBool("ForceLearning", true);
 		// now classify this message:
 		result.mail = mail.Get();
+		bool isBounded = DecisiveMargin || MaxScanKBytes;
+		double fullPr = 0;
+		if (isBounded) {
+			// classify with a full scan, too (before anything is learned):
+			BmMsgContext fullResult;
+			fullResult.mail = mail.Get();
+			bigtime_t fullStartTime = system_time();
+			spamAddon->Execute( &fullResult, &FullClassifyJob);
+			Bounded.fullTime += system_time() - fullStartTime;
+			fullPr = fullResult.GetDouble("OverallPr");
+		}
+		bigtime_t startTime = system_time();
 		spamAddon->Execute( &result, &ClassifyJob);
+		latencies.push_back( system_time() - startTime);
+		bytes += mail->RawText().Length();
 		bool isSpam = result.GetBool("IsSpam");
 		bool isTofu = result.GetBool("IsTofu");
 		bool isReinforced = result.GetBool("IsReinforced");
@@ -275,15 +703,27 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 			Out("SPAM(%f)...", overallPr);
 		else if (isTofu)
 			Out("TOFU(%f)...", overallPr);
-		if (pathVect[i].IFindFirst("spam/") >= B_OK 
-		|| mail->MailRef()->Classification().ICompare("Spam") == 0) {
+		bool shouldBeSpam = pathVect[i].IFindFirst("spam/") >= B_OK 
+			|| mail->MailRef()->Classification().ICompare("Spam") == 0;
+		if (isBounded) {
+			Bounded.mails++;
+			if ((fullPr < 0) != (overallPr < 0))
+				Bounded.flips++;
+			if (shouldBeSpam && fullPr >= 0)
+				Bounded.fullFalseNeg++;
+			else if (!shouldBeSpam && fullPr < 0)
+				Bounded.fullFalsePos++;
+		}
+		if (shouldBeSpam) {
 			if (overallPr >= 0) {
 				// false negative
 				if (isReinforced)
 					// in order to trigger neccessary unlearning, we mark this
 					// message (only in memory) as being classified as tofu:
 					mail->MailRef()->Classification("Genuine");
+				startTime = system_time();
 				spamAddon->Execute( &result, &LearnAsSpamJob);
+				learnLatencies.push_back( system_time() - startTime);
 				resultBuf[i] = 'N';
 				Out("laS");
 			} else if (isReinforced) {
@@ -306,7 +746,9 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 					// in order to trigger neccessary unlearning, we mark this
 					// message (only in memory) as being classified as spam:
 					mail->MailRef()->Classification("Spam");
+				startTime = system_time();
 				spamAddon->Execute( &result, &LearnAsTofuJob);
+				learnLatencies.push_back( system_time() - startTime);
 				resultBuf[i] = 'P';
 				Out("laT");
 			} else if (isReinforced) {
@@ -336,7 +778,7 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 				case 'U': ri.unsure++; break;
 			}
 		}
-		if (!Verbose)
+		if (!Verbose && !Benchmark)
 			printf(" \n");
 		ri.totalFalsePos = 100.0-ri.falsePos*100.0/perfs;
 		ri.totalOverall = 100.0-(ri.falsePos+ri.falseNeg)*100.0/perfs;
@@ -346,6 +788,14 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 							ThresholdForSpam, ThresholdForTofu,
 							UnsureForSpam, UnsureForTofu,
 							DeHtml ? "yes" : "no", KeepATags ? "yes" : "no");
+		if (DecisiveMargin || MaxScanKBytes) {
+			fprintf(stderr,"\tbounded: decisive-margin=%ld max-scan-kb=%ld\n", 
+								DecisiveMargin, MaxScanKBytes);
+			fprintf(stderr,"\tbounded vs. full scan: %lu of %lu decisions "
+								"differ, full scan would have had %lu FP / %lu FN\n",
+								Bounded.flips, Bounded.mails, 
+								Bounded.fullFalsePos, Bounded.fullFalseNeg);
+		}
 		fprintf(stderr,"\tperformance of last %d messages:\n", perfs);
 		fprintf(stderr,"\tsimple spam:      %6.2f   simple tofu:       %6.2f\n", ri.corrSpam, ri.corrTofu);
 		fprintf(stderr,"\treinforced spam:  %6.2f   reinforced tofu:   %6.2f\n", ri.reinfSpam, ri.reinfTofu);
@@ -353,7 +803,12 @@ void SpamOMeter( const char* pathfileName, ResInfo& ri)
 		fprintf(stderr,"\tunsure:           %6.2f\n", ri.unsure);
 		fprintf(stderr,"\tcorrectness (FP): %6.2f   correctness (all): %6.2f\n", ri.totalFalsePos, ri.totalOverall);
 	}
+	if (Benchmark)
+		BenchmarkReport( pathfileName, latencies, bytes, resultBuf, pvs, 
+							  learnLatencies);
 	delete [] resultBuf;
+	if (ThreadCount > 0)
+		MeasureThroughput( pathVect, pvs);
 }
 
 int 
@@ -388,6 +843,16 @@ main( int argc, char** argv)
 			KeepATags = true;
 		else if (!strcmp(argv[as], "--do-training"))
 			TrainingMode = true;
+		else if (!strncmp(argv[as], "--threads=", 10))
+			ThreadCount = atoi(argv[as]+10);
+		else if (!strcmp(argv[as], "--bulk-train"))
+			BulkTraining = true;
+		else if (!strcmp(argv[as], "--benchmark"))
+			Benchmark = true;
+		else if (!strncmp(argv[as], "--decisive-margin=", 18))
+			DecisiveMargin = atoi(argv[as]+18);
+		else if (!strncmp(argv[as], "--max-scan-kb=", 14))
+			MaxScanKBytes = atoi(argv[as]+14);
 		else 
 			fprintf(stderr, "unknown option %s ignored\n", argv[as]);
 		as++;
@@ -395,6 +860,17 @@ main( int argc, char** argv)
 	if (argc<=as && !TrainingMode) {
 		fprintf(stderr, "usage:\n\t%s [options] path-files\n", argv[0]);
 		fprintf(stderr, "where options can be any combination of:\n"
+				  "\t[--benchmark]\n"
+				  "\t\tprint throughput, latency (of classifying and learning) &\n"
+				  "\t\terror rates as key=value lines\n"
+				  "\t\t(path-files may also be directories containing the mails)\n"
+				  "\t[--bulk-train]\n"
+				  "\t\tinstead of classifying, measure bulk-training of all mails\n"
+				  "\t\t(with one thread and with --threads, default is one per cpu)\n"
+				  "\t[--decisive-margin=<num>]\n"
+				  "\t\tstop classifying a mail once its result is beyond <num>\n"
+				  "\t\t(each mail is classified with a full scan, too, and the\n"
+				  "\t\tdiffering decisions are reported)\n"
 				  "\t[--dehtml]\n"
 				  "\t\tremove html-tags from mails before classifying\n"
 				  "\t[--do-training]\n"
@@ -403,6 +879,8 @@ main( int argc, char** argv)
 				  "\t\tkeep <a>-tags (links) when removing html\n"
 				  "\t[--limit=<num>]\n"
 				  "\t\tstop after <num> mails have been classified\n"
+				  "\t[--max-scan-kb=<num>]\n"
+				  "\t\tclassify only the first <num> KB of each mail\n"
 				  "\t[--perf-count=<num>]\n"
 				  "\t\tdo performance measurement for last <num> mails\n"
 				  "\t\t(the default is one fifth of total number of mails)\n"
@@ -416,6 +894,9 @@ main( int argc, char** argv)
 				  "\t\ttreat mail as unsure if classification is below <num> for TOFU\n"
 				  "\t[--statistics]\n" 
 				  "\t\tshow resulting SPAM-filter statistics\n"
+				  "\t[--threads=<num>]\n"
+				  "\t\tafterwards, measure classification throughput with <num>\n"
+				  "\t\tthreads classifying in parallel\n"
 				  "\t[--verbose]\n"
 				  "\t\tprint each mail and its classification-result\n");
 		exit(10);
@@ -426,13 +907,17 @@ main( int argc, char** argv)
 	LearnAsSpamJob.AddString("jobSpecifier", "LearnAsSpam");
 	LearnAsTofuJob.AddString("jobSpecifier", "LearnAsTofu");
 	GetStatisticsJob.AddString("jobSpecifier", "GetStatistics");
+	LearnBulkJob.AddString("jobSpecifier", "LearnBulk");
+	FlushJob.AddString("jobSpecifier", "Flush");
 	if (DeHtml) {
 		ClassifyJob.AddBool("DeHtml", true);
+		LearnBulkJob.AddBool("DeHtml", true);
 		LearnAsSpamJob.AddBool("DeHtml", true);
 		LearnAsTofuJob.AddBool("DeHtml", true);
 	}
 	if (KeepATags) {
 		ClassifyJob.AddBool("KeepATags", true);
+		LearnBulkJob.AddBool("KeepATags", true);
 		LearnAsSpamJob.AddBool("KeepATags", true);
 		LearnAsTofuJob.AddBool("KeepATags", true);
 	}
@@ -440,6 +925,16 @@ main( int argc, char** argv)
 	ClassifyJob.AddInt32("ThresholdForTofu", ThresholdForTofu);
 	ClassifyJob.AddInt32("UnsureForSpam", UnsureForSpam);
 	ClassifyJob.AddInt32("UnsureForTofu", UnsureForTofu);
+	ClassifyJob.AddInt32("DecisiveMargin", DecisiveMargin);
+	ClassifyJob.AddInt32("MaxScanKBytes", MaxScanKBytes);
+	PlainClassifyJob = ClassifyJob;
+	PlainClassifyJob.ReplaceInt32("ThresholdForSpam", 0);
+	PlainClassifyJob.ReplaceInt32("ThresholdForTofu", 0);
+	CachedClassifyJob = PlainClassifyJob;
+	PlainClassifyJob.AddBool("UseCache", false);
+	FullClassifyJob = PlainClassifyJob;
+	FullClassifyJob.ReplaceInt32("DecisiveMargin", 0);
+	FullClassifyJob.ReplaceInt32("MaxScanKBytes", 0);
 	
 	if (TrainingMode) {
 		// make room for faked argument: